@@ -1156,14 +1156,18 @@ NecroBase necro_base_compile(NecroIntern* intern, NecroScopedSymTable* scoped_sy
     necro_base_setup_primitive(scoped_symtable, intern, "getMIDIMessageBufferSize", &base.midi_msg_buffer_size_fn,     NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "sampleRate",               &base.sample_rate,                 NECRO_PRIMOP_PRIM_VAL);
     necro_base_setup_primitive(scoped_symtable, intern, "recipSampleRate",          &base.recip_sample_rate,           NECRO_PRIMOP_PRIM_VAL);
+    necro_base_setup_primitive(scoped_symtable, intern, "blockSize",                &base.block_size,                  NECRO_PRIMOP_PRIM_VAL);
     necro_base_setup_primitive(scoped_symtable, intern, "printInt",                 &base.print_int,                   NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "printUInt",                &base.print_uint,                  NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "printFloat",               &base.print_float,                 NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "printChar",                &base.print_char,                  NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "outAudioBlock",            &base.out_audio_block,             NECRO_PRIMOP_PRIM_FN);
+    necro_base_setup_primitive(scoped_symtable, intern, "inAudioBlock",             &base.in_audio_block,              NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "recordAudioBlock",         &base.record_audio_block,          NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "recordAudioBlockFinalize", &base.record_audio_block_finalize, NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "unsafeAudioFileOpen",      &base.audio_file_open,             NECRO_PRIMOP_PRIM_FN);
+    necro_base_setup_primitive(scoped_symtable, intern, "unsafeAudioStreamOpen",    &base.audio_stream_open,           NECRO_PRIMOP_PRIM_FN);
+    necro_base_setup_primitive(scoped_symtable, intern, "unsafeAudioStreamReadBlock", &base.audio_stream_read_block,   NECRO_PRIMOP_PRIM_FN);
 
     // File IO
     necro_base_setup_primitive(scoped_symtable, intern, "closeFile",        &base.close_file,          NECRO_PRIMOP_PRIM_FN);
@@ -1172,6 +1176,7 @@ NecroBase necro_base_compile(NecroIntern* intern, NecroScopedSymTable* scoped_sy
     necro_base_setup_primitive(scoped_symtable, intern, "writeFloatToFile", &base.write_float_to_file, NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "writeCharToFile",  &base.write_char_to_file,  NECRO_PRIMOP_PRIM_FN);
     necro_base_setup_primitive(scoped_symtable, intern, "unsafeOpenFile",   &base.open_file,           NECRO_PRIMOP_PRIM_FN);
+    necro_base_setup_primitive(scoped_symtable, intern, "unsafeOpenBinaryFile", &base.open_binary_file, NECRO_PRIMOP_PRIM_FN);
 
     // Misc
     necro_base_setup_primitive(scoped_symtable, intern, "_project",         &base.proj_fn,           NECRO_PRIMOP_PROJ);
@@ -125,6 +125,7 @@ typedef struct NecroBase
     NecroAstSymbol* nat_next_power_of_2;
     NecroAstSymbol* sample_rate;
     NecroAstSymbol* recip_sample_rate;
+    NecroAstSymbol* block_size;
 
     NecroAstSymbol* pipe_forward;
     NecroAstSymbol* pipe_back;
@@ -154,9 +155,12 @@ typedef struct NecroBase
     NecroAstSymbol* print_float;
     NecroAstSymbol* print_char;
     NecroAstSymbol* out_audio_block;
+    NecroAstSymbol* in_audio_block;
     NecroAstSymbol* record_audio_block;
     NecroAstSymbol* record_audio_block_finalize;
     NecroAstSymbol* audio_file_open;
+    NecroAstSymbol* audio_stream_open;
+    NecroAstSymbol* audio_stream_read_block;
 
     NecroAstSymbol* close_file;
     NecroAstSymbol* write_int_to_file;
@@ -164,6 +168,7 @@ typedef struct NecroBase
     NecroAstSymbol* write_float_to_file;
     NecroAstSymbol* write_char_to_file;
     NecroAstSymbol* open_file;
+    NecroAstSymbol* open_binary_file;
 
     NecroAstSymbol* print_audio_block;
     NecroAstSymbol* fast_floor;
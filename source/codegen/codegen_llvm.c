@@ -1721,6 +1721,11 @@ void necro_llvm_codegen(NecroCompileInfo info, NecroMachProgram* program, NecroL
     necro_llvm_declare_function(context, program->necro_init);
     necro_llvm_declare_function(context, program->necro_main);
     necro_llvm_declare_function(context, program->necro_shutdown);
+    for (size_t i = 0; i < program->num_main_tasks; ++i)
+    {
+        necro_llvm_declare_function(context, program->main_tasks[i].fn);
+    }
+    necro_llvm_declare_function(context, program->necro_main_tail);
     // codegen functions
     for (size_t i = 0; i < program->functions.length; ++i)
     {
@@ -1747,6 +1752,11 @@ void necro_llvm_codegen(NecroCompileInfo info, NecroMachProgram* program, NecroL
     necro_llvm_codegen_function(context, program->necro_init);
     necro_llvm_codegen_function(context, program->necro_main);
     necro_llvm_codegen_function(context, program->necro_shutdown);
+    for (size_t i = 0; i < program->num_main_tasks; ++i)
+    {
+        necro_llvm_codegen_function(context, program->main_tasks[i].fn);
+    }
+    necro_llvm_codegen_function(context, program->necro_main_tail);
 
     //--------------------
     // Check runtime function usage
@@ -1769,18 +1779,23 @@ void necro_llvm_codegen(NecroCompileInfo info, NecroMachProgram* program, NecroL
     necro_llvm_map_check_symbol(context->program->runtime.necro_runtime_alloc);
     necro_llvm_map_check_symbol(context->program->runtime.necro_runtime_realloc);
     necro_llvm_map_check_symbol(context->program->runtime.necro_runtime_free);
+    necro_llvm_map_check_symbol(context->program->runtime.necro_runtime_frame_alloc);
     necro_llvm_map_check_symbol(context->base->panic->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->program->runtime.necro_runtime_out_audio_block);
     necro_llvm_map_check_symbol(context->base->test_assertion->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->open_file->core_ast_symbol->mach_symbol);
+    necro_llvm_map_check_symbol(context->base->open_binary_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->close_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->write_int_to_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->write_uint_to_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->write_float_to_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->write_char_to_file->core_ast_symbol->mach_symbol);
+    necro_llvm_map_check_symbol(context->base->in_audio_block->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->record_audio_block->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->record_audio_block_finalize->core_ast_symbol->mach_symbol);
     necro_llvm_map_check_symbol(context->base->audio_file_open->core_ast_symbol->mach_symbol);
+    necro_llvm_map_check_symbol(context->base->audio_stream_open->core_ast_symbol->mach_symbol);
+    necro_llvm_map_check_symbol(context->base->audio_stream_read_block->core_ast_symbol->mach_symbol);
 
     // assert(context->delayed_phi_node_values.length == 0);
     if (context->should_optimize)
@@ -1862,18 +1877,23 @@ void necro_llvm_jit_go(NecroCompileInfo info, NecroLLVM* context, const char* ji
     necro_llvm_map_runtime_symbol(context->engine, context->program->runtime.necro_runtime_alloc);
     necro_llvm_map_runtime_symbol(context->engine, context->program->runtime.necro_runtime_realloc);
     necro_llvm_map_runtime_symbol(context->engine, context->program->runtime.necro_runtime_free);
+    necro_llvm_map_runtime_symbol(context->engine, context->program->runtime.necro_runtime_frame_alloc);
     necro_llvm_map_runtime_symbol(context->engine, context->base->panic->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->program->runtime.necro_runtime_out_audio_block);
     necro_llvm_map_runtime_symbol(context->engine, context->base->test_assertion->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->open_file->core_ast_symbol->mach_symbol);
+    necro_llvm_map_runtime_symbol(context->engine, context->base->open_binary_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->close_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->write_int_to_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->write_uint_to_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->write_float_to_file->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->write_char_to_file->core_ast_symbol->mach_symbol);
+    necro_llvm_map_runtime_symbol(context->engine, context->base->in_audio_block->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->record_audio_block->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->record_audio_block_finalize->core_ast_symbol->mach_symbol);
     necro_llvm_map_runtime_symbol(context->engine, context->base->audio_file_open->core_ast_symbol->mach_symbol);
+    necro_llvm_map_runtime_symbol(context->engine, context->base->audio_stream_open->core_ast_symbol->mach_symbol);
+    necro_llvm_map_runtime_symbol(context->engine, context->base->audio_stream_read_block->core_ast_symbol->mach_symbol);
 
 #ifdef _WIN32
     system("cls");
@@ -1897,9 +1917,25 @@ void necro_llvm_jit_go(NecroCompileInfo info, NecroLLVM* context, const char* ji
     NecroLangCallback* necro_main     = necro_llvm_get_lang_call(context, context->program->necro_main->fn_def.symbol);
     NecroLangCallback* necro_shutdown = necro_llvm_get_lang_call(context, context->program->necro_shutdown->fn_def.symbol);
 
+    // Global machine updates as a task graph, so the runtime can spread them over its workers
+    const size_t num_main_tasks = context->program->num_main_tasks;
+    NecroTask*   main_tasks     = emalloc((num_main_tasks > 0 ? num_main_tasks : 1) * sizeof(NecroTask));
+    for (size_t i = 0; i < num_main_tasks; ++i)
+    {
+        main_tasks[i].fn               = necro_llvm_get_lang_call(context, context->program->main_tasks[i].fn->fn_def.symbol);
+        main_tasks[i].dependencies     = context->program->main_tasks[i].dependencies;
+        main_tasks[i].num_dependencies = context->program->main_tasks[i].num_dependencies;
+    }
+    NecroLangCallback* necro_main_tail = necro_llvm_get_lang_call(context, context->program->necro_main_tail->fn_def.symbol);
+    necro_runtime_audio_set_main_tasks(main_tasks, num_main_tasks, necro_main_tail);
+    necro_runtime_set_alloc_sites(context->program->alloc_sites.data, context->program->alloc_sites.length);
+
     // TODO: When to call necro_runtime_audio_init? Putting it here for now..
     // unwrap(void, necro_runtime_audio_init());
     unwrap(void, necro_runtime_audio_start(necro_init, necro_main, necro_shutdown));
+    necro_runtime_audio_set_main_tasks(NULL, 0, NULL);
+    necro_runtime_set_alloc_sites(NULL, 0);
+    free(main_tasks);
     // unwrap(void, necro_runtime_audio_shutdown());
     if (!necro_runtime_was_test_successful())
     {
@@ -2036,6 +2072,34 @@ void necro_llvm_compile_string(const char* test_name, const char* str)
     necro_llvm_test_string_go(test_name, str, NECRO_PHASE_COMPILE);
 }
 
+// JITs str and renders a short burst of it offline, so programs can be tested against the real runtime without an audio device
+#define NECRO_LLVM_TEST_RENDER_FILE "necro_render_test.wav"
+void necro_llvm_render_string(const char* test_name, const char* str)
+{
+    const NecroRuntimeOptions prev_options = necro_runtime_options;
+    necro_runtime_options.render_file_name = NECRO_LLVM_TEST_RENDER_FILE;
+    necro_runtime_options.seconds          = 0.1;
+    necro_runtime_options.stats_name       = NULL;
+    necro_llvm_test_string_go(test_name, str, NECRO_PHASE_JIT);
+    remove(NECRO_LLVM_TEST_RENDER_FILE);
+    necro_runtime_options = prev_options;
+}
+
+// Renders with the allocation audit on and fails unless nothing was allocated from the heap inside a block
+void necro_llvm_render_string_no_block_allocs(const char* test_name, const char* str)
+{
+    const bool prev_is_alloc_audit       = necro_runtime_options.is_alloc_audit;
+    necro_runtime_options.is_alloc_audit = true;
+    necro_llvm_render_string(test_name, str);
+    necro_runtime_options.is_alloc_audit = prev_is_alloc_audit;
+    const size_t num_block_allocs = necro_runtime_alloc_audit_block_allocs();
+    if (num_block_allocs == 0)
+        printf("NecroLLVM %s block allocations test: Passed\n", test_name);
+    else
+        printf("NecroLLVM %s block allocations test: FAILED, %zu heap allocations inside blocks\n", test_name, num_block_allocs);
+    assert(num_block_allocs == 0);
+}
+
 void necro_llvm_test()
 {
     necro_announce_phase("LLVM");
@@ -4145,3 +4209,62 @@ void necro_llvm_test_compile()
         necro_llvm_compile_string(test_name, test_source);
     }
 }
+
+void necro_llvm_test_render()
+{
+    necro_announce_phase("Render");
+
+    {
+        const char* test_name   = "Global Initializer Reads Constant";
+        const char* test_source = ""
+            "offset :: Int\n"
+            "offset = 3\n"
+            "counter :: Int\n"
+            "counter ~ offset = add counter 1\n"
+            "main :: *World -> *World\n"
+            "main w = testAssertion (counter == 4) w\n";
+        necro_llvm_render_string(test_name, test_source);
+    }
+
+    {
+        const char* test_name   = "Global Initializer Reads Array Constant";
+        const char* test_source = ""
+            "table :: Array 4 Int\n"
+            "table = { 1, 2, 3, 4 }\n"
+            "lastSeen :: Array 4 Int\n"
+            "lastSeen ~ deepCopyArray table = lastSeen\n"
+            "main :: *World -> *World\n"
+            "main w = testAssertion (readArrayClamped 3 lastSeen == 4) w\n";
+        necro_llvm_render_string(test_name, test_source);
+    }
+
+    {
+        const char* test_name   = "Frame Alloc Through Unboxed Tuple";
+        const char* test_source = ""
+            "scratchSum :: Int -> Int\n"
+            "scratchSum x =\n"
+            "  case unsafePtrPeekU 0 (unsafePtrPoke 0 x (ptrMalloc 4)) of\n"
+            "    (#y, _#) -> y\n"
+            "main :: *World -> *World\n"
+            "main w = testAssertion (scratchSum 7 == 7) w\n";
+        necro_llvm_render_string_no_block_allocs(test_name, test_source);
+    }
+
+    {
+        // 2mb doesn't fit in the frame arena, so every block overflows into the heap and then frees the overflow
+        const char* test_name   = "Frame Alloc Freed After Overflow";
+        const char* test_source = ""
+            "scratchFree :: Int -> Int\n"
+            "scratchFree x =\n"
+            "  case unsafePtrPeekU 0 (unsafePtrPoke 0 x (ptrMalloc 262144)) of\n"
+            "    (#y, p#) -> case ptrFree p of\n"
+            "      _ -> y\n"
+            "counter :: Int\n"
+            "counter ~ 0 = add counter 1\n"
+            "isIntact :: Bool\n"
+            "isIntact ~ True = isIntact && scratchFree counter == counter\n"
+            "main :: *World -> *World\n"
+            "main w = if counter < 16 then w else testAssertion isIntact w\n";
+        necro_llvm_render_string(test_name, test_source);
+    }
+}
@@ -62,5 +62,6 @@ void      necro_llvm_compile(NecroCompileInfo info, NecroLLVM* codegen);
 void      necro_llvm_test();
 void      necro_llvm_test_jit();
 void      necro_llvm_test_compile();
+void      necro_llvm_test_render();
 
 #endif // NECRO_LLVM_H
@@ -101,6 +101,19 @@ void necro_mach_program_add_function(NecroMachProgram* program, NecroMachAst* fu
     necro_push_necro_mach_ast_vector(&program->functions, &function);
 }
 
+size_t necro_mach_program_alloc_site(NecroMachProgram* program, NecroMachAstSymbol* machine_symbol)
+{
+    assert(machine_symbol != NULL);
+    const char* name = machine_symbol->name->str;
+    for (size_t i = NECRO_ALLOC_SITE_RUNTIME + 1; i < program->alloc_sites.length; ++i)
+    {
+        if (program->alloc_sites.data[i] == name)
+            return i;
+    }
+    necro_push_necro_mach_site_vector(&program->alloc_sites, &name);
+    return program->alloc_sites.length - 1;
+}
+
 void necro_mach_program_add_machine_def(NecroMachProgram* program, NecroMachAst* machine_def)
 {
     assert(machine_def->type == NECRO_MACH_DEF);
@@ -388,7 +401,7 @@ NecroMachAst* necro_mach_block_get_current(NecroMachAst* fn_def)
 ///////////////////////////////////////////////////////
 // Memory
 ///////////////////////////////////////////////////////
-NecroMachAst* necro_mach_build_nalloc(NecroMachProgram* program, NecroMachAst* fn_def, NecroMachType* type)
+NecroMachAst* necro_mach_build_nalloc(NecroMachProgram* program, NecroMachAst* fn_def, NecroMachType* type, size_t alloc_site)
 {
     assert(program != NULL);
     assert(type != NULL);
@@ -403,7 +416,7 @@ NecroMachAst* necro_mach_build_nalloc(NecroMachProgram* program, NecroMachAst* f
     // if (program->word_size == NECRO_WORD_8_BYTES) assert(size % 8 == 0);
     // NecroMachAst* alloc_size    = necro_mach_value_create_word_uint(program, size);
     NecroMachAst* alloc_size = necro_mach_build_size_of(program, fn_def, type);
-    NecroMachAst* void_ptr   = necro_mach_build_call(program, fn_def, program->runtime.necro_runtime_alloc->ast->fn_def.fn_value, (NecroMachAst*[]) { alloc_size }, 1, NECRO_MACH_CALL_C, "void_ptr");
+    NecroMachAst* void_ptr   = necro_mach_build_call(program, fn_def, program->runtime.necro_runtime_alloc->ast->fn_def.fn_value, (NecroMachAst*[]) { alloc_size, necro_mach_value_create_word_uint(program, alloc_site) }, 2, NECRO_MACH_CALL_C, "void_ptr");
     NecroMachAst* data_ptr   = necro_mach_build_bit_cast(program, fn_def, void_ptr, necro_mach_type_create_ptr(&program->arena, type));
     return data_ptr;
 }
@@ -1376,6 +1389,7 @@ NecroMachRuntime necro_mach_runtime_empty()
         .necro_runtime_is_done                   = NULL,
         .necro_runtime_alloc                     = NULL,
         .necro_runtime_free                      = NULL,
+        .necro_runtime_frame_alloc               = NULL,
     };
 }
 
@@ -1393,6 +1407,10 @@ NecroMachProgram necro_mach_program_empty()
         .necro_init               = NULL,
         .necro_main               = NULL,
         .necro_shutdown           = NULL,
+        .main_tasks               = NULL,
+        .num_main_tasks           = 0,
+        .necro_main_tail          = NULL,
+        .alloc_sites              = necro_empty_necro_mach_site_vector(),
         .word_size                = NECRO_WORD_4_BYTES,
 
         .arena                    = necro_paged_arena_empty(),
@@ -1421,6 +1439,10 @@ NecroMachProgram necro_mach_program_create(NecroIntern* intern, NecroBase* base)
         .necro_init               = NULL,
         .necro_main               = NULL,
         .necro_shutdown           = NULL,
+        .main_tasks               = NULL,
+        .num_main_tasks           = 0,
+        .necro_main_tail          = NULL,
+        .alloc_sites              = necro_create_necro_mach_site_vector(),
         .word_size                = (sizeof(char*) == 4) ? NECRO_WORD_4_BYTES : NECRO_WORD_8_BYTES,
 
         .arena                    = necro_paged_arena_create(),
@@ -1434,6 +1456,8 @@ NecroMachProgram necro_mach_program_create(NecroIntern* intern, NecroBase* base)
         .clash_suffix             = 0,
         .current_binding          = NULL,
     };
+    const char* runtime_alloc_site = "runtime";
+    necro_push_necro_mach_site_vector(&program.alloc_sites, &runtime_alloc_site); // NECRO_ALLOC_SITE_RUNTIME
     program.type_cache = necro_mach_type_cache_create(&program),
     necro_mach_program_init_base_and_runtime(&program);
     return program;
@@ -1448,6 +1472,7 @@ void necro_mach_program_destroy(NecroMachProgram* program)
     necro_destroy_necro_mach_ast_vector(&program->globals);
     necro_destroy_necro_mach_ast_vector(&program->functions);
     necro_destroy_necro_mach_ast_vector(&program->machine_defs);
+    necro_destroy_necro_mach_site_vector(&program->alloc_sites);
     necro_mach_type_cache_destroy(&program->type_cache);
     *program = necro_mach_program_empty();
 }
@@ -1735,7 +1760,7 @@ void necro_mach_program_init_base_and_runtime(NecroMachProgram* program)
     {
         NecroMachAstSymbol* mach_symbol      = necro_mach_ast_symbol_gen(program, NULL, "necro_runtime_alloc", NECRO_DONT_MANGLE);
         mach_symbol->is_primitive            = true;
-        NecroMachType*      fn_type          = necro_mach_type_create_fn(&program->arena, necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_uint8(program)), (NecroMachType*[]) { necro_mach_type_create_word_sized_uint(program) }, 1);
+        NecroMachType*      fn_type          = necro_mach_type_create_fn(&program->arena, necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_uint8(program)), (NecroMachType*[]) { necro_mach_type_create_word_sized_uint(program), necro_mach_type_create_word_sized_uint(program) }, 2);
         program->runtime.necro_runtime_alloc = necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_alloc, NECRO_STATE_POINTWISE)->fn_def.symbol;
     }
 
@@ -1743,7 +1768,7 @@ void necro_mach_program_init_base_and_runtime(NecroMachProgram* program)
     {
         NecroMachAstSymbol* mach_symbol        = necro_mach_ast_symbol_gen(program, NULL, "necro_runtime_realloc", NECRO_DONT_MANGLE);
         mach_symbol->is_primitive              = true;
-        NecroMachType*      fn_type            = necro_mach_type_create_fn(&program->arena, necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_uint8(program)), (NecroMachType*[]) { necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_uint8(program)), necro_mach_type_create_word_sized_uint(program) }, 2);
+        NecroMachType*      fn_type            = necro_mach_type_create_fn(&program->arena, necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_uint8(program)), (NecroMachType*[]) { necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_uint8(program)), necro_mach_type_create_word_sized_uint(program), necro_mach_type_create_word_sized_uint(program) }, 3);
         program->runtime.necro_runtime_realloc = necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_realloc, NECRO_STATE_POINTWISE)->fn_def.symbol;
     }
 
@@ -1755,6 +1780,14 @@ void necro_mach_program_init_base_and_runtime(NecroMachProgram* program)
         program->runtime.necro_runtime_free = necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_free, NECRO_STATE_POINTWISE)->fn_def.symbol;
     }
 
+    // necro_runtime_frame_alloc
+    {
+        NecroMachAstSymbol* mach_symbol            = necro_mach_ast_symbol_gen(program, NULL, "necro_runtime_frame_alloc", NECRO_DONT_MANGLE);
+        mach_symbol->is_primitive                  = true;
+        NecroMachType*      fn_type                = necro_mach_type_create_fn(&program->arena, necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_uint8(program)), (NecroMachType*[]) { necro_mach_type_create_word_sized_uint(program), necro_mach_type_create_word_sized_uint(program) }, 2);
+        program->runtime.necro_runtime_frame_alloc = necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_frame_alloc, NECRO_STATE_POINTWISE)->fn_def.symbol;
+    }
+
     // necro_runtime_print_string
     {
         NecroMachAstSymbol* mach_symbol   = necro_mach_ast_symbol_gen(program, NULL, "necro_runtime_print_string", NECRO_DONT_MANGLE);
@@ -1775,6 +1808,18 @@ void necro_mach_program_init_base_and_runtime(NecroMachProgram* program)
         program->runtime.necro_runtime_out_audio_block = necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_out_audio_block, NECRO_STATE_STATEFUL)->fn_def.symbol;
     }
 
+    // inAudioBlock
+    {
+        NecroAstSymbol*     ast_symbol                 = program->base->in_audio_block;
+        ast_symbol->is_primitive                       = true;
+        ast_symbol->core_ast_symbol->is_primitive      = true;
+        NecroMachAstSymbol* mach_symbol                = necro_mach_ast_symbol_create_from_core_ast_symbol(&program->arena, ast_symbol->core_ast_symbol);
+        mach_symbol->is_primitive                      = true;
+        NecroMachType*      audio_block_type           = necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_array(&program->arena, program->type_cache.f64_type, necro_runtime_get_block_size()));
+        NecroMachType*      fn_type                    = necro_mach_type_create_fn(&program->arena, audio_block_type, (NecroMachType*[]) { program->type_cache.word_uint_type }, 1);
+        necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_in_audio_block, NECRO_STATE_STATEFUL);
+    }
+
     // recordAudioBlock
     {
         NecroAstSymbol*     ast_symbol                 = program->base->record_audio_block;
@@ -1784,8 +1829,9 @@ void necro_mach_program_init_base_and_runtime(NecroMachProgram* program)
         mach_symbol->is_primitive                      = true;
         NecroMachType*      audio_block_type           = necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_array(&program->arena, program->type_cache.f64_type, necro_runtime_get_block_size()));
         NecroMachType*      scratch_buffer_type        = necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_ptr(&program->arena, program->type_cache.word_uint_type));
+        NecroMachType*      string_type                = necro_mach_type_create_ptr(&program->arena, program->type_cache.word_uint_type);
         NecroMachType*      fn_type                    =
-            necro_mach_type_create_fn(&program->arena, scratch_buffer_type, (NecroMachType*[]) { program->type_cache.uint64_type, program->type_cache.uint64_type, audio_block_type, scratch_buffer_type }, 4);
+            necro_mach_type_create_fn(&program->arena, scratch_buffer_type, (NecroMachType*[]) { string_type, program->type_cache.uint64_type, program->type_cache.uint64_type, program->type_cache.uint64_type, audio_block_type, scratch_buffer_type }, 6);
         necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_record_audio_block, NECRO_STATE_STATEFUL);
     }
 
@@ -1816,6 +1862,32 @@ void necro_mach_program_init_base_and_runtime(NecroMachProgram* program)
         necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_open_audio_file, NECRO_STATE_STATEFUL);
     }
 
+    // audioStreamOpen
+    {
+        NecroAstSymbol*     ast_symbol                 = program->base->audio_stream_open;
+        ast_symbol->is_primitive                       = true;
+        ast_symbol->core_ast_symbol->is_primitive      = true;
+        NecroMachAstSymbol* mach_symbol                = necro_mach_ast_symbol_create_from_core_ast_symbol(&program->arena, ast_symbol->core_ast_symbol);
+        mach_symbol->is_primitive                      = true;
+        NecroMachType*      word_uint_ptr_type         = necro_mach_type_create_ptr(&program->arena, program->type_cache.word_uint_type);
+        NecroMachType*      fn_type                    =
+            necro_mach_type_create_fn(&program->arena, word_uint_ptr_type, (NecroMachType*[]) { word_uint_ptr_type, program->type_cache.uint64_type }, 2);
+        necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_open_audio_stream, NECRO_STATE_STATEFUL);
+    }
+
+    // audioStreamReadBlock
+    {
+        NecroAstSymbol*     ast_symbol                 = program->base->audio_stream_read_block;
+        ast_symbol->is_primitive                       = true;
+        ast_symbol->core_ast_symbol->is_primitive      = true;
+        NecroMachAstSymbol* mach_symbol                = necro_mach_ast_symbol_create_from_core_ast_symbol(&program->arena, ast_symbol->core_ast_symbol);
+        mach_symbol->is_primitive                      = true;
+        NecroMachType*      word_uint_ptr_type         = necro_mach_type_create_ptr(&program->arena, program->type_cache.word_uint_type);
+        NecroMachType*      fn_type                    =
+            necro_mach_type_create_fn(&program->arena, word_uint_ptr_type, (NecroMachType*[]) { word_uint_ptr_type, program->type_cache.uint64_type }, 2);
+        necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_read_audio_stream_block, NECRO_STATE_STATEFUL);
+    }
+
     // // printAudioBlock
     // {
     //     NecroAstSymbol*     ast_symbol                   = program->base->print_audio_block;
@@ -1912,4 +1984,15 @@ void necro_mach_program_init_base_and_runtime(NecroMachProgram* program)
         necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_open_file, NECRO_STATE_POINTWISE);
     }
 
+    // open_binary_file
+    {
+        NecroAstSymbol*     ast_symbol            = program->base->open_binary_file;
+        ast_symbol->is_primitive                  = true;
+        ast_symbol->core_ast_symbol->is_primitive = true;
+        NecroMachAstSymbol* mach_symbol           = necro_mach_ast_symbol_create_from_core_ast_symbol(&program->arena, ast_symbol->core_ast_symbol);
+        mach_symbol->is_primitive                 = true;
+        NecroMachType*      fn_type               = necro_mach_type_create_fn(&program->arena, program->type_cache.word_uint_type, (NecroMachType*[]) { necro_mach_type_create_ptr(&program->arena, program->type_cache.word_uint_type), program->type_cache.uint64_type }, 2);
+        necro_mach_create_runtime_fn(program, mach_symbol, fn_type, (NecroMachFnPtr) necro_runtime_open_binary_file, NECRO_STATE_POINTWISE);
+    }
+
 }
@@ -479,6 +479,7 @@ typedef struct NecroMachAst
 // Runtime / Program
 //--------------------
 NECRO_DECLARE_VECTOR(NecroMachAst*, NecroMachAst, necro_mach_ast);
+NECRO_DECLARE_VECTOR(const char*, NecroMachSite, necro_mach_site);
 typedef struct NecroMachRuntime
 {
     NecroMachAstSymbol* necro_init_runtime;
@@ -500,6 +501,7 @@ typedef struct NecroMachRuntime
     NecroMachAstSymbol* necro_runtime_alloc;
     NecroMachAstSymbol* necro_runtime_realloc;
     NecroMachAstSymbol* necro_runtime_free;
+    NecroMachAstSymbol* necro_runtime_frame_alloc;
     NecroMachAstSymbol* necro_runtime_out_audio_block;
     // NecroMachAstSymbol* necro_runtime_print_audio_block;
     NecroMachAstSymbol* necro_runtime_test_assertion;
@@ -508,6 +510,14 @@ typedef struct NecroMachRuntime
     // NOTE: Don't forget to add mappings to mach_ast.c and codegen_llvm.c when you add new runtime symbols
 } NecroMachRuntime;
 
+// One global machine's slice of necro_main, see mach_schedule.h
+typedef struct NecroMachMainTask
+{
+    NecroMachAst* fn;               // fn() -> word_int, updates the machine's global value
+    size_t*       dependencies;     // Indices of the earlier tasks which must finish before this one runs
+    size_t        num_dependencies;
+} NecroMachMainTask;
+
 typedef enum
 {
     NECRO_WORD_4_BYTES = 4, // 32-bit
@@ -525,6 +535,10 @@ typedef struct NecroMachProgram
     NecroMachAst*           necro_init;
     NecroMachAst*           necro_main;
     NecroMachAst*           necro_shutdown;
+    NecroMachMainTask*      main_tasks;      // necro_main split up so independent global machines can update in parallel
+    size_t                  num_main_tasks;
+    NecroMachAst*           necro_main_tail; // Runs program main, the rest of necro_main once every main task has run
+    NecroMachSiteVector     alloc_sites;     // Names of the machines which allocate, indexed by the site id passed to necro_runtime_alloc. Site 0 is the runtime
     NECRO_WORD_SIZE         word_size;
 
     // Useful structs
@@ -589,7 +603,7 @@ NecroMachAst* necro_mach_block_get_current(NecroMachAst* fn_def);
 //--------------------
 // Memory
 //--------------------
-NecroMachAst* necro_mach_build_nalloc(NecroMachProgram* program, NecroMachAst* fn_def, struct NecroMachType* type);
+NecroMachAst* necro_mach_build_nalloc(NecroMachProgram* program, NecroMachAst* fn_def, struct NecroMachType* type, size_t alloc_site);
 // NecroMachAst* necro_mach_build_alloca(NecroMachProgram* program, NecroMachAst* fn_def, size_t num_slots);
 NecroMachAst* necro_mach_build_gep(NecroMachProgram* program, NecroMachAst* fn_def, NecroMachAst* source_value, size_t* a_indices, size_t num_indices, const char* dest_name);
 NecroMachAst* necro_mach_build_insert_value(NecroMachProgram* program, NecroMachAst* fn_def, NecroMachAst* aggregate_value, NecroMachAst* inserted_value, size_t index, const char* dest_name);
@@ -651,5 +665,6 @@ void             necro_mach_program_add_function(NecroMachProgram* program, Necr
 void             necro_mach_program_add_machine_def(NecroMachProgram* program, NecroMachAst* machine_def);
 void             necro_mach_program_add_global(NecroMachProgram* program, NecroMachAst* global);
 NecroMachAst*    necro_mach_create_string_global_constant(NecroMachProgram* program, NecroSymbol string_symbol);
+size_t           necro_mach_program_alloc_site(NecroMachProgram* program, NecroMachAstSymbol* machine_symbol); // Site id for allocations made by machine_symbol, see Allocation audit in runtime.c
 
 #endif // NECRO_MACH_H
@@ -0,0 +1,241 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <string.h>
+#include "mach_schedule.h"
+#include "utility/hash_table.h"
+#include "runtime.h"
+
+///////////////////////////////////////////////////////
+// Access analysis
+//     * Each task's fn is walked along with every lang fn it can reach, collecting the global machines it touches.
+//     * Walks are per task, a fn is only marked visited for the task currently being walked.
+///////////////////////////////////////////////////////
+#define NECRO_MACH_SCHEDULE_WORD_BITS (sizeof(size_t) * 8)
+
+typedef struct NecroMachTaskAccess
+{
+    size_t* touched;   // Bit set over tasks, the tasks whose global value or state this task reads or writes
+    bool    is_serial; // Calls runtime functions which can't run on two threads at once
+    bool    is_opaque; // Makes an indirect call
+} NecroMachTaskAccess;
+
+typedef struct NecroMachScheduleContext
+{
+    NecroPagedArena      arena;   // Scratch, freed once the dependencies have been copied into the program
+    NecroArenaChainTable owners;  // Global symbol => 1 + index of the task updating it
+    NecroArenaChainTable visited; // Fn def => 1 + index of the last task whose walk reached it
+    size_t               num_words;
+} NecroMachScheduleContext;
+
+// Runtime functions which only read state that is fixed for the whole block, or are otherwise fine to call from several threads at once
+static bool necro_mach_schedule_is_thread_safe_runtime_fn(NecroMachAst* fn_def)
+{
+    const NecroMachFnPtr fn_addr = fn_def->fn_def.runtime_fn_addr;
+    return fn_addr == (NecroMachFnPtr) necro_runtime_alloc
+        || fn_addr == (NecroMachFnPtr) necro_runtime_realloc
+        || fn_addr == (NecroMachFnPtr) necro_runtime_free
+        || fn_addr == (NecroMachFnPtr) necro_runtime_frame_alloc
+        || fn_addr == (NecroMachFnPtr) necro_runtime_get_mouse_x
+        || fn_addr == (NecroMachFnPtr) necro_runtime_get_mouse_y
+        || fn_addr == (NecroMachFnPtr) necro_runtime_get_key_press
+        || fn_addr == (NecroMachFnPtr) necro_runtime_get_midi_buffer
+        || fn_addr == (NecroMachFnPtr) necro_runtime_get_num_buffered_midi_messages
+        || fn_addr == (NecroMachFnPtr) necro_runtime_in_audio_block
+        || fn_addr == (NecroMachFnPtr) necro_runtime_is_done
+        || fn_addr == (NecroMachFnPtr) necro_runtime_error_exit               // Both exit, but sit in nearly every fn's error path
+        || fn_addr == (NecroMachFnPtr) necro_runtime_inexhaustive_case_exit;
+}
+
+static void necro_mach_schedule_walk_value(NecroMachScheduleContext* context, NecroMachTaskAccess* access, NecroMachAst* ast)
+{
+    if (ast == NULL || ast->type != NECRO_MACH_VALUE || ast->value.value_type != NECRO_MACH_VALUE_GLOBAL)
+        return;
+    size_t* owner = necro_arena_chain_table_get(&context->owners, (uint64_t) (size_t) ast->value.global_symbol);
+    if (owner == NULL)
+        return;
+    const size_t task_index = *owner - 1;
+    access->touched[task_index / NECRO_MACH_SCHEDULE_WORD_BITS] |= ((size_t) 1) << (task_index % NECRO_MACH_SCHEDULE_WORD_BITS);
+}
+
+static void necro_mach_schedule_walk_fn(NecroMachScheduleContext* context, NecroMachTaskAccess* access, size_t task_index, NecroMachAst* fn_def);
+
+static void necro_mach_schedule_walk_statement(NecroMachScheduleContext* context, NecroMachTaskAccess* access, size_t task_index, NecroMachAst* ast)
+{
+    switch (ast->type)
+    {
+    case NECRO_MACH_CALL:
+    {
+        NecroMachAst* fn_value = ast->call.fn_value;
+        if (fn_value->type == NECRO_MACH_VALUE && fn_value->value.value_type == NECRO_MACH_VALUE_GLOBAL && fn_value->value.global_symbol->ast != NULL && fn_value->value.global_symbol->ast->type == NECRO_MACH_FN_DEF)
+            necro_mach_schedule_walk_fn(context, access, task_index, fn_value->value.global_symbol->ast);
+        else
+            access->is_opaque = true;
+        for (size_t i = 0; i < ast->call.num_parameters; ++i)
+            necro_mach_schedule_walk_value(context, access, ast->call.parameters[i]);
+        return;
+    }
+    case NECRO_MACH_CALLI:
+        for (size_t i = 0; i < ast->call_intrinsic.num_parameters; ++i)
+            necro_mach_schedule_walk_value(context, access, ast->call_intrinsic.parameters[i]);
+        return;
+    case NECRO_MACH_LOAD:
+        necro_mach_schedule_walk_value(context, access, ast->load.source_ptr);
+        return;
+    case NECRO_MACH_STORE:
+        necro_mach_schedule_walk_value(context, access, ast->store.source_value);
+        necro_mach_schedule_walk_value(context, access, ast->store.dest_ptr);
+        return;
+    case NECRO_MACH_BIT_CAST:
+        necro_mach_schedule_walk_value(context, access, ast->bit_cast.from_value);
+        return;
+    case NECRO_MACH_ZEXT:
+        necro_mach_schedule_walk_value(context, access, ast->zext.from_value);
+        return;
+    case NECRO_MACH_GEP:
+        necro_mach_schedule_walk_value(context, access, ast->gep.source_value);
+        for (size_t i = 0; i < ast->gep.num_indices; ++i)
+            necro_mach_schedule_walk_value(context, access, ast->gep.indices[i]);
+        return;
+    case NECRO_MACH_INSERT_VALUE:
+        necro_mach_schedule_walk_value(context, access, ast->insert_value.aggregate_value);
+        necro_mach_schedule_walk_value(context, access, ast->insert_value.inserted_value);
+        return;
+    case NECRO_MACH_EXTRACT_VALUE:
+        necro_mach_schedule_walk_value(context, access, ast->extract_value.aggregate_value);
+        return;
+    case NECRO_MACH_UOP:
+        necro_mach_schedule_walk_value(context, access, ast->uop.param);
+        return;
+    case NECRO_MACH_BINOP:
+        necro_mach_schedule_walk_value(context, access, ast->binop.left);
+        necro_mach_schedule_walk_value(context, access, ast->binop.right);
+        return;
+    case NECRO_MACH_CMP:
+        necro_mach_schedule_walk_value(context, access, ast->cmp.left);
+        necro_mach_schedule_walk_value(context, access, ast->cmp.right);
+        return;
+    case NECRO_MACH_SELECT:
+        necro_mach_schedule_walk_value(context, access, ast->select.cmp_value);
+        necro_mach_schedule_walk_value(context, access, ast->select.left);
+        necro_mach_schedule_walk_value(context, access, ast->select.right);
+        return;
+    case NECRO_MACH_PHI:
+        for (NecroMachPhiList* values = ast->phi.values; values != NULL; values = values->next)
+            necro_mach_schedule_walk_value(context, access, values->data.value);
+        return;
+    default:
+        return;
+    }
+}
+
+static void necro_mach_schedule_walk_fn(NecroMachScheduleContext* context, NecroMachTaskAccess* access, size_t task_index, NecroMachAst* fn_def)
+{
+    assert(fn_def->type == NECRO_MACH_FN_DEF);
+    if (fn_def->fn_def.fn_type == NECRO_MACH_FN_RUNTIME)
+    {
+        if (!necro_mach_schedule_is_thread_safe_runtime_fn(fn_def))
+            access->is_serial = true;
+        return;
+    }
+    const size_t visit_mark = task_index + 1;
+    size_t*      prev_mark  = necro_arena_chain_table_get(&context->visited, (uint64_t) (size_t) fn_def);
+    if (prev_mark != NULL && *prev_mark == visit_mark)
+        return;
+    necro_arena_chain_table_insert(&context->visited, (uint64_t) (size_t) fn_def, (void*) &visit_mark);
+    for (NecroMachAst* block = fn_def->fn_def.call_body; block != NULL; block = block->block.next_block)
+    {
+        for (size_t i = 0; i < block->block.num_statements; ++i)
+            necro_mach_schedule_walk_statement(context, access, task_index, block->block.statements[i]);
+        NecroMachTerminator* terminator = block->block.terminator;
+        if (terminator == NULL)
+            continue;
+        if (terminator->type == NECRO_MACH_TERM_RETURN)
+            necro_mach_schedule_walk_value(context, access, terminator->return_terminator.return_value);
+        else if (terminator->type == NECRO_MACH_TERM_COND_BREAK)
+            necro_mach_schedule_walk_value(context, access, terminator->cond_break_terminator.cond_value);
+        else if (terminator->type == NECRO_MACH_TERM_SWITCH)
+            necro_mach_schedule_walk_value(context, access, terminator->switch_terminator.choice_val);
+    }
+}
+
+///////////////////////////////////////////////////////
+// Dependencies
+///////////////////////////////////////////////////////
+static bool necro_mach_schedule_is_touched(NecroMachTaskAccess* access, size_t task_index)
+{
+    return (access->touched[task_index / NECRO_MACH_SCHEDULE_WORD_BITS] & (((size_t) 1) << (task_index % NECRO_MACH_SCHEDULE_WORD_BITS))) != 0;
+}
+
+static bool necro_mach_schedule_is_conflict(NecroMachTaskAccess* accesses, size_t task_a, size_t task_b)
+{
+    return accesses[task_a].is_opaque
+        || accesses[task_b].is_opaque
+        || (accesses[task_a].is_serial && accesses[task_b].is_serial)
+        || necro_mach_schedule_is_touched(accesses + task_a, task_b)
+        || necro_mach_schedule_is_touched(accesses + task_b, task_a);
+}
+
+void necro_mach_schedule_main_tasks(NecroMachProgram* program)
+{
+    const size_t num_tasks = program->num_main_tasks;
+    if (num_tasks == 0)
+        return;
+    NecroMachScheduleContext context =
+    {
+        .arena     = necro_paged_arena_create(),
+        .owners    = necro_create_arena_chain_table(sizeof(size_t)),
+        .visited   = necro_create_arena_chain_table(sizeof(size_t)),
+        .num_words = (num_tasks + NECRO_MACH_SCHEDULE_WORD_BITS - 1) / NECRO_MACH_SCHEDULE_WORD_BITS,
+    };
+
+    //--------------------
+    // Globals owned by each task, the state its fn loads and the value it stores (see necro_mach_build_global_update)
+    for (size_t i = 0; i < num_tasks; ++i)
+    {
+        const size_t  owner = i + 1;
+        NecroMachAst* entry = program->main_tasks[i].fn->fn_def.call_body;
+        for (size_t s = 0; s < entry->block.num_statements; ++s)
+        {
+            NecroMachAst* statement = entry->block.statements[s];
+            if (statement->type == NECRO_MACH_STORE && statement->store.dest_ptr->value.value_type == NECRO_MACH_VALUE_GLOBAL)
+                necro_arena_chain_table_insert(&context.owners, (uint64_t) (size_t) statement->store.dest_ptr->value.global_symbol, (void*) &owner);
+            else if (statement->type == NECRO_MACH_LOAD && statement->load.source_ptr->value.value_type == NECRO_MACH_VALUE_GLOBAL)
+                necro_arena_chain_table_insert(&context.owners, (uint64_t) (size_t) statement->load.source_ptr->value.global_symbol, (void*) &owner);
+        }
+    }
+
+    //--------------------
+    // Walk each task
+    NecroMachTaskAccess* accesses = necro_paged_arena_alloc(&context.arena, num_tasks * sizeof(NecroMachTaskAccess));
+    for (size_t i = 0; i < num_tasks; ++i)
+    {
+        accesses[i].touched   = necro_paged_arena_alloc(&context.arena, context.num_words * sizeof(size_t));
+        accesses[i].is_serial = false;
+        accesses[i].is_opaque = false;
+        memset(accesses[i].touched, 0, context.num_words * sizeof(size_t));
+        necro_mach_schedule_walk_fn(&context, accesses + i, i, program->main_tasks[i].fn);
+    }
+
+    //--------------------
+    // Each task depends on every earlier task it conflicts with
+    size_t* dependencies = necro_paged_arena_alloc(&context.arena, num_tasks * sizeof(size_t));
+    for (size_t i = 0; i < num_tasks; ++i)
+    {
+        size_t num_dependencies = 0;
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (necro_mach_schedule_is_conflict(accesses, j, i))
+                dependencies[num_dependencies++] = j;
+        }
+        program->main_tasks[i].num_dependencies = num_dependencies;
+        program->main_tasks[i].dependencies     = necro_paged_arena_alloc(&program->arena, (num_dependencies > 0 ? num_dependencies : 1) * sizeof(size_t));
+        memcpy(program->main_tasks[i].dependencies, dependencies, num_dependencies * sizeof(size_t));
+    }
+
+    necro_destroy_arena_chain_table(&context.visited);
+    necro_destroy_arena_chain_table(&context.owners);
+    necro_paged_arena_destroy(&context.arena);
+}
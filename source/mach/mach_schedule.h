@@ -0,0 +1,27 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef MACH_SCHEDULE_H
+#define MACH_SCHEDULE_H 1
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "mach_ast.h"
+
+///////////////////////////////////////////////////////
+// Main task scheduling
+//     * necro_main updates every global machine in program order, then runs program main.
+//       necro_mach_construct_main also splits that work into one task per global machine plus necro_main_tail,
+//       so the runtime can update independent machines on different threads (see runtime_scheduler.h).
+//     * A task depends on each earlier task it conflicts with, where two tasks conflict when:
+//         - either reads or writes the other's global value or state, directly or anywhere down its call graph
+//         - both call runtime functions which aren't safe to call from two threads at once (printing, files, audio output, ...)
+//         - either makes an indirect call, which could touch anything
+//     * Conflicting tasks keep their necro_main order, so every task sees exactly the values it would have sequentially.
+///////////////////////////////////////////////////////
+void necro_mach_schedule_main_tasks(NecroMachProgram* program); // Fills in the dependencies of program->main_tasks
+
+#endif // MACH_SCHEDULE_H
@@ -15,6 +15,7 @@
 #include <ctype.h>
 #include "core/state_analysis.h"
 #include "mach_case.h"
+#include "mach_schedule.h"
 #include "runtime.h"
 
 
@@ -689,7 +690,7 @@ void necro_core_transform_to_mach_2_bind(NecroMachProgram* program, NecroCoreAst
         // mk_fn
         {
             machine_def->machine_def.mk_fn->necro_machine_type->fn_type.return_type = machine_ptr_type;
-            NecroMachAst* data_ptr = necro_mach_build_nalloc(program, machine_def->machine_def.mk_fn, machine_def->necro_machine_type);
+            NecroMachAst* data_ptr = necro_mach_build_nalloc(program, machine_def->machine_def.mk_fn, machine_def->necro_machine_type, necro_mach_program_alloc_site(program, machine_def->machine_def.symbol));
             necro_mach_build_call(program, machine_def->machine_def.mk_fn, machine_def->machine_def.init_fn->fn_def.fn_value, (NecroMachAst*[]) { data_ptr }, 1, NECRO_MACH_CALL_LANG, "");
             necro_mach_build_return(program, machine_def->machine_def.mk_fn, data_ptr);
         }
@@ -1085,6 +1086,8 @@ NecroMachAst* necro_core_transform_to_mach_3_var(NecroMachProgram* program, Necr
                 return necro_mach_value_create_uint64(program, necro_runtime_get_sample_rate());
             else if (symbol == program->base->recip_sample_rate->core_ast_symbol->mach_symbol)
                 return necro_mach_value_create_f64(program, 1.0 / ((double)necro_runtime_get_sample_rate()));
+            else if (symbol == program->base->block_size->core_ast_symbol->mach_symbol)
+                return necro_mach_value_create_uint64(program, necro_runtime_get_block_size());
             else
                 assert(false);
             return NULL;
@@ -1671,7 +1674,8 @@ NecroMachAst* necro_core_transform_to_mach_3_primop(NecroMachProgram* program, N
         if (program->word_size == NECRO_WORD_8_BYTES) assert(size % 8 == 0);
         NecroMachAst*  object_size  = necro_mach_value_create_word_uint(program, size);
         NecroMachAst*  alloc_size   = necro_mach_build_binop(program, outer->machine_def.update_fn, object_count, object_size, NECRO_PRIMOP_BINOP_UMUL);
-        NecroMachAst*  void_ptr     = necro_mach_build_call(program, outer->machine_def.update_fn, program->runtime.necro_runtime_alloc->ast->fn_def.fn_value, (NecroMachAst*[]) { alloc_size }, 1, NECRO_MACH_CALL_C, "void_ptr");
+        NecroMachAst*  alloc_site   = necro_mach_value_create_word_uint(program, necro_mach_program_alloc_site(program, outer->machine_def.symbol));
+        NecroMachAst*  void_ptr     = necro_mach_build_call(program, outer->machine_def.update_fn, program->runtime.necro_runtime_alloc->ast->fn_def.fn_value, (NecroMachAst*[]) { alloc_size, alloc_site }, 2, NECRO_MACH_CALL_C, "void_ptr");
         NecroMachAst*  data_ptr     = necro_mach_build_bit_cast(program, outer->machine_def.update_fn, void_ptr, mach_type);
         return data_ptr;
     }
@@ -1691,7 +1695,8 @@ NecroMachAst* necro_core_transform_to_mach_3_primop(NecroMachProgram* program, N
         if (program->word_size == NECRO_WORD_8_BYTES) assert(size % 8 == 0);
         NecroMachAst*  object_size   = necro_mach_value_create_word_uint(program, size);
         NecroMachAst*  alloc_size    = necro_mach_build_binop(program, outer->machine_def.update_fn, object_count, object_size, NECRO_PRIMOP_BINOP_UMUL);
-        NecroMachAst*  void_ptr      = necro_mach_build_call(program, outer->machine_def.update_fn, program->runtime.necro_runtime_realloc->ast->fn_def.fn_value, (NecroMachAst*[]) { uint8_ptr_val, alloc_size }, 2, NECRO_MACH_CALL_C, "void_ptr");
+        NecroMachAst*  alloc_site    = necro_mach_value_create_word_uint(program, necro_mach_program_alloc_site(program, outer->machine_def.symbol));
+        NecroMachAst*  void_ptr      = necro_mach_build_call(program, outer->machine_def.update_fn, program->runtime.necro_runtime_realloc->ast->fn_def.fn_value, (NecroMachAst*[]) { uint8_ptr_val, alloc_size, alloc_site }, 3, NECRO_MACH_CALL_C, "void_ptr");
         NecroMachAst*  data_ptr      = necro_mach_build_bit_cast(program, outer->machine_def.update_fn, void_ptr, mach_type);
         return data_ptr;
     }
@@ -2249,6 +2254,119 @@ NecroMachAst* necro_core_transform_to_mach_3_go(NecroMachProgram* program, Necro
 ///////////////////////////////////////////////////////
 // Construct Main
 ///////////////////////////////////////////////////////
+// Global machines which necro_main updates every block
+static bool necro_mach_is_global_update(NecroMachAst* machine_def)
+{
+    return machine_def->machine_def.state_type != NECRO_STATE_CONSTANT && machine_def->machine_def.num_arg_names == 0;
+}
+
+static void necro_mach_build_global_update(NecroMachProgram* program, NecroMachAst* fn_def, NecroMachAst* machine_def)
+{
+    if (machine_def->machine_def.num_members > 0)
+    {
+        NecroMachAst* state  = necro_mach_build_load(program, fn_def, machine_def->machine_def.global_state, "state");
+        NecroMachAst* result = necro_mach_build_call(program, fn_def, machine_def->machine_def.update_fn->fn_def.fn_value, (NecroMachAst*[]) { state }, 1, NECRO_MACH_CALL_LANG, "stateful_result");
+        necro_mach_build_store(program, fn_def, result, machine_def->machine_def.global_value);
+    }
+    else
+    {
+        NecroMachAst* result = necro_mach_build_call(program, fn_def, machine_def->machine_def.update_fn->fn_def.fn_value, NULL, 0, NECRO_MACH_CALL_LANG, "pointwise_result");
+        necro_mach_build_store(program, fn_def, result, machine_def->machine_def.global_value);
+    }
+}
+
+static void necro_mach_build_program_main_update(NecroMachProgram* program, NecroMachAst* fn_def)
+{
+    if (program->program_main == NULL)
+        return;
+    // NOTE: Main is of type World -> World, which translates to fn main(u64) -> u64
+    NecroMachAst* world_value = necro_mach_value_create_word_uint(program, 0);
+    if (program->program_main->machine_def.num_members > 0)
+    {
+        NecroMachAst* state  = necro_mach_build_load(program, fn_def, program->program_main->machine_def.global_state, "state");
+        NecroMachAst* result = necro_mach_build_call(program, fn_def, program->program_main->machine_def.update_fn->fn_def.fn_value, (NecroMachAst*[]) { state, world_value }, 2, NECRO_MACH_CALL_LANG, "main_result");
+        UNUSED(result);
+    }
+    else
+    {
+        NecroMachAst* result = necro_mach_build_call(program, fn_def, program->program_main->machine_def.update_fn->fn_def.fn_value, (NecroMachAst*[]) { world_value }, 1, NECRO_MACH_CALL_LANG, "main_result");
+        UNUSED(result);
+    }
+}
+
+///////////////////////////////////////////////////////
+// State region
+//     * Every global machine's state, and program main's, lives in one struct allocated once by necro_init,
+//       instead of each mk_fn making its own heap allocation.
+//     * Members are laid out in the order necro_main updates the machines, with program main last,
+//       so each block walks the region front to back and neighbouring states share cache lines and pages.
+//     * necro_init still sets each state up with its init_fn, in machine_defs order and right before that machine's constant (if it is one) is evaluated,
+//       since initializers can read the global values of constants earlier in the program. global_state still points at each state, so update fns don't change.
+//     * necro_shutdown frees the region as a whole.
+//     * With scheduler workers (necro_runtime_options.num_workers) neighbouring states are updated by different threads at once.
+//       Each state is then followed by NECRO_MACH_STATE_REGION_PAD bytes of padding, so no cache line holds parts of two states (no false sharing).
+//       The sizes mach sees don't include LLVM's own padding, so a full line after each state is what guarantees this, rather than rounding up.
+///////////////////////////////////////////////////////
+#define NECRO_MACH_STATE_REGION_PAD 64 // Cache line size
+
+static bool necro_mach_is_state_region_padded()
+{
+    return necro_runtime_options.num_workers > 0;
+}
+
+// Index of the state_index'th state among the region's members, skipping the padding
+static size_t necro_mach_state_region_member(size_t state_index)
+{
+    return necro_mach_is_state_region_padded() ? 2 * state_index : state_index;
+}
+
+static bool necro_mach_has_global_state(NecroMachProgram* program, NecroMachAst* machine_def)
+{
+    if (machine_def == program->program_main)
+        return machine_def->machine_def.num_members > 0;
+    return machine_def->machine_def.num_members > 0 && machine_def->machine_def.num_arg_names == 0;
+}
+
+// Allocates the region in fn_def, returns a pointer to it or NULL when no machine has state. States are set up separately, see necro_mach_build_state_init
+static NecroMachAst* necro_mach_build_state_region(NecroMachProgram* program, NecroMachAst* fn_def)
+{
+    //--------------------
+    // Layout, in necro_main order
+    const size_t   max_states   = program->machine_defs.length + 1;
+    NecroMachAst** state_defs   = necro_paged_arena_alloc(&program->arena, max_states * sizeof(NecroMachAst*));
+    size_t         num_states   = 0;
+    for (size_t i = 0; i < program->machine_defs.length; ++i)
+    {
+        if (program->machine_defs.data[i] != program->program_main && necro_mach_has_global_state(program, program->machine_defs.data[i]))
+            state_defs[num_states++] = program->machine_defs.data[i];
+    }
+    if (program->program_main != NULL && necro_mach_has_global_state(program, program->program_main))
+        state_defs[num_states++] = program->program_main;
+    if (num_states == 0)
+        return NULL;
+    const size_t    num_members = necro_mach_state_region_member(num_states - 1) + 1;
+    NecroMachType*  pad_type    = necro_mach_type_create_array(&program->arena, program->type_cache.uint64_type, NECRO_MACH_STATE_REGION_PAD / sizeof(uint64_t));
+    NecroMachType** members     = necro_paged_arena_alloc(&program->arena, num_members * sizeof(NecroMachType*));
+    for (size_t i = 0; i < num_members; ++i)
+        members[i] = pad_type;
+    for (size_t i = 0; i < num_states; ++i)
+        members[necro_mach_state_region_member(i)] = state_defs[i]->necro_machine_type;
+    NecroMachAstSymbol* region_symbol = necro_mach_ast_symbol_gen(program, NULL, "_StateRegion", NECRO_MANGLE_NAME);
+    NecroMachAst*       region_def    = necro_mach_create_struct_def(program, region_symbol, members, num_members);
+
+    return necro_mach_build_nalloc(program, fn_def, region_def->necro_machine_type, necro_mach_program_alloc_site(program, region_symbol));
+}
+
+// Inits machine_def's state in place, as member state_index of the region, and points its global_state at it
+static void necro_mach_build_state_init(NecroMachProgram* program, NecroMachAst* fn_def, NecroMachAst* region, size_t state_index, NecroMachAst* machine_def)
+{
+    assert(region != NULL);
+    assert(necro_mach_has_global_state(program, machine_def));
+    NecroMachAst* state = necro_mach_build_gep(program, fn_def, region, (size_t[]) { 0, necro_mach_state_region_member(state_index) }, 2, "state");
+    necro_mach_build_call(program, fn_def, machine_def->machine_def.init_fn->fn_def.fn_value, (NecroMachAst*[]) { state }, 1, NECRO_MACH_CALL_LANG, "");
+    necro_mach_build_store(program, fn_def, state, machine_def->machine_def.global_state);
+}
+
 void necro_mach_construct_main(NecroMachProgram* program)
 {
 
@@ -2261,6 +2379,7 @@ void necro_mach_construct_main(NecroMachProgram* program)
         assert(main_symbol->core_ast_symbol != NULL);
         program->program_main = main_symbol->core_ast_symbol->mach_symbol->ast;
     }
+    NecroMachAst* state_region_global = NULL;
 
     //--------------------
     // necro_init
@@ -2275,15 +2394,34 @@ void necro_mach_construct_main(NecroMachProgram* program)
         program->functions.length--; // Hack...
 
         //--------------------
-        // Create states and call constants
+        // Main state global
+        if (program->program_main != NULL && program->program_main->machine_def.num_members > 0 && program->program_main->machine_def.global_state == NULL)
+        {
+            NecroMachAstSymbol* global_state_symbol         = necro_mach_ast_symbol_gen(program, NULL, necro_snapshot_arena_concat_strings(&program->snapshot_arena, 2, (const char* []) { "state", program->program_main->machine_def.machine_name->name->str }), NECRO_MANGLE_NAME);
+            NecroMachAst*       global_state                = necro_mach_value_create_global(program, global_state_symbol, necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_ptr(&program->arena, program->program_main->necro_machine_type)));
+            program->program_main->machine_def.global_state = global_state;
+            necro_mach_program_add_global(program, global_state);
+        }
+
+        //--------------------
+        // Allocate states
+        NecroMachAst* state_region = necro_mach_build_state_region(program, necro_init_fn);
+        size_t        state_index  = 0;
+        if (state_region != NULL)
+        {
+            NecroMachAstSymbol* region_global_symbol = necro_mach_ast_symbol_gen(program, NULL, "state_region", NECRO_MANGLE_NAME);
+            state_region_global                      = necro_mach_value_create_global(program, region_global_symbol, necro_mach_type_create_ptr(&program->arena, state_region->necro_machine_type));
+            necro_mach_program_add_global(program, state_region_global);
+            necro_mach_build_store(program, necro_init_fn, state_region, state_region_global);
+        }
+
+        //--------------------
+        // Init states and call constants, in the same order as necro_mach_build_state_region lays them out
         for (size_t i = 0; i < program->machine_defs.length; ++i)
         {
-            // Create State
-            if (program->machine_defs.data[i]->machine_def.num_members > 0 && program->machine_defs.data[i]->machine_def.num_arg_names == 0)
-            {
-                NecroMachAst* result = necro_mach_build_call(program, necro_init_fn, program->machine_defs.data[i]->machine_def.mk_fn->fn_def.fn_value, NULL, 0, NECRO_MACH_CALL_LANG, "state");
-                necro_mach_build_store(program, necro_init_fn, result, program->machine_defs.data[i]->machine_def.global_state);
-            }
+            // Init state
+            if (program->machine_defs.data[i] != program->program_main && necro_mach_has_global_state(program, program->machine_defs.data[i]))
+                necro_mach_build_state_init(program, necro_init_fn, state_region, state_index++, program->machine_defs.data[i]);
             // Call constant
             if (program->machine_defs.data[i]->machine_def.state_type == NECRO_STATE_CONSTANT && program->machine_defs.data[i]->machine_def.num_arg_names == 0)
             {
@@ -2300,18 +2438,8 @@ void necro_mach_construct_main(NecroMachProgram* program)
                 }
             }
         }
-        if (program->program_main != NULL && program->program_main->machine_def.num_members > 0)
-        {
-            if (program->program_main->machine_def.global_state == NULL)
-            {
-                NecroMachAstSymbol* global_state_symbol         = necro_mach_ast_symbol_gen(program, NULL, necro_snapshot_arena_concat_strings(&program->snapshot_arena, 2, (const char* []) { "state", program->program_main->machine_def.machine_name->name->str }), NECRO_MANGLE_NAME);
-                NecroMachAst*       global_state                = necro_mach_value_create_global(program, global_state_symbol, necro_mach_type_create_ptr(&program->arena, necro_mach_type_create_ptr(&program->arena, program->program_main->necro_machine_type)));
-                program->program_main->machine_def.global_state = global_state;
-                necro_mach_program_add_global(program, global_state);
-            }
-            NecroMachAst* result = necro_mach_build_call(program, necro_init_fn, program->program_main->machine_def.mk_fn->fn_def.fn_value, NULL, 0, NECRO_MACH_CALL_LANG, "main_state");
-            necro_mach_build_store(program, necro_init_fn, result, program->program_main->machine_def.global_state);
-        }
+        if (program->program_main != NULL && necro_mach_has_global_state(program, program->program_main))
+            necro_mach_build_state_init(program, necro_init_fn, state_region, state_index++, program->program_main);
 
         // //--------------------
         // // Call constants
@@ -2350,40 +2478,58 @@ void necro_mach_construct_main(NecroMachProgram* program)
         // Call global update functions
         for (size_t i = 0; i < program->machine_defs.length; ++i)
         {
-            if (program->machine_defs.data[i]->machine_def.state_type == NECRO_STATE_CONSTANT || program->machine_defs.data[i]->machine_def.num_arg_names != 0)
-                continue;
-            if (program->machine_defs.data[i]->machine_def.num_members > 0)
-            {
-                NecroMachAst* state  = necro_mach_build_load(program, necro_main_fn, program->machine_defs.data[i]->machine_def.global_state, "state");
-                NecroMachAst* result = necro_mach_build_call(program, necro_main_fn, program->machine_defs.data[i]->machine_def.update_fn->fn_def.fn_value, (NecroMachAst*[]) { state }, 1, NECRO_MACH_CALL_LANG, "stateful_result");
-                necro_mach_build_store(program, necro_main_fn, result, program->machine_defs.data[i]->machine_def.global_value);
-            }
-            else
-            {
-                NecroMachAst* result = necro_mach_build_call(program, necro_main_fn, program->machine_defs.data[i]->machine_def.update_fn->fn_def.fn_value, NULL, 0, NECRO_MACH_CALL_LANG, "pointwise_result");
-                necro_mach_build_store(program, necro_main_fn, result, program->machine_defs.data[i]->machine_def.global_value);
-            }
+            if (necro_mach_is_global_update(program->machine_defs.data[i]))
+                necro_mach_build_global_update(program, necro_main_fn, program->machine_defs.data[i]);
         }
 
         //--------------------
         // Call main update function
-        if (program->program_main != NULL)
+        necro_mach_build_program_main_update(program, necro_main_fn);
+        necro_mach_build_return(program, necro_main_fn, necro_mach_value_create_word_int(program, 0));
+    }
+
+    //--------------------
+    // Main tasks
+    //--------------------
+    {
+        //--------------------
+        // One task per global update, in the same order as necro_main
+        size_t num_tasks = 0;
+        for (size_t i = 0; i < program->machine_defs.length; ++i)
         {
-            // NOTE: Main is of type World -> World, which translates to fn main(u64) -> u64
-            NecroMachAst* world_value = necro_mach_value_create_word_uint(program, 0);
-            if (program->program_main->machine_def.num_members > 0)
-            {
-                NecroMachAst* state  = necro_mach_build_load(program, necro_main_fn, program->program_main->machine_def.global_state, "state");
-                NecroMachAst* result = necro_mach_build_call(program, necro_main_fn, program->program_main->machine_def.update_fn->fn_def.fn_value, (NecroMachAst*[]) { state, world_value }, 2, NECRO_MACH_CALL_LANG, "main_result");
-                UNUSED(result);
-            }
-            else
-            {
-                NecroMachAst* result = necro_mach_build_call(program, necro_main_fn, program->program_main->machine_def.update_fn->fn_def.fn_value, (NecroMachAst*[]) { world_value }, 1, NECRO_MACH_CALL_LANG, "main_result");
-                UNUSED(result);
-            }
+            if (necro_mach_is_global_update(program->machine_defs.data[i]))
+                num_tasks++;
         }
-        necro_mach_build_return(program, necro_main_fn, necro_mach_value_create_word_int(program, 0));
+        program->main_tasks     = necro_paged_arena_alloc(&program->arena, (num_tasks > 0 ? num_tasks : 1) * sizeof(NecroMachMainTask));
+        program->num_main_tasks = 0;
+        for (size_t i = 0; i < program->machine_defs.length; ++i)
+        {
+            if (!necro_mach_is_global_update(program->machine_defs.data[i]))
+                continue;
+            NecroMachAstSymbol* task_symbol = necro_mach_ast_symbol_gen(program, NULL, necro_snapshot_arena_concat_strings(&program->snapshot_arena, 2, (const char* []) { "necro_main_task_", program->machine_defs.data[i]->machine_def.machine_name->name->str }), NECRO_MANGLE_NAME);
+            NecroMachType*      task_type   = necro_mach_type_create_fn(&program->arena, program->type_cache.word_int_type, NULL, 0);
+            NecroMachAst*       task_entry  = necro_mach_block_create(program, "entry", NULL);
+            NecroMachAst*       task_fn     = necro_mach_create_fn(program, task_symbol, task_entry, task_type);
+            assert(program->functions.length > 0);
+            program->functions.length--; // Hack...
+            necro_mach_build_global_update(program, task_fn, program->machine_defs.data[i]);
+            necro_mach_build_return(program, task_fn, necro_mach_value_create_word_int(program, 0));
+            program->main_tasks[program->num_main_tasks++] = (NecroMachMainTask) { .fn = task_fn, .dependencies = NULL, .num_dependencies = 0 };
+        }
+
+        //--------------------
+        // necro_main_tail
+        NecroMachAstSymbol* necro_main_tail_symbol = necro_mach_ast_symbol_gen(program, NULL, "necro_main_tail", NECRO_DONT_MANGLE);
+        NecroMachType*      necro_main_tail_type   = necro_mach_type_create_fn(&program->arena, program->type_cache.word_int_type, NULL, 0);
+        NecroMachAst*       necro_main_tail_entry  = necro_mach_block_create(program, "entry", NULL);
+        NecroMachAst*       necro_main_tail_fn     = necro_mach_create_fn(program, necro_main_tail_symbol, necro_main_tail_entry, necro_main_tail_type);
+        program->necro_main_tail                   = necro_main_tail_fn;
+        assert(program->functions.length > 0);
+        program->functions.length--; // Hack...
+        necro_mach_build_program_main_update(program, necro_main_tail_fn);
+        necro_mach_build_return(program, necro_main_tail_fn, necro_mach_value_create_word_int(program, 0));
+
+        necro_mach_schedule_main_tasks(program);
     }
 
 
@@ -2398,14 +2544,11 @@ void necro_mach_construct_main(NecroMachProgram* program)
         program->necro_shutdown                   = necro_shutdown_fn;
         assert(program->functions.length > 0);
         program->functions.length--; // Hack...
-        // Entry
-        for (size_t i = 0; i < program->machine_defs.length; ++i)
+        // Destroy states
+        if (state_region_global != NULL)
         {
-            if (program->machine_defs.data[i]->machine_def.global_state == NULL)
-                continue;
-            // Destroy state
-            NecroMachAst* state    = necro_mach_build_load(program, necro_shutdown_fn, program->machine_defs.data[i]->machine_def.global_state, "state");
-            NecroMachAst* data_ptr = necro_mach_build_bit_cast(program, necro_shutdown_fn, state, necro_mach_type_create_ptr(&program->arena, program->type_cache.uint8_type));
+            NecroMachAst* state_region = necro_mach_build_load(program, necro_shutdown_fn, state_region_global, "state_region");
+            NecroMachAst* data_ptr     = necro_mach_build_bit_cast(program, necro_shutdown_fn, state_region, necro_mach_type_create_ptr(&program->arena, program->type_cache.uint8_type));
             necro_mach_build_call(program, necro_shutdown_fn, program->runtime.necro_runtime_free->ast->fn_def.fn_value, (NecroMachAst* []) { data_ptr }, 1, NECRO_MACH_CALL_C, "");
         }
         necro_mach_build_return(program, necro_shutdown_fn, necro_mach_value_create_word_int(program, 0));
@@ -2413,6 +2556,287 @@ void necro_mach_construct_main(NecroMachProgram* program)
 
 }
 
+///////////////////////////////////////////////////////
+// Frame allocations
+//     * ptrMalloc allocates from the heap, which only gets the memory back if the program calls ptrFree.
+//       Allocations which provably never outlive the fn making them are moved to the runtime's frame arena instead,
+//       which is reset after every block (see necro_runtime_frame_alloc).
+//     * An allocation escapes unless every use of its pointer, and of every pointer derived from it with bit casts and geps,
+//       is the address of a load or store, or the argument of ptrFree (which ignores frame memory).
+//       Anything else, storing it as a value, returning it, passing it to a call, merging it in a phi or select, reallocating it,
+//       could let it outlive the fn.
+//     * Pointers are also followed through aggregates: inserting one into an aggregate tracks that field of the result,
+//       and extracting the field again gives back a pointer. This is what lets unsafePtrPeekU's (#a, Ptr a#) result through.
+//       The aggregate itself escapes its allocs on the same uses as a pointer does.
+///////////////////////////////////////////////////////
+#define NECRO_MACH_FRAME_PTR_SELF SIZE_MAX
+
+typedef struct NecroMachFramePtr
+{
+    NecroMachAstSymbol* reg_symbol;
+    size_t              alloc_index;
+    size_t              field_index; // NECRO_MACH_FRAME_PTR_SELF if the register is the pointer, else the aggregate field holding it
+} NecroMachFramePtr;
+
+typedef struct NecroMachFrameAllocs
+{
+    NecroPagedArena*   arena;
+    NecroMachAst**     allocs;      // necro_runtime_alloc calls in the fn
+    bool*              is_escaping;
+    size_t             num_allocs;
+    NecroMachFramePtr* ptrs;        // Registers pointing into one of the allocs, or holding such a pointer in a field
+    size_t             num_ptrs;
+    size_t             capacity;
+} NecroMachFrameAllocs;
+
+static bool necro_mach_is_runtime_call(NecroMachAst* ast, NecroMachAstSymbol* runtime_symbol)
+{
+    return ast->type == NECRO_MACH_CALL
+        && ast->call.fn_value->type == NECRO_MACH_VALUE
+        && ast->call.fn_value->value.value_type == NECRO_MACH_VALUE_GLOBAL
+        && ast->call.fn_value->value.global_symbol == runtime_symbol;
+}
+
+static NecroMachAstSymbol* necro_mach_frame_reg_symbol(NecroMachAst* value)
+{
+    if (value == NULL || value->type != NECRO_MACH_VALUE || value->value.value_type != NECRO_MACH_VALUE_REG)
+        return NULL;
+    return value->value.reg_symbol;
+}
+
+// Adds reg_symbol -> (alloc_index, field_index), returns false if it was already there
+static bool necro_mach_frame_ptr_add(NecroMachFrameAllocs* frame_allocs, NecroMachAstSymbol* reg_symbol, size_t alloc_index, size_t field_index)
+{
+    for (size_t i = 0; i < frame_allocs->num_ptrs; ++i)
+    {
+        NecroMachFramePtr* ptr = frame_allocs->ptrs + i;
+        if (ptr->reg_symbol == reg_symbol && ptr->alloc_index == alloc_index && ptr->field_index == field_index)
+            return false;
+    }
+    if (frame_allocs->num_ptrs == frame_allocs->capacity)
+    {
+        NecroMachFramePtr* ptrs = necro_paged_arena_alloc(frame_allocs->arena, frame_allocs->capacity * 2 * sizeof(NecroMachFramePtr));
+        memcpy(ptrs, frame_allocs->ptrs, frame_allocs->num_ptrs * sizeof(NecroMachFramePtr));
+        frame_allocs->ptrs      = ptrs;
+        frame_allocs->capacity *= 2;
+    }
+    frame_allocs->ptrs[frame_allocs->num_ptrs++] = (NecroMachFramePtr) { .reg_symbol = reg_symbol, .alloc_index = alloc_index, .field_index = field_index };
+    return true;
+}
+
+// dest_value = source_value, or a bit cast or gep of it
+static bool necro_mach_frame_ptr_derive(NecroMachFrameAllocs* frame_allocs, NecroMachAst* source_value, NecroMachAst* dest_value)
+{
+    NecroMachAstSymbol* source_symbol = necro_mach_frame_reg_symbol(source_value);
+    NecroMachAstSymbol* dest_symbol   = necro_mach_frame_reg_symbol(dest_value);
+    if (source_symbol == NULL || dest_symbol == NULL)
+        return false;
+    bool is_changed = false;
+    for (size_t i = 0; i < frame_allocs->num_ptrs; ++i)
+    {
+        if (frame_allocs->ptrs[i].reg_symbol == source_symbol && frame_allocs->ptrs[i].field_index == NECRO_MACH_FRAME_PTR_SELF)
+            is_changed |= necro_mach_frame_ptr_add(frame_allocs, dest_symbol, frame_allocs->ptrs[i].alloc_index, NECRO_MACH_FRAME_PTR_SELF);
+    }
+    return is_changed;
+}
+
+// dest_value = insert aggregate_value, inserted_value, index
+static bool necro_mach_frame_ptr_derive_insert(NecroMachFrameAllocs* frame_allocs, NecroMachAst* ast)
+{
+    NecroMachAstSymbol* aggregate_symbol = necro_mach_frame_reg_symbol(ast->insert_value.aggregate_value);
+    NecroMachAstSymbol* inserted_symbol  = necro_mach_frame_reg_symbol(ast->insert_value.inserted_value);
+    NecroMachAstSymbol* dest_symbol      = necro_mach_frame_reg_symbol(ast->insert_value.dest_value);
+    if (dest_symbol == NULL)
+        return false;
+    bool is_changed = false;
+    for (size_t i = 0; i < frame_allocs->num_ptrs; ++i)
+    {
+        const NecroMachFramePtr ptr = frame_allocs->ptrs[i];
+        if (inserted_symbol != NULL && ptr.reg_symbol == inserted_symbol && ptr.field_index == NECRO_MACH_FRAME_PTR_SELF)
+            is_changed |= necro_mach_frame_ptr_add(frame_allocs, dest_symbol, ptr.alloc_index, ast->insert_value.index);
+        else if (inserted_symbol != NULL && ptr.reg_symbol == inserted_symbol)
+            is_changed |= necro_mach_frame_ptr_add(frame_allocs, dest_symbol, ptr.alloc_index, NECRO_MACH_FRAME_PTR_SELF); // Nested aggregates aren't followed, treat the whole thing as the pointer
+        if (aggregate_symbol != NULL && ptr.reg_symbol == aggregate_symbol && ptr.field_index != ast->insert_value.index)
+            is_changed |= necro_mach_frame_ptr_add(frame_allocs, dest_symbol, ptr.alloc_index, ptr.field_index);
+    }
+    return is_changed;
+}
+
+// dest_value = extract aggregate_value, index
+static bool necro_mach_frame_ptr_derive_extract(NecroMachFrameAllocs* frame_allocs, NecroMachAst* ast)
+{
+    NecroMachAstSymbol* aggregate_symbol = necro_mach_frame_reg_symbol(ast->extract_value.aggregate_value);
+    NecroMachAstSymbol* dest_symbol      = necro_mach_frame_reg_symbol(ast->extract_value.dest_value);
+    if (aggregate_symbol == NULL || dest_symbol == NULL)
+        return false;
+    bool is_changed = false;
+    for (size_t i = 0; i < frame_allocs->num_ptrs; ++i)
+    {
+        const NecroMachFramePtr ptr = frame_allocs->ptrs[i];
+        if (ptr.reg_symbol == aggregate_symbol && (ptr.field_index == ast->extract_value.index || ptr.field_index == NECRO_MACH_FRAME_PTR_SELF))
+            is_changed |= necro_mach_frame_ptr_add(frame_allocs, dest_symbol, ptr.alloc_index, NECRO_MACH_FRAME_PTR_SELF);
+    }
+    return is_changed;
+}
+
+static void necro_mach_frame_ptr_escape(NecroMachFrameAllocs* frame_allocs, NecroMachAst* value)
+{
+    NecroMachAstSymbol* symbol = necro_mach_frame_reg_symbol(value);
+    if (symbol == NULL)
+        return;
+    for (size_t i = 0; i < frame_allocs->num_ptrs; ++i)
+    {
+        if (frame_allocs->ptrs[i].reg_symbol == symbol)
+            frame_allocs->is_escaping[frame_allocs->ptrs[i].alloc_index] = true;
+    }
+}
+
+static void necro_mach_frame_escape_statement(NecroMachProgram* program, NecroMachFrameAllocs* frame_allocs, NecroMachAst* ast)
+{
+    switch (ast->type)
+    {
+    case NECRO_MACH_CALL:
+        if (necro_mach_is_runtime_call(ast, program->runtime.necro_runtime_free))
+            return;
+        for (size_t i = 0; i < ast->call.num_parameters; ++i)
+            necro_mach_frame_ptr_escape(frame_allocs, ast->call.parameters[i]);
+        return;
+    case NECRO_MACH_CALLI:
+        for (size_t i = 0; i < ast->call_intrinsic.num_parameters; ++i)
+            necro_mach_frame_ptr_escape(frame_allocs, ast->call_intrinsic.parameters[i]);
+        return;
+    case NECRO_MACH_STORE:
+        necro_mach_frame_ptr_escape(frame_allocs, ast->store.source_value);
+        return;
+    case NECRO_MACH_ZEXT:
+        necro_mach_frame_ptr_escape(frame_allocs, ast->zext.from_value);
+        return;
+    case NECRO_MACH_UOP:
+        necro_mach_frame_ptr_escape(frame_allocs, ast->uop.param);
+        return;
+    case NECRO_MACH_BINOP:
+        necro_mach_frame_ptr_escape(frame_allocs, ast->binop.left);
+        necro_mach_frame_ptr_escape(frame_allocs, ast->binop.right);
+        return;
+    case NECRO_MACH_CMP:
+        necro_mach_frame_ptr_escape(frame_allocs, ast->cmp.left);
+        necro_mach_frame_ptr_escape(frame_allocs, ast->cmp.right);
+        return;
+    case NECRO_MACH_SELECT:
+        necro_mach_frame_ptr_escape(frame_allocs, ast->select.left);
+        necro_mach_frame_ptr_escape(frame_allocs, ast->select.right);
+        return;
+    case NECRO_MACH_PHI:
+        for (NecroMachPhiList* values = ast->phi.values; values != NULL; values = values->next)
+            necro_mach_frame_ptr_escape(frame_allocs, values->data.value);
+        return;
+    default:
+        // Loads and stores through the pointer, bit casts and geps of it, inserts and extracts (all tracked as derived values)
+        return;
+    }
+}
+
+static void necro_mach_frame_allocs_fn(NecroMachProgram* program, NecroPagedArena* arena, NecroMachAst* fn_def)
+{
+    if (fn_def->fn_def.fn_type != NECRO_MACH_FN_FN)
+        return;
+    size_t num_statements = 0;
+    size_t num_allocs     = 0;
+    for (NecroMachAst* block = fn_def->fn_def.call_body; block != NULL; block = block->block.next_block)
+    {
+        num_statements += block->block.num_statements;
+        for (size_t i = 0; i < block->block.num_statements; ++i)
+            num_allocs += necro_mach_is_runtime_call(block->block.statements[i], program->runtime.necro_runtime_alloc);
+    }
+    if (num_allocs == 0)
+        return;
+
+    //--------------------
+    // Collect allocs, then every value derived from them. Blocks aren't in dominance order, so repeat until nothing new turns up
+    NecroMachFrameAllocs frame_allocs =
+    {
+        .arena       = arena,
+        .allocs      = necro_paged_arena_alloc(arena, num_allocs * sizeof(NecroMachAst*)),
+        .is_escaping = necro_paged_arena_alloc(arena, num_allocs * sizeof(bool)),
+        .num_allocs  = 0,
+        .ptrs        = necro_paged_arena_alloc(arena, num_statements * sizeof(NecroMachFramePtr)),
+        .num_ptrs    = 0,
+        .capacity    = num_statements,
+    };
+    for (NecroMachAst* block = fn_def->fn_def.call_body; block != NULL; block = block->block.next_block)
+    {
+        for (size_t i = 0; i < block->block.num_statements; ++i)
+        {
+            NecroMachAst* statement = block->block.statements[i];
+            if (!necro_mach_is_runtime_call(statement, program->runtime.necro_runtime_alloc) || necro_mach_frame_reg_symbol(statement->call.result_reg) == NULL)
+                continue;
+            necro_mach_frame_ptr_add(&frame_allocs, statement->call.result_reg->value.reg_symbol, frame_allocs.num_allocs, NECRO_MACH_FRAME_PTR_SELF);
+            frame_allocs.is_escaping[frame_allocs.num_allocs] = false;
+            frame_allocs.allocs[frame_allocs.num_allocs++]    = statement;
+        }
+    }
+    bool is_changed = true;
+    while (is_changed)
+    {
+        is_changed = false;
+        for (NecroMachAst* block = fn_def->fn_def.call_body; block != NULL; block = block->block.next_block)
+        {
+            for (size_t i = 0; i < block->block.num_statements; ++i)
+            {
+                NecroMachAst* statement = block->block.statements[i];
+                if (statement->type == NECRO_MACH_BIT_CAST)
+                    is_changed |= necro_mach_frame_ptr_derive(&frame_allocs, statement->bit_cast.from_value, statement->bit_cast.to_value);
+                else if (statement->type == NECRO_MACH_GEP)
+                    is_changed |= necro_mach_frame_ptr_derive(&frame_allocs, statement->gep.source_value, statement->gep.dest_value);
+                else if (statement->type == NECRO_MACH_INSERT_VALUE)
+                    is_changed |= necro_mach_frame_ptr_derive_insert(&frame_allocs, statement);
+                else if (statement->type == NECRO_MACH_EXTRACT_VALUE)
+                    is_changed |= necro_mach_frame_ptr_derive_extract(&frame_allocs, statement);
+            }
+        }
+    }
+
+    //--------------------
+    // Escapes
+    for (NecroMachAst* block = fn_def->fn_def.call_body; block != NULL; block = block->block.next_block)
+    {
+        for (size_t i = 0; i < block->block.num_statements; ++i)
+            necro_mach_frame_escape_statement(program, &frame_allocs, block->block.statements[i]);
+        NecroMachTerminator* terminator = block->block.terminator;
+        if (terminator == NULL)
+            continue;
+        if (terminator->type == NECRO_MACH_TERM_RETURN)
+            necro_mach_frame_ptr_escape(&frame_allocs, terminator->return_terminator.return_value);
+        else if (terminator->type == NECRO_MACH_TERM_COND_BREAK)
+            necro_mach_frame_ptr_escape(&frame_allocs, terminator->cond_break_terminator.cond_value);
+        else if (terminator->type == NECRO_MACH_TERM_SWITCH)
+            necro_mach_frame_ptr_escape(&frame_allocs, terminator->switch_terminator.choice_val);
+    }
+
+    //--------------------
+    // Retarget the rest at the frame arena, the signatures are identical
+    for (size_t i = 0; i < frame_allocs.num_allocs; ++i)
+    {
+        if (!frame_allocs.is_escaping[i])
+            frame_allocs.allocs[i]->call.fn_value = program->runtime.necro_runtime_frame_alloc->ast->fn_def.fn_value;
+    }
+}
+
+static void necro_mach_frame_allocs(NecroMachProgram* program)
+{
+    NecroPagedArena arena = necro_paged_arena_create();
+    for (size_t i = 0; i < program->functions.length; ++i)
+        necro_mach_frame_allocs_fn(program, &arena, program->functions.data[i]);
+    for (size_t i = 0; i < program->machine_defs.length; ++i)
+    {
+        // Update fns belong to their machine rather than the functions list
+        NecroMachAst* update_fn = program->machine_defs.data[i]->machine_def.update_fn;
+        if (update_fn != NULL)
+            necro_mach_frame_allocs_fn(program, &arena, update_fn);
+    }
+    necro_paged_arena_destroy(&arena);
+}
+
 ///////////////////////////////////////////////////////
 // Transform Core to Mach
 ///////////////////////////////////////////////////////
@@ -2453,6 +2877,10 @@ void necro_core_transform_to_mach(NecroCompileInfo info, NecroIntern* intern, Ne
     if (top != NULL)
         necro_core_transform_to_mach_3_go(program, top, NULL);
 
+    //---------------
+    // Frame allocations
+    necro_mach_frame_allocs(program);
+
     //---------------
     // Construct main
     necro_mach_construct_main(program);
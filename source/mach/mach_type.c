@@ -1413,4 +1413,10 @@ void necro_mach_program_verify(NecroMachProgram* program)
     }
     // main
     necro_mach_ast_type_check(program, program->necro_main);
+    for (size_t i = 0; i < program->num_main_tasks; ++i)
+    {
+        necro_mach_ast_type_check(program, program->main_tasks[i].fn);
+    }
+    if (program->necro_main_tail != NULL)
+        necro_mach_ast_type_check(program, program->necro_main_tail);
 }
@@ -11,6 +11,7 @@
 #include "parse/parse_test.h"
 #include "intern.h"
 #include "runtime.h"
+#include "runtime_resample.h"
 #include "symtable.h"
 #include "ast.h"
 #include "base.h"
@@ -339,6 +340,14 @@ void necro_test(NECRO_TEST test)
     case NECRO_TEST_LLVM:                 necro_llvm_test();                  break;
     case NECRO_TEST_JIT:                  necro_llvm_test_jit();              break;
     case NECRO_TEST_COMPILE:              necro_llvm_test_compile();          break;
+    case NECRO_TEST_DOWNSAMPLE:           necro_downsample_test();            break;
+    case NECRO_TEST_RENDER:               necro_llvm_test_render();           break;
+    case NECRO_TEST_HEAP:                 necro_heap_test();                  break;
+    case NECRO_TEST_RESAMPLE:             necro_resample_test();              break;
+    case NECRO_TEST_AUDIO_STREAM:         necro_audio_stream_test();          break;
+    case NECRO_TEST_AUDIO_RECORDER:       necro_audio_recorder_test();        break;
+    case NECRO_TEST_SCHEDULER:            necro_scheduler_test();             break;
+    case NECRO_TEST_RUNTIME_OPTIONS:      necro_runtime_options_test();       break;
     case NECRO_TEST_ALL:
         necro_test_unicode_properties();
         necro_intern_test();
@@ -355,7 +364,15 @@ void necro_test(NECRO_TEST test)
         necro_core_defunctionalize_test();
         necro_state_analysis_test();
         necro_mach_test();
+        necro_downsample_test();
+        necro_heap_test();
+        necro_resample_test();
+        necro_audio_stream_test();
+        necro_audio_recorder_test();
+        necro_scheduler_test();
+        necro_runtime_options_test();
         necro_llvm_test();
+        necro_llvm_test_render();
         break;
     default:
         break;
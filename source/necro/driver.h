@@ -33,6 +33,14 @@ typedef enum
     NECRO_TEST_ARENA_CHAIN_TABLE,
     NECRO_TEST_UNICODE,
     NECRO_TEST_BASE,
+    NECRO_TEST_DOWNSAMPLE,
+    NECRO_TEST_RENDER,
+    NECRO_TEST_HEAP,
+    NECRO_TEST_RESAMPLE,
+    NECRO_TEST_AUDIO_STREAM,
+    NECRO_TEST_AUDIO_RECORDER,
+    NECRO_TEST_SCHEDULER,
+    NECRO_TEST_RUNTIME_OPTIONS,
 } NECRO_TEST;
 
 typedef enum
@@ -10,6 +10,102 @@
 #include "necro.h"
 #include "unicode_properties.h"
 #include "base.h"
+#include "runtime.h"
+
+//=====================================================
+// Runtime Options
+//=====================================================
+// Pulls runtime options out of argv so that the remaining arguments can be handled as usual.
+// Returns the new argc.
+int32_t necro_parse_runtime_options(int32_t argc, char** argv)
+{
+    int32_t out_argc = 0;
+    for (int32_t i = 0; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-render") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.render_file_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "-seconds") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.seconds = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "-device") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.audio_device_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "-midi-latency") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.midi_latency_ms = strtod(argv[++i], NULL);
+        }
+        else if (strcmp(argv[i], "-file-format") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.audio_file_format = argv[++i];
+        }
+        else if (strcmp(argv[i], "-oversample") == 0 && i + 1 < argc)
+        {
+            const long oversample            = strtol(argv[++i], NULL, 10);
+            necro_runtime_options.oversample = oversample < 1 ? 1 : (oversample > 16 ? 16 : (size_t) oversample);
+        }
+        else if (strcmp(argv[i], "-sample-rate") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.sample_rate = (size_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-block-size") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.block_size = (size_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-channels") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.num_output_channels = (size_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-input-channels") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.num_input_channels = (size_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-rt-priority") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.rt_priority = (size_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-rt-cpu") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.rt_cpu = (int64_t) strtoll(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-workers") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.num_workers = (size_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-lock-memory") == 0)
+        {
+            necro_runtime_options.is_memory_locked = true;
+        }
+        else if (strcmp(argv[i], "-heap-mb") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.heap_size_mb = (size_t) strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "-huge-pages") == 0)
+        {
+            necro_runtime_options.is_heap_huge_pages = true;
+        }
+        else if (strcmp(argv[i], "-alloc-audit") == 0)
+        {
+            necro_runtime_options.is_alloc_audit = true;
+        }
+        else if (strcmp(argv[i], "-stats") == 0 && i + 1 < argc)
+        {
+            necro_runtime_options.stats_name = argv[++i];
+        }
+        else if (strcmp(argv[i], "-no-stats") == 0)
+        {
+            necro_runtime_options.stats_name = NULL;
+        }
+        else
+        {
+            argv[out_argc++] = argv[i];
+        }
+    }
+    return out_argc;
+}
 
 //=====================================================
 // Main
@@ -19,6 +115,9 @@ int main(int32_t argc, char** argv)
     ENABLE_AUTO_MEM_CHECK();
 
     necro_base_global_init();
+    argc = necro_parse_runtime_options(argc, argv);
+    if (!necro_runtime_options_validate())
+        necro_exit(1);
     if (argc == 3 && strcmp(argv[2], "-unicode_p") == 0)
     {
         necro_unicode_property_parse(argv[1]);
@@ -113,6 +212,38 @@ int main(int32_t argc, char** argv)
         {
             necro_test(NECRO_TEST_COMPILE);
         }
+        else if (strcmp(argv[2], "downsample") == 0)
+        {
+            necro_test(NECRO_TEST_DOWNSAMPLE);
+        }
+        else if (strcmp(argv[2], "render") == 0)
+        {
+            necro_test(NECRO_TEST_RENDER);
+        }
+        else if (strcmp(argv[2], "heap") == 0)
+        {
+            necro_test(NECRO_TEST_HEAP);
+        }
+        else if (strcmp(argv[2], "resample") == 0)
+        {
+            necro_test(NECRO_TEST_RESAMPLE);
+        }
+        else if (strcmp(argv[2], "stream") == 0)
+        {
+            necro_test(NECRO_TEST_AUDIO_STREAM);
+        }
+        else if (strcmp(argv[2], "recorder") == 0)
+        {
+            necro_test(NECRO_TEST_AUDIO_RECORDER);
+        }
+        else if (strcmp(argv[2], "scheduler") == 0)
+        {
+            necro_test(NECRO_TEST_SCHEDULER);
+        }
+        else if (strcmp(argv[2], "options") == 0)
+        {
+            necro_test(NECRO_TEST_RUNTIME_OPTIONS);
+        }
     }
     else if (argc == 2 || argc == 3 || argc == 4)
     {
@@ -220,6 +351,10 @@ int main(int32_t argc, char** argv)
             else
                 necro_compile(file_name, str, length, NECRO_PHASE_COMPILE, NECRO_OPT_OFF);
         }
+        else if (necro_runtime_options.render_file_name != NULL)
+        {
+            necro_compile(file_name, str, length, NECRO_PHASE_JIT, NECRO_OPT_ON);
+        }
         else
         {
             necro_compile(file_name, str, length, NECRO_PHASE_TRANSFORM_TO_CORE, NECRO_OPT_OFF);
@@ -231,6 +366,18 @@ int main(int32_t argc, char** argv)
     else
     {
         fprintf(stderr, "Incorrect necro usage. Should be: necro filename\n");
+        fprintf(stderr, "    or, to render offline: necro filename -render out.wav -seconds N\n");
+        fprintf(stderr, "    or, to pick an audio device (portaudio, null): necro filename -jit -device name [-seconds N]\n");
+        fprintf(stderr, "    -file-format (float32, int24) sets the sample format of rendered and recorded audio files\n");
+        fprintf(stderr, "    -oversample N (1 - 16) runs the program at N times the device sample rate, decimating its output back down\n");
+        fprintf(stderr, "    -sample-rate N, -block-size N (a power of 2, at least 32) and -channels N configure the audio device, defaults are 48000, 256 and 2\n");
+        fprintf(stderr, "    -input-channels N opens N device input channels for inAudioBlock, default is 0\n");
+        fprintf(stderr, "    -rt-priority N (1 - 99) runs the audio callback thread with SCHED_FIFO priority N, -rt-cpu N pins it to cpu N\n");
+        fprintf(stderr, "    -workers N updates independent global machines on N extra threads alongside the audio thread, default is 0\n");
+        fprintf(stderr, "    -lock-memory locks the engine's memory into RAM and prefaults it, so the audio thread never page faults\n");
+        fprintf(stderr, "    -heap-mb N caps the heap at N mb (%d - %d), default is 4096. Memory is only committed as it is used, -huge-pages backs it with transparent huge pages\n", NECRO_HEAP_MIN_SIZE_MB, NECRO_HEAP_MAX_SIZE_MB);
+        fprintf(stderr, "    -alloc-audit counts heap allocations per machine, inside and outside of audio blocks, and reports them on shutdown\n");
+        fprintf(stderr, "    -stats name publishes live engine stats to the shared memory segment name (off by default, read them with necro_stats name). Fails if another engine already uses the name\n");
     }
     necro_base_global_cleanup();
 
@@ -20,9 +20,15 @@
 #endif
 
 #include <math.h>
-#include "portaudio.h"
 #include "portmidi.h"
 #include "runtime.h"
+#include "runtime_channel.h"
+#include "runtime_device.h"
+#include "runtime_file.h"
+#include "runtime_log.h"
+#include "runtime_stats.h"
+#include "runtime_telemetry.h"
+#include "runtime_thread.h"
 #include "utility.h"
 
 
@@ -37,28 +43,77 @@ typedef enum
     NECRO_RUNTIME_SHUTDOWN      = 4
 } NECRO_RUNTIME_STATE;
 
-NECRO_RUNTIME_STATE necro_runtime_state = NECRO_RUNTIME_UNINITIALIZED;
-int                 mouse_x             = 0;
-int                 mouse_y             = 0;
-uint32_t            key_press           = 0;
-bool                is_test_true        = true;
+volatile size_t     necro_runtime_state   = NECRO_RUNTIME_UNINITIALIZED; // A NECRO_RUNTIME_STATE. The input thread, the RT thread and the NRT loop can all finish the run, see necro_runtime_finish
+NecroRuntimeOptions necro_runtime_options = { .audio_device_name = "portaudio", .render_file_name = NULL, .seconds = 0.0, .midi_latency_ms = 0.0, .audio_file_format = "float32", .oversample = 1, .sample_rate = 48000, .block_size = 256, .num_output_channels = 2, .num_input_channels = 0, .rt_priority = 0, .rt_cpu = -1, .num_workers = 0, .is_memory_locked = false, .heap_size_mb = 4096, .is_heap_huge_pages = false, .is_alloc_audit = false, .stats_name = NULL };
+bool                is_test_true          = true;
+
+///////////////////////////////////////////////////////
+// Controls
+//     * User input is gathered into necro_runtime_nrt_controls by a single producer thread
+//       (the NRT loop on Windows, a dedicated X11 input thread on Unix), then published to the RT thread through a snapshot channel.
+//     * Each change is stamped with necro_time_ns() as it is published, so the RT thread can tell how stale the input it picks up is.
+//     * The RT thread picks up the latest snapshot once per block, before running necro_main,
+//       so input is stable for the whole block and JIT code never reads memory the NRT thread is writing.
+//     * New runtime inputs should be added as fields here. Fields are word sized to suit the channel.
+///////////////////////////////////////////////////////
+typedef struct NecroRuntimeControls
+{
+    size_t mouse_x;
+    size_t mouse_y;
+    size_t key_press;
+    size_t event_time_ns; // When any of the above last changed
+} NecroRuntimeControls;
+
+static NecroRuntimeControls necro_runtime_nrt_controls        = { 0 };
+static NecroRuntimeControls necro_runtime_nrt_published       = { 0 };
+static NecroRuntimeControls necro_runtime_rt_controls         = { 0 };
+static size_t               necro_runtime_rt_controls_sequence = 0;
+static NecroSnapshotChannel necro_runtime_controls_channel;
+
+static void necro_runtime_controls_init()
+{
+    necro_runtime_nrt_controls         = (NecroRuntimeControls) { 0 };
+    necro_runtime_nrt_published        = (NecroRuntimeControls) { 0 };
+    necro_runtime_rt_controls          = (NecroRuntimeControls) { 0 };
+    necro_runtime_rt_controls_sequence = 0;
+    necro_snapshot_channel_init(&necro_runtime_controls_channel);
+}
+
+// Input thread, after gathering input
+static void necro_runtime_controls_publish()
+{
+    if (memcmp(&necro_runtime_nrt_controls, &necro_runtime_nrt_published, sizeof(NecroRuntimeControls)) == 0)
+        return;
+    necro_runtime_nrt_controls.event_time_ns = (size_t) necro_time_ns();
+    necro_snapshot_channel_write(&necro_runtime_controls_channel, &necro_runtime_nrt_controls, sizeof(NecroRuntimeControls));
+    necro_runtime_nrt_published = necro_runtime_nrt_controls;
+}
+
+// RT thread, once per block. Returns how long ago a newly picked up change happened, 0 if nothing changed
+static uint64_t necro_runtime_controls_rt_update()
+{
+    if (!necro_snapshot_channel_try_read(&necro_runtime_controls_channel, &necro_runtime_rt_controls, sizeof(NecroRuntimeControls), &necro_runtime_rt_controls_sequence))
+        return 0;
+    const uint64_t now_ns = necro_time_ns();
+    return now_ns > necro_runtime_rt_controls.event_time_ns ? now_ns - necro_runtime_rt_controls.event_time_ns : 1;
+}
 
 extern DLLEXPORT int necro_runtime_get_mouse_x(size_t _dummy)
 {
     UNUSED(_dummy);
-    return mouse_x;
+    return (int) necro_runtime_rt_controls.mouse_x;
 }
 
 extern DLLEXPORT int necro_runtime_get_mouse_y(size_t _dummy)
 {
     UNUSED(_dummy);
-    return mouse_y;
+    return (int) necro_runtime_rt_controls.mouse_y;
 }
 
 extern DLLEXPORT uint32_t necro_runtime_get_key_press(size_t _dummy)
 {
     UNUSED(_dummy);
-    return key_press;
+    return (uint32_t) necro_runtime_rt_controls.key_press;
 }
 
 // extern DLLEXPORT void necro_runtime_print(int value)
@@ -71,58 +126,58 @@ extern DLLEXPORT uint32_t necro_runtime_get_key_press(size_t _dummy)
 //     printf("debug: %d", value);
 // }
 
+/*
+    Printing:
+        * trace, print and friends usually run on the RT thread, where stdio's locks and terminal writes cause xruns.
+        * So the print primitives only push their raw values into the log ring (see runtime_log.h),
+          the NRT loop formats and writes them out every time it wakes up.
+*/
 extern DLLEXPORT size_t necro_runtime_print_i32(int32_t value, size_t world)
 {
-    printf("%d", value);
+    necro_log_push_i64((int64_t) value);
     return world;
 }
 
 extern DLLEXPORT size_t necro_runtime_print_i64(int64_t value, size_t world)
 {
-    printf("%" PRId64, value);
+    necro_log_push_i64(value);
     return world;
 }
 
 extern DLLEXPORT size_t necro_runtime_print_u32(uint32_t value, size_t world)
 {
-    printf("%u", value);
+    necro_log_push_u64((uint64_t) value);
     return world;
 }
 
 extern DLLEXPORT size_t necro_runtime_print_u64(uint64_t value, size_t world)
 {
-    printf("%zu", value);
+    necro_log_push_u64(value);
     return world;
 }
 
 extern DLLEXPORT size_t necro_runtime_print_f32(float value, size_t world)
 {
-    printf("%.17f", value);
+    necro_log_push_f32(value);
     return world;
 }
 
 extern DLLEXPORT size_t necro_runtime_print_f64(double value, size_t world)
 {
-    printf("%.17g", value);
+    necro_log_push_f64(value);
     return world;
 }
 
 extern DLLEXPORT size_t necro_runtime_print_char(size_t value, size_t world)
 {
-    if (value < 256)
-        putchar((int) value);
-    else
-        printf("%zu", value);
+    necro_log_push_char(value);
     return world;
 }
 
 extern DLLEXPORT size_t necro_runtime_print_string(size_t* str, size_t str_length, size_t world)
 {
-    for (size_t i = 0; i < str_length; ++i)
-    {
-        putchar((int)str[i]);
-    }
-    putchar('\n');
+    necro_log_push_text(str, str_length);
+    necro_log_push_char('\n');
     return world;
 }
 
@@ -137,6 +192,7 @@ extern DLLEXPORT void necro_runtime_sleep(uint32_t milliseconds)
 
 extern DLLEXPORT void necro_runtime_error_exit(size_t error_code)
 {
+    necro_log_drain(stdout);
     switch (error_code)
     {
     case 1:
@@ -151,6 +207,7 @@ extern DLLEXPORT void necro_runtime_error_exit(size_t error_code)
 
 extern DLLEXPORT void necro_runtime_inexhaustive_case_exit(size_t* str, size_t str_length)
 {
+    necro_log_drain(stdout);
     fprintf(stderr, "****  Error: Non-exhaustive patterns in case statement!\n");
     fprintf(stderr, "****    found in:\n");
     fprintf(stderr, "****      ");
@@ -162,12 +219,22 @@ extern DLLEXPORT void necro_runtime_inexhaustive_case_exit(size_t* str, size_t s
     necro_exit(1);
 }
 
+#define NECRO_RUNTIME_NRT_PERIOD_MS 20
+static struct NecroSemaphore* necro_runtime_nrt_wake = NULL; // Posted when the run finishes, so the NRT loop ends straight away rather than at its next period
+
+// Any thread
+static void necro_runtime_finish()
+{
+    if (necro_atomic_compare_exchange(&necro_runtime_state, NECRO_RUNTIME_RUNNING, NECRO_RUNTIME_IS_DONE) && necro_runtime_nrt_wake != NULL)
+        necro_semaphore_post(necro_runtime_nrt_wake);
+}
+
 extern DLLEXPORT size_t necro_runtime_test_assertion(size_t is_true, size_t world)
 {
-    if (necro_runtime_state != NECRO_RUNTIME_RUNNING)
+    if (necro_atomic_load(&necro_runtime_state) != NECRO_RUNTIME_RUNNING)
         return world;
-    is_test_true        = is_true;
-    necro_runtime_state = NECRO_RUNTIME_IS_DONE;
+    is_test_true = is_true;
+    necro_runtime_finish();
     return world;
 }
 
@@ -179,6 +246,7 @@ bool necro_runtime_was_test_successful()
 extern DLLEXPORT size_t necro_runtime_panic(size_t world)
 {
     UNUSED(world);
+    necro_log_drain(stdout);
     fprintf(stderr, "****panic!\n");
     if (true) // HACK: Compiler is yelling at me on windows about the return after the exit.
         necro_exit(-1);
@@ -193,73 +261,53 @@ extern DLLEXPORT size_t necro_runtime_panic(size_t world)
 // File IO
 //--------------------
 
-extern DLLEXPORT size_t necro_runtime_open_file(size_t* str, uint64_t str_length)
+// Files are buffered and written out on a background thread, see runtime_file.h
+static size_t necro_runtime_open_file_with_mode(size_t* str, uint64_t str_length, bool is_binary)
 {
-    if (str_length == 0)
-        return 0;
-
-    // Create ascii string
-    char* file_name = malloc(str_length + 1);
-    assert(file_name != NULL);
-    if (file_name == NULL)
-        return 0;
-    for (size_t i = 0; i < str_length; ++i)
-    {
-        // TODO: Unicode handling
-        file_name[i] = (char) str[i];
-    }
-    file_name[str_length] = '\0';
+    return (size_t) necro_file_writer_open(str, (size_t) str_length, is_binary);
+}
 
-    // Open File
-#ifdef WIN32
-    FILE* file;
-    fopen_s(&file, file_name, "w");
-#else
-    FILE* file = fopen(file_name, "w");
-#endif
-    if (!file)
-    {
-        return 0;
-    }
+extern DLLEXPORT size_t necro_runtime_open_file(size_t* str, uint64_t str_length)
+{
+    return necro_runtime_open_file_with_mode(str, str_length, false);
+}
 
-    // Clean up and return
-    free(file_name);
-    return (size_t)file;
+extern DLLEXPORT size_t necro_runtime_open_binary_file(size_t* str, uint64_t str_length)
+{
+    return necro_runtime_open_file_with_mode(str, str_length, true);
 }
 
 extern DLLEXPORT size_t necro_runtime_close_file(size_t file)
 {
-    fclose((FILE*)file);
+    necro_file_writer_close((struct NecroFileWriter*)file);
     return 0;
 }
 
 extern DLLEXPORT size_t necro_runtime_write_int_to_file(int64_t value, size_t file)
 {
-    char buffer[NECRO_ITOA_BUF_LENGTH];
-    snprintf(buffer, NECRO_ITOA_BUF_LENGTH, "%" PRId64, value);
-    fputs(buffer, (FILE*)file);
+    if (file != 0)
+        necro_file_writer_write_int((struct NecroFileWriter*)file, value);
     return file;
 }
 
 extern DLLEXPORT size_t necro_runtime_write_uint_to_file(uint64_t value, size_t file)
 {
-    char buffer[NECRO_ITOA_BUF_LENGTH];
-    snprintf(buffer, NECRO_ITOA_BUF_LENGTH, "%zu", value);
-    fputs(buffer, (FILE*)file);
+    if (file != 0)
+        necro_file_writer_write_uint((struct NecroFileWriter*)file, value);
     return file;
 }
 
 extern DLLEXPORT size_t necro_runtime_write_float_to_file(double value, size_t file)
 {
-    char buffer[NECRO_ITOA_BUF_LENGTH];
-    snprintf(buffer, NECRO_ITOA_BUF_LENGTH,  "%.17f", value);
-    fputs(buffer, (FILE*)file);
+    if (file != 0)
+        necro_file_writer_write_float((struct NecroFileWriter*)file, value);
     return file;
 }
 
 extern DLLEXPORT size_t necro_runtime_write_char_to_file(size_t value, size_t file)
 {
-    fputc((int)value, (FILE*)file);
+    if (file != 0)
+        necro_file_writer_write_char((struct NecroFileWriter*)file, value);
     return file;
 }
 
@@ -267,66 +315,706 @@ extern DLLEXPORT size_t necro_runtime_write_char_to_file(size_t value, size_t fi
 //--------------------
 // Memory
 //--------------------
+/*
+    NecroHeap:
+        * One big reservation of address space (necro_runtime_options.heap_size_mb), carved into NECRO_HEAP_PAGE_SIZE pages with a bump pointer.
+        * The reservation is committed NECRO_HEAP_COMMIT_CHUNK at a time as the bump pointer approaches the end of what is committed.
+          While running on a device the NRT thread keeps NECRO_HEAP_COMMIT_HEADROOM committed ahead of it (necro_heap_commit_ahead),
+          so the RT thread only commits itself if it outruns that, or asks for a span bigger than the headroom. Those commits make syscalls
+          on the RT thread, so they are counted in num_rt_commits and reported with the stats and at shutdown.
+          Startup cost and memory use follow what the program actually allocates,
+          and anything past the committed end faults instead of scribbling over other memory.
+        * Small allocations (up to NECRO_HEAP_MAX_SMALL_SIZE) are rounded up to one of NECRO_HEAP_NUM_SMALL_CLASSES size classes.
+          Each class owns whole pages, split into equal blocks, and keeps freed blocks on its own free list.
+        * Large allocations take a span of a power of two number of pages, with one free list per power of two (buddy sizes, without the merging).
+          A fresh span is never touched past the end of its allocation, so on a lazily committed heap the rounding only costs address space.
+          span_sizes keeps the size each span was last asked for, and everything past it is kept zeroed (realloc clears the tail when shrinking).
+          So reusing a span clears only what its last owner could have written, never the whole rounded up span, on the RT thread.
+        * page_classes records which class owns each page, or starts each span,
+          so free and realloc find a block's class in O(1) without a header in front of it.
+        * Blocks are aligned to the largest power of two dividing their class size, capped at 64 bytes.
+          So every class from 64 bytes up, and every large span, is cache line aligned for simd, while small blocks don't pay for padding.
+        * Free lists are lock free stacks, since scheduler workers allocate alongside the RT thread (see runtime_scheduler.h).
+          Each head packs a block index with a tag bumped on every push and pop, so a stale pop can't succeed (ABA).
+        * Allocations are always zeroed: fresh pages come zeroed from the OS, reused blocks are cleared when they're handed out
+          and realloc clears whatever a shrink leaves behind.
+        * Alloc and free never lock or call the OS. Refilling a class from a fresh page touches one page,
+          otherwise both are a handful of atomics, plus clearing the block when it is reused.
+
+    Frame arena:
+        * Scratch memory for allocations the compiler has proven never outlive the fn making them (see Frame allocations in mach_transform.c).
+        * A separate, fully committed NECRO_FRAME_ARENA_SIZE region bumped atomically, since scheduler workers allocate alongside the RT thread.
+        * necro_runtime_frame_reset runs after every block and clears only what the block used, so frame allocations are zeroed
+          like heap ones, reuse the same few cache lines every block and never grow the heap.
+        * When a block needs more than NECRO_FRAME_ARENA_SIZE the rest comes from the heap and is counted in num_frame_overflows.
+          Each overflow allocation starts with a header linking it into the frame_overflows list, which necro_runtime_frame_reset frees.
+          The header also records the address handed out, so necro_runtime_free can tell an overflow from a heap block and leave it to the reset.
+*/
+#define NECRO_HEAP_PAGE_SIZE         65536
+#define NECRO_HEAP_RESERVE_ALIGN     (2 * 1024 * 1024)  // Transparent huge page size, so commit chunks line up with huge pages
+#define NECRO_HEAP_COMMIT_CHUNK      (32 * 1024 * 1024) // Multiple of NECRO_HEAP_RESERVE_ALIGN
+#define NECRO_HEAP_COMMIT_HEADROOM   (64 * 1024 * 1024)
+#define NECRO_HEAP_BLOCK_ALIGN       16    // Block indices in free list heads are counted in these
+#define NECRO_HEAP_MAX_SMALL_SIZE    32768
+#define NECRO_HEAP_NUM_SMALL_CLASSES 22
+#define NECRO_HEAP_NUM_LARGE_CLASSES 32
+#define NECRO_HEAP_NUM_CLASSES       (NECRO_HEAP_NUM_SMALL_CLASSES + NECRO_HEAP_NUM_LARGE_CLASSES)
+#define NECRO_HEAP_INDEX_MASK        0xFFFFFFFFull
+#define NECRO_FRAME_ARENA_SIZE       (1024 * 1024)
+
+static const size_t necro_heap_small_class_sizes[NECRO_HEAP_NUM_SMALL_CLASSES] =
+{
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 12288, 16384, 24576, 32768
+};
+
+typedef struct NecroHeapFreeList
+{
+    volatile size_t head;    // Tag in the high 32 bits, 1 + index of the first block in the low 32 bits, 0 when empty
+    uint8_t         pad[64 - sizeof(size_t)];
+} NecroHeapFreeList;
+
 typedef struct NecroHeap
 {
-    uint8_t* data;
-    size_t   bump;
-    size_t   capacity;
+    uint8_t*          data;         // The reservation
+    size_t            reserved_size;
+    uint8_t*          base;         // data, aligned to NECRO_HEAP_RESERVE_ALIGN
+    volatile size_t   bump;         // Bytes of pages handed out. Bumped atomically, scheduler workers can allocate at the same time as the RT thread
+    volatile size_t   committed;    // Bytes from base which are committed, only ever grows
+    volatile size_t   num_rt_commits; // Commits made on a realtime thread, see necro_thread_is_realtime
+    size_t            capacity;
+    bool              is_huge_pages;
+    uint8_t*          page_classes; // Per page, 1 + the class of the blocks in it or of the span starting at it, 0 for pages not handed out
+    size_t*           span_sizes;   // Per page, the size last asked of the large span starting at it. Only the span's owner touches its entry
+    NecroHeapFreeList free_lists[NECRO_HEAP_NUM_CLASSES];
+    uint8_t*          frame_data;
+    volatile size_t   frame_bump;
+    volatile size_t   num_frame_overflows;
+    volatile size_t   frame_overflows; // Address of the latest overflow allocation this block, which holds the address of the one before, 0 when empty
 } NecroHeap;
-NecroHeap necro_heap = { .data = NULL, .bump = 0, .capacity = 0 };
+NecroHeap necro_heap = { .data = NULL, .reserved_size = 0, .base = NULL, .bump = 0, .committed = 0, .capacity = 0, .is_huge_pages = false, .page_classes = NULL };
 
-NecroHeap necro_heap_create(size_t capacity)
+static uint8_t necro_heap_small_class_of[NECRO_HEAP_MAX_SMALL_SIZE / NECRO_HEAP_BLOCK_ALIGN + 1]; // By size in NECRO_HEAP_BLOCK_ALIGN units, rounded up
+
+NecroHeap necro_heap_create(size_t capacity, bool is_huge_pages)
 {
-    return (NecroHeap) { .data = calloc(capacity, sizeof(uint8_t)), .bump = 0, .capacity = capacity };
+    for (size_t units = 0, size_class = 0; units <= NECRO_HEAP_MAX_SMALL_SIZE / NECRO_HEAP_BLOCK_ALIGN; ++units)
+    {
+        while (necro_heap_small_class_sizes[size_class] < units * NECRO_HEAP_BLOCK_ALIGN)
+            size_class++;
+        necro_heap_small_class_of[units] = (uint8_t) size_class;
+    }
+    capacity                   = ((capacity + NECRO_HEAP_COMMIT_CHUNK - 1) / NECRO_HEAP_COMMIT_CHUNK) * NECRO_HEAP_COMMIT_CHUNK;
+    NecroHeap    heap          = { .reserved_size = capacity + NECRO_HEAP_RESERVE_ALIGN, .bump = 0, .committed = 0, .capacity = capacity, .is_huge_pages = is_huge_pages };
+    heap.data                  = necro_memory_reserve(heap.reserved_size);
+    if (heap.data == NULL)
+    {
+        fprintf(stderr, "Unable to reserve %zumb of address space for the heap, try a smaller -heap-mb\n", capacity / (1024 * 1024));
+        exit(665);
+    }
+    const size_t skew          = (NECRO_HEAP_RESERVE_ALIGN - ((size_t) heap.data) % NECRO_HEAP_RESERVE_ALIGN) % NECRO_HEAP_RESERVE_ALIGN;
+    heap.base                  = heap.data + skew;
+    assert(heap.capacity / NECRO_HEAP_BLOCK_ALIGN < NECRO_HEAP_INDEX_MASK);
+    heap.page_classes          = calloc(heap.capacity / NECRO_HEAP_PAGE_SIZE + 1, sizeof(uint8_t));
+    heap.span_sizes            = calloc(heap.capacity / NECRO_HEAP_PAGE_SIZE + 1, sizeof(size_t));
+    heap.frame_data            = necro_memory_reserve(NECRO_FRAME_ARENA_SIZE);
+    if (heap.frame_data == NULL || !necro_memory_commit(heap.frame_data, NECRO_FRAME_ARENA_SIZE, false))
+    {
+        fprintf(stderr, "Unable to allocate the %dkb frame arena\n", NECRO_FRAME_ARENA_SIZE / 1024);
+        exit(665);
+    }
+    return heap;
 }
 
 void necro_heap_destroy(NecroHeap* heap)
 {
-    free(heap->data);
-    heap->data     = NULL;
-    heap->bump     = 0;
-    heap->capacity = 0;
+    if (heap->num_frame_overflows > 0)
+        printf("Frame arena overflows: %zu\n", heap->num_frame_overflows);
+    if (heap->num_rt_commits > 0)
+        printf("Heap commits on the RT thread: %zu\n", heap->num_rt_commits);
+    necro_memory_release(heap->data, heap->reserved_size);
+    necro_memory_release(heap->frame_data, NECRO_FRAME_ARENA_SIZE);
+    free(heap->page_classes);
+    free(heap->span_sizes);
+    *heap = (NecroHeap) { .data = NULL, .reserved_size = 0, .base = NULL, .bump = 0, .committed = 0, .capacity = 0, .is_huge_pages = false, .page_classes = NULL };
 }
 
-// HACK / TODO: Note this is completely ridiculous, but until we have a better allocation scheme this is what we're doing for now!
-// TODO: Different Allocators based on size: Slab Allocator => Buddy => OS
-extern DLLEXPORT uint8_t* necro_runtime_alloc(size_t size)
+// Commits whole chunks until at least size bytes from base are committed. Threads racing here may commit the same range twice, which is harmless
+static bool necro_heap_commit(size_t size)
 {
-    // return malloc(size);
-    if (size == 0)
-        return NULL;
-    assert(size % 8 == 0);
-    // Make sure we're 64 byte aligned for proper simd usage
-    size_t padding = 0;
-    if ((((size_t)(necro_heap.data + necro_heap.bump)) % 64) != 0)
+    size_t committed = necro_atomic_load(&necro_heap.committed);
+    while (committed < size)
+    {
+        size_t end = ((size + NECRO_HEAP_COMMIT_CHUNK - 1) / NECRO_HEAP_COMMIT_CHUNK) * NECRO_HEAP_COMMIT_CHUNK;
+        end        = end < necro_heap.capacity ? end : necro_heap.capacity;
+        if (end <= committed || !necro_memory_commit(necro_heap.base + committed, end - committed, necro_heap.is_huge_pages))
+            return false;
+        if (necro_thread_is_realtime())
+            necro_atomic_fetch_add(&necro_heap.num_rt_commits, 1);
+        if (necro_atomic_compare_exchange(&necro_heap.committed, committed, end))
+            return true;
+        committed = necro_atomic_load(&necro_heap.committed);
+    }
+    return true;
+}
+
+// NRT thread, keeps the RT thread from having to commit memory itself
+static void necro_heap_commit_ahead()
+{
+    const size_t bump = necro_atomic_load(&necro_heap.bump);
+    if (bump < necro_heap.capacity)
+        necro_heap_commit(bump + NECRO_HEAP_COMMIT_HEADROOM);
+}
+
+static size_t necro_heap_log2_floor(size_t n)
+{
+    size_t log2 = 0;
+    while (n >>= 1)
+        log2++;
+    return log2;
+}
+
+static uint8_t* necro_heap_block(size_t index)
+{
+    return necro_heap.base + index * NECRO_HEAP_BLOCK_ALIGN;
+}
+
+static size_t necro_heap_block_index(uint8_t* block)
+{
+    return (size_t) (block - necro_heap.base) / NECRO_HEAP_BLOCK_ALIGN;
+}
+
+static uint8_t* necro_heap_pop(NecroHeapFreeList* list)
+{
+    size_t head;
+    size_t next;
+    do
     {
-        padding          = 64 - (((size_t)(necro_heap.data + necro_heap.bump)) % 64);
-        necro_heap.bump += padding;
+        head               = necro_atomic_load(&list->head);
+        const size_t index = head & NECRO_HEAP_INDEX_MASK;
+        if (index == 0)
+            return NULL;
+        // The block may be popped, reused and overwritten by another thread under us, in which case the tag has moved on and the exchange fails
+        next = ((head & ~NECRO_HEAP_INDEX_MASK) + (NECRO_HEAP_INDEX_MASK + 1)) | necro_atomic_load((volatile size_t*) necro_heap_block(index - 1));
     }
-    if (necro_heap.bump + size >= necro_heap.capacity)
+    while (!necro_atomic_compare_exchange(&list->head, head, next));
+    return necro_heap_block((head & NECRO_HEAP_INDEX_MASK) - 1);
+}
+
+// Pushes a chain of blocks, already linked from first to last
+static void necro_heap_push(NecroHeapFreeList* list, uint8_t* first, uint8_t* last)
+{
+    size_t head;
+    do
+    {
+        head = necro_atomic_load(&list->head);
+        necro_atomic_store((volatile size_t*) last, head & NECRO_HEAP_INDEX_MASK);
+    }
+    while (!necro_atomic_compare_exchange(&list->head, head, ((head & ~NECRO_HEAP_INDEX_MASK) + (NECRO_HEAP_INDEX_MASK + 1)) | (necro_heap_block_index(first) + 1)));
+}
+
+static uint8_t* necro_heap_bump_pages(size_t num_pages, size_t heap_class)
+{
+    const size_t size = num_pages * NECRO_HEAP_PAGE_SIZE;
+    const size_t bump = necro_atomic_fetch_add(&necro_heap.bump, size);
+    if (bump + size > necro_heap.capacity || !necro_heap_commit(bump + size))
     {
         fprintf(stderr, "Necro memory exhausted!\n");
         exit(665); // The neighbor of the beast
     }
-    uint8_t* data    = necro_heap.data + necro_heap.bump;
-    necro_heap.bump += size;
-    // printf("Alloc: %zu bytes, %zu padding, %zu alignmod64, total: %fmb\n\n", size, padding, ((size_t)data) % 64, (((double)necro_heap.bump) / 1000000.0));
+    const size_t page             = bump / NECRO_HEAP_PAGE_SIZE;
+    necro_heap.page_classes[page] = (uint8_t) (heap_class + 1);
+    return necro_heap.base + bump;
+}
+
+// Splits a fresh page into blocks, keeps the first and frees the rest
+static uint8_t* necro_heap_refill(size_t size_class)
+{
+    const size_t block_size = necro_heap_small_class_sizes[size_class];
+    const size_t num_blocks = NECRO_HEAP_PAGE_SIZE / block_size;
+    uint8_t*     page       = necro_heap_bump_pages(1, size_class);
+    if (num_blocks == 1)
+        return page;
+    for (size_t i = 1; i < num_blocks - 1; ++i)
+        *((size_t*) (page + i * block_size)) = necro_heap_block_index(page + (i + 1) * block_size) + 1;
+    necro_heap_push(necro_heap.free_lists + size_class, page + block_size, page + (num_blocks - 1) * block_size);
+    return page;
+}
+
+// Bytes usable at data, or 0 if data didn't come from the heap
+static size_t necro_heap_usable_size(uint8_t* data, size_t* out_class)
+{
+    if (data < necro_heap.base || data >= necro_heap.base + necro_heap.capacity)
+        return 0;
+    const size_t page = (size_t) (data - necro_heap.base) / NECRO_HEAP_PAGE_SIZE;
+    assert(necro_heap.page_classes[page] != 0);
+    if (necro_heap.page_classes[page] == 0)
+        return 0;
+    const size_t heap_class = (size_t) necro_heap.page_classes[page] - 1;
+    *out_class              = heap_class;
+    if (heap_class < NECRO_HEAP_NUM_SMALL_CLASSES)
+        return necro_heap_small_class_sizes[heap_class];
+    assert(((size_t) (data - necro_heap.base)) % NECRO_HEAP_PAGE_SIZE == 0);
+    return (size_t) NECRO_HEAP_PAGE_SIZE << (heap_class - NECRO_HEAP_NUM_SMALL_CLASSES);
+}
+
+static void necro_alloc_audit_record(size_t site, size_t size);
+
+extern DLLEXPORT uint8_t* necro_runtime_alloc(size_t size, size_t site)
+{
+    if (size == 0)
+        return NULL;
+    assert(size % 8 == 0);
+    necro_alloc_audit_record(site, size);
+    if (size <= NECRO_HEAP_MAX_SMALL_SIZE)
+    {
+        const size_t size_class = necro_heap_small_class_of[(size + NECRO_HEAP_BLOCK_ALIGN - 1) / NECRO_HEAP_BLOCK_ALIGN];
+        uint8_t*     data       = necro_heap_pop(necro_heap.free_lists + size_class);
+        if (data == NULL)
+            return necro_heap_refill(size_class);
+        memset(data, 0, necro_heap_small_class_sizes[size_class]);
+        return data;
+    }
+    const size_t num_pages   = (size + NECRO_HEAP_PAGE_SIZE - 1) / NECRO_HEAP_PAGE_SIZE;
+    const size_t large_class = necro_heap_log2_floor(num_pages) + ((num_pages & (num_pages - 1)) != 0);
+    assert(large_class < NECRO_HEAP_NUM_LARGE_CLASSES);
+    uint8_t*     data        = necro_heap_pop(necro_heap.free_lists + NECRO_HEAP_NUM_SMALL_CLASSES + large_class);
+    if (data == NULL)
+        data = necro_heap_bump_pages((size_t) 1 << large_class, NECRO_HEAP_NUM_SMALL_CLASSES + large_class);
+    else
+        memset(data, 0, necro_heap.span_sizes[(size_t) (data - necro_heap.base) / NECRO_HEAP_PAGE_SIZE]); // Past that the span is still zeroed
+    necro_heap.span_sizes[(size_t) (data - necro_heap.base) / NECRO_HEAP_PAGE_SIZE] = size;
     return data;
 }
 
-extern DLLEXPORT uint8_t* necro_runtime_realloc(uint8_t* ptr, size_t size)
+extern DLLEXPORT uint8_t* necro_runtime_realloc(uint8_t* ptr, size_t size, size_t site)
 {
-    // printf("necro_runtime_realloc, ptr: %p, size: %zu\n\n", ptr, size);
-    // return realloc(ptr, size);
+    size_t       heap_class  = 0;
+    const size_t usable_size = necro_heap_usable_size(ptr, &heap_class);
+    if (usable_size >= size && size > 0)
+    {
+        // Clear the tail on the way down so growing back in place still hands out zeroed memory
+        if (heap_class < NECRO_HEAP_NUM_SMALL_CLASSES)
+        {
+            memset(ptr + size, 0, usable_size - size);
+            return ptr;
+        }
+        // Spans are only dirty up to the size last asked of them
+        size_t* span_size = necro_heap.span_sizes + (size_t) (ptr - necro_heap.base) / NECRO_HEAP_PAGE_SIZE;
+        if (*span_size > size)
+            memset(ptr + size, 0, *span_size - size);
+        *span_size = size;
+        return ptr;
+    }
+    uint8_t* data = necro_runtime_alloc(size, site);
+    if (data != NULL && usable_size > 0)
+        memcpy(data, ptr, usable_size < size ? usable_size : size);
     necro_runtime_free(ptr);
-    // printf("REALLOC\n");
-    return necro_runtime_alloc(size);
+    return data;
+}
+
+static void necro_heap_free(uint8_t* data)
+{
+    size_t heap_class = 0;
+    if (necro_heap_usable_size(data, &heap_class) == 0)
+        return;
+    necro_heap_push(necro_heap.free_lists + heap_class, data, data);
+}
+
+// Frame allocations may still be passed to ptrFree, they belong to the frame arena until necro_runtime_frame_reset
+static bool necro_heap_is_frame_alloc(const uint8_t* data)
+{
+    if (data >= necro_heap.frame_data && data < necro_heap.frame_data + NECRO_FRAME_ARENA_SIZE)
+        return true;
+    for (size_t overflow = necro_atomic_load(&necro_heap.frame_overflows); overflow != 0; overflow = ((size_t*) overflow)[0])
+    {
+        if (((uint8_t**) overflow)[1] == data)
+            return true;
+    }
+    return false;
 }
 
 extern DLLEXPORT void necro_runtime_free(uint8_t* data)
 {
-    UNUSED(data);
-    // free(data);
+    if (data == NULL || necro_heap_is_frame_alloc(data))
+        return;
+    necro_heap_free(data);
+}
+
+extern DLLEXPORT uint8_t* necro_runtime_frame_alloc(size_t size, size_t site)
+{
+    if (size == 0)
+        return NULL;
+    assert(size % 8 == 0);
+    size               = (size + NECRO_HEAP_BLOCK_ALIGN - 1) & ~((size_t) NECRO_HEAP_BLOCK_ALIGN - 1);
+    const size_t align = size >= 64 ? 64 : NECRO_HEAP_BLOCK_ALIGN;
+    const size_t bump  = necro_atomic_fetch_add(&necro_heap.frame_bump, size + align - NECRO_HEAP_BLOCK_ALIGN);
+    if (bump + size + align - NECRO_HEAP_BLOCK_ALIGN > NECRO_FRAME_ARENA_SIZE)
+    {
+        necro_atomic_fetch_add(&necro_heap.num_frame_overflows, 1);
+        uint8_t* overflow = necro_runtime_alloc(size + align, site);
+        size_t   next     = 0;
+        ((uint8_t**) overflow)[1] = overflow + align;
+        do
+        {
+            next                    = necro_atomic_load(&necro_heap.frame_overflows);
+            ((size_t*) overflow)[0] = next;
+        }
+        while (!necro_atomic_compare_exchange(&necro_heap.frame_overflows, next, (size_t) overflow));
+        return overflow + align;
+    }
+    return necro_heap.frame_data + ((bump + align - 1) & ~(align - 1));
+}
+
+void necro_runtime_frame_reset()
+{
+    const size_t used = necro_atomic_load(&necro_heap.frame_bump);
+    memset(necro_heap.frame_data, 0, used < NECRO_FRAME_ARENA_SIZE ? used : NECRO_FRAME_ARENA_SIZE);
+    necro_atomic_store(&necro_heap.frame_bump, 0);
+    size_t overflow = necro_atomic_load(&necro_heap.frame_overflows);
+    while (overflow != 0)
+    {
+        const size_t next = *(size_t*) overflow;
+        necro_heap_free((uint8_t*) overflow);
+        overflow = next;
+    }
+    necro_atomic_store(&necro_heap.frame_overflows, 0);
+}
+
+static void necro_heap_test_result(const char* test_name, bool is_passed)
+{
+    printf("Heap %s test: %s\n", test_name, is_passed ? "passed" : "FAILED");
+}
+
+static bool necro_heap_test_is_zeroed(const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (data[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+// Runs on a heap of its own, swapped in for necro_heap while the tests run
+void necro_heap_test()
+{
+    necro_announce_phase("NecroHeap");
+    const NecroHeap prev_heap = necro_heap;
+    necro_heap                = necro_heap_create(128 * 1024 * 1024, false);
+
+    //--------------------
+    // Reserve and commit: nothing is committed up front, then whole chunks as the bump pointer reaches them
+    {
+        const bool is_nothing_committed = necro_heap.committed == 0;
+        uint8_t*   data                 = necro_runtime_alloc(64, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("commit on first use", is_nothing_committed && data != NULL && necro_heap.committed == NECRO_HEAP_COMMIT_CHUNK);
+        // Two 16mb spans take the bump pointer past the first chunk, the end of the second span has to be writable
+        uint8_t* span0 = necro_runtime_alloc(16 * 1024 * 1024, NECRO_ALLOC_SITE_RUNTIME);
+        uint8_t* span1 = necro_runtime_alloc(16 * 1024 * 1024, NECRO_ALLOC_SITE_RUNTIME);
+        span1[16 * 1024 * 1024 - 1] = 1;
+        necro_heap_test_result("commit chunks", necro_heap.committed == 2 * NECRO_HEAP_COMMIT_CHUNK && necro_heap.committed >= necro_heap.bump && span0 != NULL);
+        // Past the committed end on a realtime thread the commit still happens, but is counted. Other threads aren't counted
+        const size_t num_nrt_commits = necro_heap.num_rt_commits;
+        necro_thread_set_is_realtime(true);
+        uint8_t* span2 = necro_runtime_alloc(32 * 1024 * 1024, NECRO_ALLOC_SITE_RUNTIME);
+        necro_thread_set_is_realtime(false);
+        span2[32 * 1024 * 1024 - 1] = 1;
+        necro_heap_test_result("count rt commits", num_nrt_commits == 0 && necro_heap.num_rt_commits == 1 && necro_heap.committed >= necro_heap.bump);
+        // The NRT thread commits ahead of the bump pointer, up to the end of the reservation
+        necro_heap_commit_ahead();
+        necro_heap_test_result("commit ahead", necro_heap.committed == necro_heap.capacity);
+        necro_runtime_free(data);
+        necro_runtime_free(span0);
+        necro_runtime_free(span1);
+        necro_runtime_free(span2);
+
+        uint8_t*   reservation   = necro_memory_reserve(4 * NECRO_HEAP_RESERVE_ALIGN);
+        const bool is_committed  = reservation != NULL && necro_memory_commit(reservation, NECRO_HEAP_RESERVE_ALIGN, false);
+        if (is_committed)
+        {
+            reservation[0]                            = 1;
+            reservation[NECRO_HEAP_RESERVE_ALIGN - 1] = 1;
+        }
+        necro_heap_test_result("reserve and commit", is_committed && reservation[0] == 1 && reservation[NECRO_HEAP_RESERVE_ALIGN - 1] == 1);
+        if (reservation != NULL)
+            necro_memory_release(reservation, 4 * NECRO_HEAP_RESERVE_ALIGN);
+    }
+
+    //--------------------
+    // Size classes: freed blocks are reused by their own class, zeroed, before the heap grows
+    {
+        uint8_t* data = necro_runtime_alloc(24, NECRO_ALLOC_SITE_RUNTIME);
+        memset(data, 0xFF, 24);
+        necro_runtime_free(data);
+        uint8_t* same_class = necro_runtime_alloc(32, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("size class reuse", same_class == data && necro_heap_test_is_zeroed(same_class, 32));
+        necro_runtime_free(same_class);
+        uint8_t* other_class = necro_runtime_alloc(48, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("size class separation", other_class != data && necro_heap_test_is_zeroed(other_class, 48));
+        necro_runtime_free(other_class);
+        uint8_t* aligned_small = necro_runtime_alloc(96, NECRO_ALLOC_SITE_RUNTIME);
+        uint8_t* aligned_large = necro_runtime_alloc(3072, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("size class alignment", ((size_t) aligned_small) % 32 == 0 && ((size_t) aligned_large) % 64 == 0);
+        necro_runtime_free(aligned_small);
+        necro_runtime_free(aligned_large);
+
+        // Large spans come back through their own power of two free list
+        uint8_t* span = necro_runtime_alloc(100000, NECRO_ALLOC_SITE_RUNTIME);
+        memset(span, 0xFF, 100000);
+        necro_runtime_free(span);
+        uint8_t* span_again = necro_runtime_alloc(2 * NECRO_HEAP_PAGE_SIZE, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("large span reuse", span_again == span && necro_heap_test_is_zeroed(span_again, 2 * NECRO_HEAP_PAGE_SIZE) && ((size_t) span_again) % NECRO_HEAP_PAGE_SIZE == 0);
+        // Reuse only clears what the last owner asked for, a smaller reuse grown back in place still finds the rest of the span zeroed
+        uint8_t* full_span = necro_runtime_alloc(4 * NECRO_HEAP_PAGE_SIZE, NECRO_ALLOC_SITE_RUNTIME);
+        memset(full_span, 0xFF, 4 * NECRO_HEAP_PAGE_SIZE);
+        necro_runtime_free(full_span);
+        uint8_t* part_span = necro_runtime_alloc(3 * NECRO_HEAP_PAGE_SIZE, NECRO_ALLOC_SITE_RUNTIME);
+        const bool is_part_zeroed = necro_heap_test_is_zeroed(part_span, 3 * NECRO_HEAP_PAGE_SIZE);
+        memset(part_span, 0xFF, 3 * NECRO_HEAP_PAGE_SIZE);
+        uint8_t* shrunk_span = necro_runtime_realloc(part_span, NECRO_HEAP_PAGE_SIZE * 2 + 64, NECRO_ALLOC_SITE_RUNTIME);
+        uint8_t* grown_span  = necro_runtime_realloc(shrunk_span, 4 * NECRO_HEAP_PAGE_SIZE, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("large span partial reuse", part_span == full_span && is_part_zeroed && grown_span == full_span && necro_heap_test_is_zeroed(grown_span + NECRO_HEAP_PAGE_SIZE * 2 + 64, 2 * NECRO_HEAP_PAGE_SIZE - 64));
+        necro_runtime_free(grown_span);
+        necro_runtime_free(span_again);
+
+        // Churn: freeing everything and allocating it all again doesn't grow the heap
+        uint8_t*     churn[1024];
+        const size_t num_churn = sizeof(churn) / sizeof(uint8_t*);
+        for (size_t i = 0; i < num_churn; ++i)
+            churn[i] = necro_runtime_alloc(16 + (i % 64) * 16, NECRO_ALLOC_SITE_RUNTIME);
+        for (size_t i = 0; i < num_churn; ++i)
+            necro_runtime_free(churn[i]);
+        const size_t bump = necro_heap.bump;
+        for (size_t i = 0; i < num_churn; ++i)
+            churn[i] = necro_runtime_alloc(16 + (i % 64) * 16, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("free list churn", necro_heap.bump == bump);
+        for (size_t i = 0; i < num_churn; ++i)
+            necro_runtime_free(churn[i]);
+    }
+
+    //--------------------
+    // Realloc: stays in place while the block's class has room, clears what a shrink leaves behind, otherwise moves and frees the old block
+    {
+        uint8_t* data = necro_runtime_alloc(40, NECRO_ALLOC_SITE_RUNTIME);
+        for (size_t i = 0; i < 40; ++i)
+            data[i] = (uint8_t) (i + 1);
+        uint8_t* grown = necro_runtime_realloc(data, 48, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("realloc grow in place", grown == data && data[39] == 40 && necro_heap_test_is_zeroed(data + 40, 8));
+        uint8_t* shrunk = necro_runtime_realloc(data, 24, NECRO_ALLOC_SITE_RUNTIME);
+        uint8_t* regrown = necro_runtime_realloc(shrunk, 48, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("realloc shrink in place", shrunk == data && regrown == data && data[23] == 24 && necro_heap_test_is_zeroed(data + 24, 24));
+        uint8_t* moved    = necro_runtime_realloc(data, 200, NECRO_ALLOC_SITE_RUNTIME);
+        bool     is_moved = moved != data && necro_heap_test_is_zeroed(moved + 24, 200 - 24);
+        for (size_t i = 0; i < 24; ++i)
+            is_moved = is_moved && moved[i] == (uint8_t) (i + 1);
+        uint8_t* reused = necro_runtime_alloc(48, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("realloc move", is_moved && reused == data && necro_heap_test_is_zeroed(reused, 48));
+        necro_runtime_free(reused);
+        necro_runtime_free(moved);
+        uint8_t* fresh = necro_runtime_realloc(NULL, 64, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("realloc null", fresh != NULL && necro_heap_test_is_zeroed(fresh, 64));
+        necro_runtime_free(fresh);
+    }
+
+    //--------------------
+    // Frame arena: aligned, zeroed, reused from the start after a reset, overflows come back to the heap
+    {
+        uint8_t* small = necro_runtime_frame_alloc(24, NECRO_ALLOC_SITE_RUNTIME);
+        uint8_t* large = necro_runtime_frame_alloc(256, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("frame arena alignment",
+            small >= necro_heap.frame_data && large + 256 <= necro_heap.frame_data + NECRO_FRAME_ARENA_SIZE &&
+            ((size_t) small) % NECRO_HEAP_BLOCK_ALIGN == 0 && ((size_t) large) % 64 == 0);
+        memset(small, 0xFF, 24);
+        memset(large, 0xFF, 256);
+        necro_runtime_frame_reset();
+        uint8_t* small_again = necro_runtime_frame_alloc(24, NECRO_ALLOC_SITE_RUNTIME);
+        uint8_t* large_again = necro_runtime_frame_alloc(256, NECRO_ALLOC_SITE_RUNTIME);
+        necro_heap_test_result("frame arena reset", small_again == small && large_again == large && necro_heap_test_is_zeroed(small_again, 24) && necro_heap_test_is_zeroed(large_again, 256));
+        necro_runtime_frame_reset();
+
+        // Fill the arena, then spill over into the heap
+        uint8_t*     overflows[8];
+        const size_t num_overflows = sizeof(overflows) / sizeof(uint8_t*);
+        while (necro_heap.frame_bump + 4096 <= NECRO_FRAME_ARENA_SIZE)
+            necro_runtime_frame_alloc(4096, NECRO_ALLOC_SITE_RUNTIME);
+        bool         is_overflow_in_heap = true;
+        for (size_t i = 0; i < num_overflows; ++i)
+        {
+            overflows[i]        = necro_runtime_frame_alloc(4096, NECRO_ALLOC_SITE_RUNTIME);
+            is_overflow_in_heap = is_overflow_in_heap && overflows[i] >= necro_heap.base && overflows[i] < necro_heap.base + necro_heap.capacity && necro_heap_test_is_zeroed(overflows[i], 4096);
+            memset(overflows[i], 0xFF, 4096);
+        }
+        necro_heap_test_result("frame arena overflow", is_overflow_in_heap && necro_heap.num_frame_overflows == num_overflows);
+        // ptrFree of a frame allocation leaves it to the reset, otherwise the reset would free the same block a second time
+        necro_runtime_free(overflows[0]);
+        necro_runtime_free(overflows[num_overflows - 1]);
+        necro_runtime_free(small);
+        // The reset frees them, so the heap hands the same blocks out again rather than growing, none of them overlapping
+        necro_runtime_frame_reset();
+        const size_t bump              = necro_heap.bump;
+        bool         is_overflow_freed = necro_heap.frame_overflows == 0;
+        uint8_t*     reused[sizeof(overflows) / sizeof(uint8_t*) + 1];
+        for (size_t i = 0; i < num_overflows + 1; ++i)
+        {
+            reused[i]         = necro_runtime_alloc(4096 + 64, NECRO_ALLOC_SITE_RUNTIME);
+            is_overflow_freed = is_overflow_freed && necro_heap_test_is_zeroed(reused[i], 4096 + 64);
+            for (size_t j = 0; j < i; ++j)
+                is_overflow_freed = is_overflow_freed && (reused[j] + 4096 + 64 <= reused[i] || reused[i] + 4096 + 64 <= reused[j]);
+        }
+        necro_heap_test_result("frame arena overflow reset", is_overflow_freed && necro_heap.bump == bump);
+    }
+
+    necro_heap_destroy(&necro_heap);
+    necro_heap = prev_heap;
+}
+
+/*
+    Allocation audit:
+        * Turned on with necro_runtime_options.is_alloc_audit (-alloc-audit). Finds the machines which allocate from the heap every block,
+          slowly using it up and scattering their data over cold memory.
+        * The compiler gives every machine which allocates a site id, passed along to necro_runtime_alloc and necro_runtime_realloc,
+          and hands the runtime their names with necro_runtime_set_alloc_sites. Site 0 (NECRO_ALLOC_SITE_RUNTIME) is the runtime itself.
+        * Each allocation is counted against its site, split by whether it happened inside a block (which implies necro_init has finished)
+          or outside of one: necro_init, mk fns and the NRT thread. necro_alloc_audit_print reports both per site when the runtime shuts down.
+          Inside means on a thread running the block (see necro_thread_is_in_block), so the NRT thread allocating at the same time counts as outside.
+        * Frame allocations don't touch the heap and aren't counted, unless they overflow the frame arena.
+        * Counting is a few atomics per allocation. With the audit off it is a single branch.
+*/
+typedef struct NecroAllocAuditSite
+{
+    volatile size_t num_block_allocs;
+    volatile size_t block_bytes;
+    volatile size_t num_other_allocs;
+    volatile size_t other_bytes;
+} NecroAllocAuditSite;
+
+typedef struct NecroAllocAudit
+{
+    const char* const*   site_names; // Owned by the compiler, NULL for programs compiled ahead of time
+    size_t               num_site_names;
+    NecroAllocAuditSite* sites;      // NULL while the audit is off
+    size_t               num_sites;
+    volatile size_t      num_blocks;
+    size_t               num_last_block_allocs; // Total block allocs of the last audit, kept after it is destroyed for tests
+} NecroAllocAudit;
+static NecroAllocAudit necro_alloc_audit = { .site_names = NULL, .num_site_names = 0, .sites = NULL, .num_sites = 0, .num_blocks = 0, .num_last_block_allocs = 0 };
+
+void necro_runtime_set_alloc_sites(const char* const* site_names, size_t num_sites)
+{
+    necro_alloc_audit.site_names     = site_names;
+    necro_alloc_audit.num_site_names = num_sites;
+}
+
+size_t necro_runtime_alloc_audit_block_allocs()
+{
+    return necro_alloc_audit.num_last_block_allocs;
+}
+
+static void necro_alloc_audit_create()
+{
+    if (!necro_runtime_options.is_alloc_audit)
+        return;
+    // Programs compiled ahead of time don't pass their sites, keep room for plenty of them and report them by id
+    necro_alloc_audit.num_sites  = necro_alloc_audit.num_site_names > 0 ? necro_alloc_audit.num_site_names : 4096;
+    necro_alloc_audit.sites      = calloc(necro_alloc_audit.num_sites, sizeof(NecroAllocAuditSite));
+    necro_alloc_audit.num_blocks = 0;
+}
+
+static void necro_alloc_audit_record(size_t site, size_t size)
+{
+    if (necro_alloc_audit.sites == NULL)
+        return;
+    assert(site < necro_alloc_audit.num_sites);
+    NecroAllocAuditSite* audit_site = necro_alloc_audit.sites + (site < necro_alloc_audit.num_sites ? site : NECRO_ALLOC_SITE_RUNTIME);
+    if (necro_thread_is_in_block())
+    {
+        necro_atomic_fetch_add(&audit_site->num_block_allocs, 1);
+        necro_atomic_fetch_add(&audit_site->block_bytes, size);
+    }
+    else
+    {
+        necro_atomic_fetch_add(&audit_site->num_other_allocs, 1);
+        necro_atomic_fetch_add(&audit_site->other_bytes, size);
+    }
+}
+
+static void necro_alloc_audit_begin_block()
+{
+    necro_thread_set_is_in_block(true);
+    if (necro_alloc_audit.sites == NULL)
+        return;
+    necro_alloc_audit.num_blocks++;
+}
+
+static void necro_alloc_audit_end_block()
+{
+    necro_thread_set_is_in_block(false);
+}
+
+// Sites which allocate inside blocks come first, worst first
+static int necro_alloc_audit_compare_sites(const void* a, const void* b)
+{
+    const NecroAllocAuditSite* site_a = necro_alloc_audit.sites + *(const size_t*) a;
+    const NecroAllocAuditSite* site_b = necro_alloc_audit.sites + *(const size_t*) b;
+    if (site_a->block_bytes != site_b->block_bytes)
+        return site_a->block_bytes < site_b->block_bytes ? 1 : -1;
+    if (site_a->other_bytes != site_b->other_bytes)
+        return site_a->other_bytes < site_b->other_bytes ? 1 : -1;
+    return 0;
+}
+
+static void necro_alloc_audit_print(FILE* file)
+{
+    if (necro_alloc_audit.sites == NULL)
+        return;
+    size_t* order     = emalloc(necro_alloc_audit.num_sites * sizeof(size_t));
+    size_t  num_order = 0;
+    for (size_t i = 0; i < necro_alloc_audit.num_sites; ++i)
+    {
+        if (necro_alloc_audit.sites[i].num_block_allocs > 0 || necro_alloc_audit.sites[i].num_other_allocs > 0)
+            order[num_order++] = i;
+    }
+    qsort(order, num_order, sizeof(size_t), necro_alloc_audit_compare_sites);
+    const size_t num_blocks = necro_alloc_audit.num_blocks;
+    fprintf(file, "\nAllocation audit, %zu blocks:\n", num_blocks);
+    fprintf(file, "    %-32s %14s %16s %14s %14s %16s\n", "site", "block allocs", "block bytes", "bytes / block", "other allocs", "other bytes");
+    for (size_t i = 0; i < num_order; ++i)
+    {
+        const NecroAllocAuditSite* site = necro_alloc_audit.sites + order[i];
+        char                       unnamed_site[32];
+        const char*                name = NULL;
+        if (order[i] == NECRO_ALLOC_SITE_RUNTIME)
+            name = "(runtime)";
+        else if (order[i] < necro_alloc_audit.num_site_names)
+            name = necro_alloc_audit.site_names[order[i]];
+        if (name == NULL)
+        {
+            snprintf(unnamed_site, sizeof(unnamed_site), "site %zu", order[i]);
+            name = unnamed_site;
+        }
+        fprintf(file, "    %-32s %14zu %16zu %14.1f %14zu %16zu\n",
+            name,
+            site->num_block_allocs,
+            site->block_bytes,
+            num_blocks > 0 ? (double) site->block_bytes / (double) num_blocks : 0.0,
+            site->num_other_allocs,
+            site->other_bytes);
+    }
+    if (num_order == 0)
+        fprintf(file, "    No heap allocations\n");
+    free(order);
+}
+
+static void necro_alloc_audit_destroy()
+{
+    if (necro_alloc_audit.sites == NULL)
+        return;
+    necro_alloc_audit.num_last_block_allocs = 0;
+    for (size_t i = 0; i < necro_alloc_audit.num_sites; ++i)
+        necro_alloc_audit.num_last_block_allocs += necro_alloc_audit.sites[i].num_block_allocs;
+    free(necro_alloc_audit.sites);
+    necro_alloc_audit.sites     = NULL;
+    necro_alloc_audit.num_sites = 0;
 }
 
 
@@ -353,12 +1041,24 @@ static size_t necro_num_midi_streams = 0;
 static PmEvent necro_nrt_midi_message_buffer[NRT_MIDI_MESSAGE_BUFFER_SIZE];
 static uint64_t necro_nrt_num_buffered_midi_messages = 0;
 
+// In the FIFO timestamp is in PortMidi milliseconds (see necro_midi_time_proc).
+// In the RT buffer it has been converted into a sample offset within the current block.
 typedef struct
 {
   uint64_t message;
   uint64_t timestamp;
 } necro_midi_message;
 
+// MIDI Clock
+// Messages are stamped against our own monotonic clock so that the RT thread can compare them against the time each block starts.
+static uint64_t necro_midi_time_base_ns = 0;
+
+static PmTimestamp necro_midi_time_proc(void* time_info)
+{
+  UNUSED(time_info);
+  return (PmTimestamp) ((necro_time_ns() - necro_midi_time_base_ns) / 1000000);
+}
+
 // RT MIDI State
 // KEEP THIS IN SYNC midiArray in base.necro !!!
 #define RT_MIDI_MESSAGE_BUFFER_SIZE 256
@@ -369,8 +1069,17 @@ static size_t necro_rt_num_buffered_midi_messages = 0;
 #define MIDI_FIFO_SIZE 512
 #define MIDI_FIFO_SIZE_MASK (MIDI_FIFO_SIZE - 1)
 static necro_midi_message necro_midi_message_fifo[MIDI_FIFO_SIZE];
-static size_t necro_midi_fifo_head = 0;
-static size_t necro_midi_fifo_tail = 0;
+static volatile size_t necro_midi_fifo_head = 0; // Written only by the MIDI thread
+static volatile size_t necro_midi_fifo_tail = 0; // Written only by the RT thread
+static volatile size_t necro_midi_fifo_num_overflows = 0; // Messages dropped because the FIFO was full
+static volatile size_t necro_midi_rt_num_overflows   = 0; // Blocks where the RT buffer filled before the FIFO was drained
+
+// MIDI Thread
+// PortMidi is polled on its own thread so that input reaches the FIFO within a fraction of a millisecond, independent of the NRT loop.
+#define MIDI_THREAD_POLL_PERIOD_NS 500000
+static struct NecroThread* necro_midi_thread            = NULL;
+static volatile size_t     necro_midi_thread_is_running = false;
+static void                necro_midi_thread_fn(void* user_data);
 
 extern DLLEXPORT uint64_t* necro_runtime_get_midi_buffer(size_t _dummy)
 {
@@ -392,6 +1101,7 @@ NecroResult(void) necro_runtime_midi_init()
     memset(necro_nrt_midi_message_buffer, 0, sizeof(PmEvent) * NRT_MIDI_MESSAGE_BUFFER_SIZE);
     memset(necro_midi_message_fifo, 0, sizeof(necro_midi_message) * MIDI_FIFO_SIZE);
     memset(necro_rt_midi_message_buffer, 0, sizeof(necro_midi_message) * RT_MIDI_MESSAGE_BUFFER_SIZE);
+    necro_midi_time_base_ns = necro_time_ns();
     PmError init_error = Pm_Initialize();
     if (init_error != pmNoError)
     {
@@ -429,7 +1139,7 @@ NecroResult(void) necro_runtime_midi_init()
             i, /* PmDeviceID  	inputDevice */
             NULL, /*void *  	inputDriverInfo */
             NRT_MIDI_MESSAGE_BUFFER_SIZE, /* long  	bufferSize */
-            NULL, /* PmTimeProcPtr  	time_proc */
+            necro_midi_time_proc, /* PmTimeProcPtr  	time_proc */
             NULL /* void *  	time_info */
           );
 
@@ -476,11 +1186,38 @@ NecroResult(void) necro_runtime_midi_init()
     puts("___________________________________\n");
   }
 
+  necro_atomic_store(&necro_midi_fifo_num_overflows, 0);
+  necro_atomic_store(&necro_midi_rt_num_overflows, 0);
+  bool has_open_stream = false;
+  for (size_t i = 0; i < necro_num_midi_streams; ++i)
+    has_open_stream = has_open_stream || necro_midi_streams[i].is_opened;
+  if (!has_open_stream)
+  {
+    return ok_void();
+  }
+  necro_atomic_store(&necro_midi_thread_is_running, true);
+  necro_midi_thread = necro_thread_create(necro_midi_thread_fn, NULL);
+  if (necro_midi_thread == NULL)
+  {
+    return necro_runtime_audio_error("Unable to start MIDI thread");
+  }
+
   return ok_void();
 }
 
 NecroResult(void) necro_runtime_midi_shutdown()
 {
+    necro_atomic_store(&necro_midi_thread_is_running, false);
+    necro_thread_join(necro_midi_thread);
+    necro_midi_thread = NULL;
+
+    const size_t num_fifo_overflows = necro_atomic_load(&necro_midi_fifo_num_overflows);
+    const size_t num_rt_overflows   = necro_atomic_load(&necro_midi_rt_num_overflows);
+    if (num_fifo_overflows > 0 || num_rt_overflows > 0)
+    {
+      printf("MIDI overflows: %zu dropped messages, %zu full blocks\n", num_fifo_overflows, num_rt_overflows);
+    }
+
     if (necro_midi_streams != NULL)
     {
       for (size_t i = 0; i < necro_num_midi_streams; ++i)
@@ -545,12 +1282,17 @@ NecroResult(void) necro_runtime_midi_update()
           );
 #endif
 
-          { // Push from NRT buffer to MIDI FIFO
+          { // Push from NRT buffer to MIDI FIFO, dropping the message if the RT thread has fallen behind
             const necro_midi_message midi_message = (necro_midi_message) { (uint64_t) event->message, (uint64_t) event->timestamp };
-            assert((_mm_lfence(),  necro_midi_fifo_head != ((necro_midi_fifo_tail - 1) & MIDI_FIFO_SIZE_MASK)) && "MIDI MESSAGE FIFO FULL!");
-            necro_midi_message_fifo[necro_midi_fifo_head] = midi_message;
-            _mm_sfence();
-            necro_midi_fifo_head = (necro_midi_fifo_head + 1) & MIDI_FIFO_SIZE_MASK;
+            const size_t             head         = necro_midi_fifo_head;
+            const size_t             next_head    = (head + 1) & MIDI_FIFO_SIZE_MASK;
+            if (next_head == necro_atomic_load(&necro_midi_fifo_tail))
+            {
+              necro_atomic_fetch_add(&necro_midi_fifo_num_overflows, 1);
+              continue;
+            }
+            necro_midi_message_fifo[head] = midi_message;
+            necro_atomic_store(&necro_midi_fifo_head, next_head);
           }
         }
       }
@@ -559,23 +1301,67 @@ NecroResult(void) necro_runtime_midi_update()
   return ok_void();
 }
 
+static void necro_midi_thread_fn(void* user_data)
+{
+  UNUSED(user_data);
+  uint64_t deadline_ns = necro_time_ns();
+  while (necro_atomic_load(&necro_midi_thread_is_running))
+  {
+    NecroResult(void) result = necro_runtime_midi_update();
+    if (result.type != NECRO_RESULT_OK)
+    {
+      fprintf(stderr, "MIDI read failed, stopping MIDI input.\n");
+      return;
+    }
+    deadline_ns += MIDI_THREAD_POLL_PERIOD_NS;
+    const uint64_t now_ns = necro_time_ns();
+    if (now_ns > deadline_ns)
+      deadline_ns = now_ns;
+    necro_sleep_until_ns(deadline_ns);
+  }
+}
+
+/*
+    Sample accurate MIDI:
+        * A message stamped at time t is played at time t + midi_latency_ms, at the matching sample of whichever block covers that time.
+        * The latency has to cover the worst case delay between a message arriving and it reaching the FIFO, plus a block,
+          otherwise late messages are clamped to the start of the block, which brings back the jitter.
+        * Messages that fall after the end of this block are left in the FIFO for a later block.
+*/
 void necro_midi_rt_update()
 {
-  // For simplicity for the moment, assume the buffer is fully consumed every frame
-  // TODO: Timestamp based curation/consuming of the messages
   necro_rt_num_buffered_midi_messages = 0;
+  // By default wait one block plus a few polling periods, which is the longest a message can take to reach us
+  const uint64_t latency_ns     = necro_runtime_options.midi_latency_ms > 0.0
+    ? (uint64_t) (necro_runtime_options.midi_latency_ms * 1000000.0)
+    : (1000000000ull * necro_runtime_options.block_size) / necro_runtime_options.sample_rate + 4 * MIDI_THREAD_POLL_PERIOD_NS;
+  const uint64_t block_start_ns = necro_time_ns() - necro_midi_time_base_ns;
 
   // Pop messages from MIDI FIFO to RT buffer
-  while (_mm_lfence(), necro_midi_fifo_tail != necro_midi_fifo_head)
+  while (necro_midi_fifo_tail != necro_atomic_load(&necro_midi_fifo_head))
   {
-    assert(necro_rt_num_buffered_midi_messages < RT_MIDI_MESSAGE_BUFFER_SIZE && "RT MIDI MESSAGE BUFFER FULL!");
-    necro_rt_midi_message_buffer[necro_rt_num_buffered_midi_messages++] = necro_midi_message_fifo[necro_midi_fifo_tail];
-    _mm_sfence();
-    necro_midi_fifo_tail = (necro_midi_fifo_tail + 1) & MIDI_FIFO_SIZE_MASK;
+    if (necro_rt_num_buffered_midi_messages >= RT_MIDI_MESSAGE_BUFFER_SIZE)
+    {
+      // Leave the rest in the FIFO for the next block
+      necro_atomic_fetch_add(&necro_midi_rt_num_overflows, 1);
+      break;
+    }
+    necro_midi_message midi_message = necro_midi_message_fifo[necro_midi_fifo_tail];
+    const uint64_t     play_ns      = midi_message.timestamp * 1000000 + latency_ns;
+    uint64_t           offset       = 0;
+    if (play_ns > block_start_ns)
+    {
+      offset = ((play_ns - block_start_ns) * necro_runtime_get_sample_rate()) / 1000000000;
+      if (offset >= necro_runtime_get_block_size())
+        break;
+    }
+    midi_message.timestamp = offset;
+    necro_rt_midi_message_buffer[necro_rt_num_buffered_midi_messages++] = midi_message;
+    necro_atomic_store(&necro_midi_fifo_tail, (necro_midi_fifo_tail + 1) & MIDI_FIFO_SIZE_MASK);
 
 #if DEBUG_PORT_MIDI > 0
     printf(
-      "{ RT    :: Message: %lu, TimeStamp: %lu } necro_midi_fifo_tail: %lu\n",
+      "{ RT    :: Message: %lu, Sample Offset: %lu } necro_midi_fifo_tail: %lu\n",
       necro_rt_midi_message_buffer[necro_rt_num_buffered_midi_messages - 1].message,
       necro_rt_midi_message_buffer[necro_rt_num_buffered_midi_messages - 1].timestamp,
       (necro_midi_fifo_tail - 1) & MIDI_FIFO_SIZE_MASK
@@ -588,72 +1374,342 @@ void necro_midi_rt_update()
 ///////////////////////////////////////////////////////
 // Audio
 ///////////////////////////////////////////////////////
-static NecroLangCallback* necro_runtime_audio_lang_callback       = NULL;
-// static float**            necro_runtime_audio_output_buffer       = NULL;
-static float*             necro_runtime_audio_output_buffer       = NULL;
-static size_t             necro_runtime_audio_num_input_channels  = 0;
-static double             necro_runtime_audio_start_time          = 0.0;
-static double             necro_runtime_audio_curr_time           = 0.0;
-static PaStream*          necro_runtime_audio_pa_stream           = NULL;
-struct NecroDownsample*   necro_runtime_audio_downsample[necro_runtime_audio_num_output_channels];
+static NecroLangCallback*       necro_runtime_audio_lang_callback       = NULL;
+static double*                  necro_runtime_audio_out_blocks          = NULL;  // Planar, one block per output channel, interleaved into the device buffer once necro_main returns
+static double*                  necro_runtime_audio_decimated_blocks    = NULL;  // Planar, out_blocks brought down to the device rate when oversampling
+static size_t                   necro_runtime_audio_out_channels_mask   = 0;     // Bit per output channel written this block
+static double*                  necro_runtime_audio_in_blocks           = NULL;  // Planar, one block per input channel plus a trailing silent block, handed straight to necro_main
+static double*                  necro_runtime_audio_in_device_blocks    = NULL;  // Planar, input at the device rate waiting to be upsampled when oversampling
+static bool                     necro_runtime_audio_rt_thread_is_setup  = false;
+static double                   necro_runtime_audio_curr_time           = 0.0;
+static size_t                   necro_runtime_audio_num_blocks          = 0;
+static const NecroAudioDevice*  necro_runtime_audio_device              = NULL;
+static NecroAudioTelemetry      necro_runtime_audio_telemetry;
+static struct NecroDownsample*  necro_runtime_audio_downsample[NECRO_AUDIO_MAX_OUTPUT_CHANNELS];
+static struct NecroUpsample*    necro_runtime_audio_upsample[NECRO_AUDIO_MAX_INPUT_CHANNELS];
+static NecroSharedStats*        necro_runtime_audio_shared_stats        = NULL;
+static volatile size_t          necro_runtime_audio_rt_setup_status     = 0;     // NECRO_RT_SETUP flags, written by the RT thread once it has set itself up
+static bool                     necro_runtime_audio_rt_setup_reported   = false;
+static NecroSharedStatsValues   necro_runtime_audio_stats_values;
+static const NecroTask*         necro_runtime_audio_main_tasks          = NULL;
+static size_t                   necro_runtime_audio_num_main_tasks      = 0;
+static NecroLangCallback*       necro_runtime_audio_main_tail           = NULL;
+static struct NecroScheduler*   necro_runtime_audio_scheduler           = NULL;  // Runs the main tasks instead of necro_main when there are workers
 
 extern DLLEXPORT size_t necro_runtime_out_audio_block(size_t channel_num, double* audio_block, size_t world)
 {
-    if (channel_num >= necro_runtime_audio_num_output_channels || necro_runtime_is_done())
+    if (channel_num >= necro_runtime_options.num_output_channels || necro_runtime_is_done())
         return world;
-    // float*                  output_buffer = necro_runtime_audio_output_buffer[channel_num];
-    // struct NecroDownsample* downsample = necro_runtime_audio_downsample[channel_num];
-    // necro_downsample(downsample, necro_runtime_audio_block_size, necro_runtime_audio_oversample_amt, audio_block, output_buffer);
-    // necro_downsample(downsample, channel_num, necro_runtime_audio_num_output_channels, necro_runtime_audio_block_size, necro_runtime_audio_oversample_amt, audio_block, necro_runtime_audio_output_buffer);
+    // Stage the block, all channels are decimated, converted and interleaved in one pass by necro_runtime_audio_run_block
+    const size_t block_size = necro_runtime_get_block_size();
+    memcpy(necro_runtime_audio_out_blocks + channel_num * block_size, audio_block, block_size * sizeof(double));
+    necro_runtime_audio_out_channels_mask |= ((size_t) 1) << channel_num;
+    return world;
+}
+
+/*
+    Audio input:
+        * The device's interleaved input is split into planar double blocks once per block, before necro_main runs.
+        * necro programs read those blocks in place, inAudioBlock returns a pointer into necro_runtime_audio_in_blocks,
+          so any number of consumers share a single copy of each channel.
+        * Channels past num_input_channels, and every channel when rendering offline, read as silence.
+*/
+extern DLLEXPORT double* necro_runtime_in_audio_block(size_t channel_num)
+{
+    const size_t num_channels = necro_runtime_options.num_input_channels;
+    if (channel_num >= num_channels)
+        channel_num = num_channels;
+    return necro_runtime_audio_in_blocks + channel_num * necro_runtime_get_block_size();
+}
 
-    // output into interleaved audio buffer
-    size_t out_i = channel_num;
-    for (size_t i = 0; i < necro_runtime_audio_block_size; ++i)
+static void necro_runtime_audio_read_input(const float* input_buffer)
+{
+    const size_t device_block_size = necro_runtime_options.block_size;
+    const size_t num_channels      = necro_runtime_options.num_input_channels;
+    if (num_channels == 0 || input_buffer == NULL)
+        return;
+    if (necro_runtime_audio_in_device_blocks == NULL)
     {
-        necro_runtime_audio_output_buffer[out_i] = (float) audio_block[i];
-        out_i += necro_runtime_audio_num_output_channels;
+        necro_audio_deinterleave_from_float(input_buffer, num_channels, device_block_size, necro_runtime_audio_in_blocks);
+        return;
     }
-    return world;
+    const size_t block_size = necro_runtime_get_block_size();
+    necro_audio_deinterleave_from_float(input_buffer, num_channels, device_block_size, necro_runtime_audio_in_device_blocks);
+    for (size_t channel_num = 0; channel_num < num_channels; ++channel_num)
+        necro_upsample(necro_runtime_audio_upsample[channel_num], necro_runtime_audio_in_device_blocks + channel_num * device_block_size, necro_runtime_audio_in_blocks + channel_num * block_size);
 }
 
-static int necro_runtime_audio_pa_callback(const void* input_buffer, void* output_buffer, unsigned long frames_per_buffer, const PaStreamCallbackTimeInfo* time_info, PaStreamCallbackFlags status_flags, void* user_data)
+// Runs necro_main for one block and interleaves its output into output_buffer. Channels it didn't output are silent
+static void necro_runtime_audio_run_block(float* output_buffer)
 {
-    UNUSED(frames_per_buffer);
-    UNUSED(input_buffer);
-    UNUSED(user_data);
+    const size_t block_size        = necro_runtime_get_block_size();
+    const size_t device_block_size = necro_runtime_options.block_size;
+    const size_t num_channels      = necro_runtime_options.num_output_channels;
+    necro_runtime_audio_out_channels_mask = 0;
+    necro_alloc_audit_begin_block();
+    if (necro_runtime_audio_scheduler != NULL)
+    {
+        necro_scheduler_run(necro_runtime_audio_scheduler);
+        necro_runtime_audio_main_tail();
+    }
+    else
+    {
+        necro_runtime_audio_lang_callback();
+    }
+    necro_alloc_audit_end_block();
+    necro_runtime_frame_reset();
+    for (size_t channel_num = 0; channel_num < num_channels; ++channel_num)
+    {
+        if ((necro_runtime_audio_out_channels_mask & (((size_t) 1) << channel_num)) == 0)
+            memset(necro_runtime_audio_out_blocks + channel_num * block_size, 0, block_size * sizeof(double));
+    }
+    if (necro_runtime_audio_decimated_blocks == NULL)
+    {
+        necro_audio_interleave_to_float(necro_runtime_audio_out_blocks, num_channels, device_block_size, output_buffer);
+        return;
+    }
+    for (size_t channel_num = 0; channel_num < num_channels; ++channel_num)
+        necro_downsample(necro_runtime_audio_downsample[channel_num], necro_runtime_audio_out_blocks + channel_num * block_size, necro_runtime_audio_decimated_blocks + channel_num * device_block_size);
+    necro_audio_interleave_to_float(necro_runtime_audio_decimated_blocks, num_channels, device_block_size, output_buffer);
+}
+
+static void necro_runtime_audio_output_create()
+{
+    const size_t device_block_size = necro_runtime_options.block_size;
+    const size_t num_channels      = necro_runtime_options.num_output_channels;
+    const size_t oversample        = necro_runtime_get_block_size() / device_block_size;
+    const size_t num_in_channels   = necro_runtime_options.num_input_channels;
+    necro_runtime_audio_out_blocks = emalloc(num_channels * necro_runtime_get_block_size() * sizeof(double));
+    necro_runtime_audio_in_blocks  = emalloc((num_in_channels + 1) * necro_runtime_get_block_size() * sizeof(double));
+    memset(necro_runtime_audio_in_blocks, 0, (num_in_channels + 1) * necro_runtime_get_block_size() * sizeof(double));
+    if (oversample <= 1)
+        return;
+    necro_runtime_audio_decimated_blocks = emalloc(num_channels * device_block_size * sizeof(double));
+    for (size_t i = 0; i < num_channels; ++i)
+        necro_runtime_audio_downsample[i] = necro_downsample_create(oversample, device_block_size);
+    if (num_in_channels == 0)
+        return;
+    necro_runtime_audio_in_device_blocks = emalloc(num_in_channels * device_block_size * sizeof(double));
+    for (size_t i = 0; i < num_in_channels; ++i)
+        necro_runtime_audio_upsample[i] = necro_upsample_create(oversample, device_block_size);
+}
+
+static void necro_runtime_audio_output_destroy()
+{
+    free(necro_runtime_audio_out_blocks);
+    free(necro_runtime_audio_decimated_blocks);
+    free(necro_runtime_audio_in_blocks);
+    free(necro_runtime_audio_in_device_blocks);
+    necro_runtime_audio_out_blocks       = NULL;
+    necro_runtime_audio_decimated_blocks = NULL;
+    necro_runtime_audio_in_blocks        = NULL;
+    necro_runtime_audio_in_device_blocks = NULL;
+    for (size_t i = 0; i < necro_runtime_options.num_output_channels; ++i)
+    {
+        necro_downsample_destroy(necro_runtime_audio_downsample[i]);
+        necro_runtime_audio_downsample[i] = NULL;
+    }
+    for (size_t i = 0; i < necro_runtime_options.num_input_channels; ++i)
+    {
+        necro_upsample_destroy(necro_runtime_audio_upsample[i]);
+        necro_runtime_audio_upsample[i] = NULL;
+    }
+}
+
+// Called by the audio device on the RT thread once per block
+//--------------------
+// Real time setup
+//     * Scheduling and pinning only apply to the calling thread, and the callback thread belongs to the audio device,
+//       so the RT thread sets itself up at the start of its first block. That is the one block allowed to make syscalls.
+//     * It can't print, so it leaves flags for the NRT loop to report.
+//     * Memory is locked and the heap prefaulted by the NRT thread once necro_init has done its allocations, before the device starts.
+#define NECRO_RT_SETUP_DONE             0x1
+#define NECRO_RT_SETUP_PRIORITY_FAILED  0x2
+#define NECRO_RT_SETUP_CPU_FAILED       0x4
+#define NECRO_HEAP_PREFAULT_HEADROOM    (64 * 1024 * 1024) // Beyond what necro_init used, for allocations made while running
+
+// RT thread, first block
+static void necro_runtime_audio_rt_thread_setup()
+{
+    size_t status = NECRO_RT_SETUP_DONE;
+    necro_thread_set_is_realtime(true);
+    necro_thread_flush_denormals();
+    if (necro_runtime_options.rt_priority > 0 && !necro_thread_set_realtime_priority(necro_runtime_options.rt_priority))
+        status |= NECRO_RT_SETUP_PRIORITY_FAILED;
+    if (necro_runtime_options.rt_cpu >= 0 && !necro_thread_pin_to_cpu((size_t) necro_runtime_options.rt_cpu))
+        status |= NECRO_RT_SETUP_CPU_FAILED;
+    if (necro_runtime_options.is_memory_locked)
+        necro_thread_prefault_stack();
+    necro_atomic_store(&necro_runtime_audio_rt_setup_status, status);
+}
+
+// NRT thread, reports once the RT thread has set itself up
+static void necro_runtime_audio_rt_setup_report()
+{
+    const size_t status = necro_atomic_load(&necro_runtime_audio_rt_setup_status);
+    if (necro_runtime_audio_rt_setup_reported || (status & NECRO_RT_SETUP_DONE) == 0)
+        return;
+    necro_runtime_audio_rt_setup_reported = true;
+    if ((status & NECRO_RT_SETUP_PRIORITY_FAILED) != 0)
+        fprintf(stderr, "Unable to give the audio thread real time priority %zu, check RLIMIT_RTPRIO (ulimit -r)\n", necro_runtime_options.rt_priority);
+    if ((status & NECRO_RT_SETUP_CPU_FAILED) != 0)
+        fprintf(stderr, "Unable to pin the audio thread to cpu %" PRId64 "\n", necro_runtime_options.rt_cpu);
+}
+
+// NRT thread, after necro_init and before the device starts
+static void necro_runtime_audio_lock_memory()
+{
+    if (!necro_runtime_options.is_memory_locked)
+        return;
+    if (!necro_memory_lock_all())
+        fprintf(stderr, "Unable to lock memory, check RLIMIT_MEMLOCK (ulimit -l). Prefaulting anyway, but pages may still be swapped out\n");
+    // Only committed memory can be touched
+    const size_t prefault_size = necro_heap.bump + NECRO_HEAP_PREFAULT_HEADROOM;
+    necro_heap_commit(prefault_size < necro_heap.capacity ? prefault_size : necro_heap.capacity);
+    necro_memory_prefault(necro_heap.base, prefault_size < necro_heap.committed ? prefault_size : necro_heap.committed);
+    necro_memory_prefault(necro_heap.frame_data, NECRO_FRAME_ARENA_SIZE);
+}
+
+//--------------------
+// Workers
+//     * With workers, each block runs the main tasks through a NecroScheduler, then necro_main_tail, instead of necro_main.
+//     * The thread running blocks takes part as worker 0, so -workers N keeps N + 1 threads busy.
+//     * A single task has nothing to run alongside, so then necro_main is used as is.
+void necro_runtime_audio_set_main_tasks(const NecroTask* main_tasks, size_t num_main_tasks, NecroLangCallback* necro_main_tail)
+{
+    assert(necro_runtime_audio_scheduler == NULL);
+    necro_runtime_audio_main_tasks     = main_tasks;
+    necro_runtime_audio_num_main_tasks = num_main_tasks;
+    necro_runtime_audio_main_tail      = necro_main_tail;
+}
+
+// NRT thread, once necro_init has run
+static void necro_runtime_audio_scheduler_create(bool is_real_time)
+{
+    if (necro_runtime_options.num_workers == 0 || necro_runtime_audio_num_main_tasks < 2 || necro_runtime_audio_main_tail == NULL)
+        return;
+    const size_t rt_priority      = is_real_time ? necro_runtime_options.rt_priority : 0;
+    necro_runtime_audio_scheduler = necro_scheduler_create(necro_runtime_audio_main_tasks, necro_runtime_audio_num_main_tasks, necro_runtime_options.num_workers, is_real_time, rt_priority, is_real_time && necro_runtime_options.is_memory_locked);
+}
+
+// NRT thread, once blocks have stopped running
+static void necro_runtime_audio_scheduler_destroy()
+{
+    necro_scheduler_destroy(necro_runtime_audio_scheduler);
+    necro_runtime_audio_scheduler = NULL;
+}
+
+//--------------------
+// Shared stats, see runtime_stats.h
+static void necro_runtime_audio_stats_create()
+{
+    if (necro_runtime_options.stats_name == NULL)
+        return;
+    necro_runtime_audio_shared_stats = necro_shared_stats_create(necro_runtime_options.stats_name);
+    memset(&necro_runtime_audio_stats_values, 0, sizeof(NecroSharedStatsValues));
+#ifdef _WIN32
+    necro_runtime_audio_stats_values.pid                 = (size_t) GetCurrentProcessId();
+#else
+    necro_runtime_audio_stats_values.pid                 = (size_t) getpid();
+#endif
+    necro_runtime_audio_stats_values.sample_rate         = necro_runtime_options.sample_rate;
+    necro_runtime_audio_stats_values.block_size          = necro_runtime_options.block_size;
+    necro_runtime_audio_stats_values.oversample          = necro_runtime_options.oversample;
+    necro_runtime_audio_stats_values.num_output_channels = necro_runtime_options.num_output_channels;
+    necro_runtime_audio_stats_values.num_input_channels  = necro_runtime_options.num_input_channels;
+    necro_runtime_audio_stats_values.deadline_ns         = (size_t) necro_runtime_audio_telemetry.deadline_ns;
+    necro_runtime_audio_stats_values.heap_capacity       = necro_heap.capacity;
+}
+
+static void necro_runtime_audio_stats_destroy()
+{
+    necro_shared_stats_destroy(necro_runtime_audio_shared_stats, necro_runtime_options.stats_name);
+    necro_runtime_audio_shared_stats = NULL;
+}
+
+// RT thread, at the end of every block
+static void necro_runtime_audio_stats_publish(uint64_t now_ns, uint64_t block_ns)
+{
+    if (necro_runtime_audio_shared_stats == NULL)
+        return;
+    NecroSharedStatsValues* values  = &necro_runtime_audio_stats_values;
+    values->update_time_ns          = (size_t) now_ns;
+    values->num_blocks              = necro_runtime_audio_num_blocks;
+    values->block_ns                = (size_t) block_ns;
+    values->max_block_ns            = necro_atomic_load(&necro_runtime_audio_telemetry.max_ns);
+    values->num_deadline_misses     = necro_atomic_load(&necro_runtime_audio_telemetry.num_deadline_misses);
+    values->num_underflows          = necro_atomic_load(&necro_runtime_audio_telemetry.num_underflows);
+    values->num_overflows           = necro_atomic_load(&necro_runtime_audio_telemetry.num_overflows);
+    values->heap_bump               = necro_heap.bump;
+    values->heap_committed          = necro_heap.committed;
+    values->heap_rt_commits         = necro_atomic_load(&necro_heap.num_rt_commits);
+    values->midi_queue_depth        = (necro_atomic_load(&necro_midi_fifo_head) - necro_midi_fifo_tail) & MIDI_FIFO_SIZE_MASK;
+    values->midi_block_messages     = necro_rt_num_buffered_midi_messages;
+    values->midi_overflows          = necro_atomic_load(&necro_midi_fifo_num_overflows) + necro_atomic_load(&necro_midi_rt_num_overflows);
+    values->num_active_streams      = necro_runtime_audio_num_active_streams();
+    values->num_active_recordings   = necro_runtime_audio_num_active_recordings();
+    values->audio_file_cache_hits   = necro_runtime_audio_file_cache_num_hits();
+    values->audio_file_cache_misses = necro_runtime_audio_file_cache_num_misses();
+    necro_shared_stats_publish(necro_runtime_audio_shared_stats, values);
+}
+
+static void necro_runtime_audio_device_callback(const float* input_buffer, float* output_buffer, size_t num_frames, uint32_t status_flags)
+{
+    UNUSED(num_frames);
     if (necro_runtime_audio_lang_callback == NULL || necro_runtime_is_done())
-        return 0;
-    assert(necro_runtime_audio_block_size == frames_per_buffer);
-    if ((status_flags & paOutputUnderflow) == paOutputUnderflow)
-        printf("Output underflow!\n");
-    if ((status_flags & paOutputOverflow) == paOutputOverflow)
+        return;
+    assert(necro_runtime_options.block_size == num_frames);
+    const uint64_t start_ns = necro_time_ns();
+    if (!necro_runtime_audio_rt_thread_is_setup)
     {
-        printf("Output overflow!\n");
-        return 0;
+        // First block on the device's thread
+        necro_runtime_audio_rt_thread_setup();
+        necro_runtime_audio_rt_thread_is_setup = true;
+    }
+    // No printing on the RT thread, the NRT loop reports these from the telemetry counters
+    if ((status_flags & NECRO_AUDIO_DEVICE_STATUS_OUTPUT_UNDERFLOW) == NECRO_AUDIO_DEVICE_STATUS_OUTPUT_UNDERFLOW)
+        necro_audio_telemetry_record_underflow(&necro_runtime_audio_telemetry);
+    if ((status_flags & NECRO_AUDIO_DEVICE_STATUS_OUTPUT_OVERFLOW) == NECRO_AUDIO_DEVICE_STATUS_OUTPUT_OVERFLOW)
+    {
+        necro_audio_telemetry_record_overflow(&necro_runtime_audio_telemetry);
+        return;
     }
     // RT IO
-    // necro_runtime_audio_output_buffer = (float**) output_buffer;
-    necro_runtime_audio_output_buffer = output_buffer;
-    necro_runtime_audio_curr_time     = time_info->currentTime - necro_runtime_audio_start_time;
+    necro_runtime_audio_curr_time     = (double) (necro_runtime_audio_num_blocks * necro_runtime_options.block_size) / (double) necro_runtime_options.sample_rate;
+    necro_runtime_audio_num_blocks++;
     // RT update
+    const uint64_t input_latency_ns = necro_runtime_controls_rt_update();
+    if (input_latency_ns > 0)
+        necro_audio_telemetry_record_input(&necro_runtime_audio_telemetry, input_latency_ns);
     necro_midi_rt_update();
-    necro_runtime_audio_lang_callback();
-    return 0;
+    necro_runtime_audio_read_input(input_buffer);
+    necro_runtime_audio_run_block(output_buffer);
+    const uint64_t end_ns = necro_time_ns();
+    necro_audio_telemetry_record_block(&necro_runtime_audio_telemetry, end_ns - start_ns);
+    necro_runtime_audio_stats_publish(end_ns, end_ns - start_ns);
+}
+
+NecroAudioTelemetrySnapshot necro_runtime_audio_get_telemetry()
+{
+    return necro_audio_telemetry_snapshot(&necro_runtime_audio_telemetry);
 }
 
 NecroResult(void) necro_runtime_audio_init()
 {
-    // if (necro_runtime_audio_downsample != NULL)
-    //     free(necro_runtime_audio_downsample);
-    // for (size_t i = 0; i < necro_runtime_audio_num_output_channels; ++i)
-    //     necro_runtime_audio_downsample[i] = necro_downsample_create(necro_runtime_audio_brick_wall_cutoff, (double) (necro_runtime_audio_sample_rate * necro_runtime_audio_oversample_amt));
-    PaError pa_error = Pa_Initialize();
-    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
-    // const PaSampleFormat audio_format = paFloat32 | paNonInterleaved;
-    const PaSampleFormat audio_format = paFloat32;
-    pa_error = Pa_OpenDefaultStream(&necro_runtime_audio_pa_stream, (int) necro_runtime_audio_num_input_channels, necro_runtime_audio_num_output_channels, audio_format, (double) necro_runtime_audio_sample_rate, (unsigned long) necro_runtime_audio_block_size, necro_runtime_audio_pa_callback, NULL);
-    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
-    return ok_void();
+    necro_runtime_audio_device = necro_audio_device_get(necro_runtime_options.audio_device_name);
+    if (necro_runtime_audio_device == NULL)
+    {
+        fprintf(stderr, "Unknown audio device: %s. Available devices are: ", necro_runtime_options.audio_device_name);
+        necro_audio_device_print_names(stderr);
+        return necro_runtime_audio_error("Unknown audio device");
+    }
+    necro_runtime_audio_num_blocks         = 0;
+    necro_runtime_audio_rt_thread_is_setup = false;
+    necro_runtime_audio_rt_setup_status    = 0;
+    necro_runtime_audio_rt_setup_reported  = false;
+    necro_runtime_audio_output_create();
+    necro_audio_telemetry_reset(&necro_runtime_audio_telemetry, necro_runtime_options.sample_rate, necro_runtime_options.block_size);
+    return necro_runtime_audio_device->init(necro_runtime_audio_device_callback, necro_runtime_options.num_input_channels, necro_runtime_options.num_output_channels, necro_runtime_options.sample_rate, necro_runtime_options.block_size);
 }
 
 NecroResult(void) necro_runtime_audio_start(NecroLangCallback* necro_init, NecroLangCallback* necro_main, NecroLangCallback* necro_shutdown)
@@ -662,80 +1718,289 @@ NecroResult(void) necro_runtime_audio_start(NecroLangCallback* necro_init, Necro
     assert(necro_init != NULL);
     assert(necro_main != NULL);
     assert(necro_shutdown != NULL);
+    if (necro_runtime_options.render_file_name != NULL)
+        return necro_runtime_audio_render(necro_init, necro_main, necro_shutdown);
     //--------------------
     // Init, then start RT thread
+    NecroAudioSampleFormat audio_file_format;
+    if (!necro_audio_sample_format_from_name(necro_runtime_options.audio_file_format, &audio_file_format))
+    {
+        fprintf(stderr, "Unknown audio file format: %s. Available formats are: float32, int24\n", necro_runtime_options.audio_file_format);
+        return necro_runtime_audio_error("Unknown audio file format");
+    }
     necro_try(void, necro_runtime_audio_init());
     necro_try(void, necro_runtime_midi_init());
-    necro_heap = necro_heap_create(4096000000);
+    necro_heap = necro_heap_create(necro_runtime_options.heap_size_mb * 1024 * 1024, necro_runtime_options.is_heap_huge_pages);
+    necro_alloc_audit_create();
+    necro_runtime_nrt_wake = necro_semaphore_create();
     necro_runtime_init();
+    necro_runtime_audio_recorder_init(audio_file_format, true);
+    necro_runtime_file_init(true);
+    necro_log_init();
+    necro_runtime_audio_stats_create();
     necro_runtime_audio_lang_callback = necro_main;
-    PaError pa_error = paNoError;
     if (necro_init() == 0)
-        pa_error = Pa_StartStream(necro_runtime_audio_pa_stream);
-    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
+    {
+        necro_log_drain(stdout);
+        necro_heap_commit_ahead();
+        necro_runtime_audio_lock_memory();
+        necro_runtime_audio_scheduler_create(true);
+        necro_try(void, necro_runtime_audio_device->start());
+    }
     //--------------------
     // NRT Update
-    size_t     cpu_check             = 0;
-    const long check_if_done_time_ms = 20;
+    //     * Input has its own thread, so this loop is only housekeeping: draining the log ring, committing heap ahead of the RT thread,
+    //       and the status line. NECRO_RUNTIME_NRT_PERIOD_MS is how long prints can sit in the ring, and how often the headroom is topped up.
+    //     * It waits on necro_runtime_nrt_wake rather than sleeping, so finishing from another thread (escape, testAssertion) isn't held up by the period. That post happens once per run.
+    size_t cpu_check = 0;
     while (!necro_runtime_is_done())
     {
-        // TODO: Need to synchronize this (lockless) with rt thread!
         necro_runtime_update();
-        necro_try(void, necro_runtime_midi_update());
+        necro_log_drain(stdout);
+        necro_heap_commit_ahead();
+        necro_runtime_audio_rt_setup_report();
         if (cpu_check > 9)
         {
-            double cpu_load = Pa_GetStreamCpuLoad(necro_runtime_audio_pa_stream);
-            printf("  cpu: %.2f%%  mem: %.2fmb        \r", cpu_load * 100.0, (((double)necro_heap.bump) / 1000000.0));
+            double                      cpu_load  = necro_runtime_audio_device->cpu_load();
+            NecroAudioTelemetrySnapshot telemetry = necro_runtime_audio_get_telemetry();
+            printf("  cpu: %.2f%%  p99: %.0fus  p99.9: %.0fus  max: %.0fus / %.0fus  misses: %zu  underflows: %zu  mem: %.2fmb        \r",
+                cpu_load * 100.0,
+                ((double) telemetry.p99_ns) / 1000.0,
+                ((double) telemetry.p999_ns) / 1000.0,
+                ((double) telemetry.max_ns) / 1000.0,
+                ((double) telemetry.deadline_ns) / 1000.0,
+                telemetry.num_deadline_misses,
+                telemetry.num_underflows,
+                (((double)necro_heap.bump) / 1000000.0));
             cpu_check = 0;
         }
         cpu_check++;
-        Pa_Sleep(check_if_done_time_ms);
-        // necro_runtime_sleep(check_if_done_time_ms);
+        if (necro_runtime_options.seconds > 0.0 && necro_runtime_audio_curr_time >= necro_runtime_options.seconds)
+            necro_runtime_finish();
+        necro_semaphore_wait_ms(necro_runtime_nrt_wake, NECRO_RUNTIME_NRT_PERIOD_MS);
     }
     //--------------------
     // Shutdown
     necro_try(void, necro_runtime_midi_shutdown());
     necro_try(void, necro_runtime_audio_stop());
+    necro_runtime_audio_scheduler_destroy();
+    necro_log_drain(stdout);
+    printf("\n");
+    necro_audio_telemetry_print(necro_runtime_audio_get_telemetry(), stdout);
     necro_try(void, necro_runtime_audio_shutdown());
     // TODO: remove, for now freeing seems broken...
     // necro_shutdown();
+    necro_runtime_audio_stream_shutdown();
+    necro_runtime_audio_file_cache_shutdown();
+    necro_runtime_audio_recorder_shutdown();
+    necro_runtime_file_shutdown();
+    necro_runtime_audio_stats_destroy();
     necro_runtime_shutdown();
+    necro_semaphore_destroy(necro_runtime_nrt_wake); // Nothing can finish the run any more, the RT and input threads are gone
+    necro_runtime_nrt_wake = NULL;
+    necro_alloc_audit_print(stdout);
+    necro_alloc_audit_destroy();
     necro_heap_destroy(&necro_heap);
     return ok_void();
 }
 
-NecroResult(void) necro_runtime_audio_stop()
+/*
+    Offline rendering:
+        * Runs necro_main back to back as fast as possible, no audio device or MIDI is involved.
+        * Each block is written straight into the output file.
+        * Useful for bouncing long pieces and benchmarking DSP throughput on headless machines.
+*/
+NecroResult(void) necro_runtime_audio_render(NecroLangCallback* necro_init, NecroLangCallback* necro_main, NecroLangCallback* necro_shutdown)
 {
-    // PaError pa_error = Pa_AbortStream(necro_runtime_audio_pa_stream);
-    PaError pa_error = Pa_StopStream(necro_runtime_audio_pa_stream);
-    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
+    UNUSED(necro_shutdown);
+    assert(necro_init != NULL);
+    assert(necro_main != NULL);
+    assert(necro_runtime_options.render_file_name != NULL);
+    const char*   file_name    = necro_runtime_options.render_file_name;
+    const size_t  block_size   = necro_runtime_options.block_size;
+    const double  render_seconds = necro_runtime_options.seconds > 0.0 ? necro_runtime_options.seconds : 10.0;
+    const size_t  num_frames   = (size_t) ceil(render_seconds * (double) necro_runtime_options.sample_rate);
+    //--------------------
+    // Init
+    NecroAudioSampleFormat audio_file_format;
+    if (!necro_audio_sample_format_from_name(necro_runtime_options.audio_file_format, &audio_file_format))
+    {
+        fprintf(stderr, "Unknown audio file format: %s. Available formats are: float32, int24\n", necro_runtime_options.audio_file_format);
+        return necro_runtime_audio_error("Unknown audio file format");
+    }
+    struct NecroAudioFileWriter* writer = necro_audio_file_writer_open(file_name, necro_runtime_options.num_output_channels, necro_runtime_options.sample_rate, audio_file_format);
+    if (writer == NULL)
+        return necro_runtime_audio_error("Unable to open render output file");
+    necro_heap = necro_heap_create(necro_runtime_options.heap_size_mb * 1024 * 1024, necro_runtime_options.is_heap_huge_pages);
+    necro_alloc_audit_create();
+    necro_runtime_init();
+    necro_runtime_audio_recorder_init(audio_file_format, false);
+    necro_runtime_file_init(false);
+    necro_log_init();
+    float* output_buffer              = emalloc(block_size * necro_runtime_options.num_output_channels * sizeof(float));
+    necro_runtime_audio_output_create();
+    necro_runtime_audio_lang_callback = necro_main;
+    const size_t prev_denormal_state  = necro_thread_flush_denormals();
+    //--------------------
+    // Render
+    printf("Rendering %.2f seconds of audio to %s...\n", render_seconds, file_name);
+    struct NecroTimer* timer        = necro_timer_create();
+    size_t             frames_done  = 0;
+    necro_timer_start(timer);
+    if (necro_init() == 0)
+    {
+        necro_runtime_audio_scheduler_create(false);
+        while (frames_done < num_frames && !necro_runtime_is_done())
+        {
+            const size_t frames_left = num_frames - frames_done;
+            const size_t num_out     = frames_left < block_size ? frames_left : block_size;
+            necro_runtime_audio_curr_time = (double) frames_done / (double) necro_runtime_options.sample_rate;
+            necro_runtime_audio_run_block(output_buffer);
+            necro_audio_file_writer_write(writer, output_buffer, num_out);
+            necro_log_drain(stdout);
+            frames_done += num_out;
+        }
+    }
+    necro_log_drain(stdout);
+    const double render_time_ms = necro_timer_stop(timer);
+    necro_runtime_audio_scheduler_destroy();
+    const double audio_time_ms  = ((double) frames_done * 1000.0) / (double) necro_runtime_options.sample_rate;
+    printf("Rendered %.2fs of audio in %.2fs (%.2fx real time), mem: %.2fmb\n", audio_time_ms / 1000.0, render_time_ms / 1000.0, render_time_ms > 0.0 ? audio_time_ms / render_time_ms : 0.0, (((double)necro_heap.bump) / 1000000.0));
+    //--------------------
+    // Shutdown
+    necro_timer_destroy(timer);
+    necro_audio_file_writer_close(writer);
+    necro_thread_restore_denormals(prev_denormal_state);
+    necro_runtime_audio_lang_callback = NULL;
+    necro_runtime_audio_output_destroy();
+    free(output_buffer);
+    necro_runtime_finish();
+    // TODO: remove, for now freeing seems broken...
+    // necro_shutdown();
+    necro_runtime_audio_stream_shutdown();
+    necro_runtime_audio_file_cache_shutdown();
+    necro_runtime_audio_recorder_shutdown();
+    necro_runtime_file_shutdown();
+    necro_runtime_shutdown();
+    necro_alloc_audit_print(stdout);
+    necro_alloc_audit_destroy();
+    necro_heap_destroy(&necro_heap);
     return ok_void();
 }
 
+NecroResult(void) necro_runtime_audio_stop()
+{
+    assert(necro_runtime_audio_device != NULL);
+    return necro_runtime_audio_device->stop();
+}
+
 NecroResult(void) necro_runtime_audio_shutdown()
 {
-    PaError pa_error = Pa_CloseStream(necro_runtime_audio_pa_stream);
-    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
-    pa_error         = Pa_Terminate();
-    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
-    for (size_t i = 0; i < necro_runtime_audio_num_output_channels; ++i)
-    {
-        if (necro_runtime_audio_downsample[i] != NULL)
-            free(necro_runtime_audio_downsample[i]);
-    }
+    assert(necro_runtime_audio_device != NULL);
+    necro_try(void, necro_runtime_audio_device->shutdown());
+    necro_runtime_audio_device = NULL;
+    necro_runtime_audio_output_destroy();
     return ok_void();
 }
 
+/*
+    When oversampling, necro programs (and everything the runtime hands them, such as audio files and MIDI offsets)
+    see the oversampled rate and block size. Only the audio device and offline renders stay at the device rate.
+*/
+static size_t necro_runtime_get_oversample()
+{
+    return necro_runtime_options.oversample > 1 ? necro_runtime_options.oversample : 1;
+}
+
 extern DLLEXPORT size_t necro_runtime_get_sample_rate()
 {
-    // return necro_runtime_audio_sample_rate * necro_runtime_audio_oversample_amt;
-    return necro_runtime_audio_sample_rate;
+    return necro_runtime_options.sample_rate * necro_runtime_get_oversample();
 }
 
 extern DLLEXPORT size_t necro_runtime_get_block_size()
 {
-    // return necro_runtime_audio_block_size * necro_runtime_audio_oversample_amt;
-    return necro_runtime_audio_block_size;
+    return necro_runtime_options.block_size * necro_runtime_get_oversample();
+}
+
+/*
+    Sample rate, block size and channel count are picked per run on the command line. They have to be settled before
+    compiling, as they are baked into the program both as the BlockSize and SampleRate types and as constants.
+*/
+bool necro_runtime_options_validate()
+{
+    const size_t block_size = necro_runtime_options.block_size;
+    if (necro_runtime_options.sample_rate < NECRO_AUDIO_MIN_SAMPLE_RATE || necro_runtime_options.sample_rate > NECRO_AUDIO_MAX_SAMPLE_RATE)
+    {
+        fprintf(stderr, "Unsupported sample rate: %zu. Sample rates must be between %d and %d\n", necro_runtime_options.sample_rate, NECRO_AUDIO_MIN_SAMPLE_RATE, NECRO_AUDIO_MAX_SAMPLE_RATE);
+        return false;
+    }
+    // audioBlockSizeMask and friends in base.necro rely on blocks being a power of 2
+    if (block_size < NECRO_AUDIO_MIN_BLOCK_SIZE || block_size > NECRO_AUDIO_MAX_BLOCK_SIZE || (block_size & (block_size - 1)) != 0)
+    {
+        fprintf(stderr, "Unsupported block size: %zu. Block sizes must be a power of 2 between %d and %d\n", block_size, NECRO_AUDIO_MIN_BLOCK_SIZE, NECRO_AUDIO_MAX_BLOCK_SIZE);
+        return false;
+    }
+    if (necro_runtime_options.num_output_channels < 1 || necro_runtime_options.num_output_channels > NECRO_AUDIO_MAX_OUTPUT_CHANNELS)
+    {
+        fprintf(stderr, "Unsupported channel count: %zu. Channel counts must be between 1 and %d\n", necro_runtime_options.num_output_channels, NECRO_AUDIO_MAX_OUTPUT_CHANNELS);
+        return false;
+    }
+    if (necro_runtime_options.num_input_channels > NECRO_AUDIO_MAX_INPUT_CHANNELS)
+    {
+        fprintf(stderr, "Unsupported input channel count: %zu. Input channel counts must be between 0 and %d\n", necro_runtime_options.num_input_channels, NECRO_AUDIO_MAX_INPUT_CHANNELS);
+        return false;
+    }
+    if (necro_runtime_options.rt_priority > 99)
+    {
+        fprintf(stderr, "Unsupported real time priority: %zu. Priorities must be between 1 and 99, or 0 to leave the audio thread alone\n", necro_runtime_options.rt_priority);
+        return false;
+    }
+    if (necro_runtime_options.rt_cpu >= (int64_t) necro_thread_hardware_concurrency())
+    {
+        fprintf(stderr, "Unable to pin the audio thread to cpu %" PRId64 ", there are only %zu cpus\n", necro_runtime_options.rt_cpu, necro_thread_hardware_concurrency());
+        return false;
+    }
+    if (necro_runtime_options.heap_size_mb < NECRO_HEAP_MIN_SIZE_MB || necro_runtime_options.heap_size_mb > NECRO_HEAP_MAX_SIZE_MB)
+    {
+        fprintf(stderr, "Unsupported heap size: %zumb. Heap sizes must be between %d and %d mb\n", necro_runtime_options.heap_size_mb, NECRO_HEAP_MIN_SIZE_MB, NECRO_HEAP_MAX_SIZE_MB);
+        return false;
+    }
+    // Workers spin while there's work about, more of them than spare cpus would only fight the audio thread
+    if (necro_runtime_options.num_workers >= necro_thread_hardware_concurrency())
+    {
+        fprintf(stderr, "Too many workers: %zu. There are only %zu cpus, so at most %zu workers can run alongside the audio thread\n", necro_runtime_options.num_workers, necro_thread_hardware_concurrency(), necro_thread_hardware_concurrency() - 1);
+        return false;
+    }
+    return true;
+}
+
+void necro_runtime_options_test()
+{
+    necro_announce_phase("NecroRuntimeOptions");
+    const NecroRuntimeOptions prev_options    = necro_runtime_options;
+    necro_runtime_options.sample_rate         = 48000;
+    necro_runtime_options.num_output_channels = 2;
+    necro_runtime_options.num_input_channels  = 0;
+    necro_runtime_options.rt_priority         = 0;
+    necro_runtime_options.rt_cpu              = -1;
+    necro_runtime_options.heap_size_mb        = NECRO_HEAP_MIN_SIZE_MB;
+    necro_runtime_options.num_workers         = 0;
+    // Blocks smaller than one FloatVec would leave the Array (NatDiv BlockSize 32) blocks in base.necro empty
+    const struct { size_t block_size; bool is_valid; } block_sizes[] =
+    {
+        { NECRO_AUDIO_MIN_BLOCK_SIZE / 2, false },
+        { NECRO_AUDIO_MIN_BLOCK_SIZE,     true  },
+        { 48,                             false },
+        { NECRO_AUDIO_MAX_BLOCK_SIZE,     true  },
+        { NECRO_AUDIO_MAX_BLOCK_SIZE * 2, false },
+    };
+    for (size_t i = 0; i < sizeof(block_sizes) / sizeof(block_sizes[0]); ++i)
+    {
+        necro_runtime_options.block_size = block_sizes[i].block_size;
+        const bool is_passed             = necro_runtime_options_validate() == block_sizes[i].is_valid;
+        printf("Runtime options block size %zu test: %s\n", block_sizes[i].block_size, is_passed ? "passed" : "FAILED");
+    }
+    necro_runtime_options = prev_options;
 }
 
 ///////////////////////////////////////////////////////
@@ -753,7 +2018,6 @@ HANDLE       h_out;
 DWORD        num_read;
 INPUT_RECORD input_record[32];
 COORD        mouse_coord;
-uint32_t     keyPress;
 DWORD        original_fdw_mode;
 
 extern DLLEXPORT void necro_runtime_init()
@@ -762,6 +2026,7 @@ extern DLLEXPORT void necro_runtime_init()
         return;
     is_test_true        = true;
     necro_runtime_state = NECRO_RUNTIME_RUNNING;
+    necro_runtime_controls_init();
     h_in                = GetStdHandle(STD_INPUT_HANDLE);
     h_out               = GetStdHandle(STD_OUTPUT_HANDLE);
     GetConsoleMode(h_in, &original_fdw_mode);
@@ -790,17 +2055,17 @@ extern DLLEXPORT void necro_runtime_update()
             // printf("KEY_EVENT: %d\n", i);
             if (input_record[i].Event.KeyEvent.uChar.AsciiChar == 27 || input_record[i].Event.KeyEvent.uChar.AsciiChar == 3 || input_record[i].Event.KeyEvent.uChar.AsciiChar == 4)
             {
-                necro_runtime_state = NECRO_RUNTIME_IS_DONE;
+                necro_runtime_finish();
             }
             else
             {
-              keyPress = (uint32_t) input_record[i].Event.KeyEvent.uChar.AsciiChar;
+              necro_runtime_nrt_controls.key_press = (size_t) input_record[i].Event.KeyEvent.uChar.AsciiChar;
             }
             break;
         case MOUSE_EVENT:
             // printf("MOUSE_EVENT: %d\n", i);
-            mouse_x = input_record[i].Event.MouseEvent.dwMousePosition.X;
-            mouse_y = input_record[i].Event.MouseEvent.dwMousePosition.Y;
+            necro_runtime_nrt_controls.mouse_x = (size_t) input_record[i].Event.MouseEvent.dwMousePosition.X;
+            necro_runtime_nrt_controls.mouse_y = (size_t) input_record[i].Event.MouseEvent.dwMousePosition.Y;
             break;
         case WINDOW_BUFFER_SIZE_EVENT:
             // printf("WINDOW_BUFFER_SIZE_EVENT: %d\n", i);
@@ -815,11 +2080,12 @@ extern DLLEXPORT void necro_runtime_update()
             break;
         }
     };
+    necro_runtime_controls_publish();
 }
 
 extern DLLEXPORT size_t necro_runtime_is_done()
 {
-    return necro_runtime_state >= NECRO_RUNTIME_IS_DONE;
+    return necro_atomic_load(&necro_runtime_state) >= NECRO_RUNTIME_IS_DONE;
 }
 
 extern DLLEXPORT void necro_runtime_shutdown()
@@ -836,6 +2102,7 @@ extern DLLEXPORT void necro_runtime_shutdown()
 // Runtime Unix
 ///////////////////////////////////////////////////////
 #include <unistd.h>
+#include <poll.h>
 #include <assert.h>
 
 #include <X11/Xos.h>
@@ -846,52 +2113,40 @@ extern DLLEXPORT void necro_runtime_shutdown()
 #include <X11/keysym.h>
 #include <X11/keysymdef.h>
 
-static Window root;
-static Display* display = NULL;
+///////////////////////////////////////////////////////
+// X11 input thread
+//     * All Xlib calls happen on this thread once necro_runtime_init has opened the display, so Xlib needs no locking.
+//     * The thread blocks in poll() on the X connection, key presses and pointer motion wake it and are published to the RT thread straight away.
+//     * The root window doesn't reliably get pointer motion while the pointer is over another client's window,
+//       so the pointer is also sampled with XQueryPointer (a round trip to the server) every NECRO_X11_POINTER_PERIOD_MS.
+//       That is about one update per audio block at typical block sizes, without waking the thread a thousand times a second.
+///////////////////////////////////////////////////////
+#define NECRO_X11_POINTER_PERIOD_MS 10
+#define NECRO_X11_KEY_STRING_LENGTH 16
+
+static Window              root;
+static Display*            display                    = NULL;
+static struct NecroThread* necro_x11_input_thread     = NULL;
+static volatile size_t     necro_x11_input_is_running = false;
 
 static int catchFalseAlarm()
 {
   return 0;
 }
 
-extern DLLEXPORT void necro_runtime_init()
-{
-    if (necro_runtime_state != NECRO_RUNTIME_UNINITIALIZED)
-        return;
-    is_test_true        = true;
-
-    XSetWindowAttributes attribs;
-    assert(display == NULL);
-
-    if (!(display = XOpenDisplay(0)))
-    {
-        fprintf (stderr, "Couldn't connect to %s\n", XDisplayName (0));
-        necro_exit(EXIT_FAILURE);
-    }
-
-    attribs.override_redirect = true;
-    XSetErrorHandler((XErrorHandler)catchFalseAlarm);
-    XSync(display, 0);
-
-    necro_runtime_state = NECRO_RUNTIME_RUNNING;
-}
-
 static void query_pointer(Display *d)
 {
-    static bool once = false;
     int i = 0;
     unsigned m;
     Window w;
 
-    if (once == false)
+    int mouse_x = 0;
+    int mouse_y = 0;
+    const Bool same_screen = XQueryPointer(d, root, &root, &w, &mouse_x, &mouse_y, &i, &i, &m);
+    necro_runtime_nrt_controls.mouse_x = (size_t) mouse_x;
+    necro_runtime_nrt_controls.mouse_y = (size_t) mouse_y;
+    if (!same_screen)
     {
-        once = true;
-        root = DefaultRootWindow(d);
-        /* XGrabKeyboard(d, root, True, GrabModeAsync, GrabModeAsync, CurrentTime); This is proving probelmatic as it takes control completely away. TODO: Find an alternative*/
-        XSelectInput(d, root, KeyPressMask | SubstructureNotifyMask);
-    }
-
-    if (!XQueryPointer(d, root, &root, &w, &mouse_x, &mouse_y, &i, &i, &m)) {
         for (i = 0; i < ScreenCount(d); ++i)
         {
             if (root == RootWindow(d, i))
@@ -904,64 +2159,126 @@ static void query_pointer(Display *d)
     /* printf("X: %d Y: %d\n", mouse_x, mouse_y); */
 }
 
-extern DLLEXPORT void necro_runtime_update()
+static void necro_x11_read_events(Display* d)
 {
-    if (necro_runtime_state != NECRO_RUNTIME_RUNNING)
+    XEvent keyEvent;
+    char   keyString[NECRO_X11_KEY_STRING_LENGTH] = { 0 };
+    while (XPending(d)) //Repeats until all events are computed
+    {
+        XNextEvent(d, &keyEvent); //Gets exactly one event
+        if (keyEvent.type == MotionNotify)
+        {
+            necro_runtime_nrt_controls.mouse_x = (size_t) keyEvent.xmotion.x_root;
+            necro_runtime_nrt_controls.mouse_y = (size_t) keyEvent.xmotion.y_root;
+            continue;
+        }
+        if (keyEvent.type != KeyPress)
+            continue;
+        const int resultLength = XLookupString(&keyEvent.xkey, keyString, NECRO_X11_KEY_STRING_LENGTH, NULL, NULL);
+        if (resultLength <= 0)
+            continue;
+        const char ascii = keyString[0];
+        switch(ascii)
+        {
+        case 3:
+        case 4:
+        case 27:
+          necro_runtime_finish();
+          break;
+        default:
+          necro_runtime_nrt_controls.key_press = (size_t) ascii;
+          break;
+        }
+    }
+}
+
+static void necro_x11_input_thread_fn(void* user_data)
+{
+    UNUSED(user_data);
+    root = DefaultRootWindow(display);
+    /* XGrabKeyboard(d, root, True, GrabModeAsync, GrabModeAsync, CurrentTime); This is proving probelmatic as it takes control completely away. TODO: Find an alternative*/
+    XSelectInput(display, root, KeyPressMask | PointerMotionMask | SubstructureNotifyMask);
+    XFlush(display);
+    struct pollfd  connection    = { .fd = ConnectionNumber(display), .events = POLLIN, .revents = 0 };
+    const uint64_t period_ns     = (uint64_t) NECRO_X11_POINTER_PERIOD_MS * 1000000;
+    uint64_t       next_query_ns = necro_time_ns();
+    while (necro_atomic_load(&necro_x11_input_is_running))
+    {
+        // Events already read off the connection by Xlib won't show up on the fd, only wait when there are none queued
+        const uint64_t now_ns = necro_time_ns();
+        if (XPending(display) == 0 && now_ns < next_query_ns)
+            poll(&connection, 1, (int) ((next_query_ns - now_ns + 999999) / 1000000));
+        necro_x11_read_events(display);
+        if (necro_time_ns() >= next_query_ns)
+        {
+            query_pointer(display);
+            next_query_ns = necro_time_ns() + period_ns;
+        }
+        necro_runtime_controls_publish();
+    }
+}
+
+extern DLLEXPORT void necro_runtime_init()
+{
+    if (necro_runtime_state != NECRO_RUNTIME_UNINITIALIZED)
         return;
+    is_test_true        = true;
+    necro_runtime_controls_init();
 
-    assert(display != NULL);
-    query_pointer(display);
+    XSetWindowAttributes attribs;
+    assert(display == NULL);
 
-    // Keyboard Handling
+    // Offline renders don't take user input, and are expected to run on machines without a display
+    if (necro_runtime_options.render_file_name != NULL)
     {
-      static XEvent keyEvent;
-      static const size_t KEY_STRING_LENGTH = 16;
-      static char keyString[KEY_STRING_LENGTH] = { 0 };
-      static char ascii = 0;
-      static uint32_t keyEventCode = 0;
-      static int resultLength = 0;
+        necro_runtime_state = NECRO_RUNTIME_RUNNING;
+        return;
+    }
 
-      while (XPending(display)) //Repeats until all events are computed
-      {
-        XNextEvent(display, &keyEvent); //Gets exactly one event
-        if (keyEvent.type == KeyPress)
+    if (!(display = XOpenDisplay(0)))
+    {
+        fprintf (stderr, "Couldn't connect to %s\n", XDisplayName (0));
+        // The null device is meant for headless machines, so carry on without mouse and keyboard input
+        if (necro_runtime_options.audio_device_name != NULL && strcmp(necro_runtime_options.audio_device_name, "null") == 0)
         {
-          keyEventCode = keyEvent.xkey.keycode; //Gets the key code, NOT ITS CHAR EQUIVALENT
-          /* printf("C -- KeyEventCode: %u\n", keyEventCode); */
-          resultLength = XLookupString(&keyEvent.xkey, keyString, KEY_STRING_LENGTH, NULL, NULL);
-          if (resultLength > 0) // Check size == 1?
-          {
-            /* printf("C -- keyString: %s\n", keyString); */
-            ascii = keyString[0];
-            switch(ascii)
-            {
-            case 3:
-            case 4:
-            case 27:
-              necro_runtime_state = NECRO_RUNTIME_IS_DONE;
-              break;
-            default:
-              key_press = (uint32_t) ascii;
-              break;
-            }
-          }
+            necro_runtime_state = NECRO_RUNTIME_RUNNING;
+            return;
         }
-        /* else if(keyEvent.type==keyRelease) */
-        /* { */
-        /*   uint32_t keyEventCode=KeyEvent.xkey.keycode; */
-        /*   #<{(| Code handling a KeyRelease event |)}># */
-        /* } */
-      }
+        necro_exit(EXIT_FAILURE);
     }
+
+    attribs.override_redirect = true;
+    XSetErrorHandler((XErrorHandler)catchFalseAlarm);
+    XSync(display, 0);
+
+    necro_runtime_state        = NECRO_RUNTIME_RUNNING;
+    necro_x11_input_is_running = true;
+    necro_x11_input_thread     = necro_thread_create(necro_x11_input_thread_fn, NULL);
+}
+
+// Input is gathered by the X11 input thread as it arrives, there is nothing left to poll here
+extern DLLEXPORT void necro_runtime_update()
+{
 }
 
 extern DLLEXPORT size_t necro_runtime_is_done()
 {
-    return necro_runtime_state >= NECRO_RUNTIME_IS_DONE;
+    return necro_atomic_load(&necro_runtime_state) >= NECRO_RUNTIME_IS_DONE;
 }
 
 extern DLLEXPORT void necro_runtime_shutdown()
 {
+    if (necro_x11_input_thread != NULL)
+    {
+        necro_atomic_store(&necro_x11_input_is_running, false);
+        necro_thread_join(necro_x11_input_thread);
+        necro_x11_input_thread = NULL;
+    }
+    if (display != NULL)
+    {
+        XCloseDisplay(display);
+        display = NULL;
+    }
     if (necro_runtime_state != NECRO_RUNTIME_IS_DONE)
         return;
     printf("And so it ends...\n");
@@ -13,6 +13,38 @@
 #include "result.h"
 #include "runtime_common.h"
 #include "runtime_audio.h"
+#include "runtime_telemetry.h"
+#include "runtime_scheduler.h"
+
+//--------------------
+// Runtime Options
+#define NECRO_HEAP_MIN_SIZE_MB 64
+#define NECRO_HEAP_MAX_SIZE_MB 32768 // Free lists index the heap in 16 byte units with 32 bits
+
+typedef struct NecroRuntimeOptions
+{
+    const char* audio_device_name; // Name of the audio device backend to run on, see necro_audio_device_get
+    const char* render_file_name;  // When non-NULL audio is rendered offline into this file instead of being played through the audio device
+    double      seconds;           // Length of an offline render, or when positive how long to run on the audio device before stopping
+    double      midi_latency_ms;   // Fixed delay applied to incoming MIDI so that it can be placed sample accurately, see necro_midi_rt_update. 0 picks one automatically
+    const char* audio_file_format; // Sample format of audio files written by the runtime (renders and recordAudio), see necro_audio_sample_format_from_name
+    size_t      oversample;        // necro programs run at this many times the device sample rate and block size, and are decimated back down on output
+    size_t      sample_rate;       // Device sample rate
+    size_t      block_size;        // Device block size in frames, a power of 2
+    size_t      num_output_channels;
+    size_t      num_input_channels;  // Device input channels read by inAudioBlock, 0 opens the device output only
+    size_t      rt_priority;         // When non-zero the audio callback thread asks for SCHED_FIFO at this priority (1 - 99)
+    int64_t     rt_cpu;              // When non-negative the audio callback thread is pinned to this logical cpu
+    size_t      num_workers;         // Extra threads which update independent global machines alongside the audio thread, 0 runs necro_main on the audio thread alone
+    bool        is_memory_locked;    // Locks memory into RAM (mlockall) and prefaults the heap in use and the callback thread's stack, so the RT thread never takes a page fault
+    size_t      heap_size_mb;        // Address space reserved for the heap, which is only committed as it is used. Running past it exits with "Necro memory exhausted!"
+    bool        is_heap_huge_pages;  // Asks for transparent huge pages for the heap where the OS has them (Linux), fewer TLB misses at the cost of coarser memory use
+    bool        is_alloc_audit;      // Counts heap allocations per machine, inside and outside of blocks, and reports them on shutdown. See Allocation audit in runtime.c
+    const char* stats_name;          // Shared memory segment live engine stats are published to while running on a device, NULL (the default) turns them off. See runtime_stats.h
+} NecroRuntimeOptions;
+extern NecroRuntimeOptions necro_runtime_options;
+bool                       necro_runtime_options_validate(); // Prints what's wrong and returns false when options are out of range
+void                       necro_runtime_options_test();
 
 //--------------------
 // Runtime Management
@@ -43,6 +75,7 @@ extern DLLEXPORT size_t   necro_runtime_test_assertion(size_t is_true, size_t wo
 bool                      necro_runtime_was_test_successful();
 extern DLLEXPORT size_t   necro_runtime_panic(size_t world);
 extern DLLEXPORT size_t   necro_runtime_open_file(size_t* str, uint64_t str_length);
+extern DLLEXPORT size_t   necro_runtime_open_binary_file(size_t* str, uint64_t str_length);
 extern DLLEXPORT size_t   necro_runtime_close_file(size_t file);
 extern DLLEXPORT size_t   necro_runtime_write_int_to_file(int64_t value, size_t file);
 extern DLLEXPORT size_t   necro_runtime_write_uint_to_file(uint64_t value, size_t file);
@@ -54,11 +87,15 @@ extern DLLEXPORT size_t   necro_runtime_write_char_to_file(size_t value, size_t
 typedef int NecroLangCallback(void);
 NecroResult(void)       necro_runtime_audio_init();
 NecroResult(void)       necro_runtime_audio_start(NecroLangCallback* necro_init, NecroLangCallback* necro_main, NecroLangCallback* necro_shutdown);
+NecroResult(void)       necro_runtime_audio_render(NecroLangCallback* necro_init, NecroLangCallback* necro_main, NecroLangCallback* necro_shutdown);
+void                    necro_runtime_audio_set_main_tasks(const NecroTask* main_tasks, size_t num_main_tasks, NecroLangCallback* necro_main_tail); // necro_main split into global machine updates and program main, used instead of necro_main when there are workers. Must outlive necro_runtime_audio_start
 NecroResult(void)       necro_runtime_audio_stop();
 NecroResult(void)       necro_runtime_audio_shutdown();
+NecroAudioTelemetrySnapshot necro_runtime_audio_get_telemetry(); // Block timing of the RT callback, safe to call from the NRT thread
 extern DLLEXPORT size_t necro_runtime_get_sample_rate();
 extern DLLEXPORT size_t necro_runtime_get_block_size();
 extern DLLEXPORT size_t necro_runtime_out_audio_block(size_t channel_num, double* audio_block, size_t world);
+extern DLLEXPORT double* necro_runtime_in_audio_block(size_t channel_num); // The current block of an input channel, owned by the runtime and valid until the next block
 
 //--------------------
 // MIDI
@@ -69,8 +106,14 @@ extern DLLEXPORT uint64_t  necro_runtime_get_num_buffered_midi_messages(size_t _
 
 //--------------------
 // Memory
-extern DLLEXPORT uint8_t* necro_runtime_alloc(size_t size);
-extern DLLEXPORT uint8_t* necro_runtime_realloc(uint8_t* ptr, size_t size);
-extern DLLEXPORT void     necro_runtime_free(uint8_t* data);
+#define NECRO_ALLOC_SITE_RUNTIME 0 // Site id of allocations made by the runtime itself, compiled programs number theirs from 1
+extern DLLEXPORT uint8_t* necro_runtime_alloc(size_t size, size_t site);                 // Zeroed. Never locks, safe on the RT thread and scheduler workers. site is counted by the allocation audit
+extern DLLEXPORT uint8_t* necro_runtime_realloc(uint8_t* ptr, size_t size, size_t site);   // Keeps the contents, growing in place when the block has room
+extern DLLEXPORT void     necro_runtime_free(uint8_t* data);                               // Ignores pointers which didn't come from necro_runtime_alloc, such as NULL
+extern DLLEXPORT uint8_t* necro_runtime_frame_alloc(size_t size, size_t site);           // Zeroed, and only valid until the end of the block. Never locks
+void                      necro_runtime_frame_reset();                                     // Frees every frame allocation, once the block is done
+void                      necro_runtime_set_alloc_sites(const char* const* site_names, size_t num_sites); // Names the allocation audit reports sites by, indexed by site id. Must outlive necro_runtime_audio_start
+size_t                    necro_runtime_alloc_audit_block_allocs();                        // Heap allocations made inside blocks during the last audited run, for tests
+void                      necro_heap_test();
 
 #endif // RUNTIME_H
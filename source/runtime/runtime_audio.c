@@ -10,181 +10,484 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <sys/stat.h>
 #include "runtime_audio.h"
 #include "sndfile.h"
 #include "utility/utility.h"
 #include "runtime.h"
+#include "runtime_resample.h"
+#include "runtime_thread.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NECRO_AUDIO_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define NECRO_AUDIO_X86 0
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NECRO_AUDIO_SSE2 1
+#else
+#define NECRO_AUDIO_SSE2 0
+#endif
 
 ///////////////////////////////////////////////////////
 // NecroDownsample
 ///////////////////////////////////////////////////////
-
 /*
-    FIR filter, Windowing design:
-        * 1. Set filter sepcifications
-        * 2. Calculate ideal filter response
-        * 3. Generate coefficients by convolving ideal filter response with window function
-        * 4. Multiply block by coefficients and sum
-    Downsample setup:
-        * Filter out frequencies above new nyquist
-        * Decimate
+    Oversampled output:
+        * With an oversample factor of M, necro programs run at M times the device's sample rate and block size,
+          and each output channel is brought back down to the device rate here before being interleaved.
+        * Decimation is a Kaiser windowed-sinc low pass (see runtime_resample.h) with its cutoff at the device nyquist,
+          evaluated only at the output samples we keep, which is the same work as a polyphase decimator.
+        * The filter is NECRO_DOWNSAMPLE_TAPS_PER_FACTOR * M taps long, so the transition band is the same width at
+          the device rate whatever M is: roughly 20khz to 28khz at 48khz, where anything folding back lands above 20khz.
+        * The delay line is linear: num_taps - 1 samples of history followed by the current input block,
+          so every output is a single contiguous dot product against the reversed coefficients. History is
+          shifted down once per block instead of masking an index on every tap.
+        * The dot product picks AVX + FMA at runtime when the cpu has it, falling back to SSE2 and then scalar code.
 */
+#define NECRO_DOWNSAMPLE_TAPS_PER_FACTOR 32
 
-#define NECRO_DOWNSAMPLE_FILTER_NUM_TAPS      128
-#define NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK 127
+typedef double NecroDownsampleDotFn(const double* samples, const double* coefficients, const size_t num_taps);
 
 typedef struct NecroDownsample
 {
-    size_t sample_buffer_index;
-    double sample_buffer[NECRO_DOWNSAMPLE_FILTER_NUM_TAPS];
-    double coefficients[NECRO_DOWNSAMPLE_FILTER_NUM_TAPS];
+    size_t                factor;
+    size_t                block_size;   // Frames per output block
+    size_t                num_taps;     // Always a multiple of 8
+    double*               coefficients; // Reversed
+    double*               delay_line;   // num_taps - 1 samples of history followed by one input block
+    NecroDownsampleDotFn* dot;
 } NecroDownsample;
 
-double necro_sinc(const double x)
+static double necro_downsample_dot_scalar(const double* samples, const double* coefficients, const size_t num_taps)
 {
-    if (x > -1.0E-5 && x < 1.0E-5)
-        return(1.0);
-    return sin(x) / x;
+    double acc0 = 0.0;
+    double acc1 = 0.0;
+    double acc2 = 0.0;
+    double acc3 = 0.0;
+    for (size_t i = 0; i < num_taps; i += 4)
+    {
+        acc0 += samples[i]     * coefficients[i];
+        acc1 += samples[i + 1] * coefficients[i + 1];
+        acc2 += samples[i + 2] * coefficients[i + 2];
+        acc3 += samples[i + 3] * coefficients[i + 3];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
 }
 
-double bessel(double x)
+#if NECRO_AUDIO_SSE2
+static double necro_downsample_dot_sse2(const double* samples, const double* coefficients, const size_t num_taps)
 {
-    double sum  = 0.0;
-    for (size_t i = 1; i < 10; ++i)
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (size_t i = 0; i < num_taps; i += 4)
     {
-        const double xpow = pow(x / 2.0, (double)i);
-        size_t factorial = 1;
-        for (size_t j = 1; j <= i; ++j)
-            factorial *= j;
-        sum += pow(xpow / (double)factorial, 2.0);
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(samples + i),     _mm_loadu_pd(coefficients + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(samples + i + 2), _mm_loadu_pd(coefficients + i + 2)));
     }
-    return 1.0 + sum;
+    acc0 = _mm_add_pd(acc0, acc1);
+    acc0 = _mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0));
+    return _mm_cvtsd_f64(acc0);
 }
+#endif
+
+#if NECRO_AUDIO_X86
+#if defined(_MSC_VER)
+#define NECRO_TARGET_AVX_FMA
+#else
+#define NECRO_TARGET_AVX_FMA __attribute__((target("avx,fma")))
+#endif
 
-// Refer to the book "Spectral Audio Signal Processing" for more info on windowing
-// Refer to site iowahills.com for more information on windowing.
-NecroDownsample* necro_downsample_create(const double freq_cutoff, const double sample_rate)
+NECRO_TARGET_AVX_FMA static double necro_downsample_dot_avx_fma(const double* samples, const double* coefficients, const size_t num_taps)
 {
-    NecroDownsample* downsample = emalloc(sizeof(NecroDownsample));
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for (size_t i = 0; i < num_taps; i += 8)
+    {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(samples + i),     _mm256_loadu_pd(coefficients + i),     acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(samples + i + 4), _mm256_loadu_pd(coefficients + i + 4), acc1);
+    }
+    acc0         = _mm256_add_pd(acc0, acc1);
+    __m128d acc  = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+    acc          = _mm_add_sd(acc, _mm_unpackhi_pd(acc, acc));
+    return _mm_cvtsd_f64(acc);
+}
 
-    //--------------------
-    // Init Sample Buffer
-    downsample->sample_buffer_index = 0;
-    for (size_t i = 0; i < NECRO_DOWNSAMPLE_FILTER_NUM_TAPS; ++i)
-        downsample->sample_buffer[i] = 0;
-
-    //--------------------
-    // Create FIR coefficients
-    const double omega_c = freq_cutoff / sample_rate; // Normalized frequencies, 0 - 1
-    const double m       = NECRO_DOWNSAMPLE_FILTER_NUM_TAPS - 1;
-    for (size_t i = 0; i < NECRO_DOWNSAMPLE_FILTER_NUM_TAPS; ++i)
-    {
-        const double arg = ((double) i) - (m / 2.0); // Shift to make filter causal
-        downsample->coefficients[i]  = omega_c * necro_sinc(omega_c * arg * M_PI);
-    }
-
-    //--------------------
-    // Convolve FIR coefficients with window
-    const double dm   = m + 1;
-    const double beta = 5.0; // range is 1 -> 10
-    for (size_t i = 0; i < NECRO_DOWNSAMPLE_FILTER_NUM_TAPS; ++i)
-    {
-        // double ri = (double) i + 1;
-        // Hanning
-        // downsample->coefficients[i] *= 0.5 - 0.5 * cos(2.0 * M_PI * ri / dm);
-        // Hamming
-        // downsample->coefficients[i] *= 0.54 - 0.46 * cos(2.0 * M_PI * ri / dm);
-        // Nuttall
-        // downsample->coefficients[i]  *= 0.355768 - 0.487396 * cos((2.0 * M_PI * ri) / dm) + 0.144232 * cos((4.0 * M_PI * ri) / dm) - 0.012604 * cos((6.0 * M_PI * ri) / dm);
-        // Blackman - Nuttall
-        // downsample->coefficients[i]  *= 0.3635819 - 0.4891775 * cos((2.0 * M_PI * ri) / dm) + 0.1365995 * cos((4.0 * M_PI * ri) / dm) - 0.0106411 * cos((6.0 * M_PI * ri) / dm);
-        // Blackman - Harris
-        // downsample->coefficients[i]  *= 0.35875 - 0.48829 * cos((2.0 * M_PI * ri) / dm) + 0.14128 * cos((4.0 * M_PI * ri) / dm) - 0.01168 * cos((6.0 * M_PI * ri) / dm);
-        // Sinc
-        // downsample->coefficients[i] *= pow(necro_sinc((((double) (2 * i + 1 - NECRO_DOWNSAMPLE_FILTER_NUM_TAPS)) / m) * M_PI), beta);
-        // Sine
-        // downsample->coefficients[i] *= pow(sin(((double) (i + 1)) * M_PI / dm), beta);
-        // Kaiser-Bessel
-        double arg = beta * sqrt(1.0 - pow((((double)(2 * i + 2)) - dm) / dm, 2.0));
-        downsample->coefficients[i] *= bessel(arg) / bessel(beta);
-    }
-
-    // Unity gain adjustment
-    double gain_sum = 0.0;
-    for (size_t i = 0; i < NECRO_DOWNSAMPLE_FILTER_NUM_TAPS; ++i)
-        gain_sum += downsample->coefficients[i];
-    gain_sum /= (double) NECRO_DOWNSAMPLE_FILTER_NUM_TAPS;
-    for (size_t i = 0; i < NECRO_DOWNSAMPLE_FILTER_NUM_TAPS; ++i)
-        downsample->coefficients[i] *= gain_sum;
-
-    // for (size_t i = NECRO_DOWNSAMPLE_FILTER_NUM_TAPS / 2; i < NECRO_DOWNSAMPLE_FILTER_NUM_TAPS; ++i)
-    //     downsample->coefficients[i] *= 0.0;
+static bool necro_downsample_cpu_has_avx_fma()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool has_os_xsave = (info[2] & (1 << 27)) != 0;
+    const bool has_avx      = (info[2] & (1 << 28)) != 0;
+    const bool has_fma      = (info[2] & (1 << 12)) != 0;
+    // The OS has to save the ymm registers too
+    return has_os_xsave && has_avx && has_fma && (_xgetbv(0) & 6) == 6;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
 
+static NecroDownsampleDotFn* necro_downsample_best_dot()
+{
+#if NECRO_AUDIO_X86
+    if (necro_downsample_cpu_has_avx_fma())
+        return necro_downsample_dot_avx_fma;
+#endif
+#if NECRO_AUDIO_SSE2
+    return necro_downsample_dot_sse2;
+#else
+    return necro_downsample_dot_scalar;
+#endif
+}
+
+NecroDownsample* necro_downsample_create(const size_t factor, const size_t block_size)
+{
+    assert(factor > 1);
+    assert(block_size > 0);
+    NecroDownsample* downsample = emalloc(sizeof(NecroDownsample));
+    downsample->factor          = factor;
+    downsample->block_size      = block_size;
+    downsample->num_taps        = NECRO_DOWNSAMPLE_TAPS_PER_FACTOR * factor;
+    downsample->coefficients    = emalloc(downsample->num_taps * sizeof(double));
+    downsample->delay_line      = emalloc((downsample->num_taps - 1 + block_size * factor) * sizeof(double));
+    downsample->dot             = necro_downsample_best_dot();
+    memset(downsample->delay_line, 0, (downsample->num_taps - 1 + block_size * factor) * sizeof(double));
+    // The filter is symmetric, so reversing it is only a matter of where it's centred. Normalized to unity gain at DC
+    const double center = ((double) downsample->num_taps - 1.0) / 2.0;
+    double       sum    = 0.0;
+    for (size_t i = 0; i < downsample->num_taps; ++i)
+    {
+        downsample->coefficients[i] = necro_resample_kaiser_sinc((double) i - center, 1.0 / (double) factor, (double) downsample->num_taps / 2.0);
+        sum                        += downsample->coefficients[i];
+    }
+    for (size_t i = 0; i < downsample->num_taps; ++i)
+        downsample->coefficients[i] /= sum;
     return downsample;
 }
 
-void necro_downsample(NecroDownsample* downsample, const size_t output_channel, const size_t num_output_channels, const size_t block_size, const size_t oversample_mul, double* input_buffer, float* output_buffer)
+void necro_downsample_destroy(NecroDownsample* downsample)
 {
-    //--------------------
-    // Downsample and output
-    size_t out_i = output_channel;
-    for (size_t i = 0; i < block_size; ++i)
+    if (downsample == NULL)
+        return;
+    free(downsample->coefficients);
+    free(downsample->delay_line);
+    free(downsample);
+}
+
+void necro_downsample(NecroDownsample* downsample, const double* input_block, double* output_block)
+{
+    const size_t factor         = downsample->factor;
+    const size_t num_taps       = downsample->num_taps;
+    const size_t history        = num_taps - 1;
+    const size_t num_input      = downsample->block_size * factor;
+    double*      delay_line     = downsample->delay_line;
+    memcpy(delay_line + history, input_block, num_input * sizeof(double));
+    // Output n lines up with the last input sample of its group of factor samples
+    for (size_t i = 0; i < downsample->block_size; ++i)
+        output_block[i] = downsample->dot(delay_line + i * factor + factor - 1, downsample->coefficients, num_taps);
+    memmove(delay_line, delay_line + num_input, history * sizeof(double));
+}
+
+// Peak level of a sine at frequency (at the oversampled rate) after decimation, skipping the blocks the filter needs to settle
+static double necro_downsample_test_peak(NecroDownsample* downsample, const double frequency, const double sample_rate)
+{
+    const size_t num_blocks = 64;
+    const size_t num_input  = downsample->block_size * downsample->factor;
+    double*      input      = emalloc(num_input * sizeof(double));
+    double*      output     = emalloc(downsample->block_size * sizeof(double));
+    double       peak       = 0.0;
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        for (size_t i = 0; i < num_input; ++i)
+            input[i] = sin(2.0 * 3.14159265358979323846 * frequency * (double) (b * num_input + i) / sample_rate);
+        necro_downsample(downsample, input, output);
+        for (size_t i = 0; b >= num_blocks / 2 && i < downsample->block_size; ++i)
+            peak = fmax(peak, fabs(output[i]));
+    }
+    free(input);
+    free(output);
+    return peak;
+}
+
+static double necro_upsample_test_peak(struct NecroUpsample* upsample, const double frequency, const double sample_rate);
+
+void necro_downsample_test()
+{
+    necro_announce_phase("NecroDownsample");
+    const size_t device_rate = 48000;
+    const size_t block_size  = 256;
+    const size_t factors[]   = { 2, 4, 8 };
+    for (size_t f = 0; f < sizeof(factors) / sizeof(size_t); ++f)
+    {
+        const size_t     factor     = factors[f];
+        const double     rate       = (double) (device_rate * factor);
+        NecroDownsample* downsample = necro_downsample_create(factor, block_size);
+        // Passband: 1khz comes through at unity gain
+        const double passband_db = 20.0 * log10(necro_downsample_test_peak(downsample, 1000.0, rate));
+        if (fabs(passband_db) < 0.01)
+            printf("Downsample x%d passband test: passed\n", (int) factor);
+        else
+            printf("Downsample x%d passband test: FAILED, gain: %f db\n", (int) factor, passband_db);
+        necro_downsample_destroy(downsample);
+        // Stopband: 40khz would alias down to 8khz at the device rate, it has to be gone
+        downsample = necro_downsample_create(factor, block_size);
+        const double alias_db = 20.0 * log10(necro_downsample_test_peak(downsample, 40000.0, rate));
+        if (alias_db < -80.0)
+            printf("Downsample x%d alias rejection test: passed\n", (int) factor);
+        else
+            printf("Downsample x%d alias rejection test: FAILED, gain: %f db\n", (int) factor, alias_db);
+        necro_downsample_destroy(downsample);
+        // Upsampling passband: 1khz at the device rate comes through at unity gain at the oversampled rate
+        struct NecroUpsample* upsample    = necro_upsample_create(factor, block_size);
+        const double          upsample_db = 20.0 * log10(necro_upsample_test_peak(upsample, 1000.0, (double) device_rate));
+        if (fabs(upsample_db) < 0.01)
+            printf("Upsample x%d passband test: passed\n", (int) factor);
+        else
+            printf("Upsample x%d passband test: FAILED, gain: %f db\n", (int) factor, upsample_db);
+        necro_upsample_destroy(upsample);
+    }
+
+    // Benchmark: time per channel per device block against the time the block has to be delivered in
+    const char*           kernel_names[] = { "scalar", "sse2", "avx+fma" };
+    NecroDownsampleDotFn* kernels[]      =
     {
-        const size_t oversample_i = i * oversample_mul;
+        necro_downsample_dot_scalar,
+#if NECRO_AUDIO_SSE2
+        necro_downsample_dot_sse2,
+#else
+        NULL,
+#endif
+#if NECRO_AUDIO_X86
+        necro_downsample_cpu_has_avx_fma() ? necro_downsample_dot_avx_fma : NULL,
+#else
+        NULL,
+#endif
+    };
+    const size_t num_blocks  = 2000;
+    const double deadline_ns = (1000000000.0 * (double) block_size) / (double) device_rate;
+    for (size_t f = 0; f < sizeof(factors) / sizeof(size_t); ++f)
+    {
+        const size_t factor = factors[f];
+        double*      input  = emalloc(block_size * factor * sizeof(double));
+        double*      output = emalloc(block_size * sizeof(double));
+        for (size_t i = 0; i < block_size * factor; ++i)
+            input[i] = sin((double) i * 0.01);
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(NecroDownsampleDotFn*); ++k)
+        {
+            if (kernels[k] == NULL)
+                continue;
+            NecroDownsample* downsample = necro_downsample_create(factor, block_size);
+            downsample->dot             = kernels[k];
+            const uint64_t   start_ns   = necro_time_ns();
+            for (size_t b = 0; b < num_blocks; ++b)
+                necro_downsample(downsample, input, output);
+            const double block_ns = (double) (necro_time_ns() - start_ns) / (double) num_blocks;
+            printf("Downsample x%d %-8s %8.0f ns per block per channel, %5.2f%% of the block deadline\n", (int) factor, kernel_names[k], block_ns, 100.0 * block_ns / deadline_ns);
+            necro_downsample_destroy(downsample);
+        }
+        free(input);
+        free(output);
+    }
+}
+
+///////////////////////////////////////////////////////
+// NecroUpsample
+///////////////////////////////////////////////////////
+/*
+    Oversampled input:
+        * The counterpart of NecroDownsample, audio input arrives at the device rate and is brought up to the
+          oversampled rate the necro program runs at.
+        * Uses the same Kaiser windowed-sinc low pass as decimation, applied to the input with factor - 1 zeros
+          stuffed between each sample. Those zeros are never multiplied: each output phase p only ever touches every
+          factor'th coefficient starting at p, so the filter is split into factor polyphase sub-filters of
+          NECRO_DOWNSAMPLE_TAPS_PER_FACTOR taps, each stored reversed and contiguous for the shared dot product.
+        * The delay line holds the last NECRO_DOWNSAMPLE_TAPS_PER_FACTOR - 1 input samples followed by the current block.
+*/
+typedef struct NecroUpsample
+{
+    size_t                factor;
+    size_t                block_size;   // Frames per input block
+    size_t                num_taps;     // Per phase, always a multiple of 8
+    double*               coefficients; // factor runs of num_taps, each reversed
+    double*               delay_line;   // num_taps - 1 samples of history followed by one input block
+    NecroDownsampleDotFn* dot;
+} NecroUpsample;
 
-        //--------------------
-        // 1. Insert samples into delay line
-        for (size_t o = 0; o < oversample_mul; ++o)
+NecroUpsample* necro_upsample_create(const size_t factor, const size_t block_size)
+{
+    assert(factor > 1);
+    assert(block_size > 0);
+    NecroUpsample* upsample  = emalloc(sizeof(NecroUpsample));
+    upsample->factor         = factor;
+    upsample->block_size     = block_size;
+    upsample->num_taps       = NECRO_DOWNSAMPLE_TAPS_PER_FACTOR;
+    upsample->coefficients   = emalloc(upsample->num_taps * factor * sizeof(double));
+    upsample->delay_line     = emalloc((upsample->num_taps - 1 + block_size) * sizeof(double));
+    upsample->dot            = necro_downsample_best_dot();
+    memset(upsample->delay_line, 0, (upsample->num_taps - 1 + block_size) * sizeof(double));
+    // Prototype filter normalized to a gain of factor at DC, making up for the zeros stuffed between samples
+    const size_t prototype_taps = upsample->num_taps * factor;
+    const double center         = ((double) prototype_taps - 1.0) / 2.0;
+    double       sum            = 0.0;
+    for (size_t i = 0; i < prototype_taps; ++i)
+        sum += necro_resample_kaiser_sinc((double) i - center, 1.0 / (double) factor, (double) prototype_taps / 2.0);
+    for (size_t phase = 0; phase < factor; ++phase)
+    {
+        double* phase_coefficients = upsample->coefficients + phase * upsample->num_taps;
+        for (size_t tap = 0; tap < upsample->num_taps; ++tap)
         {
-            downsample->sample_buffer[downsample->sample_buffer_index] = input_buffer[oversample_i + o];
-            downsample->sample_buffer_index                            = (downsample->sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
+            const size_t i          = phase + (upsample->num_taps - 1 - tap) * factor;
+            phase_coefficients[tap] = necro_resample_kaiser_sinc((double) i - center, 1.0 / (double) factor, (double) prototype_taps / 2.0) * (double) factor / sum;
         }
+    }
+    return upsample;
+}
 
-        //--------------------
-        // 2. FIR Filter
-        double fir_result          = 0.0;
-        size_t sample_buffer_index = downsample->sample_buffer_index;
-        size_t coefficient_index   = 0;
-        while (coefficient_index < NECRO_DOWNSAMPLE_FILTER_NUM_TAPS)
+void necro_upsample_destroy(NecroUpsample* upsample)
+{
+    if (upsample == NULL)
+        return;
+    free(upsample->coefficients);
+    free(upsample->delay_line);
+    free(upsample);
+}
+
+void necro_upsample(NecroUpsample* upsample, const double* input_block, double* output_block)
+{
+    const size_t factor     = upsample->factor;
+    const size_t num_taps   = upsample->num_taps;
+    const size_t history    = num_taps - 1;
+    double*      delay_line = upsample->delay_line;
+    memcpy(delay_line + history, input_block, upsample->block_size * sizeof(double));
+    for (size_t i = 0; i < upsample->block_size; ++i)
+    {
+        for (size_t phase = 0; phase < factor; ++phase)
+            output_block[i * factor + phase] = upsample->dot(delay_line + i, upsample->coefficients + phase * num_taps, num_taps);
+    }
+    memmove(delay_line, delay_line + upsample->block_size, history * sizeof(double));
+}
+
+// Peak level of a sine at frequency (at the device rate) after upsampling, skipping the blocks the filter needs to settle
+static double necro_upsample_test_peak(NecroUpsample* upsample, const double frequency, const double sample_rate)
+{
+    const size_t num_blocks = 64;
+    const size_t num_output = upsample->block_size * upsample->factor;
+    double*      input      = emalloc(upsample->block_size * sizeof(double));
+    double*      output     = emalloc(num_output * sizeof(double));
+    double       peak       = 0.0;
+    for (size_t b = 0; b < num_blocks; ++b)
+    {
+        for (size_t i = 0; i < upsample->block_size; ++i)
+            input[i] = sin(2.0 * 3.14159265358979323846 * frequency * (double) (b * upsample->block_size + i) / sample_rate);
+        necro_upsample(upsample, input, output);
+        for (size_t i = 0; b >= num_blocks / 2 && i < num_output; ++i)
+            peak = fmax(peak, fabs(output[i]));
+    }
+    free(input);
+    free(output);
+    return peak;
+}
+
+///////////////////////////////////////////////////////
+// Interleave
+///////////////////////////////////////////////////////
+/*
+    Converts a block of planar double channels into the interleaved float layout audio devices and libsndfile expect.
+    Mono and stereo (the common cases) convert 4 frames at a time with SSE2, or AVX when the compiler targets it.
+    Everything else, and any leftover frames, falls back to a scalar strided loop.
+*/
+#if NECRO_AUDIO_SSE2
+static inline __m128 necro_interleave_cvt4(const double* samples)
+{
+#if defined(__AVX__)
+    return _mm256_cvtpd_ps(_mm256_loadu_pd(samples));
+#else
+    return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(samples)), _mm_cvtpd_ps(_mm_loadu_pd(samples + 2)));
+#endif
+}
+#endif
+
+void necro_audio_interleave_to_float(const double* planar_buffer, const size_t num_channels, const size_t num_frames, float* interleaved_buffer)
+{
+    size_t frame = 0;
+#if NECRO_AUDIO_SSE2
+    if (num_channels == 1)
+    {
+        for (; frame + 4 <= num_frames; frame += 4)
+            _mm_storeu_ps(interleaved_buffer + frame, necro_interleave_cvt4(planar_buffer + frame));
+    }
+    else if (num_channels == 2)
+    {
+        const double* left  = planar_buffer;
+        const double* right = planar_buffer + num_frames;
+        for (; frame + 4 <= num_frames; frame += 4)
         {
-            // Manually unroll 8 times
-            fir_result          += downsample->sample_buffer[sample_buffer_index] * downsample->coefficients[coefficient_index];
-            sample_buffer_index  = (sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
-            coefficient_index++;
-
-            fir_result          += downsample->sample_buffer[sample_buffer_index] * downsample->coefficients[coefficient_index];
-            sample_buffer_index  = (sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
-            coefficient_index++;
-
-            fir_result          += downsample->sample_buffer[sample_buffer_index] * downsample->coefficients[coefficient_index];
-            sample_buffer_index  = (sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
-            coefficient_index++;
-
-            fir_result          += downsample->sample_buffer[sample_buffer_index] * downsample->coefficients[coefficient_index];
-            sample_buffer_index  = (sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
-            coefficient_index++;
-
-            fir_result          += downsample->sample_buffer[sample_buffer_index] * downsample->coefficients[coefficient_index];
-            sample_buffer_index  = (sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
-            coefficient_index++;
-
-            fir_result          += downsample->sample_buffer[sample_buffer_index] * downsample->coefficients[coefficient_index];
-            sample_buffer_index  = (sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
-            coefficient_index++;
-
-            fir_result          += downsample->sample_buffer[sample_buffer_index] * downsample->coefficients[coefficient_index];
-            sample_buffer_index  = (sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
-            coefficient_index++;
-
-            fir_result          += downsample->sample_buffer[sample_buffer_index] * downsample->coefficients[coefficient_index];
-            sample_buffer_index  = (sample_buffer_index + 1) & NECRO_DOWNSAMPLE_FILTER_NUM_TAPS_MASK;
-            coefficient_index++;
+            const __m128 l = necro_interleave_cvt4(left + frame);
+            const __m128 r = necro_interleave_cvt4(right + frame);
+            _mm_storeu_ps(interleaved_buffer + frame * 2,     _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(interleaved_buffer + frame * 2 + 4, _mm_unpackhi_ps(l, r));
         }
+    }
+#endif
+    for (size_t channel = 0; channel < num_channels; ++channel)
+    {
+        const double* planar_channel = planar_buffer + channel * num_frames;
+        for (size_t i = frame; i < num_frames; ++i)
+            interleaved_buffer[i * num_channels + channel] = (float) planar_channel[i];
+    }
+}
+
+/*
+    The reverse of necro_audio_interleave_to_float, splits the device's interleaved float input into planar double channels.
+    Mono and stereo de-interleave and widen 4 frames at a time, everything else falls back to a scalar strided loop.
+*/
+#if NECRO_AUDIO_SSE2
+static inline void necro_deinterleave_cvt4(const __m128 samples, double* planar_samples)
+{
+#if defined(__AVX__)
+    _mm256_storeu_pd(planar_samples, _mm256_cvtps_pd(samples));
+#else
+    _mm_storeu_pd(planar_samples,     _mm_cvtps_pd(samples));
+    _mm_storeu_pd(planar_samples + 2, _mm_cvtps_pd(_mm_movehl_ps(samples, samples)));
+#endif
+}
+#endif
 
-        //--------------------
-        // 3. Decimate at new sample rate
-        output_buffer[out_i] = (float)fir_result;
-        out_i               += num_output_channels;
+void necro_audio_deinterleave_from_float(const float* interleaved_buffer, const size_t num_channels, const size_t num_frames, double* planar_buffer)
+{
+    size_t frame = 0;
+#if NECRO_AUDIO_SSE2
+    if (num_channels == 1)
+    {
+        for (; frame + 4 <= num_frames; frame += 4)
+            necro_deinterleave_cvt4(_mm_loadu_ps(interleaved_buffer + frame), planar_buffer + frame);
+    }
+    else if (num_channels == 2)
+    {
+        double* left  = planar_buffer;
+        double* right = planar_buffer + num_frames;
+        for (; frame + 4 <= num_frames; frame += 4)
+        {
+            const __m128 lr0 = _mm_loadu_ps(interleaved_buffer + frame * 2);
+            const __m128 lr1 = _mm_loadu_ps(interleaved_buffer + frame * 2 + 4);
+            necro_deinterleave_cvt4(_mm_shuffle_ps(lr0, lr1, _MM_SHUFFLE(2, 0, 2, 0)), left + frame);
+            necro_deinterleave_cvt4(_mm_shuffle_ps(lr0, lr1, _MM_SHUFFLE(3, 1, 3, 1)), right + frame);
+        }
+    }
+#endif
+    for (size_t channel = 0; channel < num_channels; ++channel)
+    {
+        double* planar_channel = planar_buffer + channel * num_frames;
+        for (size_t i = frame; i < num_frames; ++i)
+            planar_channel[i] = (double) interleaved_buffer[i * num_channels + channel];
     }
 }
 
@@ -197,11 +500,107 @@ typedef struct NecroRuntimeAudioFile
 
 static const NecroRuntimeAudioFile NULL_AUDIO_FILE = { 0, 0, NULL };
 
+///////////////////////////////////////////////////////
+// NecroAudioFileCache
+///////////////////////////////////////////////////////
+/*
+    Audio files are read only, so every audioFileOpen of the same file can share one decoded copy.
+        * Entries are keyed by canonical path, so different spellings of the same path hit, plus modification time,
+          so a file rewritten while the program runs is decoded afresh rather than served stale.
+        * Only successful loads are cached, a missing file is retried on every open.
+        * Decoded data lives in the necro heap, so the cache is emptied at shutdown along with it.
+        * audioFileOpen is never called from two threads at once (see mach_schedule.h), so the list isn't locked.
+          The counters are atomic only so the RT thread can publish them.
+*/
+typedef struct NecroAudioFileCacheEntry
+{
+    char*                            path;
+    int64_t                          modified_time;
+    NecroRuntimeAudioFile*           audio_file;
+    struct NecroAudioFileCacheEntry* next;
+} NecroAudioFileCacheEntry;
+
+static NecroAudioFileCacheEntry* necro_audio_file_cache            = NULL;
+static volatile size_t           necro_audio_file_cache_num_hits   = 0;
+static volatile size_t           necro_audio_file_cache_num_misses = 0;
+
+// NULL if the file doesn't exist, otherwise an emalloc'd absolute path with links resolved, and the file's modification time
+static char* necro_audio_file_cache_key(const char* file_name, int64_t* out_modified_time)
+{
+#ifdef _WIN32
+    struct _stat64 file_stat;
+    if (_stat64(file_name, &file_stat) != 0)
+        return NULL;
+    char* path = _fullpath(NULL, file_name, 0);
+#else
+    struct stat file_stat;
+    if (stat(file_name, &file_stat) != 0)
+        return NULL;
+    char* path = realpath(file_name, NULL);
+#endif
+    if (path == NULL)
+        return NULL;
+    *out_modified_time = (int64_t) file_stat.st_mtime;
+    return path;
+}
+
+static NecroRuntimeAudioFile* necro_audio_file_cache_find(const char* path, int64_t modified_time)
+{
+    for (NecroAudioFileCacheEntry* entry = necro_audio_file_cache; entry != NULL; entry = entry->next)
+    {
+        if (entry->modified_time == modified_time && strcmp(entry->path, path) == 0)
+            return entry->audio_file;
+    }
+    return NULL;
+}
+
+// Takes ownership of path
+static void necro_audio_file_cache_insert(char* path, int64_t modified_time, NecroRuntimeAudioFile* audio_file)
+{
+    NecroAudioFileCacheEntry* entry = emalloc(sizeof(NecroAudioFileCacheEntry));
+    entry->path                     = path;
+    entry->modified_time            = modified_time;
+    entry->audio_file               = audio_file;
+    entry->next                     = necro_audio_file_cache;
+    necro_audio_file_cache          = entry;
+}
+
+size_t necro_runtime_audio_file_cache_num_hits()
+{
+    return necro_atomic_load(&necro_audio_file_cache_num_hits);
+}
+
+size_t necro_runtime_audio_file_cache_num_misses()
+{
+    return necro_atomic_load(&necro_audio_file_cache_num_misses);
+}
+
+void necro_runtime_audio_file_cache_shutdown()
+{
+    const size_t num_hits   = necro_atomic_load(&necro_audio_file_cache_num_hits);
+    const size_t num_misses = necro_atomic_load(&necro_audio_file_cache_num_misses);
+    if (num_hits + num_misses > 0)
+        printf("Audio file cache: %zu hits, %zu misses\n", num_hits, num_misses);
+    NecroAudioFileCacheEntry* entry = necro_audio_file_cache;
+    while (entry != NULL)
+    {
+        NecroAudioFileCacheEntry* next = entry->next;
+        free(entry->path);
+        free(entry);
+        entry = next;
+    }
+    necro_audio_file_cache = NULL;
+    necro_atomic_store(&necro_audio_file_cache_num_hits, 0);
+    necro_atomic_store(&necro_audio_file_cache_num_misses, 0);
+}
+
 /*
     Note: AudioFiles opened in the manner are READ ONLY,
     thus we're dynamically allocating memory and then simply never cleaning them up as they are expected to live for the life of the program.
     This is to maximize their ease of usage in a typical necro program (load some immutable audio files to be used for samples and fun audio processing).
     A different API is required for write or read/write audio files which can be mutated and which can be manually cleaned up
+    Files recorded at a different sample rate are converted to the runtime sample rate as they're loaded (see runtime_resample.h).
+    Opening a file which is already loaded returns the same audio file, see NecroAudioFileCache.
 */
 extern DLLEXPORT const size_t* necro_runtime_open_audio_file(const size_t* a_name, const uint64_t a_name_length)
 {
@@ -220,6 +619,19 @@ extern DLLEXPORT const size_t* necro_runtime_open_audio_file(const size_t* a_nam
     }
     file_name[a_name_length] = '\0';
 
+    // Already loaded?
+    int64_t                modified_time = 0;
+    char*                  cache_path    = necro_audio_file_cache_key(file_name, &modified_time);
+    NecroRuntimeAudioFile* cached_file   = cache_path != NULL ? necro_audio_file_cache_find(cache_path, modified_time) : NULL;
+    if (cached_file != NULL)
+    {
+        necro_atomic_fetch_add(&necro_audio_file_cache_num_hits, 1);
+        free(cache_path);
+        free(file_name);
+        return (size_t*) cached_file;
+    }
+    necro_atomic_fetch_add(&necro_audio_file_cache_num_misses, 1);
+
     // Load file and file info
     SF_INFO	sf_info;
 	memset (&sf_info, 0, sizeof(sf_info)); // Yes, this is in fact the way in which libsndfile wants you to initialize the SF_INFO struct...
@@ -231,168 +643,829 @@ extern DLLEXPORT const size_t* necro_runtime_open_audio_file(const size_t* a_nam
         fprintf(stderr, "Unable to open audio file: %s\n", file_name);
         puts(sf_strerror(NULL));
         fprintf(stderr, "\n\n");
+        free(cache_path);
+        free(file_name);
         return (size_t*) &NULL_AUDIO_FILE;
     }
 
-    // TODO / HACK: We're not worrying about sample rate conversion for the time being. When we have more time fill it in here!
-    if ((size_t)sf_info.samplerate != necro_runtime_audio_sample_rate)
-    {
-        fprintf(stderr, "Incorrect sample rate: %d\n", sf_info.samplerate);
-        return (size_t*) &NULL_AUDIO_FILE;
-    }
-
-    // Read audio data
-    const uint64_t         num_channels   = sf_info.channels;
-    const uint64_t         num_samples    = sf_info.frames;
-    const size_t           buffer_size    = sf_info.channels * sf_info.frames;
-    NecroRuntimeAudioFile* audio_file_ptr = (NecroRuntimeAudioFile*) necro_runtime_alloc(sizeof(NecroRuntimeAudioFile) + (buffer_size * sizeof(double))); // Allocating in one contiguous block from runtime memory pool
-    double*                audio_data     = (double*)(audio_file_ptr + 1);
-    size_t                 read_count     = sf_read_double(snd_file, audio_data, buffer_size);
+    // Read audio data, converting it to the runtime sample rate if need be
+    const size_t           num_channels      = (size_t) sf_info.channels;
+    const size_t           num_file_frames   = (size_t) sf_info.frames;
+    const size_t           file_sample_rate  = (size_t) sf_info.samplerate;
+    const size_t           sample_rate       = necro_runtime_get_sample_rate();
+    const bool             needs_resample    = file_sample_rate != sample_rate;
+    const size_t           num_samples       = needs_resample ? necro_resample_num_output_frames(num_file_frames, file_sample_rate, sample_rate) : num_file_frames;
+    const size_t           buffer_size       = num_channels * num_samples;
+    NecroRuntimeAudioFile* audio_file_ptr    = (NecroRuntimeAudioFile*) necro_runtime_alloc(sizeof(NecroRuntimeAudioFile) + (buffer_size * sizeof(double)), NECRO_ALLOC_SITE_RUNTIME); // Allocating in one contiguous block from runtime memory pool
+    double*                audio_data        = (double*)(audio_file_ptr + 1);
+    double*                file_data         = needs_resample ? emalloc(num_channels * num_file_frames * sizeof(double)) : audio_data;
+    size_t                 read_count        = sf_read_double(snd_file, file_data, num_channels * num_file_frames);
     sf_close(snd_file);
 
     if (read_count == 0)
     {
         fprintf(stderr, "Could not read audio data for audio file: %s\n", file_name);
+        if (needs_resample)
+            free(file_data);
+        free(cache_path);
+        free(file_name);
         return (size_t*) &NULL_AUDIO_FILE;
     }
 
+    if (needs_resample)
+    {
+        memset(file_data + read_count, 0, (num_channels * num_file_frames - read_count) * sizeof(double));
+        necro_resample_interleaved(file_data, num_file_frames, num_channels, file_sample_rate, audio_data, sample_rate);
+        free(file_data);
+    }
+
     // Set audio file ptr
     audio_file_ptr->num_channels = num_channels;
     audio_file_ptr->num_samples  = num_samples;
     audio_file_ptr->audio_data   = audio_data;
 
+    if (cache_path != NULL)
+        necro_audio_file_cache_insert(cache_path, modified_time, audio_file_ptr);
+
     // Clean up and return
     // printf("Loaded audio file: %s\n", file_name);
     free(file_name);
     return (size_t*) audio_file_ptr;
 }
 
-typedef struct NecroScratchBuffer
+///////////////////////////////////////////////////////
+// NecroRuntimeAudioStream
+///////////////////////////////////////////////////////
+/*
+    Streaming audio files:
+        * Instead of decoding the whole file up front, each stream keeps a ring buffer of decoded frames ahead of the playhead.
+        * A single disk thread keeps every open stream's ring topped up, the RT thread only ever copies out of the ring.
+        * write_frame and read_frame are running frame counts owned by the disk thread and RT thread respectively,
+          so the ring is single producer, single consumer and needs no locks.
+        * If the disk thread falls behind the RT thread plays silence for the missing frames and counts an underrun.
+        * Like audio files, streams live for the life of the program and are cleaned up at shutdown.
+        * Offline renders run faster than real time, so there the RT side tops up the ring itself instead of relying on the disk thread.
+        * Files recorded at a different sample rate are decoded into a scratch chunk and run through a NecroResampleStream
+          on their way into the ring, so the conversion happens on the disk thread and matches audioFileOpen sample for sample.
+*/
+#define NECRO_AUDIO_STREAM_RING_FRAMES       131072 // Must be a power of 2
+#define NECRO_AUDIO_STREAM_RING_FRAMES_MASK  (NECRO_AUDIO_STREAM_RING_FRAMES - 1)
+#define NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES 8192
+#define NECRO_AUDIO_STREAM_POLL_PERIOD_NS    2000000
+
+typedef struct NecroRuntimeAudioStream
 {
-    double*                    audio_buffer;
-    size_t                     buffer_index;
-    struct NecroScratchBuffer* head;
-    struct NecroScratchBuffer* next;
-} NecroScratchBuffer;
+    // Header, laid out to match AudioStream in base.necro
+    uint64_t                        num_channels;
+    uint64_t                        num_frames;
+    struct NecroRuntimeAudioStream* self;
+    // Disk thread
+    SNDFILE*                        snd_file;
+    size_t                          file_frame;
+    struct NecroResampleStream*     resample;   // NULL when the file is already at the runtime sample rate
+    double*                         decode;     // Resampled streams only, NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES of file frames
+    // Shared
+    double*                         ring;
+    volatile size_t                 write_frame;
+    volatile size_t                 read_frame;
+    volatile size_t                 is_looping;
+    volatile size_t                 is_at_end;
+    volatile size_t                 num_underruns;
+    // RT thread
+    double*                         block;
+    struct NecroRuntimeAudioStream* next;
+} NecroRuntimeAudioStream;
 
-extern DLLEXPORT const size_t** necro_runtime_record_audio_block_finalize(const size_t* a_name, const uint64_t a_name_length, const uint64_t a_num_channels, size_t** a_scratch_buffer)
+static const NecroRuntimeAudioStream NULL_AUDIO_STREAM                    = { 0 };
+static NecroRuntimeAudioStream*      necro_audio_streams                  = NULL;
+static struct NecroThread*           necro_audio_stream_thread            = NULL;
+static volatile size_t               necro_audio_stream_thread_is_running = false;
+
+// Decodes up to max_frames, or as much as fits into the ring. Only ever called by one thread at a time for a given stream.
+static void necro_audio_stream_fill(NecroRuntimeAudioStream* stream, size_t max_frames)
 {
-    if (a_scratch_buffer == NULL)
-        return NULL;
-    if (a_name == NULL || a_name_length == 0)
+    if (necro_atomic_load(&stream->is_at_end))
     {
-        printf("Null audio file name in necro_runtime_record_audio!\n");
-        return NULL;
+        // Looping may have been switched on after we hit the end, the initial fill happens before the first block asks for it
+        if (!necro_atomic_load(&stream->is_looping) || stream->file_frame == 0 || sf_seek(stream->snd_file, 0, SEEK_SET) != 0)
+            return;
+        stream->file_frame = 0;
+        if (stream->resample != NULL)
+            necro_resample_stream_reset(stream->resample);
+        necro_atomic_store(&stream->is_at_end, false);
+    }
+    const size_t num_channels = (size_t) stream->num_channels;
+    const size_t start_frame  = stream->write_frame;
+    size_t       write_frame  = start_frame;
+    while (write_frame - start_frame < max_frames)
+    {
+        size_t free_frames = NECRO_AUDIO_STREAM_RING_FRAMES - (write_frame - necro_atomic_load(&stream->read_frame));
+        free_frames        = free_frames < max_frames - (write_frame - start_frame) ? free_frames : max_frames - (write_frame - start_frame);
+        if (free_frames == 0)
+            break;
+        // Decode straight into the ring, up to the wrap point
+        const size_t ring_index      = write_frame & NECRO_AUDIO_STREAM_RING_FRAMES_MASK;
+        size_t       frames_to_read  = NECRO_AUDIO_STREAM_RING_FRAMES - ring_index;
+        frames_to_read               = frames_to_read < free_frames ? frames_to_read : free_frames;
+        frames_to_read               = frames_to_read < NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES ? frames_to_read : NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES;
+        if (stream->resample != NULL)
+        {
+            // Resample whatever input is already buffered into the ring, only decoding another chunk once it runs dry
+            const size_t frames_pulled = necro_resample_stream_pull(stream->resample, stream->ring + ring_index * num_channels, frames_to_read);
+            write_frame               += frames_pulled;
+            necro_atomic_store(&stream->write_frame, write_frame);
+            if (frames_pulled == frames_to_read)
+                continue;
+            if (necro_resample_stream_is_finished(stream->resample))
+            {
+                necro_atomic_store(&stream->is_at_end, true);
+                break;
+            }
+            const size_t frames_read  = (size_t) sf_readf_double(stream->snd_file, stream->decode, NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES);
+            stream->file_frame       += frames_read;
+            necro_resample_stream_push(stream->resample, stream->decode, frames_read);
+            if (frames_read < NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES)
+            {
+                // End of file, looping carries on through the resampler so the loop point stays seamless
+                if (necro_atomic_load(&stream->is_looping) && stream->file_frame > 0 && sf_seek(stream->snd_file, 0, SEEK_SET) == 0)
+                    stream->file_frame = 0;
+                else
+                    necro_resample_stream_flush(stream->resample);
+            }
+            continue;
+        }
+        const size_t frames_read     = (size_t) sf_readf_double(stream->snd_file, stream->ring + ring_index * num_channels, (sf_count_t) frames_to_read);
+        stream->file_frame          += frames_read;
+        write_frame                 += frames_read;
+        necro_atomic_store(&stream->write_frame, write_frame);
+        if (frames_read < frames_to_read)
+        {
+            // End of file, either wrap around or stop
+            if (necro_atomic_load(&stream->is_looping) && stream->file_frame > 0 && sf_seek(stream->snd_file, 0, SEEK_SET) == 0)
+            {
+                stream->file_frame = 0;
+                continue;
+            }
+            necro_atomic_store(&stream->is_at_end, true);
+            break;
+        }
     }
+}
 
-    // We're done, Open File and write contents of scratch buffer into it
-    NecroScratchBuffer* curr_buffer = (NecroScratchBuffer*)*a_scratch_buffer;
-    assert(curr_buffer != NULL);
+static void necro_audio_stream_thread_fn(void* user_data)
+{
+    UNUSED(user_data);
+    while (necro_atomic_load(&necro_audio_stream_thread_is_running))
+    {
+        NecroRuntimeAudioStream* stream = (NecroRuntimeAudioStream*) necro_atomic_load((volatile size_t*) &necro_audio_streams);
+        while (stream != NULL)
+        {
+            necro_audio_stream_fill(stream, NECRO_AUDIO_STREAM_RING_FRAMES);
+            stream = stream->next;
+        }
+        necro_sleep_until_ns(necro_time_ns() + NECRO_AUDIO_STREAM_POLL_PERIOD_NS);
+    }
+}
+
+/*
+    Opens the file and decodes the first chunk so that playback can start straight away,
+    the rest is streamed in by the disk thread, which is started by the first stream to be opened.
+*/
+extern DLLEXPORT const size_t* necro_runtime_open_audio_stream(const size_t* a_name, const uint64_t a_name_length)
+{
+    if (a_name == NULL || a_name_length == 0)
+    {
+        fprintf(stderr, "Null audio file name in audioStreamOpen\n");
+        return (size_t*) &NULL_AUDIO_STREAM;
+    }
 
     // Create ascii string
     char* file_name = emalloc(a_name_length + 1);
     for (size_t i = 0; i < a_name_length; ++i)
     {
         // TODO: Unicode handling
-        file_name[i] = (char)a_name[i];
+        file_name[i] = (char) a_name[i];
     }
     file_name[a_name_length] = '\0';
 
-    // Set up sf_info
     SF_INFO	sf_info;
     memset(&sf_info, 0, sizeof(sf_info)); // Yes, this is in fact the way in which libsndfile wants you to initialize the SF_INFO struct...
-    sf_info.format     = SF_FORMAT_WAV | SF_FORMAT_DOUBLE;
-    sf_info.channels   = (int) a_num_channels;
-    sf_info.samplerate = (int) necro_runtime_audio_sample_rate;
-    sf_info.sections   = 1;
-    sf_info.seekable   = SF_TRUE;
-    sf_info.frames     = 0;
-
-    curr_buffer = curr_buffer->head;
-    while (curr_buffer != NULL)
+    SNDFILE* snd_file = sf_open(file_name, SFM_READ, &sf_info);
+    if (snd_file == NULL)
     {
-        sf_info.frames += curr_buffer->buffer_index / a_num_channels;
-        curr_buffer     = curr_buffer->next;
+        fprintf(stderr, "Unable to open audio file: %s\n", file_name);
+        puts(sf_strerror(NULL));
+        fprintf(stderr, "\n\n");
+        free(file_name);
+        return (size_t*) &NULL_AUDIO_STREAM;
     }
-    curr_buffer = ((NecroScratchBuffer*)* a_scratch_buffer)->head;
+    free(file_name);
 
-    // Open file
-    SNDFILE* snd_file = sf_open(file_name, SFM_WRITE, &sf_info);
-    if (snd_file == NULL)
+    const size_t             file_sample_rate = (size_t) sf_info.samplerate;
+    const size_t             sample_rate      = necro_runtime_get_sample_rate();
+    const bool               needs_resample   = file_sample_rate != sample_rate;
+    NecroRuntimeAudioStream* stream           = emalloc(sizeof(NecroRuntimeAudioStream));
+    memset(stream, 0, sizeof(NecroRuntimeAudioStream));
+    stream->num_channels                      = (uint64_t) sf_info.channels;
+    stream->num_frames                        = needs_resample ? necro_resample_num_output_frames((size_t) sf_info.frames, file_sample_rate, sample_rate) : (uint64_t) sf_info.frames;
+    stream->self                              = stream;
+    stream->snd_file                          = snd_file;
+    stream->resample                          = needs_resample ? necro_resample_stream_create((size_t) sf_info.channels, file_sample_rate, sample_rate) : NULL;
+    stream->decode                            = needs_resample ? emalloc(NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES * sf_info.channels * sizeof(double)) : NULL;
+    stream->ring                              = emalloc(NECRO_AUDIO_STREAM_RING_FRAMES * sf_info.channels * sizeof(double));
+    stream->block                             = emalloc(necro_runtime_get_block_size() * sf_info.channels * sizeof(double));
+    necro_audio_stream_fill(stream, NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES);
+
+    // Publish to the disk thread, streams are only ever pushed onto the front of the list
+    stream->next = necro_audio_streams;
+    necro_atomic_store((volatile size_t*) &necro_audio_streams, (size_t) stream);
+    if (necro_runtime_options.render_file_name == NULL && necro_audio_stream_thread == NULL)
     {
-        printf("Unable to open audio file: %s\n", file_name);
-        puts(sf_strerror(NULL));
+        necro_atomic_store(&necro_audio_stream_thread_is_running, true);
+        necro_audio_stream_thread = necro_thread_create(necro_audio_stream_thread_fn, NULL);
+    }
+    return (size_t*) stream;
+}
+
+/*
+    Called once per block by the RT thread. Copies the next block of interleaved frames out of the ring,
+    padding with silence past the end of the file or when the disk thread has fallen behind.
+*/
+extern DLLEXPORT const size_t* necro_runtime_read_audio_stream_block(const size_t* a_stream, const uint64_t a_is_looping)
+{
+    NecroRuntimeAudioStream* stream = (NecroRuntimeAudioStream*) a_stream;
+    if (stream == NULL || stream->self == NULL)
         return NULL;
+    const size_t num_channels = (size_t) stream->num_channels;
+    const size_t block_size   = necro_runtime_get_block_size();
+    necro_atomic_store(&stream->is_looping, (size_t) a_is_looping);
+    if (necro_audio_stream_thread == NULL)
+        necro_audio_stream_fill(stream, NECRO_AUDIO_STREAM_RING_FRAMES);
+    size_t       read_frame   = stream->read_frame;
+    const size_t available    = necro_atomic_load(&stream->write_frame) - read_frame;
+    const size_t num_frames   = available < block_size ? available : block_size;
+    for (size_t i = 0; i < num_frames; ++i)
+    {
+        const double* frame = stream->ring + ((read_frame + i) & NECRO_AUDIO_STREAM_RING_FRAMES_MASK) * num_channels;
+        for (size_t c = 0; c < num_channels; ++c)
+            stream->block[i * num_channels + c] = frame[c];
     }
+    if (num_frames < block_size)
+    {
+        memset(stream->block + num_frames * num_channels, 0, (block_size - num_frames) * num_channels * sizeof(double));
+        if (!necro_atomic_load(&stream->is_at_end))
+            necro_atomic_store(&stream->num_underruns, stream->num_underruns + 1);
+    }
+    necro_atomic_store(&stream->read_frame, read_frame + num_frames);
+    return (size_t*) stream->block;
+}
 
-    // Write scratch buffer(s) to contiguous scratch buffer (it seems libsndfile doesn't allow you to write chunks of data to the file, but instead wants one contiguous buffer)
-    while (curr_buffer != NULL)
+// Streams which haven't reached the end of their file, looping streams never do
+size_t necro_runtime_audio_num_active_streams()
+{
+    size_t                   num_active = 0;
+    NecroRuntimeAudioStream* stream     = (NecroRuntimeAudioStream*) necro_atomic_load((volatile size_t*) &necro_audio_streams);
+    while (stream != NULL)
     {
-        // Write buffer
-        sf_write_double(snd_file, curr_buffer->audio_buffer, curr_buffer->buffer_index);
+        if (!necro_atomic_load(&stream->is_at_end))
+            num_active++;
+        stream = stream->next;
+    }
+    return num_active;
+}
 
-        // Clean up block
-        NecroScratchBuffer* prev_buffer = curr_buffer;
-        curr_buffer                     = curr_buffer->next;
-        free(prev_buffer->audio_buffer);
-        free(prev_buffer);
-        prev_buffer                     = NULL;
+void necro_runtime_audio_stream_shutdown()
+{
+    necro_atomic_store(&necro_audio_stream_thread_is_running, false);
+    necro_thread_join(necro_audio_stream_thread);
+    necro_audio_stream_thread = NULL;
+    NecroRuntimeAudioStream* stream = necro_audio_streams;
+    while (stream != NULL)
+    {
+        NecroRuntimeAudioStream* next = stream->next;
+        if (stream->num_underruns > 0)
+            printf("Audio stream underruns: %zu\n", stream->num_underruns);
+        sf_close(stream->snd_file);
+        necro_resample_stream_destroy(stream->resample);
+        free(stream->decode);
+        free(stream->ring);
+        free(stream->block);
+        free(stream);
+        stream = next;
     }
+    necro_audio_streams = NULL;
+}
 
-    // Clean up
-    // NOTE: The scratch buffer is handed to us and is allocated via the necrolang memory system, so we don't free it here!
-    sf_close(snd_file);
-    *a_scratch_buffer = NULL;
-    free(file_name);
-    printf("Finished recording: %s\n", file_name);
+// Writes a test file at file_sample_rate and streams two passes' worth of it back a block at a time. The result has to match
+// loading it with audioFileOpen's resampler, followed by silence, or when looping, loading the file repeated end to end.
+static bool necro_audio_stream_test_matches(size_t file_sample_rate, bool is_looping)
+{
+    const char*  file_name          = "necro_audio_stream_test.wav";
+    const size_t num_channels       = 2;
+    const size_t num_file_frames    = 3 * NECRO_AUDIO_STREAM_READ_CHUNK_FRAMES + 1234;
+    const size_t num_copies         = is_looping ? 3 : 1;
+    const size_t sample_rate        = necro_runtime_get_sample_rate();
+    const size_t block_size         = necro_runtime_get_block_size();
+    const size_t num_frames         = necro_resample_num_output_frames(num_file_frames, file_sample_rate, sample_rate);
+    const size_t num_expected       = necro_resample_num_output_frames(num_copies * num_file_frames, file_sample_rate, sample_rate);
+    float*       file_data          = emalloc(num_file_frames * num_channels * sizeof(float));
+    double*      input              = emalloc(num_copies * num_file_frames * num_channels * sizeof(double));
+    double*      expected           = emalloc(num_expected * num_channels * sizeof(double));
+    for (size_t i = 0; i < num_file_frames * num_channels; ++i)
+        file_data[i] = (float) (0.5 * sin((double) i * 0.01) + 0.25 * sin((double) i * 0.37));
+    for (size_t i = 0; i < num_copies * num_file_frames * num_channels; ++i)
+        input[i] = (double) file_data[i % (num_file_frames * num_channels)];
+    if (file_sample_rate == sample_rate)
+        memcpy(expected, input, num_expected * num_channels * sizeof(double));
+    else
+        necro_resample_interleaved(input, num_copies * num_file_frames, num_channels, file_sample_rate, expected, sample_rate);
+    SF_INFO sf_info;
+    memset(&sf_info, 0, sizeof(sf_info));
+    sf_info.samplerate = (int) file_sample_rate;
+    sf_info.channels   = (int) num_channels;
+    sf_info.format     = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+    SNDFILE* snd_file  = sf_open(file_name, SFM_WRITE, &sf_info);
+    bool     is_match  = snd_file != NULL && sf_writef_float(snd_file, file_data, (sf_count_t) num_file_frames) == (sf_count_t) num_file_frames;
+    if (snd_file != NULL)
+        sf_close(snd_file);
+
+    size_t a_name[64];
+    for (size_t i = 0; file_name[i] != '\0'; ++i)
+        a_name[i] = (size_t) file_name[i];
+    NecroRuntimeAudioStream* stream = is_match ? (NecroRuntimeAudioStream*) necro_runtime_open_audio_stream(a_name, strlen(file_name)) : NULL;
+    is_match                        = stream != NULL && stream->self != NULL && stream->num_channels == num_channels && stream->num_frames == num_frames;
+    for (size_t frame = 0; is_match && frame < 2 * num_frames; frame += block_size)
+    {
+        const double* block = (const double*) necro_runtime_read_audio_stream_block((const size_t*) stream, is_looping);
+        for (size_t i = 0; is_match && i < block_size * num_channels && frame * num_channels + i < 2 * num_frames * num_channels; ++i)
+        {
+            const size_t sample = frame * num_channels + i;
+            is_match            = block[i] == (sample < num_expected * num_channels ? expected[sample] : 0.0);
+        }
+    }
+    is_match = is_match && stream->num_underruns == 0 && necro_runtime_audio_num_active_streams() == (is_looping ? 1 : 0);
+    necro_runtime_audio_stream_shutdown();
+    remove(file_name);
+    free(file_data);
+    free(input);
+    free(expected);
+    return is_match;
+}
+
+void necro_audio_stream_test()
+{
+    necro_announce_phase("NecroAudioStream");
+    // Offline settings, so the test drives the ring itself rather than starting the disk thread
+    const NecroRuntimeOptions options             = necro_runtime_options;
+    const size_t              file_sample_rates[] = { 48000, 44100, 96000 };
+    necro_runtime_options.render_file_name        = "necro_audio_stream_test";
+    necro_runtime_options.sample_rate             = 48000;
+    necro_runtime_options.block_size              = 256;
+    necro_runtime_options.oversample              = 1;
+    for (size_t r = 0; r < sizeof(file_sample_rates) / sizeof(size_t); ++r)
+    {
+        for (size_t l = 0; l < 2; ++l)
+        {
+            const bool is_passed = necro_audio_stream_test_matches(file_sample_rates[r], l == 1);
+            printf("Audio stream %d -> 48000%s test: %s\n", (int) file_sample_rates[r], l == 1 ? " looping" : "", is_passed ? "passed" : "FAILED");
+        }
+    }
+    necro_runtime_options = options;
+}
+
+///////////////////////////////////////////////////////
+// NecroAudioRecorder
+///////////////////////////////////////////////////////
+/*
+    Recording (recordAudio):
+        * A fixed pool of recorders is allocated up front, each with a ring of float frames, so recording never allocates on the RT thread.
+        * The first block of a recording claims a free recorder. Each block then has its channels interleaved straight into the ring,
+          and write_frame is published once the last channel has been written.
+        * A disk thread opens the file, writes out whatever is in each ring every 10ms, and closes the file once the recording is finished.
+          The file header is rewritten on every write, so everything up to the last flush survives a crash.
+        * If the disk falls behind and a ring fills up, whole blocks are dropped rather than blocking the RT thread. Drops are reported at shutdown.
+        * In render mode there is no disk thread, the RT side flushes after every block instead.
+        * Recordings still running at shutdown are flushed and closed.
+*/
+#define NECRO_AUDIO_RECORDER_MAX_RECORDINGS      4
+#define NECRO_AUDIO_RECORDER_MAX_CHANNELS        8
+#define NECRO_AUDIO_RECORDER_MAX_FILE_NAME       1024
+#define NECRO_AUDIO_RECORDER_RING_FRAMES         65536 // Must be a power of 2
+#define NECRO_AUDIO_RECORDER_RING_FRAMES_MASK    (NECRO_AUDIO_RECORDER_RING_FRAMES - 1)
+#define NECRO_AUDIO_RECORDER_POLL_PERIOD_NS      10000000
+
+typedef enum
+{
+    NECRO_AUDIO_RECORDER_IDLE      = 0, // Free to be claimed by the RT thread
+    NECRO_AUDIO_RECORDER_RECORDING = 1, // Being written by the RT thread
+    NECRO_AUDIO_RECORDER_FINISHING = 2, // Finished by the RT thread, waiting for the disk thread to flush and close it
+    NECRO_AUDIO_RECORDER_CLAIMING  = 3, // Claimed and being set up, the disk thread leaves it alone
+} NECRO_AUDIO_RECORDER_STATE;
+
+typedef struct NecroAudioRecorder
+{
+    volatile size_t              state;
+    volatile size_t              write_frame; // Written by the RT thread
+    volatile size_t              read_frame;  // Written by the disk thread
+    volatile size_t              num_dropped_blocks;
+    size_t                       num_channels;
+    bool                         is_dropping_block;
+    bool                         has_failed;
+    struct NecroAudioFileWriter* writer;
+    float*                       ring;
+    char                         file_name[NECRO_AUDIO_RECORDER_MAX_FILE_NAME];
+} NecroAudioRecorder;
+
+static NecroAudioRecorder*    necro_audio_recorders                  = NULL;
+static NecroAudioSampleFormat necro_audio_recorder_sample_format     = NECRO_AUDIO_SAMPLE_FORMAT_FLOAT32;
+static struct NecroThread*    necro_audio_recorder_thread            = NULL;
+static volatile size_t        necro_audio_recorder_thread_is_running = false;
+static volatile size_t        necro_audio_recorder_num_rejected      = 0;
+static size_t                 necro_audio_recorder_rejected          = 0; // Its address marks a recordAudio call which couldn't get a recorder, so it doesn't retry every block
+
+bool necro_audio_sample_format_from_name(const char* name, NecroAudioSampleFormat* out_format)
+{
+    assert(out_format != NULL);
+    if (name == NULL || strcmp(name, "float32") == 0)
+        *out_format = NECRO_AUDIO_SAMPLE_FORMAT_FLOAT32;
+    else if (strcmp(name, "int24") == 0)
+        *out_format = NECRO_AUDIO_SAMPLE_FORMAT_INT24;
+    else
+        return false;
+    return true;
+}
+
+// Writes out everything the RT thread has published, opening the file first if need be. Only ever called by one thread at a time for a given recorder.
+static void necro_audio_recorder_flush(NecroAudioRecorder* recorder)
+{
+    if (recorder->writer == NULL && !recorder->has_failed)
+    {
+        recorder->writer     = necro_audio_file_writer_open(recorder->file_name, recorder->num_channels, necro_runtime_get_sample_rate(), necro_audio_recorder_sample_format);
+        recorder->has_failed = recorder->writer == NULL;
+    }
+    const size_t write_frame = necro_atomic_load(&recorder->write_frame);
+    size_t       read_frame  = recorder->read_frame;
+    while (read_frame < write_frame)
+    {
+        // Write straight out of the ring, up to the wrap point. If the file couldn't be opened the audio is simply discarded
+        const size_t ring_index = read_frame & NECRO_AUDIO_RECORDER_RING_FRAMES_MASK;
+        size_t       num_frames = NECRO_AUDIO_RECORDER_RING_FRAMES - ring_index;
+        num_frames              = num_frames < write_frame - read_frame ? num_frames : write_frame - read_frame;
+        if (recorder->writer != NULL)
+            necro_audio_file_writer_write(recorder->writer, recorder->ring + ring_index * recorder->num_channels, num_frames);
+        read_frame += num_frames;
+    }
+    necro_atomic_store(&recorder->read_frame, read_frame);
+}
+
+static void necro_audio_recorder_close(NecroAudioRecorder* recorder)
+{
+    necro_audio_recorder_flush(recorder);
+    if (recorder->writer != NULL)
+        printf("Finished recording: %s\n", recorder->file_name);
+    if (recorder->num_dropped_blocks > 0)
+        printf("Recording %s dropped %zu blocks, the disk couldn't keep up\n", recorder->file_name, recorder->num_dropped_blocks);
+    necro_audio_file_writer_close(recorder->writer);
+    recorder->writer     = NULL;
+    recorder->has_failed = false;
+    necro_atomic_store(&recorder->state, NECRO_AUDIO_RECORDER_IDLE);
+}
+
+static void necro_audio_recorder_thread_fn(void* user_data)
+{
+    UNUSED(user_data);
+    uint64_t wake_time_ns = necro_time_ns();
+    while (necro_atomic_load(&necro_audio_recorder_thread_is_running))
+    {
+        for (size_t i = 0; i < NECRO_AUDIO_RECORDER_MAX_RECORDINGS; ++i)
+        {
+            NecroAudioRecorder* recorder = necro_audio_recorders + i;
+            const size_t        state    = necro_atomic_load(&recorder->state);
+            if (state == NECRO_AUDIO_RECORDER_RECORDING)
+                necro_audio_recorder_flush(recorder);
+            else if (state == NECRO_AUDIO_RECORDER_FINISHING)
+                necro_audio_recorder_close(recorder);
+        }
+        wake_time_ns += NECRO_AUDIO_RECORDER_POLL_PERIOD_NS;
+        necro_sleep_until_ns(wake_time_ns);
+    }
+}
+
+void necro_runtime_audio_recorder_init(NecroAudioSampleFormat sample_format, bool is_threaded)
+{
+    assert(necro_audio_recorders == NULL);
+    necro_audio_recorder_sample_format = sample_format;
+    necro_audio_recorder_num_rejected  = 0;
+    necro_audio_recorders              = emalloc(NECRO_AUDIO_RECORDER_MAX_RECORDINGS * sizeof(NecroAudioRecorder));
+    memset(necro_audio_recorders, 0, NECRO_AUDIO_RECORDER_MAX_RECORDINGS * sizeof(NecroAudioRecorder));
+    for (size_t i = 0; i < NECRO_AUDIO_RECORDER_MAX_RECORDINGS; ++i)
+        necro_audio_recorders[i].ring = emalloc(NECRO_AUDIO_RECORDER_RING_FRAMES * NECRO_AUDIO_RECORDER_MAX_CHANNELS * sizeof(float));
+    if (is_threaded)
+    {
+        necro_audio_recorder_thread_is_running = true;
+        necro_audio_recorder_thread            = necro_thread_create(necro_audio_recorder_thread_fn, NULL);
+    }
+}
+
+void necro_runtime_audio_recorder_shutdown()
+{
+    if (necro_audio_recorders == NULL)
+        return;
+    necro_atomic_store(&necro_audio_recorder_thread_is_running, false);
+    necro_thread_join(necro_audio_recorder_thread);
+    necro_audio_recorder_thread = NULL;
+    for (size_t i = 0; i < NECRO_AUDIO_RECORDER_MAX_RECORDINGS; ++i)
+    {
+        if (necro_audio_recorders[i].state != NECRO_AUDIO_RECORDER_IDLE)
+            necro_audio_recorder_close(necro_audio_recorders + i);
+        free(necro_audio_recorders[i].ring);
+    }
+    if (necro_audio_recorder_num_rejected > 0)
+        printf("%zu recordings were not started, at most %d recordings of up to %d channels can run at once\n", necro_audio_recorder_num_rejected, NECRO_AUDIO_RECORDER_MAX_RECORDINGS, NECRO_AUDIO_RECORDER_MAX_CHANNELS);
+    free(necro_audio_recorders);
+    necro_audio_recorders = NULL;
+}
+
+size_t necro_runtime_audio_num_active_recordings()
+{
+    if (necro_audio_recorders == NULL)
+        return 0;
+    size_t num_active = 0;
+    for (size_t i = 0; i < NECRO_AUDIO_RECORDER_MAX_RECORDINGS; ++i)
+    {
+        if (necro_atomic_load(&necro_audio_recorders[i].state) == NECRO_AUDIO_RECORDER_RECORDING)
+            num_active++;
+    }
+    return num_active;
+}
+
+// RT thread and scheduler workers
+static NecroAudioRecorder* necro_audio_recorder_claim(const size_t* a_name, const uint64_t a_name_length, const uint64_t a_num_channels)
+{
+    if (necro_audio_recorders == NULL || a_name == NULL || a_name_length == 0 || a_name_length >= NECRO_AUDIO_RECORDER_MAX_FILE_NAME || a_num_channels == 0 || a_num_channels > NECRO_AUDIO_RECORDER_MAX_CHANNELS)
+        return NULL;
+    for (size_t i = 0; i < NECRO_AUDIO_RECORDER_MAX_RECORDINGS; ++i)
+    {
+        // Scheduler workers can start recordings at the same time as the RT thread, so claim the recorder before touching it
+        NecroAudioRecorder* recorder = necro_audio_recorders + i;
+        if (!necro_atomic_compare_exchange(&recorder->state, NECRO_AUDIO_RECORDER_IDLE, NECRO_AUDIO_RECORDER_CLAIMING))
+            continue;
+        for (size_t c = 0; c < a_name_length; ++c)
+        {
+            // TODO: Unicode handling
+            recorder->file_name[c] = (char) a_name[c];
+        }
+        recorder->file_name[a_name_length] = '\0';
+        recorder->num_channels             = (size_t) a_num_channels;
+        recorder->is_dropping_block        = false;
+        recorder->write_frame              = 0;
+        recorder->read_frame               = 0;
+        recorder->num_dropped_blocks       = 0;
+        necro_atomic_store(&recorder->state, NECRO_AUDIO_RECORDER_RECORDING);
+        return recorder;
+    }
     return NULL;
 }
 
-extern DLLEXPORT const size_t** necro_runtime_record_audio_block(const uint64_t a_channel_num, const uint64_t a_num_channels, const double* a_audio_block, size_t** a_scratch_buffer)
+extern DLLEXPORT const size_t** necro_runtime_record_audio_block_finalize(const size_t* a_name, const uint64_t a_name_length, const uint64_t a_num_channels, size_t** a_scratch_buffer)
+{
+    UNUSED(a_name);
+    UNUSED(a_name_length);
+    UNUSED(a_num_channels);
+    if (a_scratch_buffer == NULL || *a_scratch_buffer == NULL)
+        return (const size_t**) a_scratch_buffer;
+    NecroAudioRecorder* recorder = (NecroAudioRecorder*) *a_scratch_buffer;
+    *a_scratch_buffer            = NULL;
+    if ((size_t*) recorder == &necro_audio_recorder_rejected)
+        return (const size_t**) a_scratch_buffer;
+    if (necro_audio_recorder_thread == NULL)
+        necro_audio_recorder_close(recorder);
+    else
+        necro_atomic_store(&recorder->state, NECRO_AUDIO_RECORDER_FINISHING);
+    return (const size_t**) a_scratch_buffer;
+}
+
+extern DLLEXPORT const size_t** necro_runtime_record_audio_block(const size_t* a_name, const uint64_t a_name_length, const uint64_t a_channel_num, const uint64_t a_num_channels, const double* a_audio_block, size_t** a_scratch_buffer)
 {
     if (a_scratch_buffer == NULL)
         return NULL;
 
-    const size_t        scratch_buffer_num_blocks = 5000;
-    const size_t        scratch_buffer_size       = necro_runtime_audio_block_size * scratch_buffer_num_blocks * a_num_channels;
-    NecroScratchBuffer* curr_buffer               = (NecroScratchBuffer*)*a_scratch_buffer;
-
-    // Fresh scratch buffer
-    if (curr_buffer == NULL)
-    {
-        curr_buffer               = emalloc(sizeof(NecroScratchBuffer));
-        curr_buffer->audio_buffer = emalloc(scratch_buffer_size * sizeof(double));
-        curr_buffer->buffer_index = 0;
-        curr_buffer->head         = curr_buffer;
-        curr_buffer->next         = NULL;
-        *a_scratch_buffer         = (size_t*)curr_buffer;
-    }
-    // New scratch buffer block
-    else if (curr_buffer->buffer_index >= scratch_buffer_size)
-    {
-        NecroScratchBuffer* new_buffer = emalloc(sizeof(NecroScratchBuffer));
-        new_buffer->audio_buffer       = emalloc(scratch_buffer_size * sizeof(double));
-        new_buffer->buffer_index       = 0;
-        new_buffer->head               = curr_buffer->head;
-        new_buffer->next               = NULL;
-        curr_buffer->next              = new_buffer;
-        curr_buffer                    = new_buffer;
-        *a_scratch_buffer              = (size_t*)curr_buffer;
-    }
-
-    // Write audio into scratch buffer
-    // for (size_t i = a_channel_num; i < necro_runtime_audio_block_size * a_num_channels; i += (size_t) a_num_channels)
-    for (size_t i = 0; i < necro_runtime_audio_block_size; i++)
-    {
-        /*
-            Note: audio channel are written interleaved as such:
-            l0, r0, l1, r1, l2, r2...lN, rN
-            libsnd file expects interleaved channels, so we might as well do it up front in the scratch buffer
-        */
-        curr_buffer->audio_buffer[curr_buffer->buffer_index + (i * a_num_channels) + a_channel_num] = a_audio_block[i];
-    }
-    if (a_channel_num >= a_num_channels - 1)
-        curr_buffer->buffer_index += necro_runtime_audio_block_size * a_num_channels;
+    // Fresh recording, only ever started on a block boundary
+    NecroAudioRecorder* recorder = (NecroAudioRecorder*) *a_scratch_buffer;
+    if (recorder == NULL)
+    {
+        if (a_channel_num != 0)
+            return (const size_t**) a_scratch_buffer;
+        recorder = necro_audio_recorder_claim(a_name, a_name_length, a_num_channels);
+        if (recorder == NULL)
+        {
+            necro_atomic_fetch_add(&necro_audio_recorder_num_rejected, 1);
+            *a_scratch_buffer = &necro_audio_recorder_rejected;
+            return (const size_t**) a_scratch_buffer;
+        }
+        *a_scratch_buffer = (size_t*) recorder;
+    }
+    else if ((size_t*) recorder == &necro_audio_recorder_rejected)
+    {
+        return (const size_t**) a_scratch_buffer;
+    }
+
+    // Decide once per block whether there is room for it
+    const size_t block_size  = necro_runtime_get_block_size();
+    const size_t write_frame = recorder->write_frame;
+    if (a_channel_num == 0)
+    {
+        recorder->is_dropping_block = NECRO_AUDIO_RECORDER_RING_FRAMES - (write_frame - necro_atomic_load(&recorder->read_frame)) < block_size;
+        if (recorder->is_dropping_block)
+            necro_atomic_store(&recorder->num_dropped_blocks, recorder->num_dropped_blocks + 1);
+    }
+    if (recorder->is_dropping_block)
+        return (const size_t**) a_scratch_buffer;
+
+    /*
+        Note: audio channel are written interleaved as such:
+        l0, r0, l1, r1, l2, r2...lN, rN
+        libsnd file expects interleaved channels, so we might as well do it up front in the ring
+    */
+    const size_t num_channels = recorder->num_channels;
+    float*       ring         = recorder->ring + a_channel_num;
+    for (size_t i = 0; i < block_size; i++)
+        ring[((write_frame + i) & NECRO_AUDIO_RECORDER_RING_FRAMES_MASK) * num_channels] = (float) a_audio_block[i];
+    if (a_channel_num + 1 >= num_channels)
+    {
+        necro_atomic_store(&recorder->write_frame, write_frame + block_size);
+        if (necro_audio_recorder_thread == NULL)
+            necro_audio_recorder_flush(recorder);
+    }
     return (const size_t**) a_scratch_buffer;
 }
 
+
+// Reads back a test recording, returning the number of frames and filling data with up to max_frames of them
+static size_t necro_audio_recorder_test_read(const char* file_name, double* data, size_t max_frames)
+{
+    SF_INFO sf_info;
+    memset(&sf_info, 0, sizeof(sf_info));
+    SNDFILE* snd_file = sf_open(file_name, SFM_READ, &sf_info);
+    if (snd_file == NULL)
+        return 0;
+    const size_t num_frames = (size_t) sf_info.frames < max_frames ? (size_t) sf_info.frames : max_frames;
+    sf_readf_double(snd_file, data, (sf_count_t) num_frames);
+    sf_close(snd_file);
+    remove(file_name);
+    return (size_t) sf_info.frames;
+}
+
+static void necro_audio_recorder_test_name(size_t index, char* file_name, size_t* a_name, size_t* a_name_length)
+{
+    snprintf(file_name, 64, "necro_audio_recorder_test_%d.wav", (int) index);
+    *a_name_length = strlen(file_name);
+    for (size_t i = 0; i < *a_name_length; ++i)
+        a_name[i] = (size_t) file_name[i];
+}
+
+void necro_audio_recorder_test()
+{
+    necro_announce_phase("NecroAudioRecorder");
+    const NecroRuntimeOptions options = necro_runtime_options;
+    necro_runtime_options.sample_rate = 48000;
+    necro_runtime_options.block_size  = 256;
+    necro_runtime_options.oversample  = 1;
+    const size_t block_size           = necro_runtime_get_block_size();
+    double*      block                = emalloc(block_size * sizeof(double));
+    char         file_name[64];
+    size_t       a_name[64];
+    size_t       a_name_length        = 0;
+
+    // Pool: every recorder can be claimed, one more is rejected once, and finished recorders go back into the pool
+    {
+        const size_t num_blocks                                               = 4;
+        size_t*      scratch_buffers[NECRO_AUDIO_RECORDER_MAX_RECORDINGS + 1] = { 0 };
+        necro_runtime_audio_recorder_init(NECRO_AUDIO_SAMPLE_FORMAT_FLOAT32, false);
+        for (size_t b = 0; b < num_blocks; ++b)
+        {
+            for (size_t r = 0; r < NECRO_AUDIO_RECORDER_MAX_RECORDINGS + 1; ++r)
+            {
+                necro_audio_recorder_test_name(r, file_name, a_name, &a_name_length);
+                for (size_t c = 0; c < 2; ++c)
+                {
+                    for (size_t i = 0; i < block_size; ++i)
+                        block[i] = (double) ((b * block_size + i) * 2 + c) / 4096.0;
+                    necro_runtime_record_audio_block(a_name, a_name_length, c, 2, block, scratch_buffers + r);
+                }
+            }
+        }
+        bool is_passed = necro_runtime_audio_num_active_recordings() == NECRO_AUDIO_RECORDER_MAX_RECORDINGS &&
+                         scratch_buffers[NECRO_AUDIO_RECORDER_MAX_RECORDINGS] == &necro_audio_recorder_rejected &&
+                         necro_audio_recorder_num_rejected == 1;
+        printf("Audio recorder pool claim test: %s\n", is_passed ? "passed" : "FAILED");
+        necro_runtime_record_audio_block_finalize(a_name, a_name_length, 2, scratch_buffers + NECRO_AUDIO_RECORDER_MAX_RECORDINGS);
+        necro_runtime_record_audio_block_finalize(a_name, a_name_length, 2, scratch_buffers);
+        size_t* scratch_buffer = NULL;
+        necro_audio_recorder_test_name(NECRO_AUDIO_RECORDER_MAX_RECORDINGS + 1, file_name, a_name, &a_name_length);
+        necro_runtime_record_audio_block(a_name, a_name_length, 0, 1, block, &scratch_buffer);
+        is_passed = scratch_buffer != NULL && scratch_buffer != &necro_audio_recorder_rejected && necro_runtime_audio_num_active_recordings() == NECRO_AUDIO_RECORDER_MAX_RECORDINGS;
+        printf("Audio recorder pool reuse test: %s\n", is_passed ? "passed" : "FAILED");
+        necro_runtime_record_audio_block_finalize(a_name, a_name_length, 1, &scratch_buffer);
+        for (size_t r = 1; r < NECRO_AUDIO_RECORDER_MAX_RECORDINGS; ++r)
+            necro_runtime_record_audio_block_finalize(a_name, a_name_length, 2, scratch_buffers + r);
+        necro_runtime_audio_recorder_shutdown();
+        // Every recording holds exactly what was recorded, interleaved
+        double* data = emalloc(num_blocks * block_size * 2 * sizeof(double));
+        for (size_t r = 0; r < NECRO_AUDIO_RECORDER_MAX_RECORDINGS; ++r)
+        {
+            necro_audio_recorder_test_name(r, file_name, a_name, &a_name_length);
+            is_passed = necro_audio_recorder_test_read(file_name, data, num_blocks * block_size) == num_blocks * block_size;
+            for (size_t i = 0; is_passed && i < num_blocks * block_size * 2; ++i)
+                is_passed = data[i] == (double) i / 4096.0;
+            printf("Audio recorder %d contents test: %s\n", (int) r, is_passed ? "passed" : "FAILED");
+        }
+        necro_audio_recorder_test_name(NECRO_AUDIO_RECORDER_MAX_RECORDINGS + 1, file_name, a_name, &a_name_length);
+        necro_audio_recorder_test_read(file_name, data, 0);
+        free(data);
+    }
+
+    // Drops: recording far faster than real time overruns the ring between disk thread flushes.
+    // Whole blocks are dropped and counted, everything else reaches the file in order.
+    {
+        const size_t num_blocks     = 4 * NECRO_AUDIO_RECORDER_RING_FRAMES / block_size;
+        size_t*      scratch_buffer = NULL;
+        necro_runtime_audio_recorder_init(NECRO_AUDIO_SAMPLE_FORMAT_FLOAT32, true);
+        necro_audio_recorder_test_name(0, file_name, a_name, &a_name_length);
+        for (size_t b = 0; b < num_blocks; ++b)
+        {
+            for (size_t i = 0; i < block_size; ++i)
+                block[i] = (double) (b * block_size + i);
+            necro_runtime_record_audio_block(a_name, a_name_length, 0, 1, block, &scratch_buffer);
+        }
+        NecroAudioRecorder* recorder           = (NecroAudioRecorder*) scratch_buffer;
+        const size_t        num_dropped_blocks = necro_atomic_load(&recorder->num_dropped_blocks);
+        necro_runtime_record_audio_block_finalize(a_name, a_name_length, 1, &scratch_buffer);
+        necro_runtime_audio_recorder_shutdown();
+        double*      data       = emalloc(num_blocks * block_size * sizeof(double));
+        const size_t num_frames = necro_audio_recorder_test_read(file_name, data, num_blocks * block_size);
+        bool         is_passed  = num_dropped_blocks > 0 && num_frames + num_dropped_blocks * block_size == num_blocks * block_size;
+        for (size_t i = 0; is_passed && i < num_frames; ++i)
+            is_passed = (i % block_size == 0) ? (i == 0 || data[i] > data[i - 1]) && fmod(data[i], (double) block_size) == 0.0 : data[i] == data[i - 1] + 1.0;
+        printf("Audio recorder drop test: %s\n", is_passed ? "passed" : "FAILED");
+        free(data);
+    }
+
+    free(block);
+    necro_runtime_options = options;
+}
+
+///////////////////////////////////////////////////////
+// NecroAudioFileWriter
+///////////////////////////////////////////////////////
+/*
+    Writes interleaved float blocks straight to disk as they are produced.
+    Used by offline rendering, where there is no audio device to hand the blocks to, and by the recorder's disk thread.
+    The header is kept up to date after every write, so the file stays readable even if we never get to close it.
+*/
+typedef struct NecroAudioFileWriter
+{
+    SNDFILE* snd_file;
+    size_t   num_channels;
+    size_t   num_frames_written;
+} NecroAudioFileWriter;
+
+NecroAudioFileWriter* necro_audio_file_writer_open(const char* file_name, const size_t num_channels, const size_t sample_rate, const NecroAudioSampleFormat sample_format)
+{
+    assert(file_name != NULL);
+    SF_INFO sf_info;
+    memset(&sf_info, 0, sizeof(sf_info)); // Yes, this is in fact the way in which libsndfile wants you to initialize the SF_INFO struct...
+    sf_info.format     = SF_FORMAT_WAV | (sample_format == NECRO_AUDIO_SAMPLE_FORMAT_INT24 ? SF_FORMAT_PCM_24 : SF_FORMAT_FLOAT);
+    sf_info.channels   = (int) num_channels;
+    sf_info.samplerate = (int) sample_rate;
+    SNDFILE* snd_file  = sf_open(file_name, SFM_WRITE, &sf_info);
+    if (snd_file == NULL)
+    {
+        fprintf(stderr, "Unable to open audio file: %s\n", file_name);
+        puts(sf_strerror(NULL));
+        return NULL;
+    }
+    sf_command(snd_file, SFC_SET_UPDATE_HEADER_AUTO, NULL, SF_TRUE);
+    sf_command(snd_file, SFC_SET_CLIPPING, NULL, SF_TRUE); // Otherwise out of range floats wrap around when converted to int24
+    NecroAudioFileWriter* writer = emalloc(sizeof(NecroAudioFileWriter));
+    writer->snd_file             = snd_file;
+    writer->num_channels         = num_channels;
+    writer->num_frames_written   = 0;
+    return writer;
+}
+
+size_t necro_audio_file_writer_write(NecroAudioFileWriter* writer, const float* interleaved_buffer, const size_t num_frames)
+{
+    assert(writer != NULL);
+    const size_t frames_written  = (size_t) sf_writef_float(writer->snd_file, interleaved_buffer, (sf_count_t) num_frames);
+    writer->num_frames_written  += frames_written;
+    return frames_written;
+}
+
+void necro_audio_file_writer_close(NecroAudioFileWriter* writer)
+{
+    if (writer == NULL)
+        return;
+    sf_close(writer->snd_file);
+    free(writer);
+}
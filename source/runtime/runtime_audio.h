@@ -12,15 +12,50 @@
 #include <stdbool.h>
 #include "runtime_common.h"
 
-#define                   necro_runtime_audio_num_output_channels 2
-static size_t             necro_runtime_audio_sample_rate         = 48000;
-static size_t             necro_runtime_audio_block_size          = 256;
+#define NECRO_AUDIO_MIN_SAMPLE_RATE     8000
+#define NECRO_AUDIO_MAX_SAMPLE_RATE     384000
+#define NECRO_AUDIO_MIN_BLOCK_SIZE      32 // One FloatVec 32, base.necro keeps blocks as Array (NatDiv BlockSize 32) (FloatVec 32)
+#define NECRO_AUDIO_MAX_BLOCK_SIZE      8192
+#define NECRO_AUDIO_MAX_OUTPUT_CHANNELS 32 // Written channels are tracked in a size_t bit mask each block
+#define NECRO_AUDIO_MAX_INPUT_CHANNELS  32
+
+typedef enum
+{
+    NECRO_AUDIO_SAMPLE_FORMAT_FLOAT32,
+    NECRO_AUDIO_SAMPLE_FORMAT_INT24,
+} NecroAudioSampleFormat;
+bool                            necro_audio_sample_format_from_name(const char* name, NecroAudioSampleFormat* out_format); // "float32" or "int24", NULL picks float32
 
 struct NecroDownsample;
-struct NecroDownsample*         necro_downsample_create(const double freq_cutoff, const double sample_rate);
-void                            necro_downsample(struct NecroDownsample* downsample, const size_t output_channel, const size_t num_output_channels, const size_t block_size, const size_t oversample_mul, double* input_buffer, float* output_buffer);
-extern DLLEXPORT const size_t** necro_runtime_record_audio_block(const uint64_t a_channel_num, const uint64_t a_num_channels, const double* a_audio_block, size_t** a_scratch_buffer);
+struct NecroDownsample*         necro_downsample_create(const size_t factor, const size_t block_size); // block_size is in frames at the output rate
+void                            necro_downsample_destroy(struct NecroDownsample* downsample);
+void                            necro_downsample(struct NecroDownsample* downsample, const double* input_block, double* output_block); // block_size * factor samples in, block_size samples out
+void                            necro_downsample_test();
+struct NecroUpsample;
+struct NecroUpsample*           necro_upsample_create(const size_t factor, const size_t block_size); // block_size is in frames at the input rate
+void                            necro_upsample_destroy(struct NecroUpsample* upsample);
+void                            necro_upsample(struct NecroUpsample* upsample, const double* input_block, double* output_block); // block_size samples in, block_size * factor samples out
+void                            necro_audio_deinterleave_from_float(const float* interleaved_buffer, const size_t num_channels, const size_t num_frames, double* planar_buffer); // planar_buffer gets num_channels runs of num_frames samples
+void                            necro_audio_interleave_to_float(const double* planar_buffer, const size_t num_channels, const size_t num_frames, float* interleaved_buffer); // planar_buffer holds num_channels runs of num_frames samples
+extern DLLEXPORT const size_t** necro_runtime_record_audio_block(const size_t* a_name, const uint64_t a_name_length, const uint64_t a_channel_num, const uint64_t a_num_channels, const double* a_audio_block, size_t** a_scratch_buffer);
 extern DLLEXPORT const size_t** necro_runtime_record_audio_block_finalize(const size_t* a_name, const uint64_t a_name_length, const uint64_t a_num_channels, size_t** a_scratch_buffer);
-extern DLLEXPORT const size_t*  necro_runtime_open_audio_file(const size_t* a_name, const uint64_t a_name_length);
+extern DLLEXPORT const size_t*  necro_runtime_open_audio_file(const size_t* a_name, const uint64_t a_name_length); // Returns the cached audio file if the same file is already loaded
+size_t                          necro_runtime_audio_file_cache_num_hits();   // Never blocks, safe on the RT thread
+size_t                          necro_runtime_audio_file_cache_num_misses(); // Never blocks, safe on the RT thread
+void                            necro_runtime_audio_file_cache_shutdown();   // Prints hit and miss counts, then forgets every cached file. Call before the heap is destroyed
+extern DLLEXPORT const size_t*  necro_runtime_open_audio_stream(const size_t* a_name, const uint64_t a_name_length);
+extern DLLEXPORT const size_t*  necro_runtime_read_audio_stream_block(const size_t* a_stream, const uint64_t a_is_looping);
+void                            necro_runtime_audio_stream_shutdown();
+size_t                          necro_runtime_audio_num_active_streams(); // Never blocks, safe on the RT thread
+void                            necro_audio_stream_test();
+void                            necro_runtime_audio_recorder_init(NecroAudioSampleFormat sample_format, bool is_threaded); // Without a disk thread recordings are written synchronously, for offline rendering
+void                            necro_runtime_audio_recorder_shutdown();                                                   // Flushes and closes any recordings still running
+void                            necro_audio_recorder_test();
+size_t                          necro_runtime_audio_num_active_recordings();                                               // Never blocks, safe on the RT thread
+
+struct NecroAudioFileWriter;
+struct NecroAudioFileWriter*    necro_audio_file_writer_open(const char* file_name, const size_t num_channels, const size_t sample_rate, const NecroAudioSampleFormat sample_format);
+size_t                          necro_audio_file_writer_write(struct NecroAudioFileWriter* writer, const float* interleaved_buffer, const size_t num_frames);
+void                            necro_audio_file_writer_close(struct NecroAudioFileWriter* writer);
 
 #endif // RUNTIME_AUDIO_H
\ No newline at end of file
@@ -0,0 +1,48 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "runtime_channel.h"
+#include "runtime_thread.h"
+
+///////////////////////////////////////////////////////
+// NecroSnapshotChannel
+///////////////////////////////////////////////////////
+void necro_snapshot_channel_init(NecroSnapshotChannel* channel)
+{
+    memset((void*) channel, 0, sizeof(NecroSnapshotChannel));
+}
+
+void necro_snapshot_channel_write(NecroSnapshotChannel* channel, const void* snapshot, size_t snapshot_size)
+{
+    assert((snapshot_size % sizeof(size_t)) == 0);
+    assert(snapshot_size <= NECRO_SNAPSHOT_CHANNEL_MAX_WORDS * sizeof(size_t));
+    const size_t* words     = (const size_t*) snapshot;
+    const size_t  num_words = snapshot_size / sizeof(size_t);
+    const size_t  sequence  = channel->sequence;
+    necro_atomic_store(&channel->sequence, sequence + 1);
+    for (size_t i = 0; i < num_words; ++i)
+        necro_atomic_store(channel->data + i, words[i]);
+    necro_atomic_store(&channel->sequence, sequence + 2);
+}
+
+bool necro_snapshot_channel_try_read(NecroSnapshotChannel* channel, void* out_snapshot, size_t snapshot_size, size_t* in_out_sequence)
+{
+    assert((snapshot_size % sizeof(size_t)) == 0);
+    assert(snapshot_size <= NECRO_SNAPSHOT_CHANNEL_MAX_WORDS * sizeof(size_t));
+    const size_t sequence = necro_atomic_load(&channel->sequence);
+    if ((sequence & 1) == 1 || sequence == *in_out_sequence)
+        return false;
+    size_t       words[NECRO_SNAPSHOT_CHANNEL_MAX_WORDS];
+    const size_t num_words = snapshot_size / sizeof(size_t);
+    for (size_t i = 0; i < num_words; ++i)
+        words[i] = necro_atomic_load(channel->data + i);
+    if (necro_atomic_load(&channel->sequence) != sequence)
+        return false;
+    memcpy(out_snapshot, words, snapshot_size);
+    *in_out_sequence = sequence;
+    return true;
+}
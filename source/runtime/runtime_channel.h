@@ -0,0 +1,34 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_CHANNEL_H
+#define RUNTIME_CHANNEL_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "runtime_common.h"
+
+///////////////////////////////////////////////////////
+// NecroSnapshotChannel
+//     * Single producer, single consumer, sequence locked snapshot of a small block of state.
+//     * The producer (NRT) can publish as often as it likes, the consumer (RT) picks up the latest complete snapshot.
+//     * Reads never block or retry: if a read overlaps a write the consumer keeps its previous snapshot
+//       and will pick up the new one on its next read, usually the next block.
+//     * Payloads are copied a word at a time, so their size must be a multiple of sizeof(size_t).
+///////////////////////////////////////////////////////
+#define NECRO_SNAPSHOT_CHANNEL_MAX_WORDS 32
+
+typedef struct NecroSnapshotChannel
+{
+    volatile size_t sequence; // Odd while a write is in progress
+    volatile size_t data[NECRO_SNAPSHOT_CHANNEL_MAX_WORDS];
+} NecroSnapshotChannel;
+
+void necro_snapshot_channel_init(NecroSnapshotChannel* channel);
+void necro_snapshot_channel_write(NecroSnapshotChannel* channel, const void* snapshot, size_t snapshot_size);          // Producer only
+bool necro_snapshot_channel_try_read(NecroSnapshotChannel* channel, void* out_snapshot, size_t snapshot_size, size_t* in_out_sequence); // Consumer only, true when out_snapshot was updated
+
+#endif // RUNTIME_CHANNEL_H
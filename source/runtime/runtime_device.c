@@ -0,0 +1,216 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "portaudio.h"
+#include "runtime_device.h"
+#include "runtime_thread.h"
+#include "utility.h"
+
+///////////////////////////////////////////////////////
+// PortAudio Device
+///////////////////////////////////////////////////////
+static PaStream*                 necro_portaudio_stream   = NULL;
+static NecroAudioDeviceCallback* necro_portaudio_callback = NULL;
+
+static int necro_portaudio_pa_callback(const void* input_buffer, void* output_buffer, unsigned long frames_per_buffer, const PaStreamCallbackTimeInfo* time_info, PaStreamCallbackFlags status_flags, void* user_data)
+{
+    UNUSED(time_info);
+    UNUSED(user_data);
+    uint32_t necro_status_flags = NECRO_AUDIO_DEVICE_STATUS_OK;
+    if ((status_flags & paInputUnderflow) == paInputUnderflow)
+        necro_status_flags |= NECRO_AUDIO_DEVICE_STATUS_INPUT_UNDERFLOW;
+    if ((status_flags & paInputOverflow) == paInputOverflow)
+        necro_status_flags |= NECRO_AUDIO_DEVICE_STATUS_INPUT_OVERFLOW;
+    if ((status_flags & paOutputUnderflow) == paOutputUnderflow)
+        necro_status_flags |= NECRO_AUDIO_DEVICE_STATUS_OUTPUT_UNDERFLOW;
+    if ((status_flags & paOutputOverflow) == paOutputOverflow)
+        necro_status_flags |= NECRO_AUDIO_DEVICE_STATUS_OUTPUT_OVERFLOW;
+    necro_portaudio_callback((const float*) input_buffer, (float*) output_buffer, (size_t) frames_per_buffer, necro_status_flags);
+    return paContinue;
+}
+
+static NecroResult(void) necro_portaudio_init(NecroAudioDeviceCallback* callback, size_t num_input_channels, size_t num_output_channels, size_t sample_rate, size_t block_size)
+{
+    assert(callback != NULL);
+    necro_portaudio_callback = callback;
+    PaError pa_error = Pa_Initialize();
+    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
+    // const PaSampleFormat audio_format = paFloat32 | paNonInterleaved;
+    const PaSampleFormat audio_format = paFloat32;
+    pa_error = Pa_OpenDefaultStream(&necro_portaudio_stream, (int) num_input_channels, (int) num_output_channels, audio_format, (double) sample_rate, (unsigned long) block_size, necro_portaudio_pa_callback, NULL);
+    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
+    return ok_void();
+}
+
+static NecroResult(void) necro_portaudio_start()
+{
+    PaError pa_error = Pa_StartStream(necro_portaudio_stream);
+    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
+    return ok_void();
+}
+
+static NecroResult(void) necro_portaudio_stop()
+{
+    // PaError pa_error = Pa_AbortStream(necro_portaudio_stream);
+    PaError pa_error = Pa_StopStream(necro_portaudio_stream);
+    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
+    return ok_void();
+}
+
+static NecroResult(void) necro_portaudio_shutdown()
+{
+    PaError pa_error = Pa_CloseStream(necro_portaudio_stream);
+    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
+    pa_error         = Pa_Terminate();
+    if (pa_error != paNoError) return necro_runtime_audio_error(Pa_GetErrorText(pa_error));
+    necro_portaudio_stream = NULL;
+    return ok_void();
+}
+
+static double necro_portaudio_cpu_load()
+{
+    return Pa_GetStreamCpuLoad(necro_portaudio_stream);
+}
+
+const NecroAudioDevice necro_audio_device_portaudio =
+{
+    .name     = "portaudio",
+    .init     = necro_portaudio_init,
+    .start    = necro_portaudio_start,
+    .stop     = necro_portaudio_stop,
+    .shutdown = necro_portaudio_shutdown,
+    .cpu_load = necro_portaudio_cpu_load,
+};
+
+///////////////////////////////////////////////////////
+// Null Device
+///////////////////////////////////////////////////////
+/*
+    Fires the callback from its own thread at the real block period, against absolute deadlines so that error doesn't accumulate.
+    The output is thrown away, but everything else follows the same real-time code path as a hardware device,
+    which lets us measure callback jitter, deadline misses, and CPU headroom on machines without sound hardware.
+*/
+typedef struct NecroNullDevice
+{
+    NecroAudioDeviceCallback* callback;
+    struct NecroThread*       thread;
+    float*                    input_buffer;
+    float*                    output_buffer;
+    size_t                    num_output_channels;
+    size_t                    block_size;
+    uint64_t                  block_period_ns;
+    volatile size_t           is_running;
+    volatile size_t           cpu_load_ppm; // cpu load in parts per million, smoothed
+} NecroNullDevice;
+
+static NecroNullDevice necro_null_device = { 0 };
+
+static void necro_null_device_thread(void* user_data)
+{
+    NecroNullDevice* device      = (NecroNullDevice*) user_data;
+    double           cpu_load    = 0.0;
+    uint64_t         deadline_ns = necro_time_ns() + device->block_period_ns;
+    while (necro_atomic_load(&device->is_running))
+    {
+        necro_sleep_until_ns(deadline_ns);
+        const uint64_t start_ns     = necro_time_ns();
+        // A late wake up means the previous block overran its deadline, which real hardware reports as an underflow
+        const uint32_t status_flags = (start_ns > deadline_ns + device->block_period_ns) ? NECRO_AUDIO_DEVICE_STATUS_OUTPUT_UNDERFLOW : NECRO_AUDIO_DEVICE_STATUS_OK;
+        memset(device->output_buffer, 0, device->block_size * device->num_output_channels * sizeof(float));
+        device->callback(device->input_buffer, device->output_buffer, device->block_size, status_flags);
+        const uint64_t end_ns       = necro_time_ns();
+        cpu_load                    = 0.9 * cpu_load + 0.1 * ((double) (end_ns - start_ns) / (double) device->block_period_ns);
+        necro_atomic_store(&device->cpu_load_ppm, (size_t) (cpu_load * 1000000.0));
+        deadline_ns                += device->block_period_ns;
+        // If we've fallen more than a block behind, drop the missed blocks instead of trying to catch up in a burst
+        if (end_ns > deadline_ns + device->block_period_ns)
+            deadline_ns = end_ns + device->block_period_ns;
+    }
+}
+
+static NecroResult(void) necro_null_device_init(NecroAudioDeviceCallback* callback, size_t num_input_channels, size_t num_output_channels, size_t sample_rate, size_t block_size)
+{
+    assert(callback != NULL);
+    necro_null_device                     = (NecroNullDevice) { 0 };
+    necro_null_device.callback            = callback;
+    necro_null_device.num_output_channels = num_output_channels;
+    necro_null_device.block_size          = block_size;
+    necro_null_device.block_period_ns     = (uint64_t) ((1000000000.0 * (double) block_size) / (double) sample_rate);
+    necro_null_device.input_buffer        = calloc((num_input_channels > 0 ? num_input_channels : 1) * block_size, sizeof(float));
+    necro_null_device.output_buffer       = calloc(num_output_channels * block_size, sizeof(float));
+    if (necro_null_device.input_buffer == NULL || necro_null_device.output_buffer == NULL)
+        return necro_runtime_audio_error("Unable to allocate null audio device buffers");
+    return ok_void();
+}
+
+static NecroResult(void) necro_null_device_start()
+{
+    necro_atomic_store(&necro_null_device.is_running, true);
+    necro_null_device.thread = necro_thread_create(necro_null_device_thread, &necro_null_device);
+    if (necro_null_device.thread == NULL)
+        return necro_runtime_audio_error("Unable to start null audio device thread");
+    return ok_void();
+}
+
+static NecroResult(void) necro_null_device_stop()
+{
+    necro_atomic_store(&necro_null_device.is_running, false);
+    necro_thread_join(necro_null_device.thread);
+    necro_null_device.thread = NULL;
+    return ok_void();
+}
+
+static NecroResult(void) necro_null_device_shutdown()
+{
+    free(necro_null_device.input_buffer);
+    free(necro_null_device.output_buffer);
+    necro_null_device = (NecroNullDevice) { 0 };
+    return ok_void();
+}
+
+static double necro_null_device_cpu_load()
+{
+    return ((double) necro_atomic_load(&necro_null_device.cpu_load_ppm)) / 1000000.0;
+}
+
+const NecroAudioDevice necro_audio_device_null =
+{
+    .name     = "null",
+    .init     = necro_null_device_init,
+    .start    = necro_null_device_start,
+    .stop     = necro_null_device_stop,
+    .shutdown = necro_null_device_shutdown,
+    .cpu_load = necro_null_device_cpu_load,
+};
+
+///////////////////////////////////////////////////////
+// Device lookup
+///////////////////////////////////////////////////////
+static const NecroAudioDevice* necro_audio_devices[] =
+{
+    &necro_audio_device_portaudio,
+    &necro_audio_device_null,
+};
+
+const NecroAudioDevice* necro_audio_device_get(const char* name)
+{
+    if (name == NULL)
+        return necro_audio_devices[0];
+    for (size_t i = 0; i < sizeof(necro_audio_devices) / sizeof(necro_audio_devices[0]); ++i)
+    {
+        if (strcmp(necro_audio_devices[i]->name, name) == 0)
+            return necro_audio_devices[i];
+    }
+    return NULL;
+}
+
+void necro_audio_device_print_names(FILE* stream)
+{
+    for (size_t i = 0; i < sizeof(necro_audio_devices) / sizeof(necro_audio_devices[0]); ++i)
+        fprintf(stream, "%s%s", i == 0 ? "" : ", ", necro_audio_devices[i]->name);
+    fprintf(stream, "\n");
+}
@@ -0,0 +1,49 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_DEVICE_H
+#define RUNTIME_DEVICE_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "result.h"
+#include "runtime_common.h"
+
+///////////////////////////////////////////////////////
+// NecroAudioDevice
+//     * A backend which drives the RT audio callback once per block.
+//     * Buffers handed to the callback are interleaved 32-bit floats.
+//     * Backends are chosen at startup by name, see necro_audio_device_get.
+///////////////////////////////////////////////////////
+typedef enum
+{
+    NECRO_AUDIO_DEVICE_STATUS_OK               = 0,
+    NECRO_AUDIO_DEVICE_STATUS_INPUT_UNDERFLOW  = 1,
+    NECRO_AUDIO_DEVICE_STATUS_INPUT_OVERFLOW   = 2,
+    NECRO_AUDIO_DEVICE_STATUS_OUTPUT_UNDERFLOW = 4,
+    NECRO_AUDIO_DEVICE_STATUS_OUTPUT_OVERFLOW  = 8,
+} NECRO_AUDIO_DEVICE_STATUS;
+
+typedef void NecroAudioDeviceCallback(const float* input_buffer, float* output_buffer, size_t num_frames, uint32_t status_flags);
+
+typedef struct NecroAudioDevice
+{
+    const char*       name;
+    NecroResult(void) (*init)(NecroAudioDeviceCallback* callback, size_t num_input_channels, size_t num_output_channels, size_t sample_rate, size_t block_size);
+    NecroResult(void) (*start)();
+    NecroResult(void) (*stop)();
+    NecroResult(void) (*shutdown)();
+    double            (*cpu_load)(); // Fraction of the block period spent inside the callback, 0 - 1
+} NecroAudioDevice;
+
+extern const NecroAudioDevice necro_audio_device_portaudio; // Real audio hardware through PortAudio
+extern const NecroAudioDevice necro_audio_device_null;      // No hardware. Fires the callback from a high resolution timer thread at the real block period
+
+const NecroAudioDevice* necro_audio_device_get(const char* name); // Returns NULL if there is no device by that name
+void                    necro_audio_device_print_names(FILE* stream);
+
+#endif // RUNTIME_DEVICE_H
@@ -0,0 +1,311 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "runtime_file.h"
+#include "runtime_thread.h"
+#include "utility.h"
+
+///////////////////////////////////////////////////////
+// NecroFileWriter
+///////////////////////////////////////////////////////
+/*
+    Buffered file writing:
+        * A fixed pool of writers, rings included, is allocated up front, each claimed by openFile and handed back by the background thread once closed.
+          Claiming only copies the name and resets the ring, so openFile is safe on the RT thread.
+        * The writing thread appends to the ring and publishes write_pos, the background thread opens the file,
+          writes out everything up to write_pos every few milliseconds and publishes read_pos.
+        * A file which can't be opened is reported by the background thread and whatever is written to it is discarded.
+        * When a ring is full the RT thread drops the whole value and counts the bytes, they are reported when the file is closed.
+          Any other thread waits for the background thread to make room.
+        * In render mode there is no background thread: the file is opened right away and each ring is written out synchronously
+          when it fills up or the file is closed.
+*/
+#define NECRO_FILE_BUFFER_MASK     (NECRO_FILE_BUFFER_SIZE - 1)
+#define NECRO_FILE_POLL_PERIOD_NS  5000000
+#define NECRO_FILE_WAIT_PERIOD_NS  1000000
+#define NECRO_FILE_MAX_TEXT_LENGTH 400 // Fits any double printed with %.17f: up to 309 integer digits, sign, point and 17 decimals
+
+typedef enum
+{
+    NECRO_FILE_WRITER_IDLE    = 0, // Free to be claimed by openFile
+    NECRO_FILE_WRITER_OPEN    = 1, // Being written to
+    NECRO_FILE_WRITER_CLOSING = 2, // Closed by the program, waiting for the background thread to write out the rest and close the file
+    NECRO_FILE_WRITER_OPENING = 3, // Claimed by openFile and being set up, the background thread leaves it alone
+} NECRO_FILE_WRITER_STATE;
+
+typedef struct NecroFileWriter
+{
+    volatile size_t state;
+    volatile size_t write_pos; // Written by the thread running the program
+    volatile size_t read_pos;  // Written by the background thread
+    volatile size_t num_dropped_bytes;
+    bool            is_binary;
+    bool            has_failed; // The file couldn't be opened
+    FILE*           file;       // Opened by the first flush
+    uint8_t*        buffer;
+    char            file_name[NECRO_FILE_MAX_FILE_NAME];
+} NecroFileWriter;
+
+static NecroFileWriter     necro_file_writers[NECRO_FILE_MAX_OPEN_FILES];
+static struct NecroThread* necro_file_thread            = NULL;
+static volatile size_t     necro_file_thread_is_running = false;
+static volatile size_t     necro_file_num_rejected      = 0;
+
+// Writes out everything published so far, opening the file first if need be. Only ever called by one thread at a time for a given writer
+static void necro_file_writer_flush(NecroFileWriter* writer)
+{
+    if (writer->file == NULL && !writer->has_failed)
+    {
+#ifdef WIN32
+        fopen_s(&writer->file, writer->file_name, writer->is_binary ? "wb" : "w");
+#else
+        writer->file = fopen(writer->file_name, writer->is_binary ? "wb" : "w");
+#endif
+        writer->has_failed = writer->file == NULL;
+        if (writer->has_failed && necro_file_thread != NULL)
+            fprintf(stderr, "Unable to open %s, anything written to it is discarded\n", writer->file_name);
+    }
+    const size_t write_pos = necro_atomic_load(&writer->write_pos);
+    size_t       read_pos  = writer->read_pos;
+    while (read_pos < write_pos)
+    {
+        // Write straight out of the ring, up to the wrap point
+        const size_t index     = read_pos & NECRO_FILE_BUFFER_MASK;
+        size_t       num_bytes = NECRO_FILE_BUFFER_SIZE - index;
+        num_bytes              = num_bytes < write_pos - read_pos ? num_bytes : write_pos - read_pos;
+        if (writer->file != NULL)
+            fwrite(writer->buffer + index, 1, num_bytes, writer->file);
+        read_pos              += num_bytes;
+    }
+    necro_atomic_store(&writer->read_pos, read_pos);
+}
+
+static void necro_file_writer_finish(NecroFileWriter* writer)
+{
+    necro_file_writer_flush(writer);
+    if (writer->num_dropped_bytes > 0)
+        printf("Writing %s dropped %zu bytes, the disk couldn't keep up\n", writer->file_name, writer->num_dropped_bytes);
+    if (writer->file != NULL)
+        fclose(writer->file);
+    writer->file       = NULL;
+    writer->has_failed = false;
+    necro_atomic_store(&writer->state, NECRO_FILE_WRITER_IDLE);
+}
+
+static void necro_file_thread_fn(void* user_data)
+{
+    UNUSED(user_data);
+    uint64_t wake_time_ns = necro_time_ns();
+    while (necro_atomic_load(&necro_file_thread_is_running))
+    {
+        for (size_t i = 0; i < NECRO_FILE_MAX_OPEN_FILES; ++i)
+        {
+            NecroFileWriter* writer = necro_file_writers + i;
+            const size_t     state  = necro_atomic_load(&writer->state);
+            if (state == NECRO_FILE_WRITER_OPEN)
+                necro_file_writer_flush(writer);
+            else if (state == NECRO_FILE_WRITER_CLOSING)
+                necro_file_writer_finish(writer);
+        }
+        wake_time_ns += NECRO_FILE_POLL_PERIOD_NS;
+        const uint64_t now_ns = necro_time_ns();
+        if (now_ns > wake_time_ns)
+            wake_time_ns = now_ns;
+        necro_sleep_until_ns(wake_time_ns);
+    }
+}
+
+static void necro_file_writer_write_bytes(NecroFileWriter* writer, const uint8_t* bytes, size_t num_bytes)
+{
+    size_t write_pos = writer->write_pos;
+    if (necro_thread_is_realtime() && NECRO_FILE_BUFFER_SIZE - (write_pos - necro_atomic_load(&writer->read_pos)) < num_bytes)
+    {
+        // No waiting on the RT thread. Values are dropped whole, so binary files stay aligned to their records
+        necro_atomic_store(&writer->num_dropped_bytes, writer->num_dropped_bytes + num_bytes);
+        return;
+    }
+    while (num_bytes > 0)
+    {
+        const size_t space = NECRO_FILE_BUFFER_SIZE - (write_pos - necro_atomic_load(&writer->read_pos));
+        if (space == 0)
+        {
+            // Full, wait for the background thread to catch up, or write it out ourselves when there isn't one
+            if (necro_file_thread != NULL)
+                necro_sleep_until_ns(necro_time_ns() + NECRO_FILE_WAIT_PERIOD_NS);
+            else
+                necro_file_writer_flush(writer);
+            continue;
+        }
+        const size_t index = write_pos & NECRO_FILE_BUFFER_MASK;
+        size_t       chunk = NECRO_FILE_BUFFER_SIZE - index;
+        chunk              = chunk < space ? chunk : space;
+        chunk              = chunk < num_bytes ? chunk : num_bytes;
+        memcpy(writer->buffer + index, bytes, chunk);
+        bytes             += chunk;
+        num_bytes         -= chunk;
+        write_pos         += chunk;
+        necro_atomic_store(&writer->write_pos, write_pos);
+    }
+}
+
+static void necro_file_writer_write_u32_le(NecroFileWriter* writer, uint32_t value)
+{
+    uint8_t bytes[4];
+    for (size_t i = 0; i < 4; ++i)
+        bytes[i] = (uint8_t) (value >> (i * 8));
+    necro_file_writer_write_bytes(writer, bytes, 4);
+}
+
+static void necro_file_writer_write_u64_le(NecroFileWriter* writer, uint64_t value)
+{
+    uint8_t bytes[NECRO_FILE_BINARY_RECORD_SIZE];
+    for (size_t i = 0; i < NECRO_FILE_BINARY_RECORD_SIZE; ++i)
+        bytes[i] = (uint8_t) (value >> (i * 8));
+    necro_file_writer_write_bytes(writer, bytes, NECRO_FILE_BINARY_RECORD_SIZE);
+}
+
+NecroFileWriter* necro_file_writer_open(const size_t* file_name, size_t file_name_length, bool is_binary)
+{
+    if (file_name == NULL || file_name_length == 0)
+        return NULL;
+    if (file_name_length >= NECRO_FILE_MAX_FILE_NAME)
+    {
+        necro_atomic_fetch_add(&necro_file_num_rejected, 1);
+        return NULL;
+    }
+    // Claim the slot before touching it, scheduler workers can open files at the same time as the RT thread
+    NecroFileWriter* writer = NULL;
+    for (size_t i = 0; i < NECRO_FILE_MAX_OPEN_FILES && writer == NULL; ++i)
+    {
+        if (necro_atomic_compare_exchange(&necro_file_writers[i].state, NECRO_FILE_WRITER_IDLE, NECRO_FILE_WRITER_OPENING))
+            writer = necro_file_writers + i;
+    }
+    if (writer == NULL)
+    {
+        necro_atomic_fetch_add(&necro_file_num_rejected, 1);
+        return NULL;
+    }
+    for (size_t i = 0; i < file_name_length; ++i)
+    {
+        // TODO: Unicode handling
+        writer->file_name[i] = (char) file_name[i];
+    }
+    writer->file_name[file_name_length] = '\0';
+    writer->is_binary                   = is_binary;
+    writer->has_failed                  = false;
+    writer->write_pos                   = 0;
+    writer->read_pos                    = 0;
+    writer->num_dropped_bytes           = 0;
+    if (necro_file_thread == NULL)
+    {
+        // Render mode, open it now so a bad name shows up as a failed open
+        necro_file_writer_flush(writer);
+        if (writer->has_failed)
+        {
+            writer->has_failed = false;
+            necro_atomic_store(&writer->state, NECRO_FILE_WRITER_IDLE);
+            return NULL;
+        }
+    }
+    if (is_binary)
+    {
+        necro_file_writer_write_bytes(writer, (const uint8_t*) "NECROBIN", 8);
+        necro_file_writer_write_u32_le(writer, NECRO_FILE_BINARY_VERSION);
+        necro_file_writer_write_u32_le(writer, NECRO_FILE_BINARY_RECORD_SIZE);
+    }
+    necro_atomic_store(&writer->state, NECRO_FILE_WRITER_OPEN);
+    return writer;
+}
+
+void necro_file_writer_close(NecroFileWriter* writer)
+{
+    if (writer == NULL)
+        return;
+    if (necro_file_thread == NULL)
+        necro_file_writer_finish(writer);
+    else
+        necro_atomic_store(&writer->state, NECRO_FILE_WRITER_CLOSING);
+}
+
+void necro_file_writer_write_int(NecroFileWriter* writer, int64_t value)
+{
+    if (writer->is_binary)
+    {
+        necro_file_writer_write_u64_le(writer, (uint64_t) value);
+        return;
+    }
+    char      text[NECRO_FILE_MAX_TEXT_LENGTH];
+    const int length = snprintf(text, NECRO_FILE_MAX_TEXT_LENGTH, "%" PRId64, value);
+    necro_file_writer_write_bytes(writer, (const uint8_t*) text, (size_t) length);
+}
+
+void necro_file_writer_write_uint(NecroFileWriter* writer, uint64_t value)
+{
+    if (writer->is_binary)
+    {
+        necro_file_writer_write_u64_le(writer, value);
+        return;
+    }
+    char      text[NECRO_FILE_MAX_TEXT_LENGTH];
+    const int length = snprintf(text, NECRO_FILE_MAX_TEXT_LENGTH, "%" PRIu64, value);
+    necro_file_writer_write_bytes(writer, (const uint8_t*) text, (size_t) length);
+}
+
+void necro_file_writer_write_float(NecroFileWriter* writer, double value)
+{
+    if (writer->is_binary)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(double));
+        necro_file_writer_write_u64_le(writer, bits);
+        return;
+    }
+    char      text[NECRO_FILE_MAX_TEXT_LENGTH];
+    const int length = snprintf(text, NECRO_FILE_MAX_TEXT_LENGTH, "%.17f", value);
+    assert(length < NECRO_FILE_MAX_TEXT_LENGTH);
+    necro_file_writer_write_bytes(writer, (const uint8_t*) text, (size_t) length);
+}
+
+void necro_file_writer_write_char(NecroFileWriter* writer, size_t value)
+{
+    if (writer->is_binary)
+        return;
+    const uint8_t c = (uint8_t) value;
+    necro_file_writer_write_bytes(writer, &c, 1);
+}
+
+void necro_runtime_file_init(bool is_threaded)
+{
+    assert(necro_file_thread == NULL);
+    memset(necro_file_writers, 0, sizeof(necro_file_writers));
+    necro_file_num_rejected = 0;
+    for (size_t i = 0; i < NECRO_FILE_MAX_OPEN_FILES; ++i)
+        necro_file_writers[i].buffer = emalloc(NECRO_FILE_BUFFER_SIZE);
+    if (is_threaded)
+    {
+        necro_file_thread_is_running = true;
+        necro_file_thread            = necro_thread_create(necro_file_thread_fn, NULL);
+    }
+}
+
+void necro_runtime_file_shutdown()
+{
+    necro_atomic_store(&necro_file_thread_is_running, false);
+    necro_thread_join(necro_file_thread);
+    necro_file_thread = NULL;
+    for (size_t i = 0; i < NECRO_FILE_MAX_OPEN_FILES; ++i)
+    {
+        if (necro_file_writers[i].state != NECRO_FILE_WRITER_IDLE)
+            necro_file_writer_finish(necro_file_writers + i);
+        free(necro_file_writers[i].buffer);
+        necro_file_writers[i].buffer = NULL;
+    }
+    if (necro_file_num_rejected > 0)
+        printf("%zu files were not opened, at most %d files with names shorter than %d characters can be open at once\n", necro_file_num_rejected, NECRO_FILE_MAX_OPEN_FILES, NECRO_FILE_MAX_FILE_NAME);
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_FILE_H
+#define RUNTIME_FILE_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "runtime_common.h"
+
+///////////////////////////////////////////////////////
+// NecroFileWriter
+//     * Backs the File primitives in base.necro (openFile, writeFloatToFile, ...).
+//     * Every open file gets a large ring buffer. Opening and writing only copy into it, a background thread does the actual file IO.
+//     * Text files format each value as it is written, the same way the old unbuffered primitives did.
+//     * Binary files start with a 16 byte header: "NECROBIN", then version and record size as little endian uint32s.
+//       After that every int, uint and float is one 8 byte little endian record (i64, u64 and f64).
+//       Chars carry no data in a binary file and are skipped, so separators written for text plots cost nothing.
+//     * If the disk falls behind and a ring fills up, the RT thread drops whole values and reports how much went missing when the file is closed.
+//       Other threads wait for space.
+///////////////////////////////////////////////////////
+#define NECRO_FILE_MAX_OPEN_FILES       16
+#define NECRO_FILE_MAX_FILE_NAME        1024
+#define NECRO_FILE_BUFFER_SIZE          (1 << 22) // Bytes per open file, must be a power of 2
+#define NECRO_FILE_BINARY_VERSION       1
+#define NECRO_FILE_BINARY_RECORD_SIZE   8
+
+struct NecroFileWriter;
+struct NecroFileWriter* necro_file_writer_open(const size_t* file_name, size_t file_name_length, bool is_binary); // One character per word, as necro strings are laid out. NULL if too many are already open, or in render mode if the file couldn't be opened
+void                    necro_file_writer_close(struct NecroFileWriter* writer);       // Hands the file to the background thread to finish writing and close
+void                    necro_file_writer_write_int(struct NecroFileWriter* writer, int64_t value);
+void                    necro_file_writer_write_uint(struct NecroFileWriter* writer, uint64_t value);
+void                    necro_file_writer_write_float(struct NecroFileWriter* writer, double value);
+void                    necro_file_writer_write_char(struct NecroFileWriter* writer, size_t value);
+void                    necro_runtime_file_init(bool is_threaded); // Without a background thread buffers are written out synchronously as they fill
+void                    necro_runtime_file_shutdown();             // Flushes and closes any files still open
+
+#endif // RUNTIME_FILE_H
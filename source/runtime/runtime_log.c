@@ -0,0 +1,237 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include "runtime_log.h"
+#include "runtime_thread.h"
+
+///////////////////////////////////////////////////////
+// Ring
+//     * Bounded multi producer queue (after Vyukov): each entry carries a sequence number saying whose turn it is.
+//       A producer claims a slot by bumping head, fills it in, then publishes it by advancing the slot's sequence.
+//     * Entry i is free for the push at position p when its sequence is p, and ready to drain when it is p + 1.
+//     * Sequences are stored less the entry's index, so the zero initialized ring already starts with entry i free for position i.
+//       Printing works before necro_log_init and after shutdown, rather than spinning on a slot which never comes free.
+///////////////////////////////////////////////////////
+typedef struct NecroLogEntry
+{
+    volatile size_t sequence; // Less the entry's index, see necro_log_load_sequence
+    uint32_t        type;
+    uint32_t        length; // Bytes of text used, NECRO_LOG_TEXT only
+    union
+    {
+        int64_t  i64;
+        uint64_t u64;
+        double   f64;
+        char     text[NECRO_LOG_TEXT_CHUNK];
+    };
+} NecroLogEntry;
+
+static NecroLogEntry   necro_log_entries[NECRO_LOG_NUM_ENTRIES];
+static volatile size_t necro_log_head             = 0; // Next position to push, shared by every producer
+static volatile size_t necro_log_tail             = 0; // Next position to drain, only touched by the thread holding is_draining
+static volatile size_t necro_log_is_draining      = 0;
+static volatile size_t necro_log_dropped          = 0;
+static size_t          necro_log_dropped_reported = 0;
+
+static inline size_t necro_log_load_sequence(NecroLogEntry* entry)
+{
+    return necro_atomic_load(&entry->sequence) + (size_t) (entry - necro_log_entries);
+}
+
+static inline void necro_log_store_sequence(NecroLogEntry* entry, size_t sequence)
+{
+    necro_atomic_store(&entry->sequence, sequence - (size_t) (entry - necro_log_entries));
+}
+
+void necro_log_init()
+{
+    // Anything printed before the runtime started goes out first
+    necro_log_drain(stdout);
+    for (size_t i = 0; i < NECRO_LOG_NUM_ENTRIES; ++i)
+        necro_log_entries[i].sequence = 0;
+    necro_atomic_store(&necro_log_head, 0);
+    necro_atomic_store(&necro_log_tail, 0);
+    necro_atomic_store(&necro_log_is_draining, 0);
+    necro_atomic_store(&necro_log_dropped, 0);
+    necro_log_dropped_reported = 0;
+}
+
+// When the ring is full the RT thread gets NULL and the drop is counted, any other thread drains the ring itself and tries again
+static NecroLogEntry* necro_log_claim(size_t* out_position)
+{
+    size_t position = necro_atomic_load(&necro_log_head);
+    while (true)
+    {
+        NecroLogEntry*  entry    = necro_log_entries + (position & (NECRO_LOG_NUM_ENTRIES - 1));
+        const size_t    sequence = necro_log_load_sequence(entry);
+        const ptrdiff_t diff     = (ptrdiff_t) (sequence - position);
+        if (diff == 0)
+        {
+            if (necro_atomic_compare_exchange(&necro_log_head, position, position + 1))
+            {
+                *out_position = position;
+                return entry;
+            }
+            position = necro_atomic_load(&necro_log_head);
+        }
+        else if (diff < 0 && necro_thread_is_realtime())
+        {
+            necro_atomic_fetch_add(&necro_log_dropped, 1);
+            return NULL;
+        }
+        else if (diff < 0)
+        {
+            // Another thread may be mid drain, in which case this returns straight away and we spin until it has made room
+            necro_log_drain(stdout);
+            necro_cpu_relax();
+            position = necro_atomic_load(&necro_log_head);
+        }
+        else
+        {
+            position = necro_atomic_load(&necro_log_head);
+        }
+    }
+}
+
+static inline void necro_log_publish(NecroLogEntry* entry, size_t position)
+{
+    necro_log_store_sequence(entry, position + 1);
+}
+
+void necro_log_push_i64(int64_t value)
+{
+    size_t         position;
+    NecroLogEntry* entry = necro_log_claim(&position);
+    if (entry == NULL)
+        return;
+    entry->type = NECRO_LOG_I64;
+    entry->i64  = value;
+    necro_log_publish(entry, position);
+}
+
+void necro_log_push_u64(uint64_t value)
+{
+    size_t         position;
+    NecroLogEntry* entry = necro_log_claim(&position);
+    if (entry == NULL)
+        return;
+    entry->type = NECRO_LOG_U64;
+    entry->u64  = value;
+    necro_log_publish(entry, position);
+}
+
+void necro_log_push_f32(float value)
+{
+    size_t         position;
+    NecroLogEntry* entry = necro_log_claim(&position);
+    if (entry == NULL)
+        return;
+    entry->type = NECRO_LOG_F32;
+    entry->f64  = (double) value;
+    necro_log_publish(entry, position);
+}
+
+void necro_log_push_f64(double value)
+{
+    size_t         position;
+    NecroLogEntry* entry = necro_log_claim(&position);
+    if (entry == NULL)
+        return;
+    entry->type = NECRO_LOG_F64;
+    entry->f64  = value;
+    necro_log_publish(entry, position);
+}
+
+void necro_log_push_char(size_t value)
+{
+    size_t         position;
+    NecroLogEntry* entry = necro_log_claim(&position);
+    if (entry == NULL)
+        return;
+    entry->type = NECRO_LOG_CHAR;
+    entry->u64  = (uint64_t) value;
+    necro_log_publish(entry, position);
+}
+
+void necro_log_push_text(const size_t* str, size_t str_length)
+{
+    size_t i = 0;
+    do
+    {
+        size_t         position;
+        NecroLogEntry* entry = necro_log_claim(&position);
+        if (entry == NULL)
+            return;
+        size_t length = 0;
+        for (; i < str_length && length < NECRO_LOG_TEXT_CHUNK; ++i, ++length)
+            entry->text[length] = (char) str[i];
+        entry->type   = NECRO_LOG_TEXT;
+        entry->length = (uint32_t) length;
+        necro_log_publish(entry, position);
+    }
+    while (i < str_length);
+}
+
+///////////////////////////////////////////////////////
+// Drain
+///////////////////////////////////////////////////////
+static void necro_log_print_entry(const NecroLogEntry* entry, FILE* stream)
+{
+    switch ((NECRO_LOG_ENTRY_TYPE) entry->type)
+    {
+    case NECRO_LOG_I64:  fprintf(stream, "%" PRId64, entry->i64); break;
+    case NECRO_LOG_U64:  fprintf(stream, "%" PRIu64, entry->u64); break;
+    case NECRO_LOG_F32:  fprintf(stream, "%.17f", entry->f64);    break;
+    case NECRO_LOG_F64:  fprintf(stream, "%.17g", entry->f64);    break;
+    case NECRO_LOG_CHAR:
+        if (entry->u64 < 256)
+            fputc((int) entry->u64, stream);
+        else
+            fprintf(stream, "%" PRIu64, entry->u64);
+        break;
+    case NECRO_LOG_TEXT: fwrite(entry->text, 1, entry->length, stream); break;
+    default:
+        assert(false);
+        break;
+    }
+}
+
+void necro_log_drain(FILE* stream)
+{
+    if (!necro_atomic_compare_exchange(&necro_log_is_draining, 0, 1))
+        return;
+    size_t tail       = necro_atomic_load(&necro_log_tail);
+    bool   is_written = false;
+    while (true)
+    {
+        NecroLogEntry* entry = necro_log_entries + (tail & (NECRO_LOG_NUM_ENTRIES - 1));
+        if (necro_log_load_sequence(entry) != tail + 1)
+            break;
+        necro_log_print_entry(entry, stream);
+        // Hand the slot back to producers one lap ahead
+        necro_log_store_sequence(entry, tail + NECRO_LOG_NUM_ENTRIES);
+        tail++;
+        is_written = true;
+    }
+    necro_atomic_store(&necro_log_tail, tail);
+    const size_t num_dropped = necro_atomic_load(&necro_log_dropped);
+    if (num_dropped != necro_log_dropped_reported)
+    {
+        fprintf(stderr, "\n[%zu print messages dropped, the log ring was full]\n", num_dropped - necro_log_dropped_reported);
+        necro_log_dropped_reported = num_dropped;
+    }
+    if (is_written)
+        fflush(stream);
+    necro_atomic_store(&necro_log_is_draining, 0);
+}
+
+size_t necro_log_num_dropped()
+{
+    return necro_atomic_load(&necro_log_dropped);
+}
@@ -0,0 +1,47 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_LOG_H
+#define RUNTIME_LOG_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "runtime_common.h"
+
+///////////////////////////////////////////////////////
+// NecroLog
+//     * Where the print primitives go. Pushing never locks, allocates or touches stdio, so printing from the RT thread is safe.
+//     * A preallocated ring of fixed size entries holding raw values, formatting happens when the NRT thread drains it.
+//     * Any number of threads can push. Strings are split across as many entries as they need.
+//     * When the ring is full on the RT thread (see necro_thread_is_realtime) the entry is dropped and counted, the drain reports how many went missing.
+//       Any other thread drains the ring to stdout itself, then pushes, so printing outside of blocks never loses anything.
+//     * The ring is valid from static initialization, printing before necro_log_init or after shutdown works the same way.
+///////////////////////////////////////////////////////
+#define NECRO_LOG_NUM_ENTRIES 4096 // Must be a power of 2
+#define NECRO_LOG_TEXT_CHUNK  48   // Bytes of string per entry, keeps an entry at 64 bytes
+
+typedef enum
+{
+    NECRO_LOG_I64,
+    NECRO_LOG_U64,
+    NECRO_LOG_F32,
+    NECRO_LOG_F64,
+    NECRO_LOG_CHAR,
+    NECRO_LOG_TEXT,
+} NECRO_LOG_ENTRY_TYPE;
+
+void   necro_log_init(); // Drains anything pushed beforehand, then resets the ring
+void   necro_log_push_i64(int64_t value);
+void   necro_log_push_u64(uint64_t value);
+void   necro_log_push_f32(float value);
+void   necro_log_push_f64(double value);
+void   necro_log_push_char(size_t value);
+void   necro_log_push_text(const size_t* str, size_t str_length); // One character per word, as necro strings are laid out
+void   necro_log_drain(FILE* stream);                              // Formats everything pushed so far. Safe from any thread, returns immediately if another thread is already draining
+size_t necro_log_num_dropped();
+
+#endif // RUNTIME_LOG_H
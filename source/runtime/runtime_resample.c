@@ -0,0 +1,543 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "runtime_resample.h"
+#include "runtime_thread.h"
+#include "utility.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NECRO_RESAMPLE_SSE2 1
+#include <emmintrin.h>
+#else
+#define NECRO_RESAMPLE_SSE2 0
+#endif
+
+#define NECRO_RESAMPLE_ZERO_CROSSINGS        24     // Sinc zero crossings either side of the centre tap, measured at the lower of the two rates
+#define NECRO_RESAMPLE_ROLLOFF               0.945  // Passband edge as a fraction of the lower nyquist
+#define NECRO_RESAMPLE_KAISER_BETA           9.0    // Roughly 90db of stopband attenuation
+#define NECRO_RESAMPLE_MIN_FRAMES_PER_THREAD 65536
+#define NECRO_RESAMPLE_MAX_THREADS           8
+
+static const double NECRO_RESAMPLE_PI = 3.14159265358979323846;
+
+///////////////////////////////////////////////////////
+// NecroResampleFilterBank
+///////////////////////////////////////////////////////
+/*
+    Polyphase layout:
+        * Output frame n sits at input position n * in_rate / out_rate, split into a whole input index and a fractional phase.
+        * Each phase has its own row of num_taps coefficients, so an output sample is a single dot product of
+          a row against num_taps consecutive input samples, starting half_length - 1 samples before the whole index.
+        * Exact banks have one row per phase of the reduced ratio and step through phases with integer arithmetic.
+        * Approximate banks have NECRO_RESAMPLE_APPROX_PHASES + 1 rows and blend the two rows either side of the
+          true position, which is tracked in 32.32 fixed point.
+*/
+typedef struct NecroResampleFilterBank
+{
+    bool     is_exact;
+    size_t   num_phases;
+    size_t   num_taps;     // Per phase, always a multiple of 4 for the vectorized dot product
+    size_t   half_length;
+    size_t   up;           // Reduced out_rate
+    size_t   down;         // Reduced in_rate
+    uint64_t step_fixed;   // Approximate banks only, input frames per output frame in 32.32 fixed point
+    double*  coefficients;
+} NecroResampleFilterBank;
+
+static size_t necro_resample_gcd(size_t a, size_t b)
+{
+    while (b != 0)
+    {
+        const size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static double necro_resample_bessel_i0(double x)
+{
+    // Power series, converges in a couple dozen terms for the betas used here
+    const double quarter_x_squared = 0.25 * x * x;
+    double       sum               = 1.0;
+    double       term              = 1.0;
+    for (size_t k = 1; k < 64; ++k)
+    {
+        term *= quarter_x_squared / (double) (k * k);
+        sum  += term;
+        if (term < sum * 1e-17)
+            break;
+    }
+    return sum;
+}
+
+static double necro_resample_kernel(double distance, double cutoff, double half_length, double i0_beta)
+{
+    if (fabs(distance) >= half_length)
+        return 0.0;
+    const double x      = cutoff * distance;
+    const double sinc   = fabs(x) < 1e-12 ? 1.0 : sin(NECRO_RESAMPLE_PI * x) / (NECRO_RESAMPLE_PI * x);
+    const double r      = distance / half_length;
+    const double window = necro_resample_bessel_i0(NECRO_RESAMPLE_KAISER_BETA * sqrt(1.0 - r * r)) / i0_beta;
+    return cutoff * sinc * window;
+}
+
+static NecroResampleFilterBank necro_resample_filter_bank_create(size_t in_rate, size_t out_rate)
+{
+    const size_t            divisor = necro_resample_gcd(in_rate, out_rate);
+    NecroResampleFilterBank bank;
+    bank.up          = out_rate / divisor;
+    bank.down        = in_rate / divisor;
+    bank.is_exact    = bank.up <= NECRO_RESAMPLE_MAX_PHASES;
+    bank.num_phases  = bank.is_exact ? bank.up : NECRO_RESAMPLE_APPROX_PHASES;
+    bank.step_fixed  = (uint64_t) (((double) in_rate / (double) out_rate) * 4294967296.0 + 0.5);
+    // When downsampling the cutoff drops to the output nyquist, and the kernel widens to keep the same transition band
+    const double cutoff   = (out_rate < in_rate ? (double) out_rate / (double) in_rate : 1.0) * NECRO_RESAMPLE_ROLLOFF;
+    bank.half_length      = (size_t) ceil(NECRO_RESAMPLE_ZERO_CROSSINGS / cutoff);
+    bank.num_taps         = (2 * bank.half_length + 3) & ~((size_t) 3);
+    const size_t num_rows = bank.is_exact ? bank.num_phases : bank.num_phases + 1;
+    bank.coefficients     = emalloc(num_rows * bank.num_taps * sizeof(double));
+    const double i0_beta  = necro_resample_bessel_i0(NECRO_RESAMPLE_KAISER_BETA);
+    for (size_t phase = 0; phase < num_rows; ++phase)
+    {
+        const double fraction = (double) phase / (double) bank.num_phases;
+        double*      row      = bank.coefficients + phase * bank.num_taps;
+        double       sum      = 0.0;
+        for (size_t tap = 0; tap < bank.num_taps; ++tap)
+        {
+            const double distance = fraction + (double) (bank.half_length - 1) - (double) tap;
+            row[tap]              = necro_resample_kernel(distance, cutoff, (double) bank.half_length, i0_beta);
+            sum                  += row[tap];
+        }
+        // Normalize every phase to unity gain at DC, otherwise the small gain differences between phases show up as modulation noise
+        for (size_t tap = 0; tap < bank.num_taps; ++tap)
+            row[tap] /= sum;
+    }
+    return bank;
+}
+
+///////////////////////////////////////////////////////
+// Inner loop
+///////////////////////////////////////////////////////
+static inline double necro_resample_dot(const double* samples, const double* coefficients, size_t num_taps)
+{
+    assert((num_taps % 4) == 0);
+#if NECRO_RESAMPLE_SSE2
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (size_t i = 0; i < num_taps; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(samples + i), _mm_loadu_pd(coefficients + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(samples + i + 2), _mm_loadu_pd(coefficients + i + 2)));
+    }
+    acc0 = _mm_add_pd(acc0, acc1);
+    acc0 = _mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0));
+    return _mm_cvtsd_f64(acc0);
+#else
+    double acc0 = 0.0;
+    double acc1 = 0.0;
+    double acc2 = 0.0;
+    double acc3 = 0.0;
+    for (size_t i = 0; i < num_taps; i += 4)
+    {
+        acc0 += samples[i]     * coefficients[i];
+        acc1 += samples[i + 1] * coefficients[i + 1];
+        acc2 += samples[i + 2] * coefficients[i + 2];
+        acc3 += samples[i + 3] * coefficients[i + 3];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+#endif
+}
+
+///////////////////////////////////////////////////////
+// Jobs
+///////////////////////////////////////////////////////
+typedef struct NecroResampleJob
+{
+    const NecroResampleFilterBank* bank;
+    const double*                  planar;        // num_channels zero padded channels, each planar_stride long
+    size_t                         planar_stride;
+    size_t                         planar_offset; // Index into a padded channel of the first tap for input frame 0
+    size_t                         num_channels;
+    double*                        output;        // Interleaved
+    size_t                         output_begin;
+    size_t                         output_end;
+} NecroResampleJob;
+
+static void necro_resample_job_run(void* user_data)
+{
+    const NecroResampleJob*        job          = (const NecroResampleJob*) user_data;
+    const NecroResampleFilterBank* bank         = job->bank;
+    const size_t                   num_taps     = bank->num_taps;
+    const size_t                   num_channels = job->num_channels;
+    if (bank->is_exact)
+    {
+        const size_t step_whole = bank->down / bank->up;
+        const size_t step_phase = bank->down % bank->up;
+        const uint64_t position = (uint64_t) job->output_begin * (uint64_t) bank->down;
+        size_t       index      = (size_t) (position / bank->up);
+        size_t       phase      = (size_t) (position % bank->up);
+        for (size_t frame = job->output_begin; frame < job->output_end; ++frame)
+        {
+            const double* row     = bank->coefficients + phase * num_taps;
+            const double* samples = job->planar + job->planar_offset + index;
+            double*       output  = job->output + frame * num_channels;
+            for (size_t channel = 0; channel < num_channels; ++channel)
+                output[channel] = necro_resample_dot(samples + channel * job->planar_stride, row, num_taps);
+            index += step_whole;
+            phase += step_phase;
+            if (phase >= bank->up)
+            {
+                phase -= bank->up;
+                index++;
+            }
+        }
+    }
+    else
+    {
+        uint64_t position = (uint64_t) job->output_begin * bank->step_fixed;
+        for (size_t frame = job->output_begin; frame < job->output_end; ++frame)
+        {
+            const size_t   index    = (size_t) (position >> 32);
+            const uint64_t fraction = (position & 0xFFFFFFFFull) * (uint64_t) bank->num_phases;
+            const size_t   phase    = (size_t) (fraction >> 32);
+            const double   blend    = (double) (fraction & 0xFFFFFFFFull) * (1.0 / 4294967296.0);
+            const double*  row0     = bank->coefficients + phase * num_taps;
+            const double*  row1     = row0 + num_taps;
+            const double*  samples  = job->planar + job->planar_offset + index;
+            double*        output   = job->output + frame * num_channels;
+            for (size_t channel = 0; channel < num_channels; ++channel)
+            {
+                const double a  = necro_resample_dot(samples + channel * job->planar_stride, row0, num_taps);
+                const double b  = necro_resample_dot(samples + channel * job->planar_stride, row1, num_taps);
+                output[channel] = a + blend * (b - a);
+            }
+            position += bank->step_fixed;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////
+// API
+///////////////////////////////////////////////////////
+double necro_resample_kaiser_sinc(double distance, double cutoff, double half_length)
+{
+    return necro_resample_kernel(distance, cutoff, half_length, necro_resample_bessel_i0(NECRO_RESAMPLE_KAISER_BETA));
+}
+
+size_t necro_resample_num_output_frames(size_t num_input_frames, size_t in_rate, size_t out_rate)
+{
+    assert(in_rate > 0 && out_rate > 0);
+    const size_t   divisor = necro_resample_gcd(in_rate, out_rate);
+    const uint64_t up      = out_rate / divisor;
+    const uint64_t down    = in_rate / divisor;
+    return (size_t) (((uint64_t) num_input_frames * up + down - 1) / down);
+}
+
+void necro_resample_interleaved(const double* input, size_t num_input_frames, size_t num_channels, size_t in_rate, double* output, size_t out_rate)
+{
+    assert(input != NULL);
+    assert(output != NULL);
+    const size_t num_output_frames = necro_resample_num_output_frames(num_input_frames, in_rate, out_rate);
+    if (num_output_frames == 0 || num_channels == 0)
+        return;
+    NecroResampleFilterBank bank = necro_resample_filter_bank_create(in_rate, out_rate);
+
+    // De-interleave into zero padded planar channels so the inner loop is a straight dot product with no edge cases
+    const size_t planar_padding = bank.num_taps;
+    const size_t planar_stride  = num_input_frames + 2 * planar_padding + 4;
+    double*      planar         = emalloc(planar_stride * num_channels * sizeof(double));
+    memset(planar, 0, planar_stride * num_channels * sizeof(double));
+    for (size_t channel = 0; channel < num_channels; ++channel)
+    {
+        double* planar_channel = planar + channel * planar_stride + planar_padding;
+        for (size_t frame = 0; frame < num_input_frames; ++frame)
+            planar_channel[frame] = input[frame * num_channels + channel];
+    }
+
+    // Long files are split into contiguous runs of output frames, one per worker, with the calling thread taking the first run
+    size_t num_jobs = num_output_frames / NECRO_RESAMPLE_MIN_FRAMES_PER_THREAD;
+    num_jobs        = num_jobs < necro_thread_hardware_concurrency() ? num_jobs : necro_thread_hardware_concurrency();
+    num_jobs        = num_jobs < NECRO_RESAMPLE_MAX_THREADS ? num_jobs : NECRO_RESAMPLE_MAX_THREADS;
+    num_jobs        = num_jobs > 0 ? num_jobs : 1;
+    const size_t        frames_per_job = (num_output_frames + num_jobs - 1) / num_jobs;
+    NecroResampleJob    jobs[NECRO_RESAMPLE_MAX_THREADS];
+    struct NecroThread* threads[NECRO_RESAMPLE_MAX_THREADS];
+    for (size_t i = 0; i < num_jobs; ++i)
+    {
+        jobs[i].bank          = &bank;
+        jobs[i].planar        = planar;
+        jobs[i].planar_stride = planar_stride;
+        jobs[i].planar_offset = planar_padding - (bank.half_length - 1);
+        jobs[i].num_channels  = num_channels;
+        jobs[i].output        = output;
+        jobs[i].output_begin  = i * frames_per_job;
+        jobs[i].output_end    = (i + 1) * frames_per_job < num_output_frames ? (i + 1) * frames_per_job : num_output_frames;
+        threads[i]            = NULL;
+    }
+    for (size_t i = 1; i < num_jobs; ++i)
+    {
+        threads[i] = necro_thread_create(necro_resample_job_run, jobs + i);
+        if (threads[i] == NULL)
+            necro_resample_job_run(jobs + i);
+    }
+    necro_resample_job_run(jobs);
+    for (size_t i = 1; i < num_jobs; ++i)
+        necro_thread_join(threads[i]);
+
+    free(planar);
+    free(bank.coefficients);
+}
+
+///////////////////////////////////////////////////////
+// NecroResampleStream
+///////////////////////////////////////////////////////
+/*
+    Streaming layout:
+        * Pushed input is de-interleaved onto the end of num_channels planar channels, each capacity long.
+        * The channels start with half_length - 1 zeros, so buffer position p holds input frame p - (half_length - 1),
+          and the first tap of the next output frame sits at buffer position index (or position >> 32 for approximate banks).
+        * An output frame can be pulled once all num_taps of its input samples have been pushed.
+        * Before pushing more input everything in front of the next output frame's first tap is discarded,
+          so the channels only ever hold about a chunk of input plus num_taps frames of history.
+        * Flushing pushes num_taps zeros, matching the zero padding necro_resample_interleaved puts after the input,
+          and stops output at necro_resample_num_output_frames of everything pushed, so both produce the same frames.
+*/
+typedef struct NecroResampleStream
+{
+    NecroResampleFilterBank bank;
+    size_t                  in_rate;
+    size_t                  out_rate;
+    size_t                  num_channels;
+    double*                 planar;
+    size_t                  capacity;
+    size_t                  num_buffered;
+    size_t                  index;             // Exact banks
+    size_t                  phase;             // Exact banks
+    uint64_t                position;          // Approximate banks, 32.32 fixed point
+    size_t                  num_input_frames;  // Pushed since the last reset, not counting flush padding
+    size_t                  num_output_frames; // Pulled since the last reset
+    bool                    is_flushed;
+} NecroResampleStream;
+
+static void necro_resample_stream_reserve(NecroResampleStream* stream, size_t num_frames)
+{
+    // Drop the input no future output frame reads
+    const size_t first_tap = stream->bank.is_exact ? stream->index : (size_t) (stream->position >> 32);
+    if (first_tap > 0)
+    {
+        for (size_t channel = 0; channel < stream->num_channels; ++channel)
+        {
+            double* planar_channel = stream->planar + channel * stream->capacity;
+            memmove(planar_channel, planar_channel + first_tap, (stream->num_buffered - first_tap) * sizeof(double));
+        }
+        stream->num_buffered -= first_tap;
+        stream->index        -= stream->bank.is_exact ? first_tap : 0;
+        stream->position     -= stream->bank.is_exact ? 0 : ((uint64_t) first_tap << 32);
+    }
+    if (stream->num_buffered + num_frames <= stream->capacity)
+        return;
+    size_t new_capacity = stream->capacity * 2;
+    new_capacity        = new_capacity > stream->num_buffered + num_frames ? new_capacity : stream->num_buffered + num_frames;
+    double* new_planar  = emalloc(new_capacity * stream->num_channels * sizeof(double));
+    for (size_t channel = 0; channel < stream->num_channels; ++channel)
+        memcpy(new_planar + channel * new_capacity, stream->planar + channel * stream->capacity, stream->num_buffered * sizeof(double));
+    free(stream->planar);
+    stream->planar   = new_planar;
+    stream->capacity = new_capacity;
+}
+
+NecroResampleStream* necro_resample_stream_create(size_t num_channels, size_t in_rate, size_t out_rate)
+{
+    assert(num_channels > 0);
+    assert(in_rate > 0 && out_rate > 0);
+    NecroResampleStream* stream = emalloc(sizeof(NecroResampleStream));
+    memset(stream, 0, sizeof(NecroResampleStream));
+    stream->bank                = necro_resample_filter_bank_create(in_rate, out_rate);
+    stream->in_rate             = in_rate;
+    stream->out_rate            = out_rate;
+    stream->num_channels        = num_channels;
+    stream->capacity            = 4 * stream->bank.num_taps;
+    stream->planar              = emalloc(stream->capacity * num_channels * sizeof(double));
+    necro_resample_stream_reset(stream);
+    return stream;
+}
+
+void necro_resample_stream_destroy(NecroResampleStream* stream)
+{
+    if (stream == NULL)
+        return;
+    free(stream->planar);
+    free(stream->bank.coefficients);
+    free(stream);
+}
+
+void necro_resample_stream_reset(NecroResampleStream* stream)
+{
+    stream->num_buffered      = stream->bank.half_length - 1;
+    stream->index             = 0;
+    stream->phase             = 0;
+    stream->position          = 0;
+    stream->num_input_frames  = 0;
+    stream->num_output_frames = 0;
+    stream->is_flushed        = false;
+    for (size_t channel = 0; channel < stream->num_channels; ++channel)
+        memset(stream->planar + channel * stream->capacity, 0, stream->num_buffered * sizeof(double));
+}
+
+void necro_resample_stream_push(NecroResampleStream* stream, const double* input, size_t num_input_frames)
+{
+    assert(!stream->is_flushed);
+    necro_resample_stream_reserve(stream, num_input_frames);
+    for (size_t channel = 0; channel < stream->num_channels; ++channel)
+    {
+        double* planar_channel = stream->planar + channel * stream->capacity + stream->num_buffered;
+        for (size_t frame = 0; frame < num_input_frames; ++frame)
+            planar_channel[frame] = input[frame * stream->num_channels + channel];
+    }
+    stream->num_buffered     += num_input_frames;
+    stream->num_input_frames += num_input_frames;
+}
+
+void necro_resample_stream_flush(NecroResampleStream* stream)
+{
+    if (stream->is_flushed)
+        return;
+    necro_resample_stream_reserve(stream, stream->bank.num_taps);
+    for (size_t channel = 0; channel < stream->num_channels; ++channel)
+        memset(stream->planar + channel * stream->capacity + stream->num_buffered, 0, stream->bank.num_taps * sizeof(double));
+    stream->num_buffered += stream->bank.num_taps;
+    stream->is_flushed    = true;
+}
+
+size_t necro_resample_stream_pull(NecroResampleStream* stream, double* output, size_t max_output_frames)
+{
+    const NecroResampleFilterBank* bank         = &stream->bank;
+    const size_t                   num_taps     = bank->num_taps;
+    const size_t                   num_channels = stream->num_channels;
+    if (stream->is_flushed)
+    {
+        const size_t num_left = necro_resample_num_output_frames(stream->num_input_frames, stream->in_rate, stream->out_rate) - stream->num_output_frames;
+        max_output_frames     = max_output_frames < num_left ? max_output_frames : num_left;
+    }
+    size_t frame = 0;
+    if (bank->is_exact)
+    {
+        const size_t step_whole = bank->down / bank->up;
+        const size_t step_phase = bank->down % bank->up;
+        for (; frame < max_output_frames && stream->index + num_taps <= stream->num_buffered; ++frame)
+        {
+            const double* row     = bank->coefficients + stream->phase * num_taps;
+            const double* samples = stream->planar + stream->index;
+            for (size_t channel = 0; channel < num_channels; ++channel)
+                output[frame * num_channels + channel] = necro_resample_dot(samples + channel * stream->capacity, row, num_taps);
+            stream->index += step_whole;
+            stream->phase += step_phase;
+            if (stream->phase >= bank->up)
+            {
+                stream->phase -= bank->up;
+                stream->index++;
+            }
+        }
+    }
+    else
+    {
+        for (; frame < max_output_frames && (size_t) (stream->position >> 32) + num_taps <= stream->num_buffered; ++frame)
+        {
+            const uint64_t fraction = (stream->position & 0xFFFFFFFFull) * (uint64_t) bank->num_phases;
+            const size_t   phase    = (size_t) (fraction >> 32);
+            const double   blend    = (double) (fraction & 0xFFFFFFFFull) * (1.0 / 4294967296.0);
+            const double*  row0     = bank->coefficients + phase * num_taps;
+            const double*  row1     = row0 + num_taps;
+            const double*  samples  = stream->planar + (size_t) (stream->position >> 32);
+            for (size_t channel = 0; channel < num_channels; ++channel)
+            {
+                const double a                         = necro_resample_dot(samples + channel * stream->capacity, row0, num_taps);
+                const double b                         = necro_resample_dot(samples + channel * stream->capacity, row1, num_taps);
+                output[frame * num_channels + channel] = a + blend * (b - a);
+            }
+            stream->position += bank->step_fixed;
+        }
+    }
+    stream->num_output_frames += frame;
+    return frame;
+}
+
+bool necro_resample_stream_is_finished(const NecroResampleStream* stream)
+{
+    return stream->is_flushed && stream->num_output_frames == necro_resample_num_output_frames(stream->num_input_frames, stream->in_rate, stream->out_rate);
+}
+
+///////////////////////////////////////////////////////
+// Testing
+///////////////////////////////////////////////////////
+// Streams a test signal through in uneven chunks, pulling into a small output buffer, and compares against resampling it in one go
+static bool necro_resample_stream_test_matches(size_t in_rate, size_t out_rate, size_t num_channels, size_t chunk_frames)
+{
+    const size_t num_input_frames  = 20000;
+    const size_t num_output_frames = necro_resample_num_output_frames(num_input_frames, in_rate, out_rate);
+    double*      input             = emalloc(num_input_frames * num_channels * sizeof(double));
+    double*      expected          = emalloc(num_output_frames * num_channels * sizeof(double));
+    double*      streamed          = emalloc((num_output_frames + 1) * num_channels * sizeof(double));
+    for (size_t i = 0; i < num_input_frames * num_channels; ++i)
+        input[i] = sin((double) i * 0.0123) + 0.25 * sin((double) i * 0.71);
+    necro_resample_interleaved(input, num_input_frames, num_channels, in_rate, expected, out_rate);
+
+    NecroResampleStream* stream         = necro_resample_stream_create(num_channels, in_rate, out_rate);
+    size_t               input_frame    = 0;
+    size_t               output_frame   = 0;
+    bool                 is_flushed     = false;
+    const size_t         pull_frames    = 333;
+    while (!necro_resample_stream_is_finished(stream) && output_frame <= num_output_frames)
+    {
+        const size_t pulled = necro_resample_stream_pull(stream, streamed + output_frame * num_channels, pull_frames < num_output_frames + 1 - output_frame ? pull_frames : num_output_frames + 1 - output_frame);
+        output_frame       += pulled;
+        if (pulled > 0)
+            continue;
+        if (input_frame == num_input_frames)
+        {
+            if (is_flushed)
+                break;
+            necro_resample_stream_flush(stream);
+            is_flushed = true;
+            continue;
+        }
+        // Vary the chunk size so that chunk boundaries land on every part of the filter
+        const size_t chunk = (chunk_frames + input_frame % 7) < num_input_frames - input_frame ? (chunk_frames + input_frame % 7) : num_input_frames - input_frame;
+        necro_resample_stream_push(stream, input + input_frame * num_channels, chunk);
+        input_frame += chunk;
+    }
+    bool is_match = output_frame == num_output_frames;
+    for (size_t i = 0; is_match && i < num_output_frames * num_channels; ++i)
+        is_match = streamed[i] == expected[i];
+    necro_resample_stream_destroy(stream);
+    free(input);
+    free(expected);
+    free(streamed);
+    return is_match;
+}
+
+void necro_resample_test()
+{
+    necro_announce_phase("NecroResample");
+    const size_t rates[][2] =
+    {
+        { 44100, 48000 }, // Exact upsampling
+        { 96000, 48000 }, // Exact downsampling
+        { 44101, 48000 }, // Too many phases, approximate
+    };
+    const size_t chunk_sizes[] = { 1, 61, 8192 };
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); ++r)
+    {
+        for (size_t c = 0; c < sizeof(chunk_sizes) / sizeof(size_t); ++c)
+        {
+            const bool is_passed = necro_resample_stream_test_matches(rates[r][0], rates[r][1], 2, chunk_sizes[c]);
+            printf("Resample stream %d -> %d, %d frame chunks test: %s\n", (int) rates[r][0], (int) rates[r][1], (int) chunk_sizes[c], is_passed ? "passed" : "FAILED");
+        }
+    }
+}
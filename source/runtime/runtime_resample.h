@@ -0,0 +1,43 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_RESAMPLE_H
+#define RUNTIME_RESAMPLE_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "runtime_common.h"
+
+///////////////////////////////////////////////////////
+// Sample rate conversion
+//     * Polyphase windowed-sinc (Kaiser) resampler for converting audio files to the runtime sample rate at load time.
+//     * When out_rate / in_rate reduces to a ratio with at most NECRO_RESAMPLE_MAX_PHASES phases conversion is exact,
+//       otherwise the nearest NECRO_RESAMPLE_APPROX_PHASES phases are linearly interpolated.
+//     * Not RT safe: it allocates, and large files are split across worker threads.
+///////////////////////////////////////////////////////
+#define NECRO_RESAMPLE_MAX_PHASES    1024
+#define NECRO_RESAMPLE_APPROX_PHASES 256
+
+size_t necro_resample_num_output_frames(size_t num_input_frames, size_t in_rate, size_t out_rate);
+double necro_resample_kaiser_sinc(double distance, double cutoff, double half_length); // The filter kernel, cutoff as a fraction of nyquist, zero at and beyond half_length
+void   necro_resample_interleaved(const double* input, size_t num_input_frames, size_t num_channels, size_t in_rate, double* output, size_t out_rate); // output holds necro_resample_num_output_frames frames
+void   necro_resample_test();
+
+///////////////////////////////////////////////////////
+// NecroResampleStream
+//     * Chunked version of necro_resample_interleaved for audio streams: input is pushed as it's decoded and output pulled as there's room for it.
+//     * Produces exactly the same frames as resampling all of the input in one go.
+//     * Not RT safe either, pushing may grow the stream's buffers.
+///////////////////////////////////////////////////////
+struct NecroResampleStream* necro_resample_stream_create(size_t num_channels, size_t in_rate, size_t out_rate);
+void                        necro_resample_stream_destroy(struct NecroResampleStream* stream);
+void                        necro_resample_stream_reset(struct NecroResampleStream* stream); // Back to the state it was created in, e.g. to start over from the top of a file
+void                        necro_resample_stream_push(struct NecroResampleStream* stream, const double* input, size_t num_input_frames); // Interleaved
+void                        necro_resample_stream_flush(struct NecroResampleStream* stream); // No more input, lets the last input frames be pulled
+size_t                      necro_resample_stream_pull(struct NecroResampleStream* stream, double* output, size_t max_output_frames); // Interleaved, returns fewer than max_output_frames when it needs more input
+bool                        necro_resample_stream_is_finished(const struct NecroResampleStream* stream); // Flushed and every output frame pulled
+
+#endif // RUNTIME_RESAMPLE_H
@@ -0,0 +1,399 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "runtime_scheduler.h"
+#include "runtime_thread.h"
+#include "utility.h"
+
+///////////////////////////////////////////////////////
+// NecroTaskDeque
+//     * Chase-Lev deque of task indices. The owner pushes and pops at the bottom, thieves take from the top.
+//     * Indices only ever grow, so they never need resetting between blocks. They start at 1 so bottom - 1 can't wrap.
+//     * Each task is pushed at most once a block and every deque is empty between blocks,
+//       so a ring as large as the graph can never overflow and doesn't need to grow.
+///////////////////////////////////////////////////////
+#define NECRO_SCHEDULER_CACHE_LINE 64
+
+typedef struct NecroTaskDeque
+{
+    volatile size_t  top;
+    uint8_t          top_padding[NECRO_SCHEDULER_CACHE_LINE - sizeof(size_t)];
+    volatile size_t  bottom;
+    volatile size_t* tasks;
+    uint8_t          bottom_padding[NECRO_SCHEDULER_CACHE_LINE - sizeof(size_t) - sizeof(size_t*)];
+} NecroTaskDeque;
+
+typedef struct NecroSchedulerWorker
+{
+    struct NecroScheduler* scheduler;
+    struct NecroThread*    thread;
+    size_t                 index;
+} NecroSchedulerWorker;
+
+typedef struct NecroScheduler
+{
+    // Graph
+    NecroTaskFn**          task_fns;
+    size_t*                num_dependencies;
+    size_t*                dependent_offsets; // Dependents of task i are dependents[dependent_offsets[i]] up to dependents[dependent_offsets[i + 1]]
+    size_t*                dependents;
+    size_t*                roots;             // Tasks with no dependencies, in program order
+    size_t                 num_roots;
+    size_t                 num_tasks;
+    // Per block state
+    volatile size_t*       num_pending;       // Per task, dependencies which haven't finished yet this block
+    volatile size_t        num_remaining;     // Tasks which haven't finished yet this block
+    volatile size_t        block;             // Bumped by necro_scheduler_run to start each block
+    // Workers
+    NecroTaskDeque*        deques;            // num_workers + 1, the thread calling necro_scheduler_run owns deques[0]
+    size_t                 deque_mask;
+    NecroSchedulerWorker*  workers;
+    size_t                 num_workers;
+    bool                   is_real_time;
+    size_t                 rt_priority;
+    bool                   is_memory_locked;
+    struct NecroSemaphore* wake;
+    volatile size_t        num_parked;
+    volatile size_t        is_running;
+} NecroScheduler;
+
+// Owner only
+static void necro_task_deque_push(NecroScheduler* scheduler, NecroTaskDeque* deque, size_t task)
+{
+    const size_t bottom = deque->bottom;
+    necro_atomic_store(deque->tasks + (bottom & scheduler->deque_mask), task);
+    necro_atomic_store(&deque->bottom, bottom + 1);
+}
+
+// Owner only
+static bool necro_task_deque_pop(NecroScheduler* scheduler, NecroTaskDeque* deque, size_t* out_task)
+{
+    const size_t bottom = deque->bottom - 1;
+    necro_atomic_store(&deque->bottom, bottom);
+    necro_atomic_fence(); // The store to bottom has to be visible to thieves before top is read
+    const size_t top = necro_atomic_load(&deque->top);
+    if (top > bottom)
+    {
+        necro_atomic_store(&deque->bottom, bottom + 1);
+        return false;
+    }
+    *out_task = necro_atomic_load(deque->tasks + (bottom & scheduler->deque_mask));
+    if (top < bottom)
+        return true;
+    // Last task, race the thieves for it
+    const bool is_taken = necro_atomic_compare_exchange(&deque->top, top, top + 1);
+    necro_atomic_store(&deque->bottom, bottom + 1);
+    return is_taken;
+}
+
+static bool necro_task_deque_steal(NecroScheduler* scheduler, NecroTaskDeque* deque, size_t* out_task)
+{
+    const size_t top = necro_atomic_load(&deque->top);
+    necro_atomic_fence();
+    const size_t bottom = necro_atomic_load(&deque->bottom);
+    if (top >= bottom)
+        return false;
+    const size_t task = necro_atomic_load(deque->tasks + (top & scheduler->deque_mask));
+    if (!necro_atomic_compare_exchange(&deque->top, top, top + 1))
+        return false;
+    *out_task = task;
+    return true;
+}
+
+///////////////////////////////////////////////////////
+// Running
+///////////////////////////////////////////////////////
+static void necro_scheduler_run_task(NecroScheduler* scheduler, NecroTaskDeque* deque, size_t task)
+{
+    scheduler->task_fns[task]();
+    // Dependents are pushed before num_remaining drops, so it can't reach 0 while work is still outstanding
+    for (size_t i = scheduler->dependent_offsets[task]; i < scheduler->dependent_offsets[task + 1]; ++i)
+    {
+        const size_t dependent = scheduler->dependents[i];
+        if (necro_atomic_fetch_add(scheduler->num_pending + dependent, SIZE_MAX) == 1)
+            necro_task_deque_push(scheduler, deque, dependent);
+    }
+    necro_atomic_fetch_add(&scheduler->num_remaining, SIZE_MAX);
+}
+
+static void necro_scheduler_work(NecroScheduler* scheduler, size_t index)
+{
+    NecroTaskDeque* deque            = scheduler->deques + index;
+    const size_t    num_participants = scheduler->num_workers + 1;
+    const bool      was_in_block     = necro_thread_is_in_block();
+    necro_thread_set_is_in_block(true);
+    while (necro_atomic_load(&scheduler->num_remaining) > 0)
+    {
+        size_t task     = 0;
+        bool   has_task = necro_task_deque_pop(scheduler, deque, &task);
+        for (size_t i = 1; i < num_participants && !has_task; ++i)
+            has_task = necro_task_deque_steal(scheduler, scheduler->deques + (index + i) % num_participants, &task);
+        if (has_task)
+            necro_scheduler_run_task(scheduler, deque, task);
+        else
+            necro_cpu_relax();
+    }
+    necro_thread_set_is_in_block(was_in_block);
+}
+
+static bool necro_scheduler_is_waiting(NecroScheduler* scheduler, size_t block)
+{
+    return necro_atomic_load(&scheduler->block) == block && necro_atomic_load(&scheduler->is_running);
+}
+
+static void necro_scheduler_worker_fn(void* user_data)
+{
+    NecroSchedulerWorker* worker    = (NecroSchedulerWorker*) user_data;
+    NecroScheduler*       scheduler = worker->scheduler;
+    necro_thread_set_is_realtime(scheduler->is_real_time);
+    necro_thread_flush_denormals();
+    if (scheduler->rt_priority > 0 && !necro_thread_set_realtime_priority(scheduler->rt_priority))
+        fprintf(stderr, "Unable to give scheduler worker %zu real time priority %zu, check RLIMIT_RTPRIO (ulimit -r)\n", worker->index, scheduler->rt_priority);
+    if (scheduler->is_memory_locked)
+        necro_thread_prefault_stack();
+    size_t block = 0;
+    while (true)
+    {
+        // Spin for the next block for a while, then park
+        const uint64_t spin_until_ns = necro_time_ns() + NECRO_SCHEDULER_SPIN_NS;
+        while (necro_scheduler_is_waiting(scheduler, block) && necro_time_ns() < spin_until_ns)
+            necro_cpu_relax();
+        while (necro_scheduler_is_waiting(scheduler, block))
+        {
+            // Counted as parked before checking again, so necro_scheduler_run either sees the count or we see the new block
+            necro_atomic_fetch_add(&scheduler->num_parked, 1);
+            necro_atomic_fence();
+            if (necro_scheduler_is_waiting(scheduler, block))
+                necro_semaphore_wait(scheduler->wake);
+            necro_atomic_fetch_add(&scheduler->num_parked, SIZE_MAX);
+        }
+        if (!necro_atomic_load(&scheduler->is_running))
+            return;
+        block = necro_atomic_load(&scheduler->block);
+        necro_scheduler_work(scheduler, worker->index);
+    }
+}
+
+void necro_scheduler_run(NecroScheduler* scheduler)
+{
+    assert(scheduler != NULL);
+    for (size_t i = 0; i < scheduler->num_tasks; ++i)
+        necro_atomic_store(scheduler->num_pending + i, scheduler->num_dependencies[i]);
+    necro_atomic_store(&scheduler->num_remaining, scheduler->num_tasks);
+    // Pushed in reverse so this thread pops them in program order, while thieves take from the other end
+    for (size_t i = scheduler->num_roots; i > 0; --i)
+        necro_task_deque_push(scheduler, scheduler->deques, scheduler->roots[i - 1]);
+    // Start the block, then wake anyone who has parked. Extra posts only cost a spurious wake up later
+    necro_atomic_store(&scheduler->block, scheduler->block + 1);
+    necro_atomic_fence();
+    const size_t num_parked = necro_atomic_load(&scheduler->num_parked);
+    for (size_t i = 0; i < num_parked; ++i)
+        necro_semaphore_post(scheduler->wake);
+    necro_scheduler_work(scheduler, 0);
+}
+
+///////////////////////////////////////////////////////
+// Creation
+///////////////////////////////////////////////////////
+NecroScheduler* necro_scheduler_create(const NecroTask* tasks, size_t num_tasks, size_t num_workers, bool is_real_time, size_t rt_priority, bool is_memory_locked)
+{
+    assert(tasks != NULL);
+    assert(num_tasks > 0);
+    NecroScheduler* scheduler    = emalloc(sizeof(NecroScheduler));
+    memset(scheduler, 0, sizeof(NecroScheduler));
+    scheduler->wake              = necro_semaphore_create();
+    scheduler->num_tasks         = num_tasks;
+    scheduler->num_workers       = scheduler->wake != NULL ? num_workers : 0; // Without a way to wake workers everything runs on the calling thread
+    scheduler->is_real_time      = is_real_time;
+    scheduler->rt_priority       = rt_priority;
+    scheduler->is_memory_locked  = is_memory_locked;
+    scheduler->is_running        = true;
+    //--------------------
+    // Graph, flipped around so each task knows which tasks it unblocks
+    scheduler->task_fns          = emalloc(num_tasks * sizeof(NecroTaskFn*));
+    scheduler->num_dependencies  = emalloc(num_tasks * sizeof(size_t));
+    scheduler->num_pending       = emalloc(num_tasks * sizeof(size_t));
+    scheduler->roots             = emalloc(num_tasks * sizeof(size_t));
+    scheduler->dependent_offsets = emalloc((num_tasks + 1) * sizeof(size_t));
+    memset(scheduler->dependent_offsets, 0, (num_tasks + 1) * sizeof(size_t));
+    size_t num_edges = 0;
+    for (size_t i = 0; i < num_tasks; ++i)
+    {
+        scheduler->task_fns[i]         = tasks[i].fn;
+        scheduler->num_dependencies[i] = tasks[i].num_dependencies;
+        scheduler->num_pending[i]      = 0;
+        if (tasks[i].num_dependencies == 0)
+            scheduler->roots[scheduler->num_roots++] = i;
+        for (size_t d = 0; d < tasks[i].num_dependencies; ++d)
+        {
+            assert(tasks[i].dependencies[d] < i);
+            scheduler->dependent_offsets[tasks[i].dependencies[d] + 1]++;
+        }
+        num_edges += tasks[i].num_dependencies;
+    }
+    for (size_t i = 0; i < num_tasks; ++i)
+        scheduler->dependent_offsets[i + 1] += scheduler->dependent_offsets[i];
+    scheduler->dependents = emalloc((num_edges > 0 ? num_edges : 1) * sizeof(size_t));
+    size_t* fill          = emalloc(num_tasks * sizeof(size_t));
+    memcpy(fill, scheduler->dependent_offsets, num_tasks * sizeof(size_t));
+    for (size_t i = 0; i < num_tasks; ++i)
+    {
+        for (size_t d = 0; d < tasks[i].num_dependencies; ++d)
+            scheduler->dependents[fill[tasks[i].dependencies[d]]++] = i;
+    }
+    free(fill);
+    //--------------------
+    // Deques
+    size_t capacity = 1;
+    while (capacity < num_tasks)
+        capacity <<= 1;
+    scheduler->deque_mask = capacity - 1;
+    scheduler->deques     = emalloc((scheduler->num_workers + 1) * sizeof(NecroTaskDeque));
+    memset(scheduler->deques, 0, (scheduler->num_workers + 1) * sizeof(NecroTaskDeque));
+    for (size_t i = 0; i < scheduler->num_workers + 1; ++i)
+    {
+        scheduler->deques[i].top    = 1;
+        scheduler->deques[i].bottom = 1;
+        scheduler->deques[i].tasks  = emalloc(capacity * sizeof(size_t));
+        memset((void*) scheduler->deques[i].tasks, 0, capacity * sizeof(size_t));
+    }
+    //--------------------
+    // Workers
+    scheduler->workers = emalloc((scheduler->num_workers > 0 ? scheduler->num_workers : 1) * sizeof(NecroSchedulerWorker));
+    for (size_t i = 0; i < scheduler->num_workers; ++i)
+    {
+        scheduler->workers[i].scheduler = scheduler;
+        scheduler->workers[i].index     = i + 1;
+        scheduler->workers[i].thread    = NULL;
+    }
+    for (size_t i = 0; i < scheduler->num_workers; ++i)
+        scheduler->workers[i].thread = necro_thread_create(necro_scheduler_worker_fn, scheduler->workers + i);
+    return scheduler;
+}
+
+void necro_scheduler_destroy(NecroScheduler* scheduler)
+{
+    if (scheduler == NULL)
+        return;
+    necro_atomic_store(&scheduler->is_running, false);
+    necro_atomic_fence();
+    for (size_t i = 0; i < scheduler->num_workers; ++i)
+        necro_semaphore_post(scheduler->wake);
+    for (size_t i = 0; i < scheduler->num_workers; ++i)
+        necro_thread_join(scheduler->workers[i].thread);
+    necro_semaphore_destroy(scheduler->wake);
+    for (size_t i = 0; i < scheduler->num_workers + 1; ++i)
+        free((void*) scheduler->deques[i].tasks);
+    free(scheduler->deques);
+    free(scheduler->workers);
+    free(scheduler->dependents);
+    free(scheduler->dependent_offsets);
+    free(scheduler->roots);
+    free((void*) scheduler->num_pending);
+    free(scheduler->num_dependencies);
+    free(scheduler->task_fns);
+    free(scheduler);
+}
+
+///////////////////////////////////////////////////////
+// Testing
+///////////////////////////////////////////////////////
+#define NECRO_SCHEDULER_TEST_NUM_TASKS 16
+
+static volatile size_t necro_scheduler_test_num_runs[NECRO_SCHEDULER_TEST_NUM_TASKS];
+static size_t          necro_scheduler_test_dependencies[NECRO_SCHEDULER_TEST_NUM_TASKS][2];
+static size_t          necro_scheduler_test_num_dependencies[NECRO_SCHEDULER_TEST_NUM_TASKS];
+static size_t          necro_scheduler_test_block;
+static volatile size_t necro_scheduler_test_num_out_of_order;
+static volatile size_t necro_scheduler_test_num_worker_runs;
+static volatile size_t necro_scheduler_test_num_outside_block;
+
+// Every dependency has to have run this block already, and this task can't have
+static int necro_scheduler_test_task(size_t task)
+{
+    for (size_t d = 0; d < necro_scheduler_test_num_dependencies[task]; ++d)
+    {
+        if (necro_atomic_load(&necro_scheduler_test_num_runs[necro_scheduler_test_dependencies[task][d]]) != necro_scheduler_test_block + 1)
+            necro_atomic_fetch_add(&necro_scheduler_test_num_out_of_order, 1);
+    }
+    if (necro_atomic_load(&necro_scheduler_test_num_runs[task]) != necro_scheduler_test_block)
+        necro_atomic_fetch_add(&necro_scheduler_test_num_out_of_order, 1);
+    // A little work, so that there is something for the other threads to steal
+    volatile double x = 0.0;
+    for (size_t i = 0; i < 2000; ++i)
+        x += (double) i;
+    if (necro_thread_is_realtime())
+        necro_atomic_fetch_add(&necro_scheduler_test_num_worker_runs, 1);
+    if (!necro_thread_is_in_block())
+        necro_atomic_fetch_add(&necro_scheduler_test_num_outside_block, 1);
+    necro_atomic_fetch_add(&necro_scheduler_test_num_runs[task], 1);
+    return 0;
+}
+
+#define NECRO_SCHEDULER_TEST_TASK(N) static int necro_scheduler_test_task_##N(void) { return necro_scheduler_test_task(N); }
+NECRO_SCHEDULER_TEST_TASK(0)  NECRO_SCHEDULER_TEST_TASK(1)  NECRO_SCHEDULER_TEST_TASK(2)  NECRO_SCHEDULER_TEST_TASK(3)
+NECRO_SCHEDULER_TEST_TASK(4)  NECRO_SCHEDULER_TEST_TASK(5)  NECRO_SCHEDULER_TEST_TASK(6)  NECRO_SCHEDULER_TEST_TASK(7)
+NECRO_SCHEDULER_TEST_TASK(8)  NECRO_SCHEDULER_TEST_TASK(9)  NECRO_SCHEDULER_TEST_TASK(10) NECRO_SCHEDULER_TEST_TASK(11)
+NECRO_SCHEDULER_TEST_TASK(12) NECRO_SCHEDULER_TEST_TASK(13) NECRO_SCHEDULER_TEST_TASK(14) NECRO_SCHEDULER_TEST_TASK(15)
+
+static NecroTaskFn* const necro_scheduler_test_task_fns[NECRO_SCHEDULER_TEST_NUM_TASKS] =
+{
+    necro_scheduler_test_task_0,  necro_scheduler_test_task_1,  necro_scheduler_test_task_2,  necro_scheduler_test_task_3,
+    necro_scheduler_test_task_4,  necro_scheduler_test_task_5,  necro_scheduler_test_task_6,  necro_scheduler_test_task_7,
+    necro_scheduler_test_task_8,  necro_scheduler_test_task_9,  necro_scheduler_test_task_10, necro_scheduler_test_task_11,
+    necro_scheduler_test_task_12, necro_scheduler_test_task_13, necro_scheduler_test_task_14, necro_scheduler_test_task_15,
+};
+
+/*
+    A binary tree of tasks fanning out from task 0, with every fourth task also joining on its neighbour,
+    run for a few hundred blocks. Workers are marked real time so the test can tell which tasks they ran.
+*/
+void necro_scheduler_test()
+{
+    necro_announce_phase("NecroScheduler");
+    NecroTask tasks[NECRO_SCHEDULER_TEST_NUM_TASKS];
+    for (size_t t = 0; t < NECRO_SCHEDULER_TEST_NUM_TASKS; ++t)
+    {
+        necro_scheduler_test_num_dependencies[t] = 0;
+        if (t > 0)
+            necro_scheduler_test_dependencies[t][necro_scheduler_test_num_dependencies[t]++] = (t - 1) / 2;
+        if (t > 0 && (t % 4) == 0)
+            necro_scheduler_test_dependencies[t][necro_scheduler_test_num_dependencies[t]++] = t - 1;
+        tasks[t].fn               = necro_scheduler_test_task_fns[t];
+        tasks[t].dependencies     = necro_scheduler_test_dependencies[t];
+        tasks[t].num_dependencies = necro_scheduler_test_num_dependencies[t];
+    }
+    const size_t num_workers[] = { 0, 1, 3 };
+    const size_t num_blocks    = 500;
+    for (size_t w = 0; w < sizeof(num_workers) / sizeof(size_t); ++w)
+    {
+        for (size_t t = 0; t < NECRO_SCHEDULER_TEST_NUM_TASKS; ++t)
+            necro_scheduler_test_num_runs[t] = 0;
+        necro_scheduler_test_num_out_of_order  = 0;
+        necro_scheduler_test_num_worker_runs   = 0;
+        necro_scheduler_test_num_outside_block = 0;
+        NecroScheduler* scheduler              = necro_scheduler_create(tasks, NECRO_SCHEDULER_TEST_NUM_TASKS, num_workers[w], true, 0, false);
+        bool            is_every_task_run      = true;
+        for (necro_scheduler_test_block = 0; necro_scheduler_test_block < num_blocks; ++necro_scheduler_test_block)
+        {
+            necro_scheduler_run(scheduler);
+            // The run is a barrier, every task has finished by the time it returns
+            for (size_t t = 0; t < NECRO_SCHEDULER_TEST_NUM_TASKS; ++t)
+                is_every_task_run = is_every_task_run && necro_atomic_load(&necro_scheduler_test_num_runs[t]) == necro_scheduler_test_block + 1;
+        }
+        necro_scheduler_destroy(scheduler);
+        printf("Scheduler %d workers run once test: %s\n", (int) num_workers[w], is_every_task_run ? "passed" : "FAILED");
+        printf("Scheduler %d workers dependency order test: %s\n", (int) num_workers[w], necro_scheduler_test_num_out_of_order == 0 ? "passed" : "FAILED");
+        // Without workers the calling thread runs everything, with them they should be picking up some of the work
+        const bool is_shared = num_workers[w] == 0 ? necro_scheduler_test_num_worker_runs == 0 : necro_scheduler_test_num_worker_runs > 0;
+        printf("Scheduler %d workers work sharing test: %s\n", (int) num_workers[w], is_shared ? "passed" : "FAILED");
+        // Every task runs marked as in the block, on whichever thread, and the calling thread is left as it was
+        const bool is_in_block = necro_scheduler_test_num_outside_block == 0 && !necro_thread_is_in_block();
+        printf("Scheduler %d workers in block test: %s\n", (int) num_workers[w], is_in_block ? "passed" : "FAILED");
+    }
+}
@@ -0,0 +1,41 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_SCHEDULER_H
+#define RUNTIME_SCHEDULER_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "runtime_common.h"
+
+///////////////////////////////////////////////////////
+// NecroScheduler
+//     * Runs a fixed graph of tasks once per block, spread across the calling thread and a pool of worker threads.
+//       The compiler builds the graph out of the program's global machines, see mach_schedule.c.
+//     * Every thread owns a work stealing deque (Chase-Lev). A task is pushed onto the deque of whichever thread finished
+//       the last of its dependencies, threads which run dry steal from the others.
+//     * necro_scheduler_run returns once every task has finished, so each block ends on a barrier.
+//       It never locks, allocates or waits on another thread, the only syscall is a post to wake workers parked between blocks.
+//     * Idle workers spin for NECRO_SCHEDULER_SPIN_NS before parking, so back to back blocks don't pay for a wake up.
+///////////////////////////////////////////////////////
+#define NECRO_SCHEDULER_SPIN_NS 250000
+
+typedef int NecroTaskFn(void);
+
+typedef struct NecroTask
+{
+    NecroTaskFn*  fn;
+    const size_t* dependencies;     // Indices of the tasks which must finish before this one starts, each lower than this task's own
+    size_t        num_dependencies;
+} NecroTask;
+
+struct NecroScheduler;
+struct NecroScheduler* necro_scheduler_create(const NecroTask* tasks, size_t num_tasks, size_t num_workers, bool is_real_time, size_t rt_priority, bool is_memory_locked); // Copies the graph. Workers are marked real time with is_real_time and ask for rt_priority when it is non-zero
+void                   necro_scheduler_destroy(struct NecroScheduler* scheduler);
+void                   necro_scheduler_run(struct NecroScheduler* scheduler); // Runs every task once. Must always be called from the same thread, which takes part as worker 0
+void                   necro_scheduler_test();
+
+#endif // RUNTIME_SCHEDULER_H
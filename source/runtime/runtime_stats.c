@@ -0,0 +1,215 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "runtime_stats.h"
+#include "runtime_thread.h"
+#include "utility.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+///////////////////////////////////////////////////////
+// Shared memory
+//     * POSIX shm segments are named "/<name>", Windows file mappings "Local\<name>".
+//     * A process only ever has one segment mapped, so Windows keeps its mapping handle here.
+//     * The writer only ever creates a fresh segment. If the name is taken, by another engine or one which crashed without
+//       removing it, out_is_taken is set and nothing is mapped, so two engines never publish over each other.
+///////////////////////////////////////////////////////
+#define NECRO_SHARED_STATS_MAX_NAME     256
+#define NECRO_SHARED_STATS_READ_RETRIES 64
+#define NECRO_SHARED_STATS_NUM_WORDS    (sizeof(NecroSharedStatsValues) / sizeof(size_t))
+
+#ifdef _WIN32
+
+static HANDLE necro_shared_stats_mapping = NULL;
+
+static NecroSharedStats* necro_shared_stats_map(const char* name, bool is_writer, bool* out_is_taken)
+{
+    char segment_name[NECRO_SHARED_STATS_MAX_NAME];
+    snprintf(segment_name, NECRO_SHARED_STATS_MAX_NAME, "Local\\%s", name);
+    *out_is_taken = false;
+    if (is_writer)
+        necro_shared_stats_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD) sizeof(NecroSharedStats), segment_name);
+    else
+        necro_shared_stats_mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, segment_name);
+    if (necro_shared_stats_mapping == NULL)
+        return NULL;
+    if (is_writer && GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        CloseHandle(necro_shared_stats_mapping);
+        necro_shared_stats_mapping = NULL;
+        *out_is_taken              = true;
+        return NULL;
+    }
+    void* data = MapViewOfFile(necro_shared_stats_mapping, is_writer ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, sizeof(NecroSharedStats));
+    if (data == NULL)
+    {
+        CloseHandle(necro_shared_stats_mapping);
+        necro_shared_stats_mapping = NULL;
+    }
+    return (NecroSharedStats*) data;
+}
+
+static void necro_shared_stats_unmap(NecroSharedStats* stats, const char* name)
+{
+    UNUSED(name);
+    UnmapViewOfFile((void*) stats);
+    CloseHandle(necro_shared_stats_mapping);
+    necro_shared_stats_mapping = NULL;
+}
+
+#else
+
+static NecroSharedStats* necro_shared_stats_map(const char* name, bool is_writer, bool* out_is_taken)
+{
+    char segment_name[NECRO_SHARED_STATS_MAX_NAME];
+    snprintf(segment_name, NECRO_SHARED_STATS_MAX_NAME, "/%s", name);
+    const int fd  = shm_open(segment_name, is_writer ? (O_CREAT | O_EXCL | O_RDWR) : O_RDONLY, 0644);
+    *out_is_taken = fd < 0 && is_writer && errno == EEXIST;
+    if (fd < 0)
+        return NULL;
+    struct stat segment_stat;
+    if ((is_writer && ftruncate(fd, (off_t) sizeof(NecroSharedStats)) != 0) ||
+        (!is_writer && (fstat(fd, &segment_stat) != 0 || (size_t) segment_stat.st_size < sizeof(NecroSharedStats))))
+    {
+        close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, sizeof(NecroSharedStats), is_writer ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return data == MAP_FAILED ? NULL : (NecroSharedStats*) data;
+}
+
+static void necro_shared_stats_unmap(NecroSharedStats* stats, const char* name)
+{
+    munmap((void*) stats, sizeof(NecroSharedStats));
+    if (name == NULL)
+        return;
+    char segment_name[NECRO_SHARED_STATS_MAX_NAME];
+    snprintf(segment_name, NECRO_SHARED_STATS_MAX_NAME, "/%s", name);
+    shm_unlink(segment_name);
+}
+
+#endif
+
+///////////////////////////////////////////////////////
+// Engine side
+///////////////////////////////////////////////////////
+NecroSharedStats* necro_shared_stats_create(const char* name)
+{
+    assert(name != NULL);
+    bool              is_taken = false;
+    NecroSharedStats* stats    = necro_shared_stats_map(name, true, &is_taken);
+    if (stats == NULL && is_taken)
+    {
+        fprintf(stderr, "Unable to publish live stats as %s, the name is already taken by another engine (or one which crashed, see /dev/shm/%s). Pick another name with -stats\n", name, name);
+        return NULL;
+    }
+    if (stats == NULL)
+    {
+        fprintf(stderr, "Unable to create shared memory stats segment %s, live stats are disabled\n", name);
+        return NULL;
+    }
+    // Touching every word now also means the RT thread never page faults on its first publish
+    necro_atomic_store(&stats->magic, 0);
+    memset((void*) stats->values, 0, sizeof(stats->values));
+    necro_atomic_store(&stats->version, NECRO_SHARED_STATS_VERSION);
+    necro_atomic_store(&stats->size, sizeof(NecroSharedStats));
+    necro_atomic_store(&stats->sequence, 0);
+    necro_atomic_store(&stats->magic, NECRO_SHARED_STATS_MAGIC);
+    return stats;
+}
+
+void necro_shared_stats_destroy(NecroSharedStats* stats, const char* name)
+{
+    if (stats == NULL)
+        return;
+    necro_atomic_store(&stats->magic, 0);
+    necro_shared_stats_unmap(stats, name);
+}
+
+void necro_shared_stats_publish(NecroSharedStats* stats, const NecroSharedStatsValues* values)
+{
+    const size_t* words    = (const size_t*) values;
+    const size_t  sequence = stats->sequence;
+    necro_atomic_store(&stats->sequence, sequence + 1);
+    for (size_t i = 0; i < NECRO_SHARED_STATS_NUM_WORDS; ++i)
+        necro_atomic_store(stats->values + i, words[i]);
+    necro_atomic_store(&stats->sequence, sequence + 2);
+}
+
+///////////////////////////////////////////////////////
+// Reader side
+///////////////////////////////////////////////////////
+NecroSharedStats* necro_shared_stats_open(const char* name)
+{
+    assert(name != NULL);
+    bool              is_taken = false;
+    NecroSharedStats* stats    = necro_shared_stats_map(name, false, &is_taken);
+    if (stats == NULL)
+        return NULL;
+    if (necro_atomic_load(&stats->magic) != NECRO_SHARED_STATS_MAGIC || necro_atomic_load(&stats->version) != NECRO_SHARED_STATS_VERSION || necro_atomic_load(&stats->size) != sizeof(NecroSharedStats))
+    {
+        necro_shared_stats_unmap(stats, NULL);
+        return NULL;
+    }
+    return stats;
+}
+
+void necro_shared_stats_close(NecroSharedStats* stats)
+{
+    if (stats == NULL)
+        return;
+    necro_shared_stats_unmap(stats, NULL);
+}
+
+bool necro_shared_stats_read(NecroSharedStats* stats, NecroSharedStatsValues* out_values)
+{
+    size_t words[NECRO_SHARED_STATS_NUM_WORDS];
+    for (size_t retry = 0; retry < NECRO_SHARED_STATS_READ_RETRIES; ++retry)
+    {
+        if (necro_atomic_load(&stats->magic) != NECRO_SHARED_STATS_MAGIC)
+            return false;
+        const size_t sequence = necro_atomic_load(&stats->sequence);
+        if ((sequence & 1) == 1)
+            continue;
+        for (size_t i = 0; i < NECRO_SHARED_STATS_NUM_WORDS; ++i)
+            words[i] = necro_atomic_load(stats->values + i);
+        if (necro_atomic_load(&stats->sequence) != sequence)
+            continue;
+        memcpy(out_values, words, sizeof(NecroSharedStatsValues));
+        return true;
+    }
+    return false;
+}
+
+void necro_shared_stats_print(const NecroSharedStatsValues* values, uint64_t now_ns, FILE* stream)
+{
+    const double age_ms = now_ns > values->update_time_ns ? ((double) (now_ns - values->update_time_ns)) / 1000000.0 : 0.0;
+    fprintf(stream, "necro pid %zu, %zuHz, %zu frames x%zu, %zu in / %zu out\n", values->pid, values->sample_rate, values->block_size, values->oversample, values->num_input_channels, values->num_output_channels);
+    fprintf(stream, "    updated:         %.1fms ago\n", age_ms);
+    fprintf(stream, "    blocks:          %zu\n", values->num_blocks);
+    fprintf(stream, "    block:           %.1fus / %.1fus\n", ((double) values->block_ns) / 1000.0, ((double) values->deadline_ns) / 1000.0);
+    fprintf(stream, "    max:             %.1fus\n", ((double) values->max_block_ns) / 1000.0);
+    fprintf(stream, "    deadline misses: %zu\n", values->num_deadline_misses);
+    fprintf(stream, "    underflows:      %zu\n", values->num_underflows);
+    fprintf(stream, "    overflows:       %zu\n", values->num_overflows);
+    fprintf(stream, "    heap:            %.2fmb / %.2fmb committed / %.2fmb\n", ((double) values->heap_bump) / 1000000.0, ((double) values->heap_committed) / 1000000.0, ((double) values->heap_capacity) / 1000000.0);
+    fprintf(stream, "    rt commits:      %zu\n", values->heap_rt_commits);
+    fprintf(stream, "    midi:            %zu queued, %zu this block, %zu overflows\n", values->midi_queue_depth, values->midi_block_messages, values->midi_overflows);
+    fprintf(stream, "    streams:         %zu\n", values->num_active_streams);
+    fprintf(stream, "    recordings:      %zu\n", values->num_active_recordings);
+    fprintf(stream, "    audio files:     %zu cache hits, %zu misses\n", values->audio_file_cache_hits, values->audio_file_cache_misses);
+}
@@ -0,0 +1,82 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_STATS_H
+#define RUNTIME_STATS_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "runtime_common.h"
+
+///////////////////////////////////////////////////////
+// NecroSharedStats
+//     * Live engine statistics in a named shared memory segment, so monitoring can watch a running engine
+//       without going through the audio thread or scraping the terminal.
+//     * The RT thread republishes every value at the end of each block under a sequence lock. Publishing is a handful
+//       of word stores into memory mapped at startup, it never blocks, allocates or makes syscalls.
+//     * Readers copy the values out and retry if the copy overlapped a publish.
+//     * The segment holds only words, no pointers. Readers check magic, version and size before trusting the layout,
+//       NECRO_SHARED_STATS_VERSION must be bumped whenever NecroSharedStatsValues changes.
+//     * Publishing is opt in (-stats name). Each name can only be published by one engine at a time, see necro_shared_stats_create.
+//     * necro_stats (source/tools/necro_stats.c) is a small reader which prints them.
+///////////////////////////////////////////////////////
+#define NECRO_SHARED_STATS_DEFAULT_NAME "necro_stats" // What necro_stats reads when not given a name
+#define NECRO_SHARED_STATS_MAGIC        0x4154534F5243454Eull // "NECROSTA" as little endian bytes
+#define NECRO_SHARED_STATS_VERSION      4
+
+typedef struct NecroSharedStatsValues
+{
+    // Set once at startup
+    size_t pid;
+    size_t sample_rate;
+    size_t block_size;
+    size_t oversample;
+    size_t num_output_channels;
+    size_t num_input_channels;
+    size_t deadline_ns;           // Time available to each block
+    // Updated every block
+    size_t update_time_ns;        // necro_time_ns() when the values were published, readers compare it against their own clock to spot a stalled engine
+    size_t num_blocks;
+    size_t block_ns;              // DSP time of the most recent block
+    size_t max_block_ns;
+    size_t num_deadline_misses;
+    size_t num_underflows;        // Device xruns
+    size_t num_overflows;
+    size_t heap_bump;             // Bytes of the necro heap in use
+    size_t heap_committed;        // Bytes of the heap's reservation committed, always at least heap_bump
+    size_t heap_rt_commits;       // Times the RT thread had to commit heap memory itself, each one a syscall in a block
+    size_t heap_capacity;
+    size_t midi_queue_depth;      // Messages waiting in the MIDI FIFO for a later block
+    size_t midi_block_messages;   // Messages handed to the program this block
+    size_t midi_overflows;        // Messages dropped or deferred because a MIDI buffer was full
+    size_t num_active_streams;    // Audio streams still playing
+    size_t num_active_recordings; // recordAudio recordings in progress
+    size_t audio_file_cache_hits; // audioFileOpen calls served an already loaded file
+    size_t audio_file_cache_misses;
+} NecroSharedStatsValues;
+
+typedef struct NecroSharedStats
+{
+    volatile size_t magic;    // Written last on creation, readers ignore the segment until it matches
+    volatile size_t version;
+    volatile size_t size;     // sizeof(NecroSharedStats)
+    volatile size_t sequence; // Odd while a publish is in progress
+    volatile size_t values[sizeof(NecroSharedStatsValues) / sizeof(size_t)];
+} NecroSharedStats;
+
+// Engine side
+NecroSharedStats* necro_shared_stats_create(const char* name);                                        // NULL, after printing why, if the segment couldn't be created or the name is already taken
+void              necro_shared_stats_destroy(NecroSharedStats* stats, const char* name);             // Unmaps and removes the segment
+void              necro_shared_stats_publish(NecroSharedStats* stats, const NecroSharedStatsValues* values); // RT thread only
+
+// Reader side
+NecroSharedStats* necro_shared_stats_open(const char* name); // Read only mapping, NULL if there is no segment of that name or its layout doesn't match
+void              necro_shared_stats_close(NecroSharedStats* stats);
+bool              necro_shared_stats_read(NecroSharedStats* stats, NecroSharedStatsValues* out_values); // False if no consistent copy could be taken
+void              necro_shared_stats_print(const NecroSharedStatsValues* values, uint64_t now_ns, FILE* stream);
+
+#endif // RUNTIME_STATS_H
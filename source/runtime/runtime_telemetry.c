@@ -0,0 +1,163 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "runtime_telemetry.h"
+#include "runtime_thread.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+///////////////////////////////////////////////////////
+// Histogram buckets
+///////////////////////////////////////////////////////
+static inline size_t necro_telemetry_msb(uint64_t value)
+{
+    assert(value != 0);
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (size_t) index;
+#else
+    return (size_t) (63 - __builtin_clzll(value));
+#endif
+}
+
+static inline size_t necro_telemetry_bucket_index(uint64_t value)
+{
+    if (value < NECRO_TELEMETRY_SUB_BUCKETS)
+        return (size_t) value;
+    const size_t msb   = necro_telemetry_msb(value);
+    const size_t shift = msb - NECRO_TELEMETRY_SUB_BUCKET_BITS;
+    const size_t group = shift + 1;
+    const size_t sub   = (size_t) ((value >> shift) & (NECRO_TELEMETRY_SUB_BUCKETS - 1));
+    return (group << NECRO_TELEMETRY_SUB_BUCKET_BITS) + sub;
+}
+
+// Largest value which lands in the bucket
+static inline uint64_t necro_telemetry_bucket_upper_bound(size_t index)
+{
+    const size_t group = index >> NECRO_TELEMETRY_SUB_BUCKET_BITS;
+    const size_t sub   = index & (NECRO_TELEMETRY_SUB_BUCKETS - 1);
+    if (group == 0)
+        return (uint64_t) sub;
+    const size_t   shift = group - 1;
+    const uint64_t lower = ((uint64_t) (NECRO_TELEMETRY_SUB_BUCKETS + sub)) << shift;
+    return lower + ((1ull << shift) - 1);
+}
+
+///////////////////////////////////////////////////////
+// RT side
+///////////////////////////////////////////////////////
+// Every counter has a single writer (the RT thread), so a plain load then release store is enough to publish it
+static inline void necro_telemetry_increment(volatile size_t* counter)
+{
+    necro_atomic_store(counter, *counter + 1);
+}
+
+void necro_audio_telemetry_reset(NecroAudioTelemetry* telemetry, size_t sample_rate, size_t block_size)
+{
+    memset((void*) telemetry, 0, sizeof(NecroAudioTelemetry));
+    telemetry->deadline_ns = (uint64_t) ((1000000000.0 * (double) block_size) / (double) sample_rate);
+}
+
+void necro_audio_telemetry_record_block(NecroAudioTelemetry* telemetry, uint64_t block_ns)
+{
+    necro_telemetry_increment(telemetry->buckets + necro_telemetry_bucket_index(block_ns));
+    if (block_ns > telemetry->deadline_ns)
+        necro_telemetry_increment(&telemetry->num_deadline_misses);
+    if (block_ns > telemetry->max_ns)
+        necro_atomic_store(&telemetry->max_ns, (size_t) block_ns);
+    necro_telemetry_increment(&telemetry->num_blocks);
+}
+
+void necro_audio_telemetry_record_underflow(NecroAudioTelemetry* telemetry)
+{
+    necro_telemetry_increment(&telemetry->num_underflows);
+}
+
+void necro_audio_telemetry_record_overflow(NecroAudioTelemetry* telemetry)
+{
+    necro_telemetry_increment(&telemetry->num_overflows);
+}
+
+void necro_audio_telemetry_record_input(NecroAudioTelemetry* telemetry, uint64_t latency_ns)
+{
+    if (latency_ns > telemetry->max_input_latency_ns)
+        necro_atomic_store(&telemetry->max_input_latency_ns, (size_t) latency_ns);
+    necro_telemetry_increment(&telemetry->num_input_updates);
+}
+
+///////////////////////////////////////////////////////
+// NRT side
+///////////////////////////////////////////////////////
+/*
+    The RT thread keeps writing while we read, so the bucket counts can be off from num_blocks by a block or two.
+    Percentiles are computed against the sum of the buckets actually read, which keeps them self consistent.
+*/
+NecroAudioTelemetrySnapshot necro_audio_telemetry_snapshot(NecroAudioTelemetry* telemetry)
+{
+    NecroAudioTelemetrySnapshot snapshot;
+    snapshot.deadline_ns          = telemetry->deadline_ns;
+    snapshot.num_blocks           = necro_atomic_load(&telemetry->num_blocks);
+    snapshot.num_deadline_misses  = necro_atomic_load(&telemetry->num_deadline_misses);
+    snapshot.num_underflows       = necro_atomic_load(&telemetry->num_underflows);
+    snapshot.num_overflows        = necro_atomic_load(&telemetry->num_overflows);
+    snapshot.max_ns               = necro_atomic_load(&telemetry->max_ns);
+    snapshot.num_input_updates    = necro_atomic_load(&telemetry->num_input_updates);
+    snapshot.max_input_latency_ns = necro_atomic_load(&telemetry->max_input_latency_ns);
+    snapshot.p50_ns               = 0;
+    snapshot.p99_ns               = 0;
+    snapshot.p999_ns              = 0;
+    size_t counts[NECRO_TELEMETRY_NUM_BUCKETS];
+    size_t total = 0;
+    for (size_t i = 0; i < NECRO_TELEMETRY_NUM_BUCKETS; ++i)
+    {
+        counts[i] = necro_atomic_load(telemetry->buckets + i);
+        total    += counts[i];
+    }
+    if (total == 0)
+        return snapshot;
+    const size_t p50_rank  = (total * 500 + 999) / 1000;
+    const size_t p99_rank  = (total * 990 + 999) / 1000;
+    const size_t p999_rank = (total * 999 + 999) / 1000;
+    size_t       seen      = 0;
+    for (size_t i = 0; i < NECRO_TELEMETRY_NUM_BUCKETS; ++i)
+    {
+        if (counts[i] == 0)
+            continue;
+        seen += counts[i];
+        const uint64_t upper_bound = necro_telemetry_bucket_upper_bound(i);
+        const uint64_t value       = upper_bound < snapshot.max_ns ? upper_bound : snapshot.max_ns;
+        if (snapshot.p50_ns == 0 && seen >= p50_rank)
+            snapshot.p50_ns = value;
+        if (snapshot.p99_ns == 0 && seen >= p99_rank)
+            snapshot.p99_ns = value;
+        if (snapshot.p999_ns == 0 && seen >= p999_rank)
+        {
+            snapshot.p999_ns = value;
+            break;
+        }
+    }
+    return snapshot;
+}
+
+void necro_audio_telemetry_print(NecroAudioTelemetrySnapshot snapshot, FILE* stream)
+{
+    fprintf(stream, "Audio telemetry:\n");
+    fprintf(stream, "    blocks:          %zu\n", snapshot.num_blocks);
+    fprintf(stream, "    deadline:        %.1fus\n", ((double) snapshot.deadline_ns) / 1000.0);
+    fprintf(stream, "    p50:             %.1fus\n", ((double) snapshot.p50_ns) / 1000.0);
+    fprintf(stream, "    p99:             %.1fus\n", ((double) snapshot.p99_ns) / 1000.0);
+    fprintf(stream, "    p99.9:           %.1fus\n", ((double) snapshot.p999_ns) / 1000.0);
+    fprintf(stream, "    max:             %.1fus\n", ((double) snapshot.max_ns) / 1000.0);
+    fprintf(stream, "    deadline misses: %zu\n", snapshot.num_deadline_misses);
+    fprintf(stream, "    underflows:      %zu\n", snapshot.num_underflows);
+    fprintf(stream, "    overflows:       %zu\n", snapshot.num_overflows);
+    if (snapshot.num_input_updates > 0)
+        fprintf(stream, "    input latency:   max %.1fus over %zu updates\n", ((double) snapshot.max_input_latency_ns) / 1000.0, snapshot.num_input_updates);
+}
@@ -0,0 +1,64 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_TELEMETRY_H
+#define RUNTIME_TELEMETRY_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "runtime_common.h"
+
+///////////////////////////////////////////////////////
+// NecroAudioTelemetry
+//     * Per-block timing of the RT callback against the block deadline.
+//     * Written only by the RT thread, read at any time by the NRT thread. Nothing locks or allocates.
+//     * Block times go into a log-linear histogram: each power of two is split into
+//       NECRO_TELEMETRY_SUB_BUCKETS linear buckets, so percentiles are within ~6% of the true value.
+//     * Also tracks input latency: how long mouse and keyboard changes wait before a block picks them up.
+///////////////////////////////////////////////////////
+#define NECRO_TELEMETRY_SUB_BUCKET_BITS 4
+#define NECRO_TELEMETRY_SUB_BUCKETS     (1 << NECRO_TELEMETRY_SUB_BUCKET_BITS)
+#define NECRO_TELEMETRY_NUM_BUCKETS     ((64 - NECRO_TELEMETRY_SUB_BUCKET_BITS + 1) * NECRO_TELEMETRY_SUB_BUCKETS)
+
+typedef struct NecroAudioTelemetry
+{
+    uint64_t        deadline_ns;
+    volatile size_t num_blocks;
+    volatile size_t num_deadline_misses;
+    volatile size_t num_underflows;
+    volatile size_t num_overflows;
+    volatile size_t max_ns;
+    volatile size_t num_input_updates;
+    volatile size_t max_input_latency_ns;
+    volatile size_t buckets[NECRO_TELEMETRY_NUM_BUCKETS];
+} NecroAudioTelemetry;
+
+// A consistent enough copy of the telemetry for reporting, taken on the NRT thread
+typedef struct NecroAudioTelemetrySnapshot
+{
+    uint64_t deadline_ns;
+    size_t   num_blocks;
+    size_t   num_deadline_misses;
+    size_t   num_underflows;
+    size_t   num_overflows;
+    uint64_t p50_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+    uint64_t max_ns;
+    size_t   num_input_updates;
+    uint64_t max_input_latency_ns;
+} NecroAudioTelemetrySnapshot;
+
+void                        necro_audio_telemetry_reset(NecroAudioTelemetry* telemetry, size_t sample_rate, size_t block_size);
+void                        necro_audio_telemetry_record_block(NecroAudioTelemetry* telemetry, uint64_t block_ns);   // RT thread only
+void                        necro_audio_telemetry_record_underflow(NecroAudioTelemetry* telemetry);                  // RT thread only
+void                        necro_audio_telemetry_record_overflow(NecroAudioTelemetry* telemetry);                   // RT thread only
+void                        necro_audio_telemetry_record_input(NecroAudioTelemetry* telemetry, uint64_t latency_ns); // RT thread only
+NecroAudioTelemetrySnapshot necro_audio_telemetry_snapshot(NecroAudioTelemetry* telemetry);
+void                        necro_audio_telemetry_print(NecroAudioTelemetrySnapshot snapshot, FILE* stream);
+
+#endif // RUNTIME_TELEMETRY_H
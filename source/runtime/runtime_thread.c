@@ -0,0 +1,434 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE 1 // pthread_setaffinity_np and cpu_set_t
+#endif
+
+#include <stdio.h>
+#include <limits.h>
+#include <string.h>
+#include "runtime_thread.h"
+#include "utility.h"
+
+#ifdef _WIN32
+#define UNICODE 1
+#define _UNICODE 1
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#endif
+
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#elif !defined(_WIN32)
+#include <semaphore.h>
+#endif
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define NECRO_MXCSR 1
+#else
+#define NECRO_MXCSR 0
+#endif
+
+///////////////////////////////////////////////////////
+// Threads
+///////////////////////////////////////////////////////
+typedef struct NecroThread
+{
+#ifdef _WIN32
+    HANDLE         handle;
+#else
+    pthread_t      handle;
+#endif
+    NecroThreadFn* thread_fn;
+    void*          user_data;
+} NecroThread;
+
+#ifdef _WIN32
+static DWORD WINAPI necro_thread_start(LPVOID data)
+{
+    NecroThread* thread = (NecroThread*) data;
+    thread->thread_fn(thread->user_data);
+    return 0;
+}
+#else
+static void* necro_thread_start(void* data)
+{
+    NecroThread* thread = (NecroThread*) data;
+    thread->thread_fn(thread->user_data);
+    return NULL;
+}
+#endif
+
+NecroThread* necro_thread_create(NecroThreadFn* thread_fn, void* user_data)
+{
+    assert(thread_fn != NULL);
+    NecroThread* thread = emalloc(sizeof(NecroThread));
+    thread->thread_fn   = thread_fn;
+    thread->user_data   = user_data;
+#ifdef _WIN32
+    thread->handle      = CreateThread(NULL, 0, necro_thread_start, thread, 0, NULL);
+    if (thread->handle == NULL)
+#else
+    if (pthread_create(&thread->handle, NULL, necro_thread_start, thread) != 0)
+#endif
+    {
+        fprintf(stderr, "Unable to create thread!\n");
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void necro_thread_join(NecroThread* thread)
+{
+    if (thread == NULL)
+        return;
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, NULL);
+#endif
+    free(thread);
+}
+
+size_t necro_thread_hardware_concurrency()
+{
+#ifdef _WIN32
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwNumberOfProcessors > 0 ? (size_t) system_info.dwNumberOfProcessors : 1;
+#else
+    const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return num_cpus > 0 ? (size_t) num_cpus : 1;
+#endif
+}
+
+///////////////////////////////////////////////////////
+// Semaphores
+///////////////////////////////////////////////////////
+typedef struct NecroSemaphore
+{
+#if defined(_WIN32)
+    HANDLE               handle;
+#elif defined(__APPLE__)
+    dispatch_semaphore_t handle; // macOS doesn't implement unnamed POSIX semaphores
+#else
+    sem_t                handle;
+#endif
+} NecroSemaphore;
+
+NecroSemaphore* necro_semaphore_create()
+{
+    NecroSemaphore* semaphore = emalloc(sizeof(NecroSemaphore));
+#if defined(_WIN32)
+    semaphore->handle = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    if (semaphore->handle == NULL)
+#elif defined(__APPLE__)
+    semaphore->handle = dispatch_semaphore_create(0);
+    if (semaphore->handle == NULL)
+#else
+    if (sem_init(&semaphore->handle, 0, 0) != 0)
+#endif
+    {
+        fprintf(stderr, "Unable to create semaphore!\n");
+        free(semaphore);
+        return NULL;
+    }
+    return semaphore;
+}
+
+void necro_semaphore_destroy(NecroSemaphore* semaphore)
+{
+    if (semaphore == NULL)
+        return;
+#if defined(_WIN32)
+    CloseHandle(semaphore->handle);
+#elif defined(__APPLE__)
+    dispatch_release(semaphore->handle);
+#else
+    sem_destroy(&semaphore->handle);
+#endif
+    free(semaphore);
+}
+
+void necro_semaphore_post(NecroSemaphore* semaphore)
+{
+#if defined(_WIN32)
+    ReleaseSemaphore(semaphore->handle, 1, NULL);
+#elif defined(__APPLE__)
+    dispatch_semaphore_signal(semaphore->handle);
+#else
+    sem_post(&semaphore->handle);
+#endif
+}
+
+void necro_semaphore_wait(NecroSemaphore* semaphore)
+{
+#if defined(_WIN32)
+    WaitForSingleObject(semaphore->handle, INFINITE);
+#elif defined(__APPLE__)
+    dispatch_semaphore_wait(semaphore->handle, DISPATCH_TIME_FOREVER);
+#else
+    while (sem_wait(&semaphore->handle) != 0 && errno == EINTR)
+    {
+    }
+#endif
+}
+
+bool necro_semaphore_wait_ms(NecroSemaphore* semaphore, uint32_t milliseconds)
+{
+#if defined(_WIN32)
+    return WaitForSingleObject(semaphore->handle, milliseconds) == WAIT_OBJECT_0;
+#elif defined(__APPLE__)
+    return dispatch_semaphore_wait(semaphore->handle, dispatch_time(DISPATCH_TIME_NOW, (int64_t) milliseconds * 1000000)) == 0;
+#else
+    // sem_timedwait takes an absolute CLOCK_REALTIME deadline
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    const uint64_t  nsec = (uint64_t) deadline.tv_nsec + (uint64_t) milliseconds * 1000000;
+    deadline.tv_sec     += (time_t) (nsec / 1000000000);
+    deadline.tv_nsec     = (long) (nsec % 1000000000);
+    int result;
+    while ((result = sem_timedwait(&semaphore->handle, &deadline)) != 0 && errno == EINTR)
+    {
+    }
+    return result == 0;
+#endif
+}
+
+///////////////////////////////////////////////////////
+// Real time scheduling and memory
+///////////////////////////////////////////////////////
+#define NECRO_PAGE_SIZE 4096 // Smallest page size we run on, prefaulting at this stride touches every page on larger page systems too
+
+#if defined(_MSC_VER)
+#define NECRO_NOINLINE __declspec(noinline)
+#define NECRO_THREAD_LOCAL __declspec(thread)
+#else
+#define NECRO_NOINLINE __attribute__((noinline))
+#define NECRO_THREAD_LOCAL _Thread_local
+#endif
+
+static NECRO_THREAD_LOCAL bool necro_thread_is_realtime_flag = false;
+
+void necro_thread_set_is_realtime(bool is_realtime)
+{
+    necro_thread_is_realtime_flag = is_realtime;
+}
+
+bool necro_thread_is_realtime()
+{
+    return necro_thread_is_realtime_flag;
+}
+
+static NECRO_THREAD_LOCAL bool necro_thread_is_in_block_flag = false;
+
+void necro_thread_set_is_in_block(bool is_in_block)
+{
+    necro_thread_is_in_block_flag = is_in_block;
+}
+
+bool necro_thread_is_in_block()
+{
+    return necro_thread_is_in_block_flag;
+}
+
+bool necro_thread_set_realtime_priority(size_t priority)
+{
+#ifdef _WIN32
+    UNUSED(priority);
+    return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+    const int          min_priority = sched_get_priority_min(SCHED_FIFO);
+    const int          max_priority = sched_get_priority_max(SCHED_FIFO);
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = (int) priority;
+    param.sched_priority = param.sched_priority < min_priority ? min_priority : (param.sched_priority > max_priority ? max_priority : param.sched_priority);
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+}
+
+bool necro_thread_pin_to_cpu(size_t cpu)
+{
+#if defined(_WIN32)
+    if (cpu >= sizeof(DWORD_PTR) * 8)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), ((DWORD_PTR) 1) << cpu) != 0;
+#elif defined(__linux__)
+    if (cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpu_set) == 0;
+#else
+    // No hard affinity on macOS, only affinity tags, which are hints
+    UNUSED(cpu);
+    return false;
+#endif
+}
+
+// Kept out of line so the array really is carved out of this frame
+NECRO_NOINLINE void necro_thread_prefault_stack()
+{
+    volatile uint8_t stack[NECRO_THREAD_PREFAULT_STACK_SIZE];
+    for (size_t i = 0; i < NECRO_THREAD_PREFAULT_STACK_SIZE; i += NECRO_PAGE_SIZE)
+        stack[i] = 0;
+    UNUSED(stack[0]);
+}
+
+bool necro_memory_lock_all()
+{
+#if defined(_WIN32)
+    // Windows only locks explicit ranges (VirtualLock), there is no process wide equivalent
+    return false;
+#elif defined(MCL_ONFAULT)
+    // MCL_ONFAULT matters: without it every mapped page is faulted in up front, including all of the lazily committed heap
+    return mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) == 0;
+#else
+    // Without MCL_ONFAULT locking would commit the whole heap at once, so don't
+    return false;
+#endif
+}
+
+void necro_memory_prefault(void* data, size_t size)
+{
+    volatile uint8_t* bytes = (volatile uint8_t*) data;
+    for (size_t i = 0; i < size; i += NECRO_PAGE_SIZE)
+        bytes[i] = bytes[i];
+}
+
+///////////////////////////////////////////////////////
+// Virtual memory
+///////////////////////////////////////////////////////
+void* necro_memory_reserve(size_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void* data = mmap(NULL, size, PROT_NONE, flags, -1, 0);
+    return data == MAP_FAILED ? NULL : data;
+#endif
+}
+
+bool necro_memory_commit(void* data, size_t size, bool is_huge_pages)
+{
+#ifdef _WIN32
+    UNUSED(is_huge_pages); // Windows large pages need a privilege and can't be committed piecemeal
+    return VirtualAlloc(data, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    if (mprotect(data, size, PROT_READ | PROT_WRITE) != 0)
+        return false;
+#ifdef MADV_HUGEPAGE
+    if (is_huge_pages)
+        madvise(data, size, MADV_HUGEPAGE); // Only a hint, plain pages work just as well
+#else
+    UNUSED(is_huge_pages);
+#endif
+    return true;
+#endif
+}
+
+void necro_memory_release(void* data, size_t size)
+{
+    if (data == NULL)
+        return;
+#ifdef _WIN32
+    UNUSED(size);
+    VirtualFree(data, 0, MEM_RELEASE);
+#else
+    munmap(data, size);
+#endif
+}
+
+///////////////////////////////////////////////////////
+// Time
+///////////////////////////////////////////////////////
+uint64_t necro_time_ns()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER ticks_per_sec = { 0 };
+    if (ticks_per_sec.QuadPart == 0)
+        QueryPerformanceFrequency(&ticks_per_sec);
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return (uint64_t) ((ticks.QuadPart / ticks_per_sec.QuadPart) * 1000000000ull + ((ticks.QuadPart % ticks_per_sec.QuadPart) * 1000000000ull) / ticks_per_sec.QuadPart);
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return ((uint64_t) time.tv_sec) * 1000000000ull + (uint64_t) time.tv_nsec;
+#endif
+}
+
+void necro_sleep_until_ns(uint64_t deadline_ns)
+{
+#ifdef _WIN32
+    // Sleep is only accurate to the scheduler tick, so sleep coarsely then spin out the remainder
+    const uint64_t spin_ns = 2000000;
+    uint64_t       now_ns  = necro_time_ns();
+    while (now_ns + spin_ns < deadline_ns)
+    {
+        Sleep(1);
+        now_ns = necro_time_ns();
+    }
+    while (necro_time_ns() < deadline_ns)
+        YieldProcessor();
+#else
+    struct timespec deadline;
+    deadline.tv_sec  = (time_t) (deadline_ns / 1000000000ull);
+    deadline.tv_nsec = (long) (deadline_ns % 1000000000ull);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+    {
+    }
+#endif
+}
+
+///////////////////////////////////////////////////////
+// Floating point
+///////////////////////////////////////////////////////
+#define NECRO_MXCSR_FLUSH_TO_ZERO       0x8000
+#define NECRO_MXCSR_DENORMALS_ARE_ZERO  0x0040
+#define NECRO_FPCR_FLUSH_TO_ZERO        (1ull << 24)
+
+size_t necro_thread_flush_denormals()
+{
+#if NECRO_MXCSR
+    const unsigned int mxcsr = _mm_getcsr();
+    _mm_setcsr(mxcsr | NECRO_MXCSR_FLUSH_TO_ZERO | NECRO_MXCSR_DENORMALS_ARE_ZERO);
+    return (size_t) mxcsr;
+#elif defined(__aarch64__)
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | NECRO_FPCR_FLUSH_TO_ZERO));
+    return (size_t) fpcr;
+#else
+    return 0;
+#endif
+}
+
+void necro_thread_restore_denormals(size_t prev_denormal_state)
+{
+#if NECRO_MXCSR
+    _mm_setcsr((unsigned int) prev_denormal_state);
+#elif defined(__aarch64__)
+    __asm__ __volatile__("msr fpcr, %0" : : "r"((uint64_t) prev_denormal_state));
+#else
+    UNUSED(prev_denormal_state);
+#endif
+}
@@ -0,0 +1,161 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#ifndef RUNTIME_THREAD_H
+#define RUNTIME_THREAD_H 1
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "runtime_common.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+///////////////////////////////////////////////////////
+// Threads
+///////////////////////////////////////////////////////
+typedef void NecroThreadFn(void* user_data);
+struct NecroThread;
+struct NecroThread* necro_thread_create(NecroThreadFn* thread_fn, void* user_data);
+void                necro_thread_join(struct NecroThread* thread); // Waits for the thread to finish, then frees it
+size_t              necro_thread_hardware_concurrency();           // Number of logical cpus, at least 1
+
+///////////////////////////////////////////////////////
+// Semaphores
+//     * For parking threads which have run out of work. Posting never blocks, so the RT thread can wake them.
+///////////////////////////////////////////////////////
+struct NecroSemaphore;
+struct NecroSemaphore* necro_semaphore_create();
+void                   necro_semaphore_destroy(struct NecroSemaphore* semaphore);
+void                   necro_semaphore_post(struct NecroSemaphore* semaphore);
+void                   necro_semaphore_wait(struct NecroSemaphore* semaphore); // Blocks until the count is positive, then decrements it
+bool                   necro_semaphore_wait_ms(struct NecroSemaphore* semaphore, uint32_t milliseconds); // As necro_semaphore_wait, but gives up after milliseconds, returning false
+
+///////////////////////////////////////////////////////
+// Real time scheduling and memory
+//     * The thread functions apply to the calling thread. They make syscalls, so the RT thread calls them once, before running its first block.
+//     * Each returns false when the OS refuses (usually missing privileges, see RLIMIT_RTPRIO and RLIMIT_MEMLOCK) or doesn't support it.
+///////////////////////////////////////////////////////
+#define NECRO_THREAD_PREFAULT_STACK_SIZE (128 * 1024) // Well within the smallest default thread stack (1mb on Windows)
+
+bool necro_thread_set_realtime_priority(size_t priority); // SCHED_FIFO at priority (1 - 99) on Unix, time critical priority on Windows
+void necro_thread_set_is_realtime(bool is_realtime);      // Marks the calling thread as one which must never block: the RT thread, and scheduler workers running its blocks
+bool necro_thread_is_realtime();                          // Whether the calling thread was marked, so shared code can tell when it has to drop rather than wait
+void necro_thread_set_is_in_block(bool is_in_block);      // Marks the calling thread as running a block: the RT thread around each block, scheduler workers while they work on one
+bool necro_thread_is_in_block();                          // Whether the calling thread is running a block right now, other threads allocating at the same time aren't
+bool necro_thread_pin_to_cpu(size_t cpu);                 // Restricts the calling thread to one logical cpu
+void necro_thread_prefault_stack();                       // Touches NECRO_THREAD_PREFAULT_STACK_SIZE bytes of stack below the caller, so deeper calls don't fault it in later
+bool necro_memory_lock_all();                             // Locks the process's pages into RAM as they are faulted in, so they are never paged out
+void necro_memory_prefault(void* data, size_t size);      // Writes to every page of data, faulting it in (and locking it, after necro_memory_lock_all)
+
+///////////////////////////////////////////////////////
+// Virtual memory
+//     * Reserving claims address space only: nothing is backed by memory and touching it faults, so it doubles as a guard against overruns.
+//     * Committing makes part of a reservation readable and writable. It reads back as zero and is only backed by memory as it is touched.
+//     * Ranges must be multiples of the OS page size. These make syscalls, so keep them off the RT thread where possible.
+///////////////////////////////////////////////////////
+void* necro_memory_reserve(size_t size);                                // NULL if the address space isn't available
+bool  necro_memory_commit(void* data, size_t size, bool is_huge_pages); // is_huge_pages asks for transparent huge pages where the OS has them (Linux)
+void  necro_memory_release(void* data, size_t size);                    // Releases a whole reservation, committed or not
+
+///////////////////////////////////////////////////////
+// Time
+///////////////////////////////////////////////////////
+uint64_t necro_time_ns();                            // Monotonic, high resolution clock
+void     necro_sleep_until_ns(uint64_t deadline_ns); // Sleeps until necro_time_ns() >= deadline_ns
+
+///////////////////////////////////////////////////////
+// Floating point
+//     * Denormal floats are handled in microcode on most cpus and can be ~100x slower than normal ones.
+//       Decaying feedback (filters, reverbs, envelopes) spends a lot of time down there, so the RT thread flushes them to zero.
+///////////////////////////////////////////////////////
+size_t necro_thread_flush_denormals();                            // Enables flush-to-zero and denormals-are-zero on the calling thread, returns the previous state
+void   necro_thread_restore_denormals(size_t prev_denormal_state); // Restores the state returned by necro_thread_flush_denormals
+
+///////////////////////////////////////////////////////
+// Atomics
+//     * Word sized atomics for talking between the NRT and RT threads.
+//     * Loads are acquire, stores are release, read-modify-writes are both.
+//     * necro_atomic_fence is a full barrier, for the few places which need a store ordered before a later load.
+//     * None of these ever lock or make syscalls, so they are safe to use on the RT thread.
+///////////////////////////////////////////////////////
+#if defined(_MSC_VER)
+
+static inline size_t necro_atomic_load(volatile size_t* ptr)
+{
+    const size_t value = *ptr;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void necro_atomic_store(volatile size_t* ptr, size_t value)
+{
+    _ReadWriteBarrier();
+    *ptr = value;
+}
+
+static inline size_t necro_atomic_fetch_add(volatile size_t* ptr, size_t value)
+{
+    return (size_t) _InterlockedExchangeAdd64((volatile int64_t*) ptr, (int64_t) value);
+}
+
+static inline bool necro_atomic_compare_exchange(volatile size_t* ptr, size_t expected, size_t desired)
+{
+    return (size_t) _InterlockedCompareExchange64((volatile int64_t*) ptr, (int64_t) desired, (int64_t) expected) == expected;
+}
+
+static inline void necro_atomic_fence()
+{
+    _mm_mfence();
+}
+
+// Spin wait hint
+static inline void necro_cpu_relax()
+{
+    _mm_pause();
+}
+
+#else
+
+static inline size_t necro_atomic_load(volatile size_t* ptr)
+{
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void necro_atomic_store(volatile size_t* ptr, size_t value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+static inline size_t necro_atomic_fetch_add(volatile size_t* ptr, size_t value)
+{
+    return __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static inline bool necro_atomic_compare_exchange(volatile size_t* ptr, size_t expected, size_t desired)
+{
+    return __atomic_compare_exchange_n(ptr, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline void necro_atomic_fence()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// Spin wait hint
+static inline void necro_cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#endif
+
+#endif // RUNTIME_THREAD_H
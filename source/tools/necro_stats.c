@@ -0,0 +1,93 @@
+/* Copyright (C) Chad McKinney and Curtis McKinney - All Rights Reserved
+ * Unauthorized copying of this file, via any medium is strictly prohibited
+ * Proprietary and confidential
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "runtime_stats.h"
+#include "runtime_thread.h"
+
+///////////////////////////////////////////////////////
+// necro_stats
+//     * Reads the live stats a running necro engine publishes to shared memory, see runtime_stats.h.
+//     * Only ever maps the segment read only, so it can't disturb the engine.
+//     * -kv prints one "key value" pair per line for monitoring scripts, -watch N reprints every N milliseconds.
+///////////////////////////////////////////////////////
+static void necro_stats_print_kv(const NecroSharedStatsValues* values, uint64_t now_ns)
+{
+    printf("pid %zu\n",                     values->pid);
+    printf("sample_rate %zu\n",             values->sample_rate);
+    printf("block_size %zu\n",              values->block_size);
+    printf("oversample %zu\n",              values->oversample);
+    printf("num_output_channels %zu\n",     values->num_output_channels);
+    printf("num_input_channels %zu\n",      values->num_input_channels);
+    printf("deadline_ns %zu\n",             values->deadline_ns);
+    printf("age_ns %zu\n",                  now_ns > values->update_time_ns ? (size_t) (now_ns - values->update_time_ns) : 0);
+    printf("num_blocks %zu\n",              values->num_blocks);
+    printf("block_ns %zu\n",                values->block_ns);
+    printf("max_block_ns %zu\n",            values->max_block_ns);
+    printf("num_deadline_misses %zu\n",     values->num_deadline_misses);
+    printf("num_underflows %zu\n",          values->num_underflows);
+    printf("num_overflows %zu\n",           values->num_overflows);
+    printf("heap_bump %zu\n",               values->heap_bump);
+    printf("heap_committed %zu\n",          values->heap_committed);
+    printf("heap_rt_commits %zu\n",         values->heap_rt_commits);
+    printf("heap_capacity %zu\n",           values->heap_capacity);
+    printf("midi_queue_depth %zu\n",        values->midi_queue_depth);
+    printf("midi_block_messages %zu\n",     values->midi_block_messages);
+    printf("midi_overflows %zu\n",          values->midi_overflows);
+    printf("num_active_streams %zu\n",      values->num_active_streams);
+    printf("num_active_recordings %zu\n",   values->num_active_recordings);
+    printf("audio_file_cache_hits %zu\n",   values->audio_file_cache_hits);
+    printf("audio_file_cache_misses %zu\n", values->audio_file_cache_misses);
+}
+
+int main(int argc, char** argv)
+{
+    const char* name     = NECRO_SHARED_STATS_DEFAULT_NAME;
+    bool        is_kv    = false;
+    long        watch_ms = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-kv") == 0)
+            is_kv = true;
+        else if (strcmp(argv[i], "-watch") == 0 && i + 1 < argc)
+            watch_ms = strtol(argv[++i], NULL, 10);
+        else if (argv[i][0] != '-')
+            name = argv[i];
+        else
+        {
+            fprintf(stderr, "Usage: necro_stats [name] [-kv] [-watch milliseconds]\n");
+            return 2;
+        }
+    }
+    NecroSharedStats* stats = necro_shared_stats_open(name);
+    if (stats == NULL)
+    {
+        fprintf(stderr, "No running necro engine is publishing stats as %s\n", name);
+        return 1;
+    }
+    int result = 0;
+    do
+    {
+        NecroSharedStatsValues values;
+        if (!necro_shared_stats_read(stats, &values))
+        {
+            fprintf(stderr, "Unable to read stats from %s, the engine may have shut down\n", name);
+            result = 1;
+            break;
+        }
+        if (is_kv)
+            necro_stats_print_kv(&values, necro_time_ns());
+        else
+            necro_shared_stats_print(&values, necro_time_ns(), stdout);
+        fflush(stdout);
+        if (watch_ms > 0)
+            necro_sleep_until_ns(necro_time_ns() + (uint64_t) watch_ms * 1000000);
+    }
+    while (watch_ms > 0);
+    necro_shared_stats_close(stats);
+    return result;
+}
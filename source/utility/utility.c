@@ -16,6 +16,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <time.h>
 #endif
 
 ///////////////////////////////////////////////////////
@@ -102,7 +103,9 @@ typedef struct NecroTimer
     LARGE_INTEGER end_time;
     double        total_time_ms;
 #else
-    size_t todo;
+    struct timespec start_time;
+    struct timespec end_time;
+    double          total_time_ms;
 #endif
 } NecroTimer;
 
@@ -118,7 +121,7 @@ NecroTimer* necro_timer_create()
     *timer = (NecroTimer) { .start_time = 0, .end_time = 0 };
     QueryPerformanceFrequency(&timer->ticks_per_sec);
 #else
-    // TODO
+    *timer = (NecroTimer) { .total_time_ms = 0.0 };
 #endif
     return timer;
 }
@@ -135,8 +138,7 @@ void necro_timer_start(NecroTimer* timer)
 #if _WIN32
     QueryPerformanceCounter(&timer->start_time);
 #else
-    // TODO
-    UNUSED(timer);
+    clock_gettime(CLOCK_MONOTONIC, &timer->start_time);
 #endif
 }
 
@@ -148,9 +150,10 @@ double necro_timer_stop(NecroTimer* timer)
     timer->total_time_ms = time;
     return time;
 #else
-    // TODO
-    UNUSED(timer);
-    return 0.0;
+    clock_gettime(CLOCK_MONOTONIC, &timer->end_time);
+    double time = ((double) (timer->end_time.tv_sec - timer->start_time.tv_sec) * 1000.0) + ((double) (timer->end_time.tv_nsec - timer->start_time.tv_nsec) / 1000000.0);
+    timer->total_time_ms = time;
+    return time;
 #endif
 }
 